@@ -0,0 +1,760 @@
+// Microbenchmarks for the lexer, parser, evaluator and data structures.
+// Every case runs on generated workloads of increasing size and reports
+// ns/op, throughput and heap allocations per op; results are also written as
+// JSON so runs from different revisions can be compared.
+#define _POSIX_C_SOURCE 200809L
+#include "context.h"
+#include "ds.h"
+#include "format.h"
+#include "eval.h"
+#include "lexer.h"
+#include "number.h"
+#include "parallel.h"
+#include "parser.h"
+#include "profile.h"
+#include "sweep.h"
+#include "vector.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+#define MIN_BENCH_NS 200000000ull // run each case for at least 0.2s
+#define MAX_RESULTS 128
+
+/*--ALLOCATION COUNTING--*/
+// The bench binary is linked with --wrap for these symbols
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static size_t allocations;
+static size_t allocatedBytes;
+
+void *__wrap_malloc(size_t size) {
+  allocations++;
+  allocatedBytes += size;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  allocations++;
+  allocatedBytes += count * size;
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  allocations++;
+  allocatedBytes += size;
+  return __real_realloc(ptr, size);
+}
+
+/*--TIMING--*/
+static inline unsigned long long monotonicNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull +
+         (unsigned long long)ts.tv_nsec;
+}
+
+typedef struct benchResult {
+  const char *name;
+  size_t size;       // workload size: terms, identifiers or nodes
+  size_t opsPerIter; // work items per iteration, for throughput
+  const char *unit;  // what opsPerIter counts
+  double nsPerOp;    // per iteration
+  double throughput; // units per second
+  double allocsPerOp;
+  double bytesPerOp;
+} benchResult;
+
+static benchResult results[MAX_RESULTS];
+static size_t resultCount;
+
+typedef void (*benchFn)(void *state);
+
+// Doubles the iteration count until the case has run for MIN_BENCH_NS
+static void runBench(const char *name, size_t size, size_t opsPerIter,
+                     const char *unit, benchFn fn, void *state) {
+  fn(state); // warm-up
+
+  unsigned long long elapsed = 0;
+  size_t iterations = 1;
+  size_t allocs = 0, bytes = 0;
+  while (true) {
+    size_t allocsBefore = allocations, bytesBefore = allocatedBytes;
+    unsigned long long start = monotonicNs();
+    for (size_t i = 0; i < iterations; i++)
+      fn(state);
+    elapsed = monotonicNs() - start;
+    allocs = allocations - allocsBefore;
+    bytes = allocatedBytes - bytesBefore;
+
+    if (elapsed >= MIN_BENCH_NS)
+      break;
+    iterations *= 2;
+  }
+
+  benchResult *r = &results[resultCount++];
+  *r = (benchResult){
+      .name = name,
+      .size = size,
+      .opsPerIter = opsPerIter,
+      .unit = unit,
+      .nsPerOp = (double)elapsed / iterations,
+      .throughput = (double)opsPerIter * iterations * 1e9 / elapsed,
+      .allocsPerOp = (double)allocs / iterations,
+      .bytesPerOp = (double)bytes / iterations,
+  };
+
+  char rate[16];
+  snprintf(rate, sizeof(rate), "%s/s", unit);
+  printf("%-16s %8zu %14.1f ns/op %12.3e %-9s %10.1f allocs/op\n", name,
+         size, r->nsPerOp, r->throughput, rate, r->allocsPerOp);
+}
+
+/*--WORKLOADS--*/
+static unsigned long long rngState = 0x9E3779B97F4A7C15ull;
+
+static unsigned long long nextRandom(void) {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 7;
+  rngState ^= rngState << 17;
+  return rngState;
+}
+
+// "t0 op t1 op ..." with numeric terms and a mix of every binary operator
+static char *generateArithmetic(size_t terms) {
+  static const char *ops[] = {" + ", " - ", " * ", " / "};
+  char *out = malloc(terms * 24 + 1);
+  size_t len = 0;
+
+  for (size_t i = 0; i < terms; i++) {
+    if (i)
+      len += sprintf(out + len, "%s", ops[nextRandom() % 4]);
+    if (nextRandom() % 8 == 0)
+      len += sprintf(out + len, "sin %llu.%02llu", nextRandom() % 1000,
+                     nextRandom() % 100);
+    else
+      len += sprintf(out + len, "%llu.%02llu", nextRandom() % 1000 + 1,
+                     nextRandom() % 100);
+  }
+  out[len] = '\0';
+  return out;
+}
+
+// Balanced tree of `terms` numbers, fully parenthesised so that every
+// operator has two subtrees of about the same size
+static size_t appendBalanced(char *out, size_t terms) {
+  static const char *ops[] = {" + ", " - ", " + sin ", " - cos "};
+  if (terms == 1)
+    return sprintf(out, "%llu.%02llu", nextRandom() % 1000 + 1,
+                   nextRandom() % 100);
+
+  size_t len = sprintf(out, "(");
+  len += appendBalanced(out + len, terms / 2);
+  len += sprintf(out + len, "%s", ops[nextRandom() % 4]);
+  len += appendBalanced(out + len, terms - terms / 2);
+  len += sprintf(out + len, ")");
+  return len;
+}
+
+static char *generateBalanced(size_t terms) {
+  char *out = malloc(terms * 24 + 1);
+  out[appendBalanced(out, terms)] = '\0';
+  return out;
+}
+
+// Identifiers are letters only, so number them in base 26
+static int identifierName(char *out, size_t index) {
+  int len = 0;
+  do {
+    out[len++] = (char)('a' + index % 26);
+    index /= 26;
+  } while (index);
+  out[len] = '\0';
+  return len;
+}
+
+// Definitions (va = ...)(vb = ...)... followed by va + vb + ...
+static char *generateIdentifiers(size_t count) {
+  char *out = malloc(count * 48 + 1);
+  char name[16];
+  size_t len = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    identifierName(name, i);
+    len += sprintf(out + len, "(v%s = %llu * x + %llu)", name,
+                   nextRandom() % 100, nextRandom() % 100);
+  }
+  len += sprintf(out + len, "(x = 2) ");
+  for (size_t i = 0; i < count; i++) {
+    identifierName(name, i);
+    len += sprintf(out + len, i ? " + v%s" : "v%s", name);
+  }
+  out[len] = '\0';
+  return out;
+}
+
+static void freeTokens(tokenStream *tknStream) {
+  tokenStream_free(tknStream);
+  free(tknStream);
+}
+
+/*--CASES--*/
+typedef struct textState {
+  const char *text;
+} textState;
+
+static void benchTokenise(void *state) {
+  textState *s = state;
+  freeTokens(tokenise(s->text));
+}
+
+typedef struct parseState {
+  tokenStream *tknStream;
+  parser psr;
+  ASTNode *root;
+  real result;
+} parseState;
+
+static void benchParse(void *state) {
+  parseState *s = state;
+  memPool_reset(&s->psr.nodePool);
+  s->psr.currentToken = 0;
+  s->psr.errorReported = false;
+  s->root = parseExpression(&s->psr);
+}
+
+static void benchEval(void *state) {
+  parseState *s = state;
+  s->result = eval(s->root);
+}
+
+// Every top-level reference goes through parseIdentifier(): lookup, clone,
+// substitution and evaluation of the definition
+static void benchIdentifiers(void *state) {
+  parseState *s = state;
+  runExpression(&s->psr, s->root, &s->result);
+}
+
+static void benchParallelEval(void *state) {
+  parseState *s = state;
+  s->result = parallel_eval(s->root);
+}
+
+// 2 * x + x through the kernels; after the warm-up the arena serves every
+// temporary without allocating
+typedef struct vectorState {
+  vectorArena arena;
+  value x;
+  value result;
+} vectorState;
+
+static void benchVectorAxpy(void *state) {
+  vectorState *s = state;
+  value scaled;
+  vectorArena_reset(&s->arena);
+  vector_binary(&s->arena, TOKEN_MUL, (value){.scalar = 2}, s->x, &scaled);
+  vector_binary(&s->arena, TOKEN_PLUS, scaled, s->x, &s->result);
+}
+
+static void benchVectorSum(void *state) {
+  vectorState *s = state;
+  vector_reduce(TOKEN_ELEMENT_SUM, s->x, &s->result);
+}
+
+typedef struct mapState {
+  substring *keys;
+  size_t count;
+  hashMap map;
+  ASTNode node;
+} mapState;
+
+static void benchMapInsert(void *state) {
+  mapState *s = state;
+  hashMap_init(&s->map, s->count / 5);
+  for (size_t i = 0; i < s->count; i++)
+    hashmap_setKey(&s->map, s->keys[i], &s->node, 1, NULL);
+  hashMap_free(&s->map);
+}
+
+static void benchMapLookup(void *state) {
+  mapState *s = state;
+  size_t treeSize;
+  ASTNode *declarations;
+  for (size_t i = 0; i < s->count; i++)
+    hashMap_getValue(&s->map, s->keys[i], &treeSize, &declarations);
+}
+
+typedef struct poolState {
+  size_t count;
+  size_t initialCapacity;
+} poolState;
+
+static void benchPool(void *state) {
+  poolState *s = state;
+  memPool pool;
+  memPool_init(&pool, s->initialCapacity);
+  for (size_t i = 0; i < s->count; i++)
+    memPool_alloc(&pool);
+  memPool_free(&pool);
+}
+
+static const size_t sizes[] = {10, 100, 1000, 10000, 100000};
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+
+static void benchLexerParserEval(void) {
+  for (size_t i = 0; i < SIZE_COUNT; i++) {
+    char *text = generateArithmetic(sizes[i]);
+    textState ts = {.text = text};
+    runBench("tokenise", sizes[i], strlen(text), "bytes", benchTokenise, &ts);
+
+    parseState ps = {.tknStream = tokenise(text)};
+    memPool_init(&ps.psr.nodePool, ps.tknStream->count);
+    ps.psr.tknStream = ps.tknStream;
+    runBench("parseExpression", sizes[i], ps.tknStream->count, "tokens",
+             benchParse, &ps);
+    runBench("eval", sizes[i], ps.psr.nodePool.used, "nodes", benchEval,
+             &ps);
+
+    memPool_free(&ps.psr.nodePool);
+    freeTokens(ps.tknStream);
+    free(text);
+  }
+}
+
+static void benchParseIdentifier(void) {
+  // A top-level reference may trigger at most 100 parseIdentifier() calls,
+  // each reference here costs one
+  for (size_t i = 0; i < SIZE_COUNT && sizes[i] <= 10000; i++) {
+    char *text = generateIdentifiers(sizes[i]);
+    parseState ps = {.tknStream = tokenise(text)};
+    ps.psr.tknStream = ps.tknStream;
+    memPool_init(&ps.psr.nodePool, ps.tknStream->count);
+    hashMap_init(&ps.psr.map, ps.tknStream->count / 5);
+    // Kept across runs as an evalContext does, so clones stop allocating
+    clonePools clones = {0};
+    ps.psr.clones = &clones;
+
+    if (!parseDeclarations(&ps.psr) || !(ps.root = parseExpression(&ps.psr))) {
+      fprintf(stderr, "Failed to parse identifier workload\n");
+      exit(1);
+    }
+    runBench("parseIdentifier", sizes[i], sizes[i], "refs", benchIdentifiers,
+             &ps);
+    // The same references timed by --profile
+    profile_setEnabled(true);
+    runBench("parseIdentifier_profiled", sizes[i], sizes[i], "refs",
+             benchIdentifiers, &ps);
+    profile_setEnabled(false);
+    profile_reset();
+
+    clonePools_free(&clones);
+    hashMap_free(&ps.psr.map);
+    memPool_free(&ps.psr.nodePool);
+    freeTokens(ps.tknStream);
+    free(text);
+  }
+}
+
+// Small trees stay below the grain size and must not get slower; wide ones
+// are split across one thread per online CPU
+static void benchParallel(void) {
+  static const size_t treeSizes[] = {100, 10000, 1000000};
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  parallel_setThreads(cpus > 1 ? (size_t)cpus : 1);
+  printf("# parallel evaluation with %zu threads\n", parallel_threads());
+
+  for (size_t i = 0; i < sizeof(treeSizes) / sizeof(treeSizes[0]); i++) {
+    char *text = generateBalanced(treeSizes[i]);
+    parseState ps = {.tknStream = tokenise(text)};
+    memPool_init(&ps.psr.nodePool, ps.tknStream->count);
+    ps.psr.tknStream = ps.tknStream;
+    ps.root = parseExpression(&ps.psr);
+    if (!ps.root) {
+      fprintf(stderr, "Failed to parse balanced workload\n");
+      exit(1);
+    }
+
+    runBench("eval_wide", treeSizes[i], ps.psr.nodePool.used, "nodes",
+             benchEval, &ps);
+    runBench("parallel_eval", treeSizes[i], ps.psr.nodePool.used, "nodes",
+             benchParallelEval, &ps);
+
+    memPool_free(&ps.psr.nodePool);
+    freeTokens(ps.tknStream);
+    free(text);
+  }
+}
+
+static void benchVectors(void) {
+  static const size_t lengths[] = {1000, 100000, 1000000};
+  for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+    vectorState vs = {0};
+    if (!vector_range(&vs.arena, 1, (real)lengths[i], &vs.x)) {
+      fprintf(stderr, "Failed to allocate vector workload\n");
+      exit(1);
+    }
+    // The operand must survive the resets between iterations
+    vectorArena input = vs.arena;
+    vs.arena = (vectorArena){0};
+
+    runBench("vector_axpy", lengths[i], lengths[i], "elements",
+             benchVectorAxpy, &vs);
+    runBench("vector_sum", lengths[i], lengths[i], "elements", benchVectorSum,
+             &vs);
+
+    vectorArena_free(&vs.arena);
+    vectorArena_free(&input);
+  }
+}
+
+// integrate() over a growing number of oscillations. f is inlined into one
+// tree; g has a declaration block, so each point runs it through
+// parseIdentifier() instead
+static void benchNumeric(void) {
+  static const char *cases[][2] = {
+      {"integrate_inline", "(f = sin x * x) integrate(f, x, 0, %zu)"},
+      {"integrate_general",
+       "(g = (c = 1) sin x * x * c) integrate(g, x, 0, %zu)"},
+      {"solve", "(f = x^3 - x) solve(f - %zu, x, 0, 200)"},
+  };
+  static const size_t spans[] = {1, 10, 100};
+
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    for (size_t i = 0; i < sizeof(spans) / sizeof(spans[0]); i++) {
+      char text[128];
+      snprintf(text, sizeof(text), cases[c][1], spans[i]);
+      parseState ps = {.tknStream = tokenise(text)};
+      ps.psr.tknStream = ps.tknStream;
+      memPool_init(&ps.psr.nodePool, ps.tknStream->count);
+      hashMap_init(&ps.psr.map, 4);
+
+      if (!parseDeclarations(&ps.psr) ||
+          !(ps.root = parseExpression(&ps.psr))) {
+        fprintf(stderr, "Failed to parse numeric workload\n");
+        exit(1);
+      }
+      runBench(cases[c][0], spans[i], 1, "calls", benchIdentifiers, &ps);
+
+      hashMap_free(&ps.psr.map);
+      memPool_free(&ps.psr.nodePool);
+      freeTokens(ps.tknStream);
+    }
+  }
+}
+
+typedef struct sweepState {
+  evalContext ctx;
+  const char *expression;
+  outputFormat format;
+  sweepAxis axis;
+  FILE *out;
+} sweepState;
+
+static void benchSweepRun(void *state) {
+  sweepState *ss = state;
+  if (runSweep(&ss->ctx, ss->expression, &ss->axis, 1, SWEEP_GRID,
+               ss->format, ss->out)) {
+    fprintf(stderr, "Failed to run sweep workload\n");
+    exit(1);
+  }
+}
+
+// Whole sweeps including parsing, evaluation and formatting, on the threads
+// set up by benchParallel(). sweep_general keeps an assignment per point,
+// sweep_f64 writes binary instead of text
+static void benchSweep(void) {
+  static const struct {
+    const char *name;
+    const char *expression;
+    outputFormat format;
+  } cases[] = {
+      {"sweep_inline", "(f = sin x * x) f + x^2", OUTPUT_TEXT},
+      {"sweep_general", "(x = *x * 2) sin x * x", OUTPUT_TEXT},
+      {"sweep_f64", "(f = sin x * x) f + x^2", OUTPUT_F64},
+  };
+  static const size_t counts[] = {1000, 100000};
+
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+      char spec[64];
+      snprintf(spec, sizeof(spec), "x=0:1:%zu", counts[i]);
+      sweepState ss = {.expression = cases[c].expression,
+                       .format = cases[c].format,
+                       .out = fopen("/dev/null", "w")};
+      if (!ss.out || !evalContext_init(&ss.ctx, "bench/no_config.txt") ||
+          !sweepAxis_parse(&ss.axis, spec)) {
+        fprintf(stderr, "Failed to set up sweep workload\n");
+        exit(1);
+      }
+      runBench(cases[c].name, counts[i], counts[i], "points", benchSweepRun,
+               &ss);
+
+      sweepAxis_free(&ss.axis);
+      evalContext_free(&ss.ctx);
+      fclose(ss.out);
+    }
+  }
+}
+
+typedef struct formatState {
+  double *values;
+  size_t count;
+  const char *format; // printf format, or NULL for format_shortest()
+  char *out;
+} formatState;
+
+static void benchFormatRun(void *state) {
+  formatState *fs = state;
+  char *out = fs->out;
+  for (size_t i = 0; i < fs->count; i++) {
+    if (fs->format)
+      out += snprintf(out, FORMAT_SHORTEST_MAX, fs->format, fs->values[i]);
+    else
+      out += format_shortest(fs->values[i], out);
+  }
+}
+
+// Text output of random finite doubles: the shortest round-trip formatter
+// against printf with the 17 digits needed to round-trip, and the 15 of the
+// old default
+static void benchFormat(void) {
+  static const struct {
+    const char *name;
+    const char *format;
+  } cases[] = {
+      {"format_shortest", NULL},
+      {"format_printf17", "%.17g"},
+      {"format_printf15", "%.15g"},
+  };
+  static const size_t count = 10000;
+
+  formatState fs = {.values = malloc(count * sizeof(double)),
+                    .count = count,
+                    .out = malloc(count * FORMAT_SHORTEST_MAX)};
+  if (!fs.values || !fs.out) {
+    fprintf(stderr, "Failed to allocate format workload\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < count;) {
+    unsigned long long bits = nextRandom();
+    memcpy(&fs.values[i], &bits, sizeof(double));
+    i += isfinite(fs.values[i]) != 0;
+  }
+
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    fs.format = cases[c].format;
+    runBench(cases[c].name, count, count, "values", benchFormatRun, &fs);
+  }
+  free(fs.values);
+  free(fs.out);
+}
+
+// "l0 + l1 + ..." where the literals are short decimals, integers, exponents
+// and full 17 digit doubles in equal parts
+static char *generateLiterals(size_t count) {
+  char *out = malloc(count * 32 + 1);
+  size_t len = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (i)
+      len += sprintf(out + len, " + ");
+    unsigned long long r = nextRandom();
+    switch (r % 4) {
+    case 0:
+      len += sprintf(out + len, "%llu.%02llu", r % 1000, (r >> 10) % 100);
+      break;
+    case 1:
+      len += sprintf(out + len, "%llu", r >> 40);
+      break;
+    case 2:
+      len += sprintf(out + len, "%llu.%llue%llu", r % 10, (r >> 8) % 100000,
+                     (r >> 30) % 300);
+      break;
+    default:
+      len += sprintf(out + len, "%.17g", (double)(r >> 11) / (1ull << 40));
+    }
+  }
+  out[len] = '\0';
+  return out;
+}
+
+typedef struct numberState {
+  tokenStream *tknStream;
+  bool useStrtod;
+  real sum;
+} numberState;
+
+static void benchNumberRun(void *state) {
+  numberState *ns = state;
+  for (size_t i = 0; i < ns->tknStream->count; i++) {
+    const token *tkn = &ns->tknStream->stream[i];
+    if (tkn->type != TOKEN_NUMBER)
+      continue;
+    substring lexeme = tokenStream_lexeme(ns->tknStream, i);
+    real value = 0;
+    if (ns->useStrtod)
+      value = realParse(lexeme.str, NULL);
+    else
+      number_parse(lexeme, &value);
+    ns->sum += value;
+  }
+}
+
+// Literal conversion alone, number_parse() against the strtod() call it
+// replaced, then whole parses of literal-heavy expressions
+static void benchNumbers(void) {
+  static const size_t count = 10000;
+  char *text = generateLiterals(count);
+  numberState ns = {.tknStream = tokenise(text)};
+  if (!ns.tknStream) {
+    fprintf(stderr, "Failed to tokenise literal workload\n");
+    exit(1);
+  }
+  runBench("number_parse", count, count, "literals", benchNumberRun, &ns);
+  ns.useStrtod = true;
+  runBench("number_strtod", count, count, "literals", benchNumberRun, &ns);
+
+  parseState ps = {.tknStream = ns.tknStream};
+  memPool_init(&ps.psr.nodePool, ps.tknStream->count);
+  ps.psr.tknStream = ps.tknStream;
+  runBench("parse_literals", count, strlen(text), "bytes", benchParse, &ps);
+  if (!ps.root) {
+    fprintf(stderr, "Failed to parse literal workload\n");
+    exit(1);
+  }
+
+  memPool_free(&ps.psr.nodePool);
+  freeTokens(ns.tknStream);
+  free(text);
+}
+
+typedef struct configState {
+  const char *path;
+  bool lazy;
+  real result;
+} configState;
+
+static void benchConfigRun(void *state) {
+  configState *cs = state;
+  evalContext ctx;
+  evalContext_setLazyConfig(cs->lazy);
+  if (!evalContext_init(&ctx, cs->path) ||
+      !evalContext_evaluate(&ctx, "ka + kb", &cs->result)) {
+    fprintf(stderr, "Failed to run config workload\n");
+    exit(1);
+  }
+  evalContext_free(&ctx);
+}
+
+// Startup plus one expression that uses two definitions, with the whole
+// config parsed up front and with definitions parsed on first use
+static void benchConfig(void) {
+  char path[] = "/tmp/eval_benchXXXXXX";
+  int fd = mkstemp(path);
+  FILE *file = fd >= 0 ? fdopen(fd, "w") : NULL;
+  if (!file) {
+    fprintf(stderr, "Failed to create config workload\n");
+    exit(1);
+  }
+
+  size_t written = 0;
+  for (size_t i = 1; i < SIZE_COUNT; i++) {
+    char name[16];
+    for (; written < sizes[i]; written++) {
+      identifierName(name, written);
+      fprintf(file, "(k%s = %llu * x + %llu)\n", name, nextRandom() % 100,
+              nextRandom() % 100);
+    }
+    fprintf(file, "(x = 2)\n");
+    fflush(file);
+
+    configState cs = {.path = path};
+    runBench("config_eager", sizes[i], sizes[i], "definitions",
+             benchConfigRun, &cs);
+    cs.lazy = true;
+    runBench("config_lazy", sizes[i], sizes[i], "definitions",
+             benchConfigRun, &cs);
+  }
+  evalContext_setLazyConfig(false);
+  fclose(file);
+  remove(path);
+}
+
+static void benchDataStructures(void) {
+  for (size_t i = 0; i < SIZE_COUNT; i++) {
+    size_t count = sizes[i];
+    mapState ms = {.keys = malloc(sizeof(substring) * count), .count = count};
+    char *names = malloc(count * 16);
+    for (size_t k = 0; k < count; k++) {
+      int len = sprintf(names + k * 16, "key_%zu", k);
+      ms.keys[k] = (substring){.str = names + k * 16, .len = (size_t)len};
+    }
+
+    runBench("hashMap_insert", count, count, "keys", benchMapInsert, &ms);
+
+    hashMap_init(&ms.map, count / 5);
+    for (size_t k = 0; k < count; k++)
+      hashmap_setKey(&ms.map, ms.keys[k], &ms.node, 1, NULL);
+    runBench("hashMap_lookup", count, count, "keys", benchMapLookup, &ms);
+    hashMap_free(&ms.map);
+
+    poolState exact = {.count = count, .initialCapacity = count};
+    runBench("memPool_alloc", count, count, "nodes", benchPool, &exact);
+    poolState growing = {.count = count, .initialCapacity = 16};
+    runBench("memPool_grow", count, count, "nodes", benchPool, &growing);
+
+    free(names);
+    free(ms.keys);
+  }
+}
+
+static bool writeJson(const char *path) {
+  FILE *out = fopen(path, "w");
+  if (!out)
+    return false;
+
+  fprintf(out, "{\n  \"revision\": \"%s\",\n  \"results\": [\n",
+          BENCH_REVISION);
+  for (size_t i = 0; i < resultCount; i++) {
+    benchResult *r = &results[i];
+    fprintf(out,
+            "    {\"name\": \"%s\", \"size\": %zu, \"ns_per_op\": %.1f, "
+            "\"throughput\": %.6e, \"unit\": \"%s/s\", "
+            "\"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f}%s\n",
+            r->name, r->size, r->nsPerOp, r->throughput, r->unit,
+            r->allocsPerOp, r->bytesPerOp, i + 1 < resultCount ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+  return fclose(out) == 0;
+}
+
+int main(int argc, char **argv) {
+  const char *jsonPath = argc > 1 ? argv[1] : "bench.json";
+
+  printf("%-16s %8s %20s %22s %20s\n", "benchmark", "size", "time",
+         "throughput", "allocations");
+  benchLexerParserEval();
+  benchParseIdentifier();
+  benchParallel();
+  benchVectors();
+  benchNumeric();
+  benchSweep();
+  benchFormat();
+  benchNumbers();
+  benchConfig();
+  benchDataStructures();
+
+  if (!writeJson(jsonPath)) {
+    perror(jsonPath);
+    return 1;
+  }
+  printf("Results written to %s\n", jsonPath);
+  return 0;
+}
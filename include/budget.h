@@ -0,0 +1,26 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Memory held by the evaluation running on the calling thread: its tokens,
+// the nodes reserved to parse it, the copy every reference in progress makes
+// of its definition, the map entries of its assignments and its vectors.
+// Charged where an evaluation takes the memory, not where it is allocated,
+// so buffers reused from earlier evaluations count as much as new ones.
+
+// Global, must be set before evaluating; 0 (the default) means no budget
+void memBudget_set(size_t bytes);
+size_t memBudget_get(void);
+
+// Starts an evaluation on this thread with nothing charged
+void memBudget_begin(void);
+// Adds bytes to the evaluation, unless that takes it past the budget: then
+// nothing is charged and errno is set to MEMORY_BUDGET_EXCEEDED
+bool memBudget_charge(size_t bytes);
+void memBudget_release(size_t bytes);
+// Most bytes held at once since memBudget_begin()
+size_t memBudget_peak(void);
+
+#endif
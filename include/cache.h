@@ -0,0 +1,75 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "ds.h"
+#include "lexer.h"
+#include "real.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bounded LRU cache of evaluation results. Keys are a whitespace-insensitive
+// encoding of an expression's tokens, tagged with the environment version the
+// result was computed against.
+typedef struct cacheEntry {
+  substring key;
+  unsigned long version;
+  real result;
+  struct cacheEntry *next; // bucket chain
+  struct cacheEntry *newer;
+  struct cacheEntry *older;
+} cacheEntry;
+
+typedef struct resultCache {
+  cacheEntry **buckets;
+  size_t bucketCount;
+  cacheEntry *newest;
+  cacheEntry *oldest;
+  size_t count;
+  size_t memoryUsed;
+  size_t memoryLimit;
+  unsigned long long hits;
+  unsigned long long misses;
+} resultCache;
+
+bool resultCache_init(resultCache *cache, size_t memoryLimit);
+bool resultCache_get(resultCache *cache, const substring key,
+                     unsigned long version, real *result);
+void resultCache_put(resultCache *cache, const substring key,
+                     unsigned long version, real result);
+void resultCache_free(resultCache *cache);
+
+// An expression parsed once and run many times. Identifier keys in the tree
+// point into the program's own copy of the text.
+typedef struct compiledProgram {
+  substring text;
+  unsigned long version; // config version the tree was parsed against
+  ASTNode *root;
+  memPool nodePool;
+  substring normalisedKey; // result cache key, empty when that cache is off
+
+  struct compiledProgram *next; // bucket chain
+  struct compiledProgram *newer;
+  struct compiledProgram *older;
+} compiledProgram;
+
+void compiledProgram_free(compiledProgram *program);
+
+// Bounded LRU cache from exact expression text to its compiled program
+typedef struct programCache {
+  compiledProgram **buckets;
+  size_t bucketCount;
+  compiledProgram *newest;
+  compiledProgram *oldest;
+  size_t count;
+  size_t capacity;
+  unsigned long long hits;
+  unsigned long long misses;
+} programCache;
+
+bool programCache_init(programCache *cache, size_t capacity);
+compiledProgram *programCache_get(programCache *cache, const substring text,
+                                  unsigned long version);
+void programCache_put(programCache *cache, compiledProgram *program);
+void programCache_free(programCache *cache);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "ds.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// One leading "(iden = ...)" statement of the config, parsed and bound the
+// first time its name is looked up
+typedef struct configDefinition {
+  substring name;
+  size_t start; // byte range of the statement, parentheses included
+  size_t end;
+  struct configDefinition *previous; // earlier definition of the same name
+  struct configDefinition *next;     // bucket chain, latest definitions only
+
+  atomic_bool loaded;
+  ASTNode *value;
+  size_t treeSize;
+  ASTNode *declarations;
+} configDefinition;
+
+// Index of the config's leading declarations by name. Building it only
+// matches parentheses over the text, so startup no longer depends on the size
+// of the config; each definition is tokenised and parsed on first use, as a
+// lookupFallback (see ds.h) of the config map.
+//
+// Bindings see what they would have seen in source order: a dereference is
+// resolved against the definitions that precede its statement, and a
+// redefinition only hides the earlier one from what follows it.
+typedef struct configIndex {
+  const char *text;
+  configDefinition *definitions;
+  size_t count;
+  configDefinition **buckets;
+  size_t size;
+  memPool nodePool; // trees of the definitions loaded so far
+  pthread_mutex_t lock;
+} configIndex;
+
+// Indexes the statements text starts with and sets *tail to the offset of
+// whatever follows them, which is left to parseDeclarations() and the
+// expression prefix as before. Errors inside a statement are only reported
+// once it is loaded.
+bool configIndex_init(configIndex *index, const char *text, size_t *tail);
+// The lookupFallback: arg is the index. NULL for names it does not define and
+// for definitions that fail to parse or bind, which are reported.
+ASTNode *configIndex_lookup(void *arg, substring key, size_t *treeSize,
+                            ASTNode **declarations);
+void configIndex_free(configIndex *index);
+
+#endif
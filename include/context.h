@@ -0,0 +1,99 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include "cache.h"
+#include "config.h"
+#include "ds.h"
+#include "lexer.h"
+#include "parser.h"
+#include "real.h"
+#include "vector.h"
+#include <stdbool.h>
+
+// A vector read by evalContext_loadVector(), bound under its name on top of
+// the config
+typedef struct loadedVector {
+  struct loadedVector *next;
+  char *name;
+  real *data;
+  size_t len;
+} loadedVector;
+
+// What one evaluation works in: the tree of the expression, the nodes created
+// while running it, its assignments, its vectors and the copies of the
+// definitions it references. Kept between evaluations and reset in place, so
+// once they have grown to fit, evaluating allocates nothing.
+typedef struct evalBuffers {
+  memPool programPool; // the expression's tree, when no cache keeps it
+  memPool scratchPool;
+  hashMap layer; // assignments of the expression, on top of the config
+  vectorArena arena; // vectors of the current evaluation
+  clonePools clones;
+} evalBuffers;
+
+// Resident evaluation environment. The config is tokenised and parsed once;
+// every expression is then parsed on top of its definitions, with its own
+// assignments kept in a layer that is emptied afterwards. Without a result or
+// program cache nothing of an evaluation outlives it, so after the first few
+// evaluations have grown the buffers, one makes no heap allocation at all.
+typedef struct evalContext {
+  const char *configFile;
+  char *config; // identifier keys point into this buffer
+  configIndex *index; // declarations parsed on first use, NULL unless lazy
+  tokenStream tokens;
+  size_t tokenCapacity;
+  size_t expressionStart; // first token parsed for every expression
+  size_t appendIndex;     // expression tokens replace the config EOF
+  memPool nodePool;
+  hashMap map;
+  evalBuffers buffers;
+  loadedVector *loaded; // kept across reloads
+
+  unsigned long version;   // bumped whenever the definitions may have changed
+  resultCache *cache;      // optional, owned by the caller
+  programCache *programs;  // optional, owned by the caller
+} evalContext;
+
+// Off by default. When set, evalContext_init() only indexes the config's
+// leading declarations and parses each one on first use (see config.h).
+void evalContext_setLazyConfig(bool lazy);
+bool evalContext_init(evalContext *ctx, const char *configFile);
+bool evalContext_reload(evalContext *ctx);
+// Fails for an expression whose result is a vector
+bool evalContext_evaluate(evalContext *ctx, const char *expression,
+                          real *result);
+// Vector results stay valid until the next evaluation
+bool evalContext_evaluateValue(evalContext *ctx, const char *expression,
+                               value *result);
+// Tokenises and parses an expression on top of the config, without running
+// it. The tree stays valid until compiledProgram_free(), also for several
+// threads running it at once with parsers of their own.
+compiledProgram *evalContext_compile(evalContext *ctx, const char *expression);
+// Reads raw float64 values from path and binds them to name
+bool evalContext_loadVector(evalContext *ctx, const char *name,
+                            const char *path);
+// Places tokens behind the config, where they can see its declarations. They
+// stay there until the next call or evaluation, and read their lexemes from
+// the text they were tokenised from.
+bool evalContext_appendTokens(evalContext *ctx, const tokenStream *tokens);
+void evalContext_free(evalContext *ctx);
+
+// Evaluates expressions against a context from a thread of its own. The
+// config tokens are copied once and every pool an evaluation uses is the
+// worker's, so any number of workers may share a context that nothing
+// reloads or extends meanwhile. The result and program caches are not used.
+typedef struct evalWorker {
+  evalContext *ctx;
+  tokenStream tokens; // the context's config tokens, then the expression
+  size_t tokenCapacity;
+  evalBuffers buffers;
+} evalWorker;
+
+bool evalWorker_init(evalWorker *w, evalContext *ctx);
+// expression[0, len) has to end between two tokens; vector results stay
+// valid until the next evaluation
+bool evalWorker_evaluate(evalWorker *w, const char *expression, size_t len,
+                         value *result);
+void evalWorker_free(evalWorker *w);
+
+#endif
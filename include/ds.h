@@ -8,38 +8,71 @@ typedef struct substring {
   size_t len;
 } substring;
 
+bool substringCmp(substring s1, substring s2);
+size_t substringHash(substring key);
+
 typedef struct ASTNode ASTNode;
 typedef struct tokenStream tokenStream;
 
+typedef struct poolBlock {
+  ASTNode *nodes;
+  struct poolBlock *next;
+} poolBlock;
+
+// Nodes never move once handed out: a full pool retires its block and
+// continues in one twice the size.
 typedef struct memPool {
   ASTNode *nodes;
   size_t capacity;
   size_t used;
+  poolBlock *retired;
+#ifdef EVAL_STATS
+  unsigned long long allocated; // nodes handed out since init or reset
+#endif
 } memPool;
 
 bool memPool_init(memPool *pool, size_t capacity);
 ASTNode *memPool_alloc(memPool *nodes);
 void memPool_reset(memPool *nodes);
+// Resets the pool with room for at least capacity nodes in its block, which
+// only allocates when it is smaller. Initialises a zeroed pool.
+bool memPool_reserve(memPool *pool, size_t capacity);
 void memPool_free(memPool *nodes);
+// Takes over every block of `other`, whose nodes stay valid until `pool` is
+// freed. `other` must not be used afterwards.
+bool memPool_adopt(memPool *pool, memPool *other);
 
 typedef struct entry {
   substring key;
   ASTNode *value;
   size_t treeSize;
-  size_t declarationStartIndex;
+  ASTNode *declarations; // bound before each reference, chained through body
   struct entry *next;
 } entry;
 
+// Resolves a key a map does not hold itself; has to be safe to call from
+// several threads at once
+typedef ASTNode *(*lookupFallback)(void *arg, substring key, size_t *treeSize,
+                                   ASTNode **declarations);
+
 typedef struct hashMap {
   size_t size;
   entry **buckets;
+  size_t count;  // entries in the buckets
+  entry *spare;  // cleared entries, reused before allocating new ones
+  const struct hashMap *parent; // consulted on lookup misses, never modified
+  lookupFallback fallback;      // consulted on misses before the parent
+  void *fallbackArg;
 } hashMap;
 
 hashMap *hashMap_init(hashMap *map, size_t size);
 bool hashmap_setKey(hashMap *map, const substring key, ASTNode *value,
-                    size_t treeSize, size_t declarationStartIndex);
+                    size_t treeSize, ASTNode *declarations);
 ASTNode *hashMap_getValue(const hashMap *map, const substring key,
-                          size_t *treeSize, size_t *declaratonStartIndex);
+                          size_t *treeSize, ASTNode **declarations);
+// Removes every entry but keeps the buckets and the entries themselves, for a
+// layer that is reused. Nothing to do for a map without entries.
+void hashMap_clear(hashMap *map);
 void hashMap_free(hashMap *map);
 
 #endif
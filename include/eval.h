@@ -2,6 +2,34 @@
 #define EVAL_H
 
 #include "parser.h"
-double eval(ASTNode *root);
+#include <stdbool.h>
+#include <stddef.h>
+
+real eval(ASTNode *root);
+real evalUnary(tokenType type, real operand);
+real evalBinary(tokenType type, real left, real right);
+
+// Binary operators whose left operands nest as deep as a chain like
+// 1 + 2 + 3 + ... is long. Tree walkers loop over such a chain from the bottom
+// up instead of recursing down it, so its length never reaches the stack.
+bool isChainOperator(tokenType type);
+
+// A chain on this thread's stack of chain operators, see astChain_push()
+typedef struct astChain {
+  size_t base;
+  size_t len;
+} astChain;
+
+// Pushes top, a chain operator, and those below it along the left operands,
+// down to the last one whose left operand is something else or a chain
+// operator with fewer than minSize or at least stopSize pure nodes. False when
+// out of memory.
+bool astChain_push(astChain *chain, const ASTNode *top, size_t minSize,
+                   size_t stopSize);
+// The i-th operator from the bottom, so 0 holds the chain's first operand on
+// its left
+const ASTNode *astChain_node(const astChain *chain, size_t i);
+// Chains are popped in the reverse order of their pushes
+void astChain_pop(const astChain *chain);
 
 #endif
@@ -0,0 +1,16 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stddef.h>
+
+// Longest text format_shortest() writes, "-2.2250738585072014e-308", with
+// room for the terminating NUL
+#define FORMAT_SHORTEST_MAX 25
+
+// Writes the shortest decimal that reads back as exactly value, laid out like
+// printf's "%.17g" (fixed notation for exponents from -4 to 16, otherwise
+// d.ddde+XX) and NUL terminated. Independent of the locale. Returns the
+// length, without the NUL; out needs FORMAT_SHORTEST_MAX bytes.
+size_t format_shortest(double value, char *out);
+
+#endif
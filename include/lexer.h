@@ -3,7 +3,9 @@
 
 #include "ds.h"
 #include "util.h"
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 typedef int tokenType;
 enum {
@@ -23,6 +25,9 @@ enum {
 
   TOKEN_OPENPAREN,
   TOKEN_CLOSEPAREN,
+  TOKEN_COMMA,
+  TOKEN_OPENBRACKET,
+  TOKEN_CLOSEBRACKET,
 
   TOKEN_IDEN,
 
@@ -30,28 +35,82 @@ enum {
   TOKEN_COS,
   TOKEN_LOG,
 
+  // sum(i, from, to, exp) and prod(i, from, to, exp)
+  TOKEN_SUM,
+  TOKEN_PROD,
+
+  // min(v), max(v), dot(u, v) and range(from, to)
+  TOKEN_MINIMUM,
+  TOKEN_MAXIMUM,
+  TOKEN_DOT,
+  TOKEN_RANGE,
+
+  // integrate(exp, x, a, b) and solve(exp, x, lo, hi)
+  TOKEN_INTEGRATE,
+  TOKEN_SOLVE,
+
   TOKEN_ASSIGNMENT,
 
+  // Only produced by the parser, for '*' in front of an identifier
+  TOKEN_DEREF,
+  // Also parser-only: a vector value, and sum(v) or prod(v) of its elements
+  TOKEN_VECTOR,
+  TOKEN_ELEMENT_SUM,
+  TOKEN_ELEMENT_PROD,
+
   TOKEN_MAX,
 };
 
+// 12 bytes per token. The lexeme is not kept: it is the len bytes at pos in
+// the text the token was read from, see tokenStream_lexeme().
 typedef struct token {
-  tokenType type;
-  substring lexeme;
-  size_t pos;
+  uint32_t pos;
+  uint32_t len;
+  uint8_t type;
 } token;
 
+// The text that tokens from first on were read from
+typedef struct tokenSource {
+  const char *text;
+  size_t first;
+} tokenSource;
+
+// Inputs are limited to 4 GiB, the reach of a token's pos
 typedef struct tokenStream {
   token *stream;
   size_t count;
+  tokenSource *sources; // in stream order, the texts have to outlive them
+  size_t sourceCount;
+  size_t sourceCapacity;
 } tokenStream;
 
 typedef struct lexer {
   const char *const start;
   const char *current;
+  const char *end; // tokens stop here, or at a NUL before it
   tokenType previousTokenType;
 } lexer;
 
 tokenStream *tokenise(const char *input);
+// Tokenises input[from, to), which has to end between two tokens. Positions
+// and lexemes stay relative to input.
+tokenStream *tokeniseRange(const char *input, size_t from, size_t to);
+// Tokenises input[from, to) like tokeniseRange(), appending to a stream of
+// *capacity tokens that is grown as needed. The stream keeps its count on
+// failure.
+bool tokeniseAppend(tokenStream *tokens, size_t *capacity, const char *input,
+                    size_t from, size_t to);
+// Appends from's first count tokens to a stream of *capacity tokens, along
+// with the texts they were read from
+bool tokenStream_append(tokenStream *tokens, size_t *capacity,
+                        const tokenStream *from, size_t count);
+substring tokenStream_lexeme(const tokenStream *tokens, size_t index);
+// Frees the tokens and sources, not the stream itself
+void tokenStream_free(tokenStream *tokens);
+// Length of the identifier text starts with, reading at most len bytes. 0
+// when it starts with anything else, a keyword included.
+size_t identifierLength(const char *text, size_t len);
+// True when the whole text is one identifier, without reporting otherwise
+bool isIdentifierName(const char *text);
 
 #endif
@@ -0,0 +1,27 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define LOG_DEFAULT_PATH "log.txt"
+
+// Error log written by a background thread. Records are copied into a fixed
+// ring buffer and appended to the log file in batches, one line each:
+//   2026-01-31T12:00:00.123Z func=parseExpression code=1006 msg="..."
+// Recording never blocks on I/O; when the ring is full the record is dropped
+// and counted instead. The thread starts with the first record.
+
+// Must be called before the first record to take effect
+void logger_setPath(const char *path);
+
+// funcName must outlive the logger (a string literal or __func__)
+void logger_record(const char *funcName, int code, const char *message);
+
+// Blocks until everything recorded so far has been written
+void logger_flush(void);
+
+// Writes what is left and stops the thread; runs at exit automatically
+void logger_shutdown(void);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include "ds.h"
+#include "real.h"
+#include <stdbool.h>
+
+// Value of a number literal the lexer has matched, digits[.digits] with an
+// optional (e|E)[+|-]digits exponent, correctly rounded to real. Reads no
+// further than text.len and ignores the locale. Returns false with errno set
+// to OVERFLOW when the value rounds to infinity, or to UNDERFLOW when a
+// nonzero value rounds to zero.
+bool number_parse(substring text, real *out);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef NUMERIC_H
+#define NUMERIC_H
+
+#include "real.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Defaults for integrate() and solve(), a little above the rounding error of
+// the real type
+#define NUMERIC_TOLERANCE (1000 * REAL_EPSILON)
+#define NUMERIC_MAX_EVALUATIONS 100000
+
+// Function of one variable evaluated by integrate() and solve(). Returns false
+// when the evaluation failed, with errno set and the error already reported.
+typedef bool (*numericFunction)(void *arg, real x, real *y);
+
+// Both are global and must be set before evaluating. A result is accepted
+// once its error estimate is at most max(absolute, relative * |result|).
+void numeric_setTolerance(real absolute, real relative);
+// Function evaluations allowed per integrate() or solve() call
+void numeric_setMaxEvaluations(size_t count);
+
+// Integral of f from a to b by adaptive 7-15 point Gauss-Kronrod quadrature.
+// Sets errno to NO_CONVERGENCE when the tolerance cannot be met within the
+// evaluation limit, or to INVALID_RANGE for bounds that are not finite.
+bool numeric_integrate(numericFunction f, void *arg, real a, real b,
+                       real *result);
+
+// Root of f between lo and hi by Brent's method. Sets errno to NO_SIGN_CHANGE
+// when f(lo) and f(hi) have the same sign, and to NO_CONVERGENCE or
+// INVALID_RANGE like numeric_integrate().
+bool numeric_solve(numericFunction f, void *arg, real lo, real hi,
+                   real *root);
+
+#endif
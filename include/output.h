@@ -0,0 +1,81 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "real.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Writes of at least this many bytes skip the copy into the writer's buffer
+#define OUTPUT_BUFFER_SIZE (1u << 20)
+// Room for the text of one value and its NUL
+#define OUTPUT_VALUE_BYTES 64
+#define OUTPUT_NPY_MAX_DIMS 32
+
+// How results are written. Binary values are little-endian float64 whatever
+// the real type:
+//   text:   values as written by output_formatReal(), separated by spaces,
+//           one result per line
+//   f64:    the values back to back
+//   npy:    a NumPy .npy header with the shape of the whole output, then f64
+//   framed: per result, uint32 status | uint32 count | count float64, where
+//           status is 0 or the errCodes value (or errno) of the failure and
+//           count is 0 for a failure
+typedef enum {
+  OUTPUT_TEXT,
+  OUTPUT_F64,
+  OUTPUT_NPY,
+  OUTPUT_FRAMED,
+} outputFormat;
+
+// Accepts "text", "f64", "npy" and "framed"
+bool output_parseFormat(const char *name, outputFormat *format);
+
+typedef struct outputBuffer {
+  char *data;
+  size_t len;
+  size_t capacity;
+} outputBuffer;
+
+// Makes room for bytes more, reporting an allocation failure
+bool outputBuffer_reserve(outputBuffer *buf, size_t bytes);
+void outputBuffer_free(outputBuffer *buf);
+
+// Text of one value, NUL terminated, into OUTPUT_VALUE_BYTES of out. Doubles
+// get the shortest decimal that reads back exactly (see format.h), the other
+// types REAL_FORMAT. Returns the length.
+size_t output_formatReal(real value, char *out);
+// One value as text followed by separator
+bool output_appendText(outputBuffer *buf, real value, char separator);
+// One value as a little-endian float64
+bool output_appendF64(outputBuffer *buf, real value);
+// One result of count values in the given format
+bool output_appendResult(outputBuffer *buf, outputFormat format,
+                         const real *values, size_t count);
+// A failed result: a frame carrying status in the framed format, nothing in
+// the others, whose failures are only logged
+bool output_appendError(outputBuffer *buf, outputFormat format,
+                        uint32_t status);
+// The .npy header for an output of the given shape, no dimensions for a
+// scalar. Nothing in the other formats.
+bool output_appendHeader(outputBuffer *buf, outputFormat format,
+                         const size_t *shape, size_t dims);
+
+// Buffers writes to a file descriptor and hands them to the kernel in blocks
+// of OUTPUT_BUFFER_SIZE, large writes together with the pending bytes in one
+// writev(). Once a write fails, later ones are dropped and report false.
+typedef struct outputWriter {
+  int fd;
+  outputBuffer buffer;
+  bool failed;
+} outputWriter;
+
+bool outputWriter_init(outputWriter *w, int fd);
+bool outputWriter_write(outputWriter *w, const void *data, size_t len);
+// Writes out a buffer filled with the output_append functions and empties it
+bool outputWriter_writeBuffer(outputWriter *w, outputBuffer *buf);
+bool outputWriter_flush(outputWriter *w);
+// Flushes and releases the buffer, returns false if any write failed
+bool outputWriter_free(outputWriter *w);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "parser.h"
+#include "real.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Subtrees with fewer nodes are never split, so small expressions evaluate
+// without touching the thread pool
+#define PARALLEL_GRAIN 32768
+#define PARALLEL_TASKS_PER_THREAD 4
+
+// Task callback for parallel_run(), called once for every index
+typedef void (*parallelTask)(void *arg, size_t task);
+
+// Starts threads - 1 workers (the caller is the last one); 0 or 1 keeps
+// evaluation serial. Call once, before the first evaluation.
+bool parallel_setThreads(size_t threads);
+size_t parallel_threads(void);
+
+// Runs task(arg, 0) ... task(arg, taskCount - 1) on the pool and returns
+// once all of them have finished. Called from within a task, it runs the
+// inner tasks serially on the calling thread instead.
+void parallel_run(size_t taskCount, parallelTask task, void *arg);
+
+// Evaluates a pure subtree (node->pureSize != 0) like eval(). Independent
+// subtrees of at least PARALLEL_GRAIN nodes are evaluated on the pool and
+// combined in the same order eval() would, so the result is identical.
+real parallel_eval(ASTNode *root);
+
+// Stops the workers; runs at exit automatically
+void parallel_shutdown(void);
+
+#endif
@@ -2,7 +2,10 @@
 #define PARSE_H
 #include "ds.h"
 #include "lexer.h"
+#include "real.h"
+#include "vector.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef int precedence;
 enum {
@@ -16,11 +19,14 @@ enum {
 
 typedef struct ASTNode {
   tokenType type;
+  // Node count when the subtree holds only numbers and operators (saturating),
+  // 0 if it references identifiers or contains assignments
+  uint32_t pureSize;
   size_t pos;
   substring identifer;
 
   union {
-    double number;
+    real number;
     struct {
       struct ASTNode *operand;
     } unary;
@@ -28,19 +34,79 @@ typedef struct ASTNode {
       struct ASTNode *left;
       struct ASTNode *right;
     } binary;
+    struct {
+      struct ASTNode *value;
+      struct ASTNode *body; // evaluated after (or before) the binding
+      // Leading declaration block of the value, chained through body
+      struct ASTNode *declarations;
+      bool bindAfter;
+    } assignment;
+    struct {
+      struct ASTNode *from;
+      struct ASTNode *to;
+      struct ASTNode *body; // run for every index or point, named by identifer
+    } reduction;
+    struct {
+      const real *data;
+      size_t len;
+    } vector;
   };
 } ASTNode;
 
+// References resolved at once (nested in each other) that get a pool below
+#define PARSER_CLONE_POOLS 128
+
+// Pools for the copies parseIdentifier() makes of definitions, one for each
+// reference still being resolved. Kept by the owner of the parser across
+// runs, they stop allocating once grown to fit the largest definitions.
+typedef struct clonePools {
+  memPool pools[PARSER_CLONE_POOLS];
+  size_t depth; // references being resolved
+} clonePools;
+
+void clonePools_free(clonePools *clones);
+
+// Operands parsed inside each other: every parenthesis, function call and
+// unary operator recurses once, and so does every walk of the tree. Chains of
+// binary operators (see isChainOperator()) do not count, however long.
+#define PARSER_MAX_NESTING 10000
+
 typedef struct parser {
   memPool nodePool;
   size_t currentToken;
+  size_t nesting; // operands being parsed, up to PARSER_MAX_NESTING
   int unmatchedParanthesisCount;
   size_t recursionDepth;
+  size_t baseDepth; // recursionDepth references start from, raised in loops
   bool parsingAssignment;
+  bool errorReported; // parseExpression recurses, so report errors only once
+  bool quiet;         // leave errors unreported, the caller parses again
   tokenStream *tknStream;
   hashMap map;
+  vectorArena *arena; // vector results, vectors are an error while NULL
+  clonePools *clones; // NULL allocates a pool for every reference
 } parser;
 
+// Parsing only builds the tree; identifiers and assignments are resolved when
+// the tree is run against psr->map.
 ASTNode *parseExpression(parser *psr);
+// Fails for a vector result, see runExpressionValue()
+bool runExpression(parser *psr, ASTNode *root, real *result);
+bool runExpressionValue(parser *psr, ASTNode *root, value *result);
+
+// Copies root into pool for eval() alone to run: identifiers in names point
+// at the matching node of variables, which the caller sets before each run,
+// and every other identifier is replaced by its definition in a leading
+// declaration block of root or in psr->map. NULL, with nothing reported, when
+// root needs more than numbers and operators (nested or dereferencing
+// declarations, vectors, loops, unknown identifiers).
+ASTNode *inlineExpression(parser *psr, const ASTNode *root,
+                          const substring *names, ASTNode *variables,
+                          size_t count, memPool *pool);
+
+// Parses and immediately binds the assignments starting at currentToken.
+// With more than one thread (see parallel.h), long runs of top-level
+// assignments are parsed in parallel first and then bound in source order.
+bool parseDeclarations(parser *psr);
 
 #endif
@@ -0,0 +1,33 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "ds.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+// Per-identifier profile of parseIdentifier(): every reference is timed with
+// two clock reads and charged to its chain of enclosing references, one call
+// tree per thread. Inclusive time covers the lookup, declaration binds,
+// cloning, substitution and evaluation of the definition; exclusive time is
+// that minus the nested references. Off by default, when a reference costs a
+// single branch.
+typedef struct profileNode profileNode;
+
+// Must be set before evaluating
+void profile_setEnabled(bool enabled);
+bool profile_enabled(void);
+
+// Brackets one reference; NULL, and a no-op leave, when profiling is off
+profileNode *profile_enter(substring name);
+void profile_leave(profileNode *node);
+
+// Folded stacks ("f;g;h <exclusive ns>" per line) of every thread's calls
+// merged, the input format of flamegraph.pl and similar tools
+bool profile_writeFolded(FILE *out);
+// Calls, inclusive and exclusive time per identifier, most exclusive first.
+// Inclusive time of a recursive identifier counts only its outermost calls.
+void profile_printSummary(FILE *out);
+// Discards everything recorded; no thread may be inside a reference
+void profile_reset(void);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef REAL_H
+#define REAL_H
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+// Numeric type used by the parser and evaluator, chosen at compile time:
+// -DEVAL_REAL_F32 for float, -DEVAL_REAL_F80 for long double, double
+// otherwise. Everything that touches a value goes through these names.
+// REAL_FORMAT prints enough digits (FLT_DECIMAL_DIG, DBL_DECIMAL_DIG,
+// LDBL_DECIMAL_DIG) for the text to read back as the same value.
+#if defined(EVAL_REAL_F32)
+typedef float real;
+#define REAL_NAME "f32"
+#define REAL_FORMAT "%.9g"
+#define REAL_EPSILON FLT_EPSILON
+#define REAL_HUGE HUGE_VALF
+#define realParse strtof
+#define realSin sinf
+#define realCos cosf
+#define realLog10 log10f
+#define realPow powf
+#define realAbs fabsf
+
+#elif defined(EVAL_REAL_F80)
+typedef long double real;
+#define REAL_NAME "f80"
+#define REAL_FORMAT "%.21Lg"
+#define REAL_EPSILON LDBL_EPSILON
+#define REAL_HUGE HUGE_VALL
+#define realParse strtold
+#define realSin sinl
+#define realCos cosl
+#define realLog10 log10l
+#define realPow powl
+#define realAbs fabsl
+
+#else
+typedef double real;
+#define REAL_NAME "f64"
+#define REAL_FORMAT "%.17g"
+#define REAL_EPSILON DBL_EPSILON
+#define REAL_HUGE HUGE_VAL
+#define realParse strtod
+#define realSin sin
+#define realCos cos
+#define realLog10 log10
+#define realPow pow
+#define realAbs fabs
+#endif
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include "lexer.h"
+#include "parser.h"
+#include "real.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Index values evaluated together by the native loop
+#define REDUCE_BLOCK 256
+// Deeper bodies take the general path instead, each level needs a block
+#define REDUCE_MAX_DEPTH 32
+
+// Largest magnitude of a bound. Up to it, from, from + 1, ... are exact and
+// all different in the real type: 2^23 for f32, 2^52 for f64, 2^63 for f80.
+#define REDUCE_MAX_INDEX (1 / REAL_EPSILON)
+// Most indices of one sum() or prod(), a few seconds of the native loop
+#define REDUCE_MAX_COUNT 1000000000
+
+// Running sum or product of a sum()/prod() node. Sums may use Kahan-Babuska
+// compensation, see reduce_setCompensated().
+typedef struct accumulator {
+  tokenType type; // TOKEN_SUM or TOKEN_PROD
+  real value;
+  real compensation;
+} accumulator;
+
+// Off by default; must be set before evaluating
+void reduce_setCompensated(bool enabled);
+
+// Number of indices from, from + 1, ... up to to, 0 when to < from. Fails with
+// errno set when a bound is not finite or beyond REDUCE_MAX_INDEX, or when
+// there would be more than maxCount.
+bool reduce_indexCount(real from, real to, size_t maxCount, size_t *count);
+
+accumulator reduce_init(tokenType type);
+void reduce_add(accumulator *acc, real term);
+// Same as reduce_add() for every term in order, without a call per term
+void reduce_addAll(accumulator *acc, const real *terms, size_t count);
+real reduce_result(const accumulator *acc);
+
+// True when the body only uses numbers, operators and the index, so it can be
+// evaluated without the parser by reduce_native()
+bool reduce_isNative(const ASTNode *body, substring index);
+
+// Adds body(first), body(first + 1), ... body(first + count - 1) to acc,
+// for a body accepted by reduce_isNative()
+void reduce_native(accumulator *acc, const ASTNode *body, real first,
+                   size_t count);
+
+#endif
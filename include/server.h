@@ -0,0 +1,30 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "context.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Wire protocol, host byte order (both ends share a Unix domain socket):
+//   request:  uint32 length | length bytes of expression text
+//   response: uint32 status | float64 result
+// status is 0 on success, otherwise the errCodes value (or errno) of the
+// failure. Requests are answered in order, so clients may pipeline.
+#define SERVER_REQUEST_HEADER_SIZE 4
+#define SERVER_RESPONSE_SIZE 12
+#define SERVER_MAX_REQUEST_SIZE (64u << 20)
+
+typedef struct serverResponse {
+  uint32_t status;
+  double result;
+} serverResponse;
+
+size_t server_encodeRequest(unsigned char *buffer, const char *expression,
+                            uint32_t length);
+void server_decodeResponse(const unsigned char *buffer,
+                           serverResponse *response);
+
+int runServer(evalContext *ctx, const char *socketPath);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Hot-path counters. They are only compiled in with -DEVAL_STATS
+// (make STATS=1); otherwise the macros below expand to nothing.
+typedef enum {
+  PHASE_CONFIG,   // tokenising and binding config.txt
+  PHASE_TOKENISE, // tokenising an expression
+  PHASE_PARSE,    // building its tree
+  PHASE_RUN,      // binding identifiers and evaluating
+  PHASE_MAX,
+} statsPhase;
+
+typedef struct evalStats {
+  unsigned long long tokens;
+
+  // Nodes handed out by each pool
+  unsigned long long configNodes;
+  unsigned long long programNodes;
+  unsigned long long scratchNodes;
+  unsigned long long identifierNodes; // per-reference instance pools
+
+  unsigned long long cloneCalls;
+  unsigned long long clonedNodes;
+  unsigned long long identifierCalls;
+  unsigned long long maxRecursionDepth;
+  unsigned long long declarationBinds; // declaration blocks applied
+  unsigned long long lazyDefinitions;  // config definitions parsed on first use
+  unsigned long long parallelTasks;    // subtrees handed to the thread pool
+  unsigned long long watchComputes;    // identifiers recomputed by --watch
+
+  unsigned long long hashProbes;     // buckets inspected, per map layer
+  unsigned long long hashChainSteps; // entries compared
+  unsigned long long hashMaxChain;
+
+  unsigned long long peakBytes; // most one evaluation held, see budget.h
+
+  unsigned long long phaseNs[PHASE_MAX];
+} evalStats;
+
+bool evalStats_enabled(void);
+// Totals over every thread. Read while no evaluation is running.
+const evalStats *evalStats_get(void);
+void evalStats_reset(void);
+void evalStats_print(FILE *out);
+
+#ifdef EVAL_STATS
+// Each thread counts into its own block, so threads never share a counter;
+// evalStats_get() merges the blocks
+extern _Thread_local evalStats *threadStats;
+evalStats *statsRegisterThread(void);
+unsigned long long statsClock(void);
+
+#define STATS_LOCAL (threadStats ? threadStats : statsRegisterThread())
+#define STATS_ADD(field, n) (STATS_LOCAL->field += (n))
+#define STATS_MAX(field, value)                                                \
+  do {                                                                         \
+    evalStats *local = STATS_LOCAL;                                            \
+    if ((unsigned long long)(value) > local->field)                            \
+      local->field = (value);                                                  \
+  } while (0)
+#define STATS_TIMER(name) unsigned long long name = statsClock()
+#define STATS_ELAPSED(phase, name)                                             \
+  (STATS_LOCAL->phaseNs[phase] += statsClock() - (name))
+#else
+#define STATS_ADD(field, n) ((void)0)
+#define STATS_MAX(field, value) ((void)0)
+#define STATS_TIMER(name) ((void)0)
+#define STATS_ELAPSED(phase, name) ((void)0)
+#endif
+
+#endif
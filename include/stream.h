@@ -0,0 +1,34 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "context.h"
+#include "output.h"
+
+// Lines between the reader and the writer at any time, which bounds memory
+// whatever the length of the stream
+#define STREAM_SLOTS 1024
+// Polls of a condition before a stage goes to sleep on it
+#define STREAM_SPINS 64
+// Longest a finished result is held back for the ones evaluated after it
+#define STREAM_FLUSH_NS 1000000ull
+
+// Evaluates one expression per line of inFd and writes one result per line
+// to outFd, in input order, until the end of the input. A reader thread
+// splits the input, the threads set with parallel_setThreads() evaluate on
+// workers of their own (see evalWorker) and a writer thread puts the results
+// back in order. Results are flushed as soon as every line read so far has
+// one, otherwise within STREAM_FLUSH_NS.
+//
+// The stages share a ring of STREAM_SLOTS slots. The reader fills slot n
+// once the writer is done with slot n - STREAM_SLOTS, evaluators claim slots
+// in order and the writer takes them in order once evaluated, so each stage
+// waits on the one after it instead of buffering. Slots are handed over with
+// atomics; a stage only takes a lock to sleep, or to wake one that sleeps.
+//
+// In text a failed line gives an empty line, in the framed format an error
+// frame; f64 has no room for it, and npy, which needs the shape up front, is
+// rejected. Per-stage throughput is reported on stderr. Returns 0 when every
+// line evaluated and was written.
+int runStream(evalContext *ctx, int inFd, int outFd, outputFormat format);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef STRESS_H
+#define STRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Synthetic workloads that grow along one dimension while everything else
+// stays fixed, to find the paths whose cost grows faster than their input.
+// Each is a single expression declaring whatever it references, so it runs
+// as is from the command line, in stream mode or against a context.
+typedef enum stressDimension {
+  STRESS_LENGTH,      // size terms joined by binary operators
+  STRESS_DEPTH,       // size nested parentheses around one operation
+  STRESS_IDENTIFIERS, // size declared identifiers, each referenced once
+  STRESS_CHAIN,       // an identifier defined through size - 1 others
+  STRESS_FANOUT,      // size references to one definition with a declaration
+  STRESS_DIMENSIONS
+} stressDimension;
+
+const char *stress_name(stressDimension dimension);
+// false for a name that is not one of stress_name()'s
+bool stress_parseDimension(const char *name, stressDimension *dimension);
+// Largest size a workload evaluates at: a chain takes one level of the
+// identifier recursion limit per identifier and depth one level of nesting
+// per parenthesis, the others are unbounded
+size_t stress_maxSize(stressDimension dimension);
+// The workload of the given size (at least 1), NUL-terminated and owned by
+// the caller. The same arguments always give the same text.
+char *stress_generate(stressDimension dimension, size_t size);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "context.h"
+#include "output.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+#define SWEEP_MAX_AXES 16
+// Points each task evaluates and formats before the results are written
+#define SWEEP_TASK_POINTS 8192
+
+typedef enum {
+  SWEEP_ROWS, // "x y result" per point
+  SWEEP_CSV,  // a header line, then "x,y,result" per point
+  SWEEP_GRID, // results only, one line per run of the last axis
+} sweepLayout;
+
+// Values an identifier takes: count evenly spaced values from `from` to `to`,
+// both included, or the listed values when list is set
+typedef struct sweepAxis {
+  substring name;
+  real from;
+  real to;
+  size_t count;
+  real *list;
+} sweepAxis;
+
+// Parses "<iden>=<from>:<to>:<count>" or "<iden>=<value>,<value>,...". The
+// name points into spec. Reports and returns false for a malformed spec.
+bool sweepAxis_parse(sweepAxis *axis, const char *spec);
+void sweepAxis_free(sweepAxis *axis);
+
+// Evaluates the expression at every point of the Cartesian product of the
+// axes, the last axis varying fastest. The expression is parsed once; points
+// are evaluated in parallel on the threads set with parallel_setThreads() and
+// written to out in order as they complete. In binary formats the rows layout
+// (and csv, which has no meaning there) writes the axis values and the result
+// of each point, the grid layout the results alone, shaped like the grid in a
+// .npy file. Stops at the first point that fails, after writing every point
+// before it and, in the framed format, an error frame. Returns 0 on success.
+int runSweep(evalContext *ctx, const char *expression, const sweepAxis *axes,
+             size_t axisCount, sweepLayout layout, outputFormat format,
+             FILE *out);
+
+#endif
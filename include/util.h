@@ -1,9 +1,9 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include "ds.h"
 #include <stddef.h>
 
-typedef struct token token;
 typedef int errCodes;
 enum {
   MISSING_ERROR_CODE = 1000,
@@ -22,9 +22,22 @@ enum {
   UNKNOWN_IDENTIFIER,
   UNDEFINED_REFERENCE,
   MAXIMUM_RECURSION_DEPTH,
+  INVALID_REDUCTION,
+  INVALID_RANGE,
+  INVALID_VECTOR_SYNTAX,
+  LENGTH_MISMATCH,
+  INVALID_VECTOR_USE,
+  NO_CONVERGENCE,
+  NO_SIGN_CHANGE,
+  MEMORY_BUDGET_EXCEEDED,
+  RANGE_TOO_LONG,
+  NESTING_TOO_DEEP,
+  INEXACT_RANGE,
 };
 
 void logError(const char *message, const char *functionName);
-void createErrorMessage(char *buffer, size_t bufferSize, const token *tkn);
+// Describes errno for the lexeme found at pos
+void createErrorMessage(char *buffer, size_t bufferSize, substring lexeme,
+                        size_t pos);
 
 #endif
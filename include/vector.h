@@ -0,0 +1,58 @@
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include "lexer.h"
+#include "real.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define VECTOR_ALIGN 64              // bytes, every vector starts on a line
+#define VECTOR_CHUNK_SIZE (1 << 20)  // bytes per arena chunk at least
+#define VECTOR_MAX_RANGE (1 << 27)   // elements of one range(), 1 GiB of f64
+
+// Result of running an expression: a vector when data is set, otherwise the
+// scalar. Vector data belongs to an arena or to a loaded file.
+typedef struct value {
+  real scalar;
+  const real *data;
+  size_t len;
+} value;
+
+// Temporary vectors of one evaluation. Reset keeps the chunks, so repeated
+// evaluations reuse the same memory instead of allocating per operation.
+typedef struct arenaChunk {
+  struct arenaChunk *next;
+  size_t size;
+  size_t used;
+  unsigned char *data;
+} arenaChunk;
+
+typedef struct vectorArena {
+  arenaChunk *chunks;
+} vectorArena;
+
+real *vectorArena_alloc(vectorArena *arena, size_t len);
+void vectorArena_reset(vectorArena *arena);
+void vectorArena_free(vectorArena *arena);
+
+// Element-wise operators; a scalar operand is broadcast over the other
+// vector's elements, two vectors must have the same length. The result is
+// allocated from the arena. errno is set on failure.
+bool vector_unary(vectorArena *arena, tokenType type, value operand,
+                  value *result);
+bool vector_binary(vectorArena *arena, tokenType type, value left, value right,
+                   value *result);
+
+// TOKEN_ELEMENT_SUM, TOKEN_ELEMENT_PROD, TOKEN_MINIMUM or TOKEN_MAXIMUM of
+// the elements; a scalar is its own reduction
+bool vector_reduce(tokenType type, value operand, value *result);
+bool vector_dot(value left, value right, value *result);
+
+// from, from + 1, ... up to to
+bool vector_range(vectorArena *arena, real from, real to, value *result);
+
+// Reads a file of raw native-endian float64 values into aligned memory, which
+// the caller frees with free()
+real *vector_load(const char *path, size_t *len);
+
+#endif
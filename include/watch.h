@@ -0,0 +1,16 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "context.h"
+#include <stdio.h>
+
+// Spreadsheet-style evaluation. The identifiers in `outputs` (comma
+// separated) are printed once, then every line read from `in` is applied as
+// a sequence of assignments, e.g. "(x = 4)(y = x * 2)". After each line only
+// the outputs that depend on a changed identifier are re-evaluated, and only
+// those whose value changed are printed, as "name = value" or "name error N".
+//
+// Definitions made by an update persist for later lines.
+int runWatch(evalContext *ctx, const char *outputs, FILE *in, FILE *out);
+
+#endif
@@ -0,0 +1,66 @@
+#!/bin/bash
+
+# End-to-end checks of `eval --serve` through the bundled client
+EXEC=./eval
+CLIENT=./build/bin/eval_client
+SOCKET="${TMPDIR:-/tmp}/eval_server_test.$$.sock"
+NESTING_TOO_DEEP=1025
+
+for bin in "$EXEC" "$CLIENT"; do
+  if [ ! -x "$bin" ]; then
+    echo "Error: $bin not found. Please run make and make tools."
+    exit 1
+  fi
+done
+
+"$EXEC" --serve "$SOCKET" 2> /dev/null &
+server=$!
+trap 'kill $server 2> /dev/null; rm -f "$SOCKET"' EXIT
+
+for i in $(seq 50); do
+  [ -S "$SOCKET" ] && break
+  sleep 0.1
+done
+
+status=0
+
+# expect <description> <expected output>, with the requests on stdin
+expect() {
+  echo -n "Testing: $1 ... "
+  local output
+  output=$(timeout 20 "$CLIENT" "$SOCKET" 2> /dev/null)
+  if [ "$output" == "$2" ] && kill -0 $server 2> /dev/null; then
+    echo "PASS"
+  else
+    echo "FAIL"
+    status=1
+  fi
+}
+
+expect "simple request" "2" <<< "1 + 1"
+
+# Every operator of a chain is nested in the next one's left operand
+expect "chain of 200000 terms" "200000" < <(
+  awk 'BEGIN { for (i = 1; i < 200000; i++) printf "1+"; print 1 }')
+expect "definition with a chain of 200000 terms" "-399996" < <(
+  awk 'BEGIN { printf "(x = "; for (i = 1; i < 200000; i++) printf "1-";
+               print "1) x * 2" }')
+
+expect "200000 nested parentheses" "error $NESTING_TOO_DEEP" < <(
+  awk 'BEGIN { for (i = 0; i < 200000; i++) printf "(";
+               printf 1; for (i = 0; i < 200000; i++) printf ")"; print "" }')
+expect "request after the deep ones" "6" <<< "2 * 3"
+
+# 12 bytes each, so the responses outgrow the server's 1 MiB output queue
+# long before the client has sent every request
+echo -n "Testing: 200000 pipelined requests ... "
+responses=$(seq 200000 | awk '{ print $1 " * 2" }' |
+  timeout 20 "$CLIENT" "$SOCKET" 2> /dev/null | awk '$1 == 2 * NR' | wc -l)
+if [ "$responses" -eq 200000 ] && kill -0 $server 2> /dev/null; then
+  echo "PASS"
+else
+  echo "FAIL"
+  status=1
+fi
+
+exit $status
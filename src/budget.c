@@ -0,0 +1,32 @@
+#include "budget.h"
+#include "util.h"
+#include <errno.h>
+
+static size_t budget;
+
+static _Thread_local size_t held;
+static _Thread_local size_t peak;
+
+void memBudget_set(size_t bytes) { budget = bytes; }
+
+size_t memBudget_get(void) { return budget; }
+
+void memBudget_begin(void) {
+  held = 0;
+  peak = 0;
+}
+
+bool memBudget_charge(size_t bytes) {
+  if (budget && (held > budget || bytes > budget - held)) {
+    errno = MEMORY_BUDGET_EXCEEDED;
+    return false;
+  }
+  held += bytes;
+  if (held > peak)
+    peak = held;
+  return true;
+}
+
+void memBudget_release(size_t bytes) { held -= bytes < held ? bytes : held; }
+
+size_t memBudget_peak(void) { return peak; }
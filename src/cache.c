@@ -0,0 +1,227 @@
+#include "cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Rough size of a small entry, used to pick the bucket count up front
+#define TYPICAL_ENTRY_SIZE 128
+#define MIN_BUCKETS 16
+#define MAX_BUCKETS ((size_t)1 << 24)
+
+static inline size_t entrySize(size_t keyLen) {
+  return sizeof(cacheEntry) + keyLen;
+}
+
+bool resultCache_init(resultCache *cache, size_t memoryLimit) {
+  *cache = (resultCache){.memoryLimit = memoryLimit};
+
+  size_t bucketCount = MIN_BUCKETS;
+  while (bucketCount < MAX_BUCKETS &&
+         bucketCount * TYPICAL_ENTRY_SIZE < memoryLimit)
+    bucketCount *= 2;
+
+  cache->buckets = calloc(bucketCount, sizeof(cacheEntry *));
+  if (!cache->buckets)
+    return false;
+
+  cache->bucketCount = bucketCount;
+  cache->memoryUsed = bucketCount * sizeof(cacheEntry *);
+  return true;
+}
+
+static void unlinkRecency(resultCache *cache, cacheEntry *e) {
+  if (e->newer)
+    e->newer->older = e->older;
+  else
+    cache->newest = e->older;
+
+  if (e->older)
+    e->older->newer = e->newer;
+  else
+    cache->oldest = e->newer;
+}
+
+static void linkNewest(resultCache *cache, cacheEntry *e) {
+  e->newer = NULL;
+  e->older = cache->newest;
+  if (cache->newest)
+    cache->newest->newer = e;
+  cache->newest = e;
+  if (!cache->oldest)
+    cache->oldest = e;
+}
+
+static void removeEntry(resultCache *cache, cacheEntry *e) {
+  cacheEntry **link =
+      &cache->buckets[substringHash(e->key) & (cache->bucketCount - 1)];
+  while (*link != e)
+    link = &(*link)->next;
+  *link = e->next;
+
+  unlinkRecency(cache, e);
+  cache->memoryUsed -= entrySize(e->key.len);
+  cache->count--;
+  free(e);
+}
+
+bool resultCache_get(resultCache *cache, const substring key,
+                     unsigned long version, real *result) {
+  cacheEntry *e = cache->buckets[substringHash(key) & (cache->bucketCount - 1)];
+
+  while (e && !substringCmp(e->key, key))
+    e = e->next;
+
+  if (!e || e->version != version) {
+    // Results computed against an older environment can never hit again
+    if (e)
+      removeEntry(cache, e);
+    cache->misses++;
+    return false;
+  }
+
+  unlinkRecency(cache, e);
+  linkNewest(cache, e);
+  *result = e->result;
+  cache->hits++;
+  return true;
+}
+
+void resultCache_put(resultCache *cache, const substring key,
+                     unsigned long version, real result) {
+  size_t size = entrySize(key.len);
+  if (cache->bucketCount * sizeof(cacheEntry *) + size > cache->memoryLimit)
+    return;
+
+  while (cache->oldest && cache->memoryUsed + size > cache->memoryLimit)
+    removeEntry(cache, cache->oldest);
+
+  cacheEntry *e = malloc(size);
+  if (!e)
+    return;
+
+  char *keyCopy = (char *)(e + 1);
+  memcpy(keyCopy, key.str, key.len);
+  *e = (cacheEntry){
+      .key = {.str = keyCopy, .len = key.len},
+      .version = version,
+      .result = result,
+  };
+
+  size_t idx = substringHash(key) & (cache->bucketCount - 1);
+  e->next = cache->buckets[idx];
+  cache->buckets[idx] = e;
+  linkNewest(cache, e);
+
+  cache->memoryUsed += size;
+  cache->count++;
+}
+
+void resultCache_free(resultCache *cache) {
+  cacheEntry *e = cache->newest;
+  while (e) {
+    cacheEntry *tmp = e;
+    e = e->older;
+    free(tmp);
+  }
+
+  free(cache->buckets);
+}
+
+/*--PROGRAM CACHE--*/
+void compiledProgram_free(compiledProgram *program) {
+  memPool_free(&program->nodePool);
+  free(program->normalisedKey.str);
+  free(program->text.str);
+  free(program);
+}
+
+bool programCache_init(programCache *cache, size_t capacity) {
+  *cache = (programCache){.capacity = capacity};
+
+  size_t bucketCount = MIN_BUCKETS;
+  while (bucketCount < MAX_BUCKETS && bucketCount < capacity)
+    bucketCount *= 2;
+
+  cache->buckets = calloc(bucketCount, sizeof(compiledProgram *));
+  if (!cache->buckets)
+    return false;
+
+  cache->bucketCount = bucketCount;
+  return true;
+}
+
+static void programUnlinkRecency(programCache *cache, compiledProgram *p) {
+  if (p->newer)
+    p->newer->older = p->older;
+  else
+    cache->newest = p->older;
+
+  if (p->older)
+    p->older->newer = p->newer;
+  else
+    cache->oldest = p->newer;
+}
+
+static void programLinkNewest(programCache *cache, compiledProgram *p) {
+  p->newer = NULL;
+  p->older = cache->newest;
+  if (cache->newest)
+    cache->newest->newer = p;
+  cache->newest = p;
+  if (!cache->oldest)
+    cache->oldest = p;
+}
+
+static void programRemove(programCache *cache, compiledProgram *p) {
+  compiledProgram **link =
+      &cache->buckets[substringHash(p->text) & (cache->bucketCount - 1)];
+  while (*link != p)
+    link = &(*link)->next;
+  *link = p->next;
+
+  programUnlinkRecency(cache, p);
+  cache->count--;
+  compiledProgram_free(p);
+}
+
+compiledProgram *programCache_get(programCache *cache, const substring text,
+                                  unsigned long version) {
+  compiledProgram *p =
+      cache->buckets[substringHash(text) & (cache->bucketCount - 1)];
+
+  while (p && !substringCmp(p->text, text))
+    p = p->next;
+
+  if (!p || p->version != version) {
+    if (p)
+      programRemove(cache, p);
+    cache->misses++;
+    return NULL;
+  }
+
+  programUnlinkRecency(cache, p);
+  programLinkNewest(cache, p);
+  cache->hits++;
+  return p;
+}
+
+void programCache_put(programCache *cache, compiledProgram *program) {
+  while (cache->oldest && cache->count >= cache->capacity)
+    programRemove(cache, cache->oldest);
+
+  size_t idx = substringHash(program->text) & (cache->bucketCount - 1);
+  program->next = cache->buckets[idx];
+  cache->buckets[idx] = program;
+  programLinkNewest(cache, program);
+  cache->count++;
+}
+
+void programCache_free(programCache *cache) {
+  compiledProgram *p = cache->newest;
+  while (p) {
+    compiledProgram *tmp = p;
+    p = p->older;
+    compiledProgram_free(tmp);
+  }
+
+  free(cache->buckets);
+}
@@ -0,0 +1,216 @@
+#include "config.h"
+#include "lexer.h"
+#include "parser.h"
+#include "stats.h"
+#include "util.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A load is already holding the lock of this index on this thread, and may
+// only see the definitions before limit
+static _Thread_local const configIndex *loadingIndex;
+static _Thread_local size_t loadLimit;
+
+/*--SCANNING--*/
+static inline bool isSpace(char c) {
+  return c == ' ' || c == '\r' || c == '\n' || c == '\t';
+}
+
+static size_t skipSpace(const char *text, size_t len, size_t pos) {
+  while (pos < len && isSpace(text[pos]))
+    pos++;
+  return pos;
+}
+
+// One past the parenthesis closing the one at pos, 0 when it is unbalanced
+static size_t matchParenthesis(const char *text, size_t len, size_t pos) {
+  size_t depth = 0;
+  for (; pos < len; pos++) {
+    if (text[pos] == '(')
+      depth++;
+    else if (text[pos] == ')' && --depth == 0)
+      return pos + 1;
+  }
+  return 0;
+}
+
+// Adds the statement at pos when it is "(iden = ...)", the same test
+// parseDeclarations() makes on tokens, and returns its end or 0
+static size_t scanStatement(configIndex *index, size_t len, size_t pos,
+                            size_t *capacity) {
+  const char *text = index->text;
+  if (pos >= len || text[pos] != '(')
+    return 0;
+  size_t name = skipSpace(text, len, pos + 1);
+  size_t nameLen = identifierLength(text + name, len - name);
+  size_t assignment = skipSpace(text, len, name + nameLen);
+  if (!nameLen || assignment >= len || text[assignment] != '=')
+    return 0;
+  size_t end = matchParenthesis(text, len, pos);
+  if (!end)
+    return 0; // left to the parser to report
+
+  if (index->count == *capacity) {
+    size_t grown = *capacity ? *capacity * 2 : 64;
+    configDefinition *definitions =
+        realloc(index->definitions, sizeof(configDefinition) * grown);
+    if (!definitions) {
+      logError("Fatal: Memory allocation failure", __func__);
+      return SIZE_MAX;
+    }
+    index->definitions = definitions;
+    *capacity = grown;
+  }
+  configDefinition *d = &index->definitions[index->count++];
+  *d = (configDefinition){
+      .name = {.str = (char *)text + name, .len = nameLen},
+      .start = pos,
+      .end = end,
+  };
+  atomic_init(&d->loaded, false);
+  return end;
+}
+
+// Links every name's latest definition into the buckets, with the earlier
+// ones behind it
+static bool linkDefinitions(configIndex *index) {
+  index->size = index->count ? index->count : 1;
+  index->buckets = calloc(index->size, sizeof(configDefinition *));
+  if (!index->buckets) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return false;
+  }
+
+  for (size_t i = 0; i < index->count; i++) {
+    configDefinition *d = &index->definitions[i];
+    configDefinition **link =
+        &index->buckets[substringHash(d->name) % index->size];
+    while (*link && !substringCmp((*link)->name, d->name))
+      link = &(*link)->next;
+    if (*link) {
+      d->previous = *link;
+      d->next = (*link)->next;
+    } else {
+      d->next = NULL;
+    }
+    *link = d;
+  }
+  return true;
+}
+
+bool configIndex_init(configIndex *index, const char *text, size_t *tail) {
+  *index = (configIndex){.text = text};
+  size_t len = strlen(text);
+  size_t capacity = 0;
+
+  size_t pos = 0, end;
+  while ((end = scanStatement(index, len, skipSpace(text, len, pos),
+                              &capacity)) &&
+         end != SIZE_MAX)
+    pos = end;
+
+  bool ok = end != SIZE_MAX && linkDefinitions(index);
+  if (ok && !memPool_init(&index->nodePool, 1)) {
+    logError("Fatal: Memory allocation failure", __func__);
+    ok = false;
+  }
+  if (!ok) {
+    free(index->buckets);
+    free(index->definitions);
+    return false;
+  }
+
+  pthread_mutex_init(&index->lock, NULL);
+  *tail = pos;
+  return true;
+}
+
+/*--LOADING--*/
+// Parses and binds the statement on a parser of its own, whose map only
+// falls back to the definitions before it. Runs under the index lock.
+static bool loadDefinition(configIndex *index, configDefinition *d) {
+  const configIndex *outerIndex = loadingIndex;
+  size_t outerLimit = loadLimit;
+  loadingIndex = index;
+  loadLimit = d->start;
+
+  tokenStream *tokens = tokeniseRange(index->text, d->start, d->end);
+  parser psr = {0};
+  psr.tknStream = tokens;
+  bool ok = tokens && memPool_init(&psr.nodePool, tokens->count) &&
+            hashMap_init(&psr.map, 1);
+  if (tokens && !ok)
+    logError("Fatal: Memory allocation failure", __func__);
+
+  if (ok) {
+    psr.map.fallback = configIndex_lookup;
+    psr.map.fallbackArg = index;
+    errno = 0;
+    ok = parseDeclarations(&psr) && psr.currentToken + 1 == tokens->count;
+  }
+
+  if (ok) {
+    // Bound in the parser's own map, nothing of it escapes
+    ASTNode *value = hashMap_getValue(&psr.map, d->name, &d->treeSize,
+                                      &d->declarations);
+    STATS_ADD(configNodes, psr.nodePool.allocated);
+    STATS_ADD(lazyDefinitions, 1);
+    ok = memPool_adopt(&index->nodePool, &psr.nodePool);
+    if (ok) {
+      d->value = value;
+      atomic_store_explicit(&d->loaded, true, memory_order_release);
+    } else {
+      logError("Fatal: Memory allocation failure", __func__);
+    }
+  }
+
+  memPool_free(&psr.nodePool);
+  if (psr.map.buckets)
+    hashMap_free(&psr.map);
+  if (tokens) {
+    tokenStream_free(tokens);
+    free(tokens);
+  }
+  loadingIndex = outerIndex;
+  loadLimit = outerLimit;
+  return ok;
+}
+
+ASTNode *configIndex_lookup(void *arg, substring key, size_t *treeSize,
+                            ASTNode **declarations) {
+  configIndex *index = arg;
+  bool nested = loadingIndex == index;
+  size_t limit = nested ? loadLimit : SIZE_MAX;
+
+  configDefinition *d = index->buckets[substringHash(key) % index->size];
+  while (d && !substringCmp(d->name, key))
+    d = d->next;
+  while (d && d->start >= limit)
+    d = d->previous;
+  if (!d)
+    return NULL;
+
+  if (!atomic_load_explicit(&d->loaded, memory_order_acquire)) {
+    if (!nested)
+      pthread_mutex_lock(&index->lock);
+    bool ok = atomic_load_explicit(&d->loaded, memory_order_relaxed) ||
+              loadDefinition(index, d);
+    if (!nested)
+      pthread_mutex_unlock(&index->lock);
+    if (!ok)
+      return NULL;
+  }
+
+  *treeSize = d->treeSize;
+  *declarations = d->declarations;
+  return d->value;
+}
+
+void configIndex_free(configIndex *index) {
+  pthread_mutex_destroy(&index->lock);
+  memPool_free(&index->nodePool);
+  free(index->buckets);
+  free(index->definitions);
+}
@@ -0,0 +1,573 @@
+#include "context.h"
+#include "budget.h"
+#include "config.h"
+#include "lexer.h"
+#include "parser.h"
+#include "stats.h"
+#include "util.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Nodes created while running, i.e. resolved dereferences. The pool grows on
+// demand and is reused across runs.
+#define SCRATCH_POOL_SIZE 64
+// Assignments of one expression. The layer grows for larger expressions and
+// keeps its buckets afterwards.
+#define LAYER_SIZE 8
+
+static bool lazyConfig;
+
+void evalContext_setLazyConfig(bool lazy) { lazyConfig = lazy; }
+
+static char *readConfigFile(const char *filename) {
+  FILE *file = fopen(filename, "r");
+  if (!file) {
+    // Config file is optional, so don't treat this as an error
+    errno = 0;
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  long fileSize = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  if (fileSize <= 0) {
+    logError("I/O error while processing config. Continuing without config\n",
+             __func__);
+    fclose(file);
+    errno = 0;
+    return NULL;
+  }
+
+  char *buffer = malloc(fileSize + 1);
+  if (!buffer) {
+    logError("Fatal: Memory allocation failure\n", __func__);
+    fclose(file);
+    return NULL;
+  }
+
+  size_t bytesRead = fread(buffer, 1, fileSize, file);
+  buffer[bytesRead] = '\0';
+
+  fclose(file);
+  return buffer;
+}
+
+static bool evalBuffers_init(evalBuffers *b) {
+  return memPool_init(&b->scratchPool, SCRATCH_POOL_SIZE) &&
+         hashMap_init(&b->layer, LAYER_SIZE);
+}
+
+// Safe on buffers whose init failed part way, as long as they started zeroed
+static void evalBuffers_free(evalBuffers *b) {
+  if (b->layer.buckets)
+    hashMap_free(&b->layer);
+  memPool_free(&b->programPool);
+  memPool_free(&b->scratchPool);
+  vectorArena_free(&b->arena);
+  clonePools_free(&b->clones);
+}
+
+// Indexes the leading declarations of the config when loading lazily; *tail
+// is set to the offset of the text that is still parsed up front
+static bool indexConfig(evalContext *ctx, size_t *tail) {
+  *tail = 0;
+  if (!lazyConfig || !ctx->config)
+    return true;
+
+  ctx->index = malloc(sizeof(configIndex));
+  if (!ctx->index) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return false;
+  }
+  if (!configIndex_init(ctx->index, ctx->config, tail)) {
+    free(ctx->index);
+    ctx->index = NULL;
+    return false;
+  }
+  return true;
+}
+
+static void freeIndex(evalContext *ctx) {
+  if (!ctx->index)
+    return;
+  configIndex_free(ctx->index);
+  free(ctx->index);
+}
+
+bool evalContext_init(evalContext *ctx, const char *configFile) {
+  *ctx = (evalContext){.configFile = configFile};
+  errno = 0;
+  STATS_TIMER(start);
+
+  ctx->config = readConfigFile(configFile);
+  if (errno)
+    return false;
+
+  size_t tail;
+  if (!indexConfig(ctx, &tail)) {
+    free(ctx->config);
+    return false;
+  }
+
+  const char *text = ctx->config ? ctx->config : "";
+  tokenStream *configTokens = tokeniseRange(text, tail, strlen(text));
+  if (!configTokens) {
+    freeIndex(ctx);
+    free(ctx->config);
+    return false;
+  }
+
+  ctx->tokens = *configTokens;
+  ctx->tokenCapacity = configTokens->count;
+  free(configTokens);
+
+  parser psr = {0};
+  psr.tknStream = &ctx->tokens;
+
+  if (!memPool_init(&psr.nodePool, ctx->tokens.count) ||
+      !hashMap_init(&psr.map, ctx->tokens.count / 5)) {
+    logError("Fatal: Memory allocation failure", __func__);
+    memPool_free(&psr.nodePool);
+    tokenStream_free(&ctx->tokens);
+    freeIndex(ctx);
+    free(ctx->config);
+    return false;
+  }
+  if (ctx->index) {
+    psr.map.fallback = configIndex_lookup;
+    psr.map.fallbackArg = ctx->index;
+  }
+
+  errno = 0;
+  if (!parseDeclarations(&psr) || !evalBuffers_init(&ctx->buffers)) {
+    memPool_free(&psr.nodePool);
+    hashMap_free(&psr.map);
+    evalBuffers_free(&ctx->buffers);
+    tokenStream_free(&ctx->tokens);
+    freeIndex(ctx);
+    free(ctx->config);
+    return false;
+  }
+
+  // Anything after the declarations prefixes every expression, exactly as if
+  // the config had been concatenated in front of it.
+  ctx->expressionStart = psr.currentToken;
+  ctx->appendIndex = ctx->tokens.count - 1;
+  ctx->nodePool = psr.nodePool;
+  ctx->map = psr.map;
+  STATS_ADD(configNodes, psr.nodePool.allocated);
+  STATS_ELAPSED(PHASE_CONFIG, start);
+  return true;
+}
+
+// Loaded vectors are leaves of their own, placed in the config pool
+static bool bindVector(evalContext *ctx, const loadedVector *vector) {
+  ASTNode *node = memPool_alloc(&ctx->nodePool);
+  if (!node)
+    return false;
+
+  substring key = {.str = vector->name, .len = strlen(vector->name)};
+  *node = (ASTNode){.type = TOKEN_VECTOR, .identifer = key};
+  node->vector.data = vector->data;
+  node->vector.len = vector->len;
+  return hashmap_setKey(&ctx->map, key, node, 1, NULL);
+}
+
+bool evalContext_reload(evalContext *ctx) {
+  evalContext fresh;
+  if (!evalContext_init(&fresh, ctx->configFile))
+    return false; // keep serving the old definitions
+
+  fresh.version = ctx->version + 1;
+  fresh.cache = ctx->cache;
+  fresh.programs = ctx->programs;
+
+  // Loads are applied in their original order, so the last one of a name wins
+  for (const loadedVector *vector = ctx->loaded; vector; vector = vector->next) {
+    if (!bindVector(&fresh, vector)) {
+      logError("Fatal: Memory allocation failure", __func__);
+      evalContext_free(&fresh);
+      return false;
+    }
+  }
+  fresh.loaded = ctx->loaded;
+  ctx->loaded = NULL;
+
+  evalContext_free(ctx);
+  *ctx = fresh;
+  return true;
+}
+
+bool evalContext_loadVector(evalContext *ctx, const char *name,
+                            const char *path) {
+  // The name has to be a single identifier to be referenced at all
+  if (!isIdentifierName(name)) {
+    errno = INVALID_ASSIGNMENT_SYNTAX;
+    logError("Invalid vector name: expected a single identifier\n", __func__);
+    return false;
+  }
+
+  loadedVector *vector = calloc(1, sizeof(loadedVector));
+  char *copy = malloc(strlen(name) + 1);
+  if (!vector || !copy) {
+    logError("Fatal: Memory allocation failure", __func__);
+    free(vector);
+    free(copy);
+    return false;
+  }
+  strcpy(copy, name);
+  vector->name = copy;
+
+  errno = 0;
+  vector->data = vector_load(path, &vector->len);
+  if (!vector->data) {
+    logError("Failed to load vector file", __func__);
+    free(vector->name);
+    free(vector);
+    return false;
+  }
+
+  if (!bindVector(ctx, vector)) {
+    logError("Fatal: Memory allocation failure", __func__);
+    free(vector->data);
+    free(vector->name);
+    free(vector);
+    return false;
+  }
+
+  loadedVector **tail = &ctx->loaded;
+  while (*tail)
+    tail = &(*tail)->next;
+  *tail = vector;
+  ctx->version++;
+  return true;
+}
+
+// Encodes the expression's tokens as type byte + lexeme pairs. Token types
+// are below any printable character, so the encoding is unambiguous while
+// ignoring whitespace.
+static bool normaliseTokens(const tokenStream *tokens, size_t first,
+                            substring *key) {
+  size_t len = 0;
+  for (size_t i = first; i + 1 < tokens->count; i++)
+    len += 1 + tokens->stream[i].len;
+
+  char *out = malloc(len + 1);
+  if (!out)
+    return false;
+  *key = (substring){.str = out, .len = len};
+
+  for (size_t i = first; i + 1 < tokens->count; i++) {
+    substring lexeme = tokenStream_lexeme(tokens, i);
+    *out++ = (char)tokens->stream[i].type;
+    memcpy(out, lexeme.str, lexeme.len);
+    out += lexeme.len;
+  }
+  return true;
+}
+
+bool evalContext_appendTokens(evalContext *ctx, const tokenStream *tokens) {
+  ctx->tokens.count = ctx->appendIndex;
+  return tokenStream_append(&ctx->tokens, &ctx->tokenCapacity, tokens,
+                            tokens->count);
+}
+
+// Tokenises expression[0, len) behind the config tokens, in place of the
+// previous expression. The lexemes are read from expression.
+static bool appendExpression(tokenStream *tokens, size_t *tokenCapacity,
+                             size_t appendIndex, const char *expression,
+                             size_t len) {
+  tokens->count = appendIndex;
+  STATS_TIMER(start);
+  bool ok = tokeniseAppend(tokens, tokenCapacity, expression, 0, len);
+  STATS_ELAPSED(PHASE_TOKENISE, start);
+  return ok;
+}
+
+// Charges the tokens of the expression behind the config, and the node per
+// token parsing reserves, to the evaluation's budget
+static bool chargeExpression(const tokenStream *tokens, size_t appendIndex,
+                             size_t expressionStart) {
+  size_t bytes = (tokens->count - appendIndex) * sizeof(token) +
+                 (tokens->count - expressionStart) * sizeof(ASTNode);
+  if (memBudget_charge(bytes))
+    return true;
+
+  // Reported against the whole expression, from its first token to its last,
+  // cut short to leave the message room for the budget
+  const token *first = &tokens->stream[appendIndex];
+  substring lexeme = tokenStream_lexeme(tokens, appendIndex);
+  if (tokens->count - appendIndex > 1) {
+    const token *last = &tokens->stream[tokens->count - 2];
+    lexeme.len = last->pos + last->len - first->pos;
+  }
+  if (lexeme.len > 128)
+    lexeme.len = 128;
+  char buffer[256];
+  createErrorMessage(buffer, sizeof(buffer), lexeme, first->pos);
+  logError(buffer, __func__);
+  return false;
+}
+
+// Parses the expression behind the config into pool
+static ASTNode *parseTokens(tokenStream *tokens, size_t expressionStart,
+                            memPool *pool) {
+  parser psr = {0};
+  psr.currentToken = expressionStart;
+  psr.tknStream = tokens;
+  psr.nodePool = *pool;
+
+  STATS_TIMER(start);
+  ASTNode *root = parseExpression(&psr);
+  STATS_ELAPSED(PHASE_PARSE, start);
+  STATS_ADD(programNodes, psr.nodePool.allocated);
+  *pool = psr.nodePool; // may have grown
+  return root;
+}
+
+// A tree of many nodes may make as many assignments, so the layer gets a
+// bucket for every five of them, as a layer of its own would. It is empty
+// between runs and keeps the larger buckets.
+static bool reserveLayer(hashMap *layer, size_t nodes) {
+  size_t size = nodes / 5;
+  if (size <= layer->size)
+    return true;
+
+  entry **buckets = calloc(size, sizeof(entry *));
+  if (!buckets) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return false;
+  }
+  free(layer->buckets);
+  layer->buckets = buckets;
+  layer->size = size;
+  return true;
+}
+
+// Runs a tree of the given number of nodes on top of config, with the
+// buffers' layer for its assignments
+static bool runTree(evalBuffers *b, tokenStream *tokens, const hashMap *config,
+                    ASTNode *root, size_t nodes, value *result) {
+  if (!reserveLayer(&b->layer, nodes))
+    return false;
+
+  parser psr = {0};
+  psr.tknStream = tokens;
+  psr.arena = &b->arena;
+  psr.clones = &b->clones;
+  memPool_reset(&b->scratchPool);
+  psr.nodePool = b->scratchPool;
+  psr.map = b->layer;
+  psr.map.parent = config; // set every run, a reload moves the context
+
+  STATS_TIMER(start);
+  bool ok = runExpressionValue(&psr, root, result);
+  STATS_ELAPSED(PHASE_RUN, start);
+  STATS_ADD(scratchNodes, psr.nodePool.allocated);
+  STATS_MAX(peakBytes, memBudget_peak());
+
+  b->scratchPool = psr.nodePool; // may have grown
+  hashMap_clear(&psr.map); // assignments do not outlive their expression
+  b->layer = psr.map;
+  return ok;
+}
+
+// Tokenises, parses and runs the expression in the buffers, where nothing of
+// it outlives the evaluation
+static bool evaluateInPlace(evalBuffers *b, tokenStream *tokens,
+                            size_t *tokenCapacity, const evalContext *ctx,
+                            const char *expression, size_t len,
+                            value *result) {
+  if (!appendExpression(tokens, tokenCapacity, ctx->appendIndex, expression,
+                        len) ||
+      !chargeExpression(tokens, ctx->appendIndex, ctx->expressionStart))
+    return false;
+
+  if (!memPool_reserve(&b->programPool,
+                       tokens->count - ctx->expressionStart)) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return false;
+  }
+  ASTNode *root = parseTokens(tokens, ctx->expressionStart, &b->programPool);
+  return root && runTree(b, tokens, &ctx->map, root, b->programPool.capacity,
+                         result);
+}
+
+// Tokenises a private copy of the expression behind the config tokens
+static compiledProgram *loadProgram(evalContext *ctx, const substring text) {
+  compiledProgram *program = calloc(1, sizeof(compiledProgram));
+  char *copy = malloc(text.len + 1);
+  if (!program || !copy) {
+    logError("Fatal: Memory allocation failure", __func__);
+    free(program);
+    free(copy);
+    return NULL;
+  }
+
+  memcpy(copy, text.str, text.len);
+  copy[text.len] = '\0';
+  program->text = (substring){.str = copy, .len = text.len};
+  program->version = ctx->version;
+
+  bool loaded =
+      appendExpression(&ctx->tokens, &ctx->tokenCapacity, ctx->appendIndex,
+                       copy, text.len) &&
+      (!ctx->cache ||
+       normaliseTokens(&ctx->tokens, ctx->appendIndex,
+                       &program->normalisedKey));
+  if (!loaded) {
+    compiledProgram_free(program);
+    return NULL;
+  }
+  return program;
+}
+
+static bool parseProgram(evalContext *ctx, compiledProgram *program) {
+  if (!memPool_init(&program->nodePool,
+                    ctx->tokens.count - ctx->expressionStart)) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return false;
+  }
+  program->root =
+      parseTokens(&ctx->tokens, ctx->expressionStart, &program->nodePool);
+  return program->root != NULL;
+}
+
+compiledProgram *evalContext_compile(evalContext *ctx,
+                                     const char *expression) {
+  errno = 0;
+  substring text = {.str = (char *)expression, .len = strlen(expression)};
+  compiledProgram *program = loadProgram(ctx, text);
+  if (program && !parseProgram(ctx, program)) {
+    compiledProgram_free(program);
+    return NULL;
+  }
+  return program;
+}
+
+bool evalContext_evaluateValue(evalContext *ctx, const char *expression,
+                               value *result) {
+  errno = 0;
+  vectorArena_reset(&ctx->buffers.arena);
+  memBudget_begin();
+  *result = (value){0};
+  substring text = {.str = (char *)expression, .len = strlen(expression)};
+  if (!ctx->cache && !ctx->programs)
+    return evaluateInPlace(&ctx->buffers, &ctx->tokens, &ctx->tokenCapacity,
+                           ctx, expression, text.len, result);
+
+  compiledProgram *program = NULL;
+  if (ctx->programs)
+    program = programCache_get(ctx->programs, text, ctx->version);
+
+  bool cached = program != NULL;
+  if (!cached) {
+    program = loadProgram(ctx, text);
+    if (!program)
+      return false;
+  }
+
+  // A cached result makes parsing and running unnecessary
+  if (ctx->cache && program->normalisedKey.str &&
+      resultCache_get(ctx->cache, program->normalisedKey, ctx->version,
+                      &result->scalar)) {
+    if (!cached)
+      compiledProgram_free(program);
+    return true;
+  }
+
+  if (!cached) {
+    if (!chargeExpression(&ctx->tokens, ctx->appendIndex,
+                          ctx->expressionStart) ||
+        !parseProgram(ctx, program)) {
+      compiledProgram_free(program);
+      return false;
+    }
+    if (ctx->programs) {
+      programCache_put(ctx->programs, program);
+      cached = true;
+    }
+  }
+
+  // Vectors live in the arena, so only numbers are cached
+  bool ok = runTree(&ctx->buffers, &ctx->tokens, &ctx->map, program->root,
+                    program->nodePool.capacity, result);
+  if (ok && !result->data && ctx->cache && program->normalisedKey.str)
+    resultCache_put(ctx->cache, program->normalisedKey, ctx->version,
+                    result->scalar);
+
+  if (!cached)
+    compiledProgram_free(program);
+  return ok;
+}
+
+bool evalContext_evaluate(evalContext *ctx, const char *expression,
+                          real *result) {
+  value full;
+  if (!evalContext_evaluateValue(ctx, expression, &full))
+    return false;
+
+  if (full.data) {
+    errno = INVALID_VECTOR_USE;
+    substring text = {.str = (char *)expression, .len = strlen(expression)};
+    char buffer[256];
+    createErrorMessage(buffer, sizeof(buffer), text, 0);
+    logError(buffer, __func__);
+    return false;
+  }
+
+  *result = full.scalar;
+  return true;
+}
+
+/*--WORKERS--*/
+bool evalWorker_init(evalWorker *w, evalContext *ctx) {
+  *w = (evalWorker){.ctx = ctx};
+  // Config nodes refer to their tokens by index, so the copy keeps them
+  if (!tokenStream_append(&w->tokens, &w->tokenCapacity, &ctx->tokens,
+                          ctx->appendIndex)) {
+    evalWorker_free(w);
+    return false;
+  }
+  if (!evalBuffers_init(&w->buffers)) {
+    logError("Fatal: Memory allocation failure", __func__);
+    evalWorker_free(w);
+    return false;
+  }
+  return true;
+}
+
+bool evalWorker_evaluate(evalWorker *w, const char *expression, size_t len,
+                         value *result) {
+  errno = 0;
+  *result = (value){0};
+  vectorArena_reset(&w->buffers.arena);
+  memBudget_begin();
+  return evaluateInPlace(&w->buffers, &w->tokens, &w->tokenCapacity, w->ctx,
+                         expression, len, result);
+}
+
+// Safe on a worker whose init failed part way
+void evalWorker_free(evalWorker *w) {
+  evalBuffers_free(&w->buffers);
+  tokenStream_free(&w->tokens);
+}
+
+void evalContext_free(evalContext *ctx) {
+  while (ctx->loaded) {
+    loadedVector *vector = ctx->loaded;
+    ctx->loaded = vector->next;
+    free(vector->data);
+    free(vector->name);
+    free(vector);
+  }
+  evalBuffers_free(&ctx->buffers);
+  hashMap_free(&ctx->map);
+  memPool_free(&ctx->nodePool);
+  tokenStream_free(&ctx->tokens);
+  freeIndex(ctx);
+  free(ctx->config);
+}
@@ -1,5 +1,6 @@
 #include "ds.h"
 #include "parser.h"
+#include "stats.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -12,30 +13,111 @@ bool substringCmp(substring s1, substring s2) {
 
 /*--MEMORY POOl--*/
 bool memPool_init(memPool *pool, size_t capacity) {
+  if (capacity == 0)
+    capacity = 1;
+
   pool->nodes = malloc(sizeof(ASTNode) * (capacity));
+  pool->retired = NULL;
   if (!pool->nodes) {
     return false;
   }
 
   pool->capacity = capacity;
   pool->used = 0;
+#ifdef EVAL_STATS
+  pool->allocated = 0;
+#endif
+  return true;
+}
+
+static bool memPool_grow(memPool *pool) {
+  poolBlock *block = malloc(sizeof(poolBlock));
+  ASTNode *nodes = malloc(sizeof(ASTNode) * pool->capacity * 2);
+  if (!block || !nodes) {
+    free(block);
+    free(nodes);
+    return false;
+  }
+
+  *block = (poolBlock){.nodes = pool->nodes, .next = pool->retired};
+  pool->retired = block;
+  pool->nodes = nodes;
+  pool->capacity *= 2;
+  pool->used = 0;
   return true;
 }
 
 inline ASTNode *memPool_alloc(memPool *pool) {
-  return (pool->used >= pool->capacity) ? NULL : &pool->nodes[pool->used++];
+  if (pool->used >= pool->capacity && !memPool_grow(pool))
+    return NULL;
+#ifdef EVAL_STATS
+  pool->allocated++;
+#endif
+  return &pool->nodes[pool->used++];
 }
 
-void memPool_reset(memPool *pool) { pool->used = 0; }
+static void memPool_freeRetired(memPool *pool) {
+  while (pool->retired) {
+    poolBlock *block = pool->retired;
+    pool->retired = block->next;
+    free(block->nodes);
+    free(block);
+  }
+}
+
+void memPool_reset(memPool *pool) {
+  memPool_freeRetired(pool);
+  pool->used = 0;
+#ifdef EVAL_STATS
+  pool->allocated = 0;
+#endif
+}
+
+bool memPool_reserve(memPool *pool, size_t capacity) {
+  if (!pool->nodes)
+    return memPool_init(pool, capacity);
+
+  memPool_reset(pool);
+  if (capacity <= pool->capacity)
+    return true;
+  if (capacity < pool->capacity * 2)
+    capacity = pool->capacity * 2;
+  ASTNode *nodes = malloc(sizeof(ASTNode) * capacity);
+  if (!nodes)
+    return false;
+  free(pool->nodes);
+  pool->nodes = nodes;
+  pool->capacity = capacity;
+  return true;
+}
 
 void memPool_free(memPool *pool) {
+  memPool_freeRetired(pool);
   if (pool->nodes) {
     free(pool->nodes);
   }
 }
 
+bool memPool_adopt(memPool *pool, memPool *other) {
+  poolBlock *block = malloc(sizeof(poolBlock));
+  if (!block)
+    return false;
+
+  *block = (poolBlock){.nodes = other->nodes, .next = other->retired};
+  poolBlock *last = block;
+  while (last->next)
+    last = last->next;
+  last->next = pool->retired;
+  pool->retired = block;
+#ifdef EVAL_STATS
+  pool->allocated += other->allocated;
+#endif
+  *other = (memPool){0};
+  return true;
+}
+
 /*--HASH MAP--*/
-static inline size_t hash(substring key) {
+size_t substringHash(substring key) {
   size_t h = 5381;
   int c;
 
@@ -46,17 +128,20 @@ static inline size_t hash(substring key) {
   return h;
 }
 
-static inline entry *entryInit(const substring key, ASTNode *value,
-                               size_t treeSize, size_t declarationStartIndex) {
-  entry *e = malloc(sizeof(entry));
-  if (!e)
+static inline entry *entryInit(hashMap *map, const substring key,
+                               ASTNode *value, size_t treeSize,
+                               ASTNode *declarations) {
+  entry *e = map->spare;
+  if (e)
+    map->spare = e->next;
+  else if (!(e = malloc(sizeof(entry))))
     return NULL;
 
   *e = (entry){
       .key = key,
       .value = value,
       .treeSize = treeSize,
-      .declarationStartIndex = declarationStartIndex,
+      .declarations = declarations,
       .next = NULL,
   };
 
@@ -64,62 +149,106 @@ static inline entry *entryInit(const substring key, ASTNode *value,
 }
 
 hashMap *hashMap_init(hashMap *map, size_t size) {
+  if (size == 0)
+    size = 1;
+
   map->size = size;
   map->buckets = calloc(size, sizeof(entry *));
-  return map;
+  map->count = 0;
+  map->spare = NULL;
+  map->parent = NULL;
+  map->fallback = NULL;
+  map->fallbackArg = NULL;
+  return map->buckets ? map : NULL;
 }
 
 bool hashmap_setKey(hashMap *map, const substring key, ASTNode *value,
-                    size_t treeSize, size_t declarationStartIndex) {
-  size_t idx = hash(key) % map->size;
+                    size_t treeSize, ASTNode *declarations) {
+  size_t idx = substringHash(key) % map->size;
   entry *cur = map->buckets[idx];
+  size_t chain = 0;
+  STATS_ADD(hashProbes, 1);
 
   while (cur) {
+    chain++;
     if (substringCmp(cur->key, key)) {
       cur->value = value;
       cur->treeSize = treeSize;
-      cur->declarationStartIndex = declarationStartIndex;
+      cur->declarations = declarations;
+      STATS_ADD(hashChainSteps, chain);
+      STATS_MAX(hashMaxChain, chain);
       return true;
     }
     cur = cur->next;
   }
+  STATS_ADD(hashChainSteps, chain);
+  STATS_MAX(hashMaxChain, chain);
 
-  entry *entry = entryInit(key, value, treeSize, declarationStartIndex);
+  entry *entry = entryInit(map, key, value, treeSize, declarations);
   if (!entry) {
     return false;
   }
   entry->next = map->buckets[idx];
   map->buckets[idx] = entry;
+  map->count++;
   return true;
 }
 
 ASTNode *hashMap_getValue(const hashMap *map, const substring key,
-                          size_t *treeSize, size_t *declarationStartIndex) {
-  size_t idx = hash(key) % map->size;
-  entry *cur = map->buckets[idx];
+                          size_t *treeSize, ASTNode **declarations) {
+  size_t h = substringHash(key);
 
-  while (cur) {
-    if (substringCmp(cur->key, key)) {
-      *treeSize = cur->treeSize;
-      *declarationStartIndex = cur->declarationStartIndex;
-      return cur->value;
+  for (; map; map = map->parent) {
+    entry *cur = map->buckets[h % map->size];
+    size_t chain = 0;
+    STATS_ADD(hashProbes, 1);
+
+    while (cur) {
+      chain++;
+      if (substringCmp(cur->key, key)) {
+        *treeSize = cur->treeSize;
+        *declarations = cur->declarations;
+        STATS_ADD(hashChainSteps, chain);
+        STATS_MAX(hashMaxChain, chain);
+        return cur->value;
+      }
+      cur = cur->next;
+    }
+    STATS_ADD(hashChainSteps, chain);
+    STATS_MAX(hashMaxChain, chain);
+
+    if (map->fallback) {
+      ASTNode *value =
+          map->fallback(map->fallbackArg, key, treeSize, declarations);
+      if (value)
+        return value;
     }
-    cur = cur->next;
   }
 
   return NULL;
 }
 
-void hashMap_free(hashMap *map) {
-  for (size_t i = 0; i < map->size; i++) {
+void hashMap_clear(hashMap *map) {
+  for (size_t i = 0; map->count && i < map->size; i++) {
     entry *cur = map->buckets[i];
 
     while (cur) {
       entry *tmp = cur;
       cur = cur->next;
-      free(tmp);
+      tmp->next = map->spare;
+      map->spare = tmp;
+      map->count--;
     }
+    map->buckets[i] = NULL;
   }
+}
 
+void hashMap_free(hashMap *map) {
+  hashMap_clear(map);
+  while (map->spare) {
+    entry *tmp = map->spare;
+    map->spare = tmp->next;
+    free(tmp);
+  }
   free(map->buckets);
 }
@@ -1,33 +1,131 @@
+#include "eval.h"
 #include "lexer.h"
 #include "parser.h"
+#include "real.h"
 #include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
 
-double eval(ASTNode *root) {
-  switch (root->type) {
-  case TOKEN_NUMBER:
-    return root->number;
+real evalUnary(tokenType type, real operand) {
+  switch (type) {
   case TOKEN_UNARY_MINUS:
-    return -eval(root->unary.operand);
-  case (TOKEN_UNARY_PLUS):
-    return eval(root->unary.operand);
+    return -operand;
+  case TOKEN_UNARY_PLUS:
+    return operand;
+  case TOKEN_SIN:
+    return realSin(operand);
+  case TOKEN_COS:
+    return realCos(operand);
+  case TOKEN_LOG:
+    return realLog10(operand);
+  default:
+    return nan("Invalid Token");
+  }
+}
+
+real evalBinary(tokenType type, real left, real right) {
+  switch (type) {
+  case TOKEN_PLUS:
+    return left + right;
+  case TOKEN_MINUS:
+    return left - right;
+  case TOKEN_MUL:
+    return left * right;
+  case TOKEN_DIV:
+    return left / right;
+  case TOKEN_EXP:
+    return realPow(left, right);
+  default:
+    return nan("Invalid Token");
+  }
+}
+
+/*--CHAINS--*/
+// Operators pushed by astChain_push(), top first. Nested walks push above the
+// ones they are inside of, and the memory is kept for the thread's next walk.
+static _Thread_local struct {
+  const ASTNode **nodes;
+  size_t count;
+  size_t capacity;
+} chainStack;
+
+bool isChainOperator(tokenType type) {
+  switch (type) {
   case TOKEN_PLUS:
-    return eval(root->binary.left) + eval(root->binary.right);
   case TOKEN_MINUS:
-    return eval(root->binary.left) - eval(root->binary.right);
   case TOKEN_MUL:
-    return eval(root->binary.left) * eval(root->binary.right);
   case TOKEN_DIV:
-    return eval(root->binary.left) / eval(root->binary.right);
   case TOKEN_EXP:
-    return pow(eval(root->binary.left), eval(root->binary.right));
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool astChain_push(astChain *chain, const ASTNode *top, size_t minSize,
+                   size_t stopSize) {
+  chain->base = chainStack.count;
+  chain->len = 0;
+  do {
+    if (chainStack.count == chainStack.capacity) {
+      size_t capacity = chainStack.capacity ? 2 * chainStack.capacity : 64;
+      const ASTNode **nodes =
+          realloc(chainStack.nodes, sizeof(ASTNode *) * capacity);
+      if (!nodes) {
+        chainStack.count = chain->base;
+        return false;
+      }
+      chainStack.nodes = nodes;
+      chainStack.capacity = capacity;
+    }
+    chainStack.nodes[chainStack.count++] = top;
+    chain->len++;
+    top = top->binary.left;
+  } while (isChainOperator(top->type) && top->pureSize >= minSize &&
+           top->pureSize < stopSize);
+  return true;
+}
+
+const ASTNode *astChain_node(const astChain *chain, size_t i) {
+  return chainStack.nodes[chain->base + chain->len - 1 - i];
+}
+
+void astChain_pop(const astChain *chain) { chainStack.count = chain->base; }
+
+static real evalChain(const ASTNode *top) {
+  astChain chain;
+  if (!astChain_push(&chain, top, 0, SIZE_MAX))
+    return nan("Allocation failed");
+
+  real result = eval(astChain_node(&chain, 0)->binary.left);
+  for (size_t i = 0; i < chain.len; i++) {
+    const ASTNode *node = astChain_node(&chain, i);
+    result = evalBinary(node->type, result, eval(node->binary.right));
+  }
+  astChain_pop(&chain);
+  return result;
+}
+
+/*--EVALUATION--*/
+real eval(ASTNode *root) {
+  switch (root->type) {
+  case TOKEN_NUMBER:
+    return root->number;
+  case TOKEN_UNARY_MINUS:
+  case TOKEN_UNARY_PLUS:
   case TOKEN_SIN:
-    return sin(eval(root->unary.operand));
   case TOKEN_COS:
-    return cos(eval(root->unary.operand));
   case TOKEN_LOG:
-    return log10(eval(root->unary.operand));
-  case TOKEN_IDEN:
-    return eval(root->unary.operand);
+    return evalUnary(root->type, eval(root->unary.operand));
+  case TOKEN_PLUS:
+  case TOKEN_MINUS:
+  case TOKEN_MUL:
+  case TOKEN_DIV:
+  case TOKEN_EXP:
+    if (isChainOperator(root->binary.left->type))
+      return evalChain(root);
+    return evalBinary(root->type, eval(root->binary.left),
+                      eval(root->binary.right));
   default:
     return nan("Invalid Token");
   }
@@ -0,0 +1,276 @@
+#include "format.h"
+#include "format_tables.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Ryu (Ulf Adams, PLDI 2018): the interval of decimals that round to the
+// double is computed with exact 128-bit multipliers of powers of five, and
+// digits are dropped while both ends of the interval still differ, which
+// leaves the shortest decimal inside it, the closest one on ties.
+#define MANTISSA_BITS 52
+#define EXPONENT_BITS 11
+#define EXPONENT_BIAS 1023
+
+/*--ARITHMETIC--*/
+// Bit length of 5^e, for 0 <= e <= 3528
+static int32_t pow5Bits(int32_t e) {
+  return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+// floor(log10(2^e)) and floor(log10(5^e)), for 0 <= e <= 1650
+static int32_t log10Pow2(int32_t e) {
+  return (int32_t)(((uint32_t)e * 78913) >> 18);
+}
+
+static int32_t log10Pow5(int32_t e) {
+  return (int32_t)(((uint32_t)e * 732923) >> 20);
+}
+
+static bool multipleOfPowerOf5(uint64_t value, int32_t p) {
+  int32_t count = 0;
+  for (; value % 5 == 0; value /= 5)
+    count++;
+  return count >= p;
+}
+
+static bool multipleOfPowerOf2(uint64_t value, int32_t p) {
+  return (value & ((1ull << p) - 1)) == 0;
+}
+
+#ifndef __SIZEOF_INT128__
+static uint64_t multiply128(uint64_t a, uint64_t b, uint64_t *high) {
+  uint64_t aLow = (uint32_t)a, aHigh = a >> 32;
+  uint64_t bLow = (uint32_t)b, bHigh = b >> 32;
+  uint64_t low = aLow * bLow;
+  uint64_t middle1 = aHigh * bLow + (low >> 32);
+  uint64_t middle2 = aLow * bHigh + (uint32_t)middle1;
+  *high = aHigh * bHigh + (middle1 >> 32) + (middle2 >> 32);
+  return (middle2 << 32) | (uint32_t)low;
+}
+#endif
+
+// (m * multiplier) >> shift for one of the 125-bit table entries, where
+// shift is at least 64
+static uint64_t mulShift(uint64_t m, const uint64_t *multiplier,
+                         int32_t shift) {
+#ifdef __SIZEOF_INT128__
+  __extension__ typedef unsigned __int128 uint128;
+  uint128 low = (uint128)m * multiplier[0];
+  uint128 high = (uint128)m * multiplier[1];
+  return (uint64_t)(((low >> 64) + high) >> (shift - 64));
+#else
+  uint64_t lowHigh, highHigh;
+  multiply128(m, multiplier[0], &lowHigh);
+  uint64_t sum = multiply128(m, multiplier[1], &highHigh) + lowHigh;
+  highHigh += sum < lowHigh;
+  shift -= 64;
+  if (shift >= 64)
+    return highHigh >> (shift - 64);
+  return shift ? (highHigh << (64 - shift)) | (sum >> shift) : sum;
+#endif
+}
+
+/*--SHORTEST DECIMAL--*/
+// mantissa * 10^exponent
+typedef struct decimal {
+  uint64_t mantissa;
+  int32_t exponent;
+} decimal;
+
+// Integers below 2^53 need all their digits, so they are printed exactly
+static bool smallInteger(uint64_t m2, int32_t e2, decimal *out) {
+  if (e2 > 0 || e2 < -MANTISSA_BITS)
+    return false;
+  uint64_t fraction = m2 & ((1ull << -e2) - 1);
+  if (fraction)
+    return false;
+
+  *out = (decimal){.mantissa = m2 >> -e2};
+  while (out->mantissa % 10 == 0) {
+    out->mantissa /= 10;
+    out->exponent++;
+  }
+  return true;
+}
+
+static decimal shortestDecimal(uint64_t ieeeMantissa, uint32_t ieeeExponent) {
+  int32_t e2;
+  uint64_t m2;
+  if (ieeeExponent == 0) { // subnormal
+    e2 = 1 - EXPONENT_BIAS - MANTISSA_BITS - 2;
+    m2 = ieeeMantissa;
+  } else {
+    e2 = (int32_t)ieeeExponent - EXPONENT_BIAS - MANTISSA_BITS - 2;
+    m2 = (1ull << MANTISSA_BITS) | ieeeMantissa;
+  }
+
+  decimal result;
+  if (ieeeExponent && smallInteger(m2, e2 + 2, &result))
+    return result;
+
+  // The double is mv / 4 * 2^e2; mp and mm, either side of it, are halfway
+  // to its neighbours. The lower neighbour is closer at a power of two.
+  bool acceptBounds = (m2 & 1) == 0; // round to even accepts the halfways
+  uint64_t mv = 4 * m2;
+  uint32_t mmShift = ieeeMantissa != 0 || ieeeExponent <= 1;
+
+  // vr, vp and vm are mv, mp and mm times 2^e2 / 10^e10
+  uint64_t vr, vp, vm;
+  int32_t e10;
+  bool vmIsTrailingZeros = false, vrIsTrailingZeros = false;
+  if (e2 >= 0) {
+    int32_t q = log10Pow2(e2) - (e2 > 3);
+    e10 = q;
+    int32_t shift = -e2 + q + FORMAT_POW5_INV_BITS + pow5Bits(q) - 1;
+    vr = mulShift(mv, FORMAT_POW5_INV[q], shift);
+    vp = mulShift(mv + 2, FORMAT_POW5_INV[q], shift);
+    vm = mulShift(mv - 1 - mmShift, FORMAT_POW5_INV[q], shift);
+
+    // Only one of mp, mv and mm can be a multiple of 5
+    if (q <= 21) {
+      if (mv % 5 == 0)
+        vrIsTrailingZeros = multipleOfPowerOf5(mv, q);
+      else if (acceptBounds)
+        vmIsTrailingZeros = multipleOfPowerOf5(mv - 1 - mmShift, q);
+      else
+        vp -= multipleOfPowerOf5(mv + 2, q);
+    }
+  } else {
+    int32_t q = log10Pow5(-e2) - (-e2 > 1);
+    e10 = q + e2;
+    int32_t i = -e2 - q;
+    int32_t shift = q - (pow5Bits(i) - FORMAT_POW5_BITS);
+    vr = mulShift(mv, FORMAT_POW5[i], shift);
+    vp = mulShift(mv + 2, FORMAT_POW5[i], shift);
+    vm = mulShift(mv - 1 - mmShift, FORMAT_POW5[i], shift);
+
+    // The products are exact when mv, mp or mm have q trailing zero bits
+    if (q <= 1) {
+      vrIsTrailingZeros = true;
+      if (acceptBounds)
+        vmIsTrailingZeros = mmShift == 1;
+      else
+        vp--;
+    } else if (q < 63) {
+      vrIsTrailingZeros = multipleOfPowerOf2(mv, q);
+    }
+  }
+
+  // Drop digits while the interval still holds a shorter decimal
+  int32_t removed = 0;
+  uint64_t output;
+  if (vmIsTrailingZeros || vrIsTrailingZeros) {
+    // Rare: an end of the interval or the value itself is exact, which
+    // matters for the bounds and for rounding ties to even
+    uint32_t lastRemovedDigit = 0;
+    while (vp / 10 > vm / 10) {
+      vmIsTrailingZeros &= vm % 10 == 0;
+      vrIsTrailingZeros &= lastRemovedDigit == 0;
+      lastRemovedDigit = (uint32_t)(vr % 10);
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    if (vmIsTrailingZeros) {
+      while (vm % 10 == 0) {
+        vrIsTrailingZeros &= lastRemovedDigit == 0;
+        lastRemovedDigit = (uint32_t)(vr % 10);
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        removed++;
+      }
+    }
+    if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0)
+      lastRemovedDigit = 4; // exactly halfway, round to even
+    output = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) ||
+                   lastRemovedDigit >= 5);
+  } else {
+    bool roundUp = false;
+    if (vp / 100 > vm / 100) { // two digits at once, the usual case
+      roundUp = vr % 100 >= 50;
+      vr /= 100;
+      vp /= 100;
+      vm /= 100;
+      removed += 2;
+    }
+    while (vp / 10 > vm / 10) {
+      roundUp = vr % 10 >= 5;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    output = vr + (vr == vm || roundUp);
+  }
+
+  return (decimal){.mantissa = output, .exponent = e10 + removed};
+}
+
+/*--LAYOUT--*/
+static size_t copyText(char *out, const char *text) {
+  size_t len = strlen(text);
+  memcpy(out, text, len + 1);
+  return len;
+}
+
+size_t format_shortest(double value, char *out) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  bool negative = bits >> 63;
+  uint64_t ieeeMantissa = bits & ((1ull << MANTISSA_BITS) - 1);
+  uint32_t ieeeExponent =
+      (uint32_t)(bits >> MANTISSA_BITS) & ((1u << EXPONENT_BITS) - 1);
+
+  char *start = out;
+  if (negative)
+    *out++ = '-';
+  if (ieeeExponent == (1u << EXPONENT_BITS) - 1)
+    return (size_t)(out - start) + copyText(out, ieeeMantissa ? "nan" : "inf");
+  if (!ieeeExponent && !ieeeMantissa)
+    return (size_t)(out - start) + copyText(out, "0");
+
+  decimal d = shortestDecimal(ieeeMantissa, ieeeExponent);
+  char digits[20];
+  int32_t count = 0;
+  for (uint64_t m = d.mantissa; m; m /= 10)
+    digits[sizeof(digits) - 1 - count++] = (char)('0' + m % 10);
+  const char *first = digits + sizeof(digits) - count;
+  int32_t exponent = d.exponent + count - 1; // of the first digit
+
+  if (exponent < -4 || exponent >= 17) {
+    *out++ = first[0];
+    if (count > 1) {
+      *out++ = '.';
+      memcpy(out, first + 1, (size_t)count - 1);
+      out += count - 1;
+    }
+    *out++ = 'e';
+    *out++ = exponent < 0 ? '-' : '+';
+    int32_t magnitude = exponent < 0 ? -exponent : exponent;
+    if (magnitude >= 100)
+      *out++ = (char)('0' + magnitude / 100);
+    *out++ = (char)('0' + magnitude / 10 % 10);
+    *out++ = (char)('0' + magnitude % 10);
+  } else if (exponent < 0) {
+    memcpy(out, "0.0000", (size_t)(1 - exponent));
+    out += 1 - exponent;
+    memcpy(out, first, (size_t)count);
+    out += count;
+  } else if (count <= exponent + 1) {
+    memcpy(out, first, (size_t)count);
+    memset(out + count, '0', (size_t)(exponent + 1 - count));
+    out += exponent + 1;
+  } else {
+    memcpy(out, first, (size_t)exponent + 1);
+    out += exponent + 1;
+    *out++ = '.';
+    memcpy(out, first + exponent + 1, (size_t)(count - exponent - 1));
+    out += count - exponent - 1;
+  }
+
+  *out = '\0';
+  return (size_t)(out - start);
+}
@@ -1,4 +1,5 @@
 #include "lexer.h"
+#include "stats.h"
 #include "util.h"
 #include <errno.h>
 #include <stdbool.h>
@@ -18,23 +19,23 @@ static inline bool is_alpha(char c) {
 static inline token tokenInit(lexer *lxr, tokenType type,
                               const char *tokenStart) {
   return (token){
-      .type = type,
-      .lexeme = (substring){.str = (char *)tokenStart,
-                            .len = (size_t)(lxr->current - tokenStart)},
-      .pos = (size_t)(tokenStart - lxr->start),
+      .pos = (uint32_t)(tokenStart - lxr->start),
+      .len = (uint32_t)(lxr->current - tokenStart),
+      .type = (uint8_t)type,
   };
 }
 
-static inline lexer lexerInit(const char *input) {
+static inline lexer lexerInit(const char *input, size_t from, size_t to) {
   return (lexer){
       .start = input,
-      .current = input,
+      .current = input + from,
+      .end = input + to,
       .previousTokenType = TOKEN_OPENPAREN,
   };
 }
 
 static inline void skipWhiteSpace(lexer *lxr) {
-  while (*lxr->current != '\0' && is_whitespace(*lxr->current)) {
+  while (lxr->current < lxr->end && is_whitespace(*lxr->current)) {
     lxr->current++;
   }
 }
@@ -49,8 +50,9 @@ static inline bool tokenMatches(const char *tokenStart, const char *current,
 static bool findEndOfLexeme(lexer *lxr, tokenType type) {
   switch (type) {
   case TOKEN_IDEN: {
-    static const char *delimiters = " \r\n\t+-*/^()0123456789";
-    while (*lxr->current != '\0' && !strchr(delimiters, *lxr->current)) {
+    static const char *delimiters = " \r\n\t+-*/^()[],0123456789";
+    while (lxr->current < lxr->end && *lxr->current != '\0' &&
+           !strchr(delimiters, *lxr->current)) {
       lxr->current++;
     }
     return true;
@@ -96,6 +98,25 @@ static bool findEndOfLexeme(lexer *lxr, tokenType type) {
   }
 }
 
+// Keywords are lexed like identifiers and told apart afterwards
+static tokenType identifierType(const char *start, const char *end) {
+  static const struct {
+    const char *name;
+    tokenType type;
+  } keywords[] = {
+      {"log", TOKEN_LOG},         {"sin", TOKEN_SIN},
+      {"cos", TOKEN_COS},         {"sum", TOKEN_SUM},
+      {"prod", TOKEN_PROD},       {"min", TOKEN_MINIMUM},
+      {"max", TOKEN_MAXIMUM},     {"dot", TOKEN_DOT},
+      {"range", TOKEN_RANGE},     {"integrate", TOKEN_INTEGRATE},
+      {"solve", TOKEN_SOLVE},
+  };
+  for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++)
+    if (tokenMatches(start, end, keywords[i].name))
+      return keywords[i].type;
+  return TOKEN_IDEN;
+}
+
 // Error code is reported through tkn.errCode
 static token nextToken(lexer *lxr) {
   skipWhiteSpace(lxr);
@@ -104,7 +125,7 @@ static token nextToken(lexer *lxr) {
   const char current = *lxr->current;
   const char *tokenStart = lxr->current;
 
-  if (current == '\0') {
+  if (lxr->current >= lxr->end || current == '\0') {
     tkn = tokenInit(lxr, TOKEN_EOF, tokenStart);
     return tkn;
   }
@@ -145,8 +166,17 @@ static token nextToken(lexer *lxr) {
   case '=':
     tkn = tokenInit(lxr, TOKEN_ASSIGNMENT, tokenStart);
     break;
+  case ',':
+    tkn = tokenInit(lxr, TOKEN_COMMA, tokenStart);
+    break;
+  case '[':
+    tkn = tokenInit(lxr, TOKEN_OPENBRACKET, tokenStart);
+    break;
+  case ']':
+    tkn = tokenInit(lxr, TOKEN_CLOSEBRACKET, tokenStart);
+    break;
 
-  // handles identifiers/constants, sin, cos, and tan
+  // handles identifiers/constants, sin, cos, log and the named functions
   default:
     lxr->current--; // back to start of Lexeme
     if (!is_alpha(current)) {
@@ -157,14 +187,8 @@ static token nextToken(lexer *lxr) {
     }
 
     findEndOfLexeme(lxr, TOKEN_IDEN);
-    if (tokenMatches(tokenStart, lxr->current, "log"))
-      tkn = tokenInit(lxr, TOKEN_LOG, tokenStart);
-    else if (tokenMatches(tokenStart, lxr->current, "sin"))
-      tkn = tokenInit(lxr, TOKEN_SIN, tokenStart);
-    else if (tokenMatches(tokenStart, lxr->current, "cos"))
-      tkn = tokenInit(lxr, TOKEN_COS, tokenStart);
-    else
-      tkn = tokenInit(lxr, TOKEN_IDEN, tokenStart);
+    tkn = tokenInit(lxr, identifierType(tokenStart, lxr->current),
+                    tokenStart);
     break;
   }
 
@@ -172,21 +196,74 @@ static token nextToken(lexer *lxr) {
 }
 
 tokenStream *tokenise(const char *input) {
-  lexer lxr = lexerInit(input);
+  return tokeniseRange(input, 0, strlen(input));
+}
+
+static bool reserveTokens(tokenStream *tokens, size_t *capacity,
+                          size_t count) {
+  if (count <= *capacity)
+    return true;
+
+  size_t grown = *capacity * 2 > count ? *capacity * 2 : count;
+  token *stream = realloc(tokens->stream, sizeof(token) * grown);
+  if (stream == NULL)
+    return false;
+
+  tokens->stream = stream;
+  *capacity = grown;
+  return true;
+}
 
-  size_t tokenCount = 0;
-  size_t maxTokens = strlen(input) + 1;
+// Makes text the source of the tokens appended from here on. Sources whose
+// tokens have all been dropped from the stream are forgotten first.
+static bool addSource(tokenStream *tokens, const char *text) {
+  while (tokens->sourceCount &&
+         tokens->sources[tokens->sourceCount - 1].first >= tokens->count)
+    tokens->sourceCount--;
+  if (tokens->sourceCount &&
+      tokens->sources[tokens->sourceCount - 1].text == text)
+    return true;
+
+  if (tokens->sourceCount == tokens->sourceCapacity) {
+    size_t grown = tokens->sourceCapacity ? tokens->sourceCapacity * 2 : 2;
+    tokenSource *sources =
+        realloc(tokens->sources, sizeof(tokenSource) * grown);
+    if (sources == NULL)
+      return false;
+    tokens->sources = sources;
+    tokens->sourceCapacity = grown;
+  }
+  tokens->sources[tokens->sourceCount++] =
+      (tokenSource){.text = text, .first = tokens->count};
+  return true;
+}
 
-  token *tokenList = calloc(maxTokens, sizeof(token));
-  if (tokenList == NULL) {
+bool tokeniseAppend(tokenStream *tokens, size_t *capacity, const char *input,
+                    size_t from, size_t to) {
+  if (to > UINT32_MAX) {
+    errno = EOVERFLOW;
+    logError("Input too long to tokenise", __func__);
+    return false;
+  }
+  // Grown as the tokens come instead of one per byte up front, so a stream
+  // is not larger than the text it was read from
+  if (!reserveTokens(tokens, capacity, tokens->count + 1 + (to - from) / 4) ||
+      !addSource(tokens, input)) {
     logError("Fatal: Memory allocation failure.\n", __func__);
-    return NULL;
+    return false;
   }
 
+  lexer lxr = lexerInit(input, from, to);
+  size_t tokenCount = tokens->count;
   token tkn;
   do {
+    if (tokenCount == *capacity &&
+        !reserveTokens(tokens, capacity, tokenCount + 1)) {
+      logError("Fatal: Memory allocation failure.\n", __func__);
+      return false;
+    }
     tkn = nextToken(&lxr);
-    tokenList[tokenCount++] = tkn;
+    tokens->stream[tokenCount++] = tkn;
     lxr.previousTokenType = tkn.type;
   } while (tkn.type != TOKEN_EOF && tkn.type != TOKEN_ERROR);
 
@@ -199,31 +276,100 @@ tokenStream *tokenise(const char *input) {
                __func__);
     }
 
-    createErrorMessage(error_message, sizeof(error_message), &tkn);
-    free(tokenList);
+    substring lexeme = {.str = (char *)input + tkn.pos, .len = tkn.len};
+    createErrorMessage(error_message, sizeof(error_message), lexeme, tkn.pos);
     logError(error_message, __func__);
+    return false;
+  }
+
+  STATS_ADD(tokens, tokenCount - tokens->count);
+  tokens->count = tokenCount;
+  return true;
+}
+
+bool tokenStream_append(tokenStream *tokens, size_t *capacity,
+                        const tokenStream *from, size_t count) {
+  if (!reserveTokens(tokens, capacity, tokens->count + count)) {
+    logError("Fatal: Memory allocation failure.\n", __func__);
+    return false;
+  }
+
+  size_t start = tokens->count;
+  for (size_t i = 0; i < from->sourceCount && from->sources[i].first < count;
+       i++) {
+    tokens->count = start + from->sources[i].first;
+    if (!addSource(tokens, from->sources[i].text)) {
+      tokens->count = start;
+      logError("Fatal: Memory allocation failure.\n", __func__);
+      return false;
+    }
+  }
+
+  memcpy(&tokens->stream[start], from->stream, sizeof(token) * count);
+  tokens->count = start + count;
+  return true;
+}
+
+substring tokenStream_lexeme(const tokenStream *tokens, size_t index) {
+  // Searched from the back, where the expression being parsed is
+  size_t source = tokens->sourceCount - 1;
+  while (source && tokens->sources[source].first > index)
+    source--;
+
+  const token *tkn = &tokens->stream[index];
+  return (substring){.str = (char *)tokens->sources[source].text + tkn->pos,
+                     .len = tkn->len};
+}
+
+void tokenStream_free(tokenStream *tokens) {
+  free(tokens->stream);
+  free(tokens->sources);
+}
+
+tokenStream *tokeniseRange(const char *input, size_t from, size_t to) {
+  tokenStream *tknStream = malloc(sizeof(tokenStream));
+  if (tknStream == NULL) {
+    logError("Fatal: Memory allocation failure.\n", __func__);
+    return NULL;
+  }
+  *tknStream = (tokenStream){0};
+  size_t capacity = 0;
+  if (!tokeniseAppend(tknStream, &capacity, input, from, to)) {
+    tokenStream_free(tknStream);
+    free(tknStream);
     return NULL;
   }
 
-  token *resizedList = realloc(tokenList, sizeof(token) * tokenCount);
+  token *resizedList =
+      realloc(tknStream->stream, sizeof(token) * tknStream->count);
   if (resizedList == NULL) {
     // If realloc fails, keep the original (oversized) array
     logError("Warning: Memory reallocation failure, keeping original array.\n",
              __func__);
   } else {
-    tokenList = resizedList;
+    tknStream->stream = resizedList;
   }
+  return tknStream;
+}
 
-  if (tokenList[tokenCount - 1].type != TOKEN_EOF) {
-    logError("Application failure: tokenList does not end with EOF\n",
-             __func__);
-    free(tokenList);
-    return NULL;
+bool isIdentifierName(const char *text) {
+  tokenStream *tokens = tokenise(text);
+  bool valid = tokens && tokens->count == 2 &&
+               tokens->stream[0].type == TOKEN_IDEN &&
+               tokens->stream[0].len == strlen(text);
+  if (tokens) {
+    tokenStream_free(tokens);
+    free(tokens);
   }
+  return valid;
+}
 
-  tokenStream *tknStream = malloc(sizeof(tokenStream));
-  tknStream->stream = tokenList;
-  tknStream->count = tokenCount;
-
-  return tknStream;
+size_t identifierLength(const char *text, size_t len) {
+  if (!len || !is_alpha(*text))
+    return 0;
+  lexer lxr = lexerInit(text, 0, len);
+  findEndOfLexeme(&lxr, TOKEN_IDEN);
+  return identifierType(text, lxr.current) == TOKEN_IDEN
+             ? (size_t)(lxr.current - text)
+             : 0;
 }
@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+#include "logger.h"
+#include "util.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_SLOTS 4096
+#define LOG_MESSAGE_SIZE 512
+#define LOG_BATCH_THRESHOLD 64  // wake the writer early once this many wait
+#define LOG_BATCH_DELAY_NS 100000000L // otherwise let a burst gather for 100ms
+
+typedef struct logRecord {
+  struct timespec time;
+  const char *funcName;
+  int code;
+  char message[LOG_MESSAGE_SIZE];
+} logRecord;
+
+// head and tail only ever increase; slots [tail, head) belong to the writer
+// until tail passes them, so records are formatted without holding the lock.
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t pending;
+  pthread_cond_t drained;
+  pthread_t thread;
+  bool running;
+  bool stopping;
+  size_t flushWaiters;
+  size_t head;
+  size_t tail;
+  unsigned long long dropped;
+  const char *path;
+  logRecord slots[LOG_SLOTS];
+} logger = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .pending = PTHREAD_COND_INITIALIZER,
+    .drained = PTHREAD_COND_INITIALIZER,
+    .path = LOG_DEFAULT_PATH,
+};
+
+static pthread_once_t startOnce = PTHREAD_ONCE_INIT;
+
+/*--FORMATTING--*/
+static void writeEscaped(FILE *file, const char *str) {
+  size_t len = strlen(str);
+  while (len && (str[len - 1] == '\n' || str[len - 1] == '\r'))
+    len--;
+
+  for (size_t i = 0; i < len; i++) {
+    switch (str[i]) {
+    case '\n':
+      fputs("\\n", file);
+      break;
+    case '\t':
+      fputs("\\t", file);
+      break;
+    case '"':
+    case '\\':
+      fputc('\\', file);
+      fputc(str[i], file);
+      break;
+    default:
+      fputc(str[i], file);
+    }
+  }
+}
+
+static void writeRecord(FILE *file, const logRecord *record) {
+  struct tm tm;
+  char timeStr[32];
+  gmtime_r(&record->time.tv_sec, &tm);
+  strftime(timeStr, sizeof(timeStr), "%Y-%m-%dT%H:%M:%S", &tm);
+
+  fprintf(file, "%s.%03ldZ func=%s code=%d", timeStr,
+          record->time.tv_nsec / 1000000, record->funcName, record->code);
+  if (record->code && record->code < MISSING_ERROR_CODE)
+    fprintf(file, " error=\"%s\"", strerror(record->code));
+  fputs(" msg=\"", file);
+  writeEscaped(file, record->message);
+  fputs("\"\n", file);
+}
+
+static FILE *openLog(void) {
+  FILE *file = fopen(logger.path, "a");
+  if (!file)
+    fprintf(stderr, "Failed to open log file\n");
+  return file;
+}
+
+/*--WRITER THREAD--*/
+static void writeBatch(FILE *file, size_t from, size_t to,
+                       unsigned long long dropped) {
+  if (!file)
+    return;
+
+  for (size_t i = from; i < to; i++)
+    writeRecord(file, &logger.slots[i % LOG_SLOTS]);
+
+  if (dropped) {
+    logRecord note = {.funcName = __func__};
+    clock_gettime(CLOCK_REALTIME, &note.time);
+    snprintf(note.message, sizeof(note.message),
+             "Log buffer full, dropped %llu records", dropped);
+    writeRecord(file, &note);
+  }
+  fflush(file);
+}
+
+static void *writerMain(void *arg) {
+  (void)arg;
+  FILE *file = openLog();
+
+  pthread_mutex_lock(&logger.lock);
+  while (true) {
+    if (logger.head == logger.tail && !logger.dropped) {
+      if (logger.stopping)
+        break;
+      pthread_cond_wait(&logger.pending, &logger.lock);
+      continue;
+    }
+
+    if (logger.head - logger.tail < LOG_BATCH_THRESHOLD && !logger.stopping &&
+        !logger.flushWaiters) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += LOG_BATCH_DELAY_NS;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&logger.pending, &logger.lock, &deadline);
+    }
+
+    size_t from = logger.tail, to = logger.head;
+    unsigned long long dropped = logger.dropped;
+    logger.dropped = 0;
+    pthread_mutex_unlock(&logger.lock);
+
+    writeBatch(file, from, to, dropped);
+
+    pthread_mutex_lock(&logger.lock);
+    logger.tail = to;
+    pthread_cond_broadcast(&logger.drained);
+  }
+  pthread_mutex_unlock(&logger.lock);
+
+  if (file)
+    fclose(file);
+  return NULL;
+}
+
+static void startLogger(void) {
+  if (pthread_create(&logger.thread, NULL, writerMain, NULL) != 0)
+    return; // records are then written synchronously
+
+  logger.running = true;
+  atexit(logger_shutdown);
+}
+
+/*--API--*/
+void logger_setPath(const char *path) {
+  pthread_mutex_lock(&logger.lock);
+  logger.path = path;
+  pthread_mutex_unlock(&logger.lock);
+}
+
+void logger_record(const char *funcName, int code, const char *message) {
+  int savedErrno = errno;
+  pthread_once(&startOnce, startLogger);
+
+  logRecord record = {.funcName = funcName, .code = code};
+  clock_gettime(CLOCK_REALTIME, &record.time);
+
+  pthread_mutex_lock(&logger.lock);
+  if (!logger.running) {
+    // No writer thread: fall back to appending directly
+    FILE *file = openLog();
+    if (file) {
+      snprintf(record.message, sizeof(record.message), "%s", message);
+      writeRecord(file, &record);
+      fclose(file);
+    }
+  } else if (logger.head - logger.tail == LOG_SLOTS) {
+    logger.dropped++;
+  } else {
+    logRecord *slot = &logger.slots[logger.head % LOG_SLOTS];
+    *slot = record;
+    snprintf(slot->message, sizeof(slot->message), "%s", message);
+
+    size_t waiting = ++logger.head - logger.tail;
+    if (waiting == 1 || waiting == LOG_BATCH_THRESHOLD)
+      pthread_cond_signal(&logger.pending);
+  }
+  pthread_mutex_unlock(&logger.lock);
+
+  errno = savedErrno;
+}
+
+void logger_flush(void) {
+  pthread_mutex_lock(&logger.lock);
+  if (logger.running) {
+    size_t target = logger.head;
+    logger.flushWaiters++;
+    pthread_cond_signal(&logger.pending);
+    while (logger.tail < target)
+      pthread_cond_wait(&logger.drained, &logger.lock);
+    logger.flushWaiters--;
+  }
+  pthread_mutex_unlock(&logger.lock);
+}
+
+void logger_shutdown(void) {
+  pthread_mutex_lock(&logger.lock);
+  if (!logger.running) {
+    pthread_mutex_unlock(&logger.lock);
+    return;
+  }
+  logger.stopping = true;
+  pthread_cond_signal(&logger.pending);
+  pthread_mutex_unlock(&logger.lock);
+
+  pthread_join(logger.thread, NULL);
+
+  pthread_mutex_lock(&logger.lock);
+  logger.running = false;
+  pthread_mutex_unlock(&logger.lock);
+}
@@ -1,134 +1,246 @@
-#include "ds.h"
-#include "eval.h"
-#include "lexer.h"
-#include "parser.h"
+#include "budget.h"
+#include "cache.h"
+#include "context.h"
+#include "logger.h"
+#include "numeric.h"
+#include "output.h"
+#include "parallel.h"
+#include "profile.h"
+#include "reduce.h"
+#include "server.h"
+#include "stats.h"
+#include "stream.h"
+#include "sweep.h"
+#include "watch.h"
+#include "util.h"
 #include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-size_t configLen = 0;
+#define CONFIG_FILE "config.txt"
+#define MAX_LOADS 64
 
-char *readConfigFile(const char *filename) {
-  FILE *file = fopen(filename, "r");
-  if (!file) {
-    // Config file is optional, so don't treat this as an error
-    return NULL;
-  }
-
-  fseek(file, 0, SEEK_END);
-  long fileSize = ftell(file);
-  fseek(file, 0, SEEK_SET);
+// Writes the result of a single expression, or in the framed format the
+// error it failed with
+static int printResult(evalContext *ctx, const char *expression,
+                       outputFormat format) {
+  value result;
+  bool ok = evalContext_evaluateValue(ctx, expression, &result);
+  uint32_t status = (uint32_t)errno;
 
-  if (fileSize <= 0) {
-    logError("I/O error while processing config. Continuing without config\n",
-             __func__);
-    fclose(file);
-    return NULL;
+  outputWriter writer;
+  if (!outputWriter_init(&writer, STDOUT_FILENO))
+    return -1;
+  outputBuffer *buf = &writer.buffer;
+  bool written;
+  if (!ok) {
+    written = output_appendError(buf, format, status);
+  } else if (!result.data) {
+    written = output_appendHeader(buf, format, NULL, 0) &&
+              output_appendResult(buf, format, &result.scalar, 1);
+  } else {
+    written = output_appendHeader(buf, format, &result.len, 1) &&
+              output_appendResult(buf, format, result.data, result.len);
   }
+  written = outputWriter_free(&writer) && written;
+  return ok && written ? 0 : -1;
+}
 
-  char *buffer = malloc(fileSize + 1);
-  if (!buffer) {
-    logError("Fatal: Memory allocation failure\n", __func__);
-    fclose(file);
-    return NULL;
+// Folded stacks to path, the per-identifier table to stderr
+static int writeProfile(const char *path) {
+  FILE *out = fopen(path, "w");
+  bool written = out && profile_writeFolded(out);
+  if (out && fclose(out))
+    written = false;
+  if (!written) {
+    logError("Failed to write profile", __func__);
+    return -1;
   }
-
-  size_t bytesRead = fread(buffer, 1, fileSize, file);
-  buffer[bytesRead] = '\0';
-
-  fclose(file);
-  return buffer;
+  profile_printSummary(stderr);
+  return 0;
 }
 
-char *createCombinedInput(const char *configContent, const char *userInput) {
-  if (!configContent) {
-    // No config content, just duplicate user input
-    size_t len = strlen(userInput);
-    char *combined = malloc(len + 1);
-    if (combined) {
-      strcpy(combined, userInput);
-    }
-    return combined;
+int main(int argc, char **argv) {
+  const char *socketPath = NULL;
+  const char *userInput = NULL;
+  const char *watchOutputs = NULL;
+  const char *profilePath = NULL;
+  size_t cacheBytes = 0;
+  size_t programCacheEntries = 0;
+  size_t threads = 1;
+  real absoluteTolerance = NUMERIC_TOLERANCE;
+  real relativeTolerance = NUMERIC_TOLERANCE;
+  char *loads[MAX_LOADS];
+  size_t loadCount = 0;
+  const char *sweeps[SWEEP_MAX_AXES];
+  size_t sweepCount = 0;
+  sweepLayout layout = SWEEP_ROWS;
+  outputFormat format = OUTPUT_TEXT;
+  bool printStats = false;
+  bool lazyConfig = false;
+  bool streaming = false;
+  bool validArgs = true;
+
+  // Expressions may start with '-', so only known options are consumed
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+      socketPath = argv[++i];
+    else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc)
+      watchOutputs = argv[++i];
+    else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+      cacheBytes = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--program-cache") == 0 && i + 1 < argc)
+      programCacheEntries = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+      threads = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--log-file") == 0 && i + 1 < argc)
+      logger_setPath(argv[++i]);
+    else if (strcmp(argv[i], "--stream") == 0)
+      streaming = true;
+    else if (strcmp(argv[i], "--stats") == 0)
+      printStats = true;
+    else if (strcmp(argv[i], "--lazy-config") == 0)
+      lazyConfig = true;
+    else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+      profilePath = argv[++i];
+    else if (strcmp(argv[i], "--compensated") == 0)
+      reduce_setCompensated(true);
+    else if (strcmp(argv[i], "--abs-tol") == 0 && i + 1 < argc)
+      absoluteTolerance = strtod(argv[++i], NULL);
+    else if (strcmp(argv[i], "--rel-tol") == 0 && i + 1 < argc)
+      relativeTolerance = strtod(argv[++i], NULL);
+    else if (strcmp(argv[i], "--max-evals") == 0 && i + 1 < argc)
+      numeric_setMaxEvaluations(strtoull(argv[++i], NULL, 10));
+    else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc)
+      memBudget_set(strtoull(argv[++i], NULL, 10));
+    else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc &&
+             sweepCount < SWEEP_MAX_AXES)
+      sweeps[sweepCount++] = argv[++i];
+    else if (strcmp(argv[i], "--sweep-layout") == 0 && i + 1 < argc) {
+      const char *name = argv[++i];
+      if (strcmp(name, "rows") == 0)
+        layout = SWEEP_ROWS;
+      else if (strcmp(name, "csv") == 0)
+        layout = SWEEP_CSV;
+      else if (strcmp(name, "grid") == 0)
+        layout = SWEEP_GRID;
+      else
+        validArgs = false;
+    } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+      if (!output_parseFormat(argv[++i], &format))
+        validArgs = false;
+    } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc &&
+             loadCount < MAX_LOADS && strchr(argv[i + 1], '='))
+      loads[loadCount++] = argv[++i];
+    else if (!userInput)
+      userInput = argv[i];
+    else
+      validArgs = false;
   }
 
-  configLen = strlen(configContent);
-  size_t userLen = strlen(userInput);
-
-  char *combined = malloc(configLen + 1 + userLen + 1);
-  if (!combined) {
-    return NULL;
+  int modes = !!socketPath + !!userInput + !!watchOutputs + streaming;
+  if (!validArgs || modes != 1 || (sweepCount && !userInput) ||
+      (format != OUTPUT_TEXT && !userInput && !streaming)) {
+    logError("Usage: program [options] <expression> | "
+             "program [options] --serve <socket> | "
+             "program [options] --watch <iden>[,<iden>...] | "
+             "program [options] --stream\n"
+             "Options: --cache <bytes> --program-cache <entries> --stats "
+             "--log-file <path> --threads <n> --compensated "
+             "--load <iden>=<file> --abs-tol <t> --rel-tol <t> "
+             "--max-evals <n> --sweep <iden>=<from>:<to>:<count> "
+             "--sweep <iden>=<value>,... --sweep-layout rows|csv|grid "
+             "--output text|f64|npy|framed --lazy-config "
+             "--profile <path> --memory-budget <bytes>",
+             "main");
+    return -1;
   }
 
-  strcpy(combined, configContent);
-  strcat(combined, userInput);
+  numeric_setTolerance(absoluteTolerance, relativeTolerance);
+  profile_setEnabled(profilePath != NULL);
 
-  return combined;
-}
+  if (printStats && !evalStats_enabled())
+    fprintf(stderr, "Warning: stats are not compiled in, "
+                    "rebuild with make STATS=1\n");
 
-int main(int argc, char **argv) {
-  if (argc != 2) {
-    logError("Usage: program <expression>", "main");
+  if (!parallel_setThreads(threads)) {
+    logError("Fatal: Failed to start evaluation threads", "main");
     return -1;
   }
 
-  const char *userInput = argv[1];
-
-  char *configContent = readConfigFile("config.txt");
-  if (errno)
+  // Watch mode builds its dependency graph from every definition up front
+  evalContext_setLazyConfig(lazyConfig && !watchOutputs);
+  evalContext ctx;
+  if (!evalContext_init(&ctx, CONFIG_FILE))
     return -1;
 
-  char *input = createCombinedInput(configContent, userInput);
-  if (!input) {
-    logError("Fatal: Memory allocation failure for input string", "main");
-    free(configContent);
-    return -1;
+  for (size_t i = 0; i < loadCount; i++) {
+    char *path = strchr(loads[i], '=');
+    *path++ = '\0';
+    if (!evalContext_loadVector(&ctx, loads[i], path)) {
+      evalContext_free(&ctx);
+      return -1;
+    }
   }
 
-  tokenStream *tknStream = tokenise(input);
-  if (!tknStream) {
-    free(configContent);
-    free(input);
-    return -1;
+  resultCache cache;
+  if (cacheBytes) {
+    if (!resultCache_init(&cache, cacheBytes)) {
+      logError("Fatal: Memory allocation failure", "main");
+      evalContext_free(&ctx);
+      return -1;
+    }
+    ctx.cache = &cache;
   }
 
-  // Initialize parser
-  parser psr = {0};
-  psr.currentToken = 0;
-  psr.unmatchedParanthesisCount = 0;
-  psr.parsingAssignment = false;
-  psr.tknStream = tknStream;
-
-  if (!memPool_init(&psr.nodePool, tknStream->count) ||
-      !hashMap_init(&psr.map, (size_t)tknStream->count / 5)) {
-    logError("Fatal: Memory allocation failure", "memPool_init");
-    free(configContent);
-    free(input);
-    free(tknStream->stream);
-    free(tknStream);
-    return -1;
+  programCache programs;
+  if (programCacheEntries) {
+    if (!programCache_init(&programs, programCacheEntries)) {
+      logError("Fatal: Memory allocation failure", "main");
+      if (ctx.cache)
+        resultCache_free(&cache);
+      evalContext_free(&ctx);
+      return -1;
+    }
+    ctx.programs = &programs;
   }
 
-  ASTNode *root = parseExpression(&psr);
-  if (!root) {
-    free(configContent);
-    free(input);
-    free(tknStream->stream);
-    free(tknStream);
-    hashMap_free(&psr.map);
-    memPool_free(&psr.nodePool);
-    return -1;
+  int status = 0;
+  if (socketPath) {
+    status = runServer(&ctx, socketPath);
+  } else if (watchOutputs) {
+    status = runWatch(&ctx, watchOutputs, stdin, stdout);
+  } else if (streaming) {
+    status = runStream(&ctx, STDIN_FILENO, STDOUT_FILENO, format);
+  } else if (sweepCount) {
+    sweepAxis axes[SWEEP_MAX_AXES];
+    size_t parsed = 0;
+    while (parsed < sweepCount &&
+           sweepAxis_parse(&axes[parsed], sweeps[parsed]))
+      parsed++;
+    status = parsed == sweepCount
+                 ? runSweep(&ctx, userInput, axes, sweepCount, layout,
+                            format, stdout)
+                 : -1;
+    for (size_t i = 0; i < parsed; i++)
+      sweepAxis_free(&axes[i]);
+  } else {
+    status = printResult(&ctx, userInput, format);
   }
 
-  double result = eval(root);
-  printf("%.15g\n", result);
-
-  free(configContent);
-  free(input);
-  free(tknStream->stream);
-  free(tknStream);
-  hashMap_free(&psr.map);
-  memPool_free(&psr.nodePool);
-
-  return 0;
+  // Totals over every request when serving
+  if (printStats && evalStats_enabled())
+    evalStats_print(stderr);
+  if (profilePath && writeProfile(profilePath))
+    status = -1;
+
+  if (ctx.programs)
+    programCache_free(&programs);
+  if (ctx.cache)
+    resultCache_free(&cache);
+  evalContext_free(&ctx);
+  return status;
 }
@@ -0,0 +1,210 @@
+#define _POSIX_C_SOURCE 200809L
+#include "number.h"
+#include "number_tables.h"
+#include "util.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Literals longer than this are copied to the heap for the fallback
+#define NUMBER_COPY_BYTES 128
+
+// strtod() and friends on a NUL terminated copy of the literal, for what the
+// fast paths do not cover and for the float and long double builds
+static bool parseFallback(substring text, real *out) {
+  char local[NUMBER_COPY_BYTES];
+  char *copy = text.len < sizeof(local) ? local : strndup(text.str, text.len);
+  if (!copy) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return false;
+  }
+  if (copy == local) {
+    memcpy(local, text.str, text.len);
+    local[text.len] = '\0';
+  }
+
+  errno = 0;
+  real num = realParse(copy, NULL);
+  bool outOfRange = errno == ERANGE;
+  if (copy != local)
+    free(copy);
+
+  // Results that are merely subnormal are kept
+  if (outOfRange && num == 0) {
+    errno = UNDERFLOW;
+    return false;
+  }
+  if (outOfRange && (num == REAL_HUGE || num == -REAL_HUGE)) {
+    errno = OVERFLOW;
+    return false;
+  }
+  errno = 0;
+  *out = num;
+  return true;
+}
+
+#if !defined(EVAL_REAL_F32) && !defined(EVAL_REAL_F80)
+/*--DOUBLES--*/
+// Significant digits that always fit in a uint64_t
+#define MAX_DIGITS 19
+// Larger exponents only saturate the result
+#define MAX_EXPONENT 100000
+#define MANTISSA_BITS 52
+
+// Exact powers of ten for Clinger's fast path
+static const double exactPowers[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// The literal as w * 10^q. Digits past the first MAX_DIGITS significant ones
+// only move q, and set *truncated unless they are zeros.
+static void splitLiteral(substring text, uint64_t *w, int64_t *q,
+                         bool *truncated) {
+  const char *c = text.str, *end = text.str + text.len;
+  int digits = 0;
+  *w = 0;
+  *q = 0;
+  *truncated = false;
+
+  for (; c < end && *c >= '0' && *c <= '9'; c++) {
+    if (digits < MAX_DIGITS) {
+      *w = *w * 10 + (uint64_t)(*c - '0');
+      digits += *w != 0;
+    } else {
+      (*q)++;
+      *truncated |= *c != '0';
+    }
+  }
+  if (c < end && *c == '.') {
+    for (c++; c < end && *c >= '0' && *c <= '9'; c++) {
+      if (digits < MAX_DIGITS) {
+        *w = *w * 10 + (uint64_t)(*c - '0');
+        digits += *w != 0;
+        (*q)--;
+      } else {
+        *truncated |= *c != '0';
+      }
+    }
+  }
+  if (c < end && (*c == 'e' || *c == 'E')) {
+    c++;
+    bool negative = c < end && *c == '-';
+    c += c < end && (*c == '-' || *c == '+');
+    int64_t exponent = 0;
+    for (; c < end && *c >= '0' && *c <= '9'; c++)
+      if (exponent < MAX_EXPONENT)
+        exponent = exponent * 10 + (*c - '0');
+    *q += negative ? -exponent : exponent;
+  }
+}
+
+// Low and high halves of a * b
+static uint64_t multiply(uint64_t a, uint64_t b, uint64_t *high) {
+#ifdef __SIZEOF_INT128__
+  __extension__ typedef unsigned __int128 uint128;
+  uint128 product = (uint128)a * b;
+  *high = (uint64_t)(product >> 64);
+  return (uint64_t)product;
+#else
+  uint64_t aLow = (uint32_t)a, aHigh = a >> 32;
+  uint64_t bLow = (uint32_t)b, bHigh = b >> 32;
+  uint64_t low = aLow * bLow;
+  uint64_t middle1 = aHigh * bLow + (low >> 32);
+  uint64_t middle2 = aLow * bHigh + (uint32_t)middle1;
+  *high = aHigh * bHigh + (middle1 >> 32) + (middle2 >> 32);
+  return (middle2 << 32) | (uint32_t)low;
+#endif
+}
+
+static int leadingZeros(uint64_t x) {
+#ifdef __GNUC__
+  return __builtin_clzll(x);
+#else
+  int count = 0;
+  for (; !(x >> 63); x <<= 1)
+    count++;
+  return count;
+#endif
+}
+
+// Eisel-Lemire (Lemire, "Number Parsing at a Gigabyte per Second", 2021):
+// w * 5^q from the 128-bit table entry, shifted into place and rounded to
+// even. The few products too close to a rounding boundary to decide with
+// 128 bits, and results that are not normal doubles, return false.
+static bool eiselLemire(uint64_t w, int64_t q, double *out) {
+  const uint64_t *power = NUMBER_POW5[q - NUMBER_MIN_POWER];
+  // floor(log2(10^q)) plus the bias and the width of w, for |q| <= 400
+  int64_t exponent = (((152170 + 65536) * q) >> 16) + 1024 + 63;
+  int zeros = leadingZeros(w);
+  w <<= zeros;
+
+  uint64_t upper;
+  uint64_t lower = multiply(w, power[0], &upper);
+  if ((upper & 0x1FF) == 0x1FF && lower + w < lower) {
+    // The low half of the table entry may still carry into the result
+    uint64_t middle2;
+    uint64_t low = multiply(w, power[1], &middle2);
+    uint64_t middle = lower + middle2;
+    upper += middle < lower;
+    if (middle + 1 == 0 && (upper & 0x1FF) == 0x1FF && low + w < low)
+      return false;
+    lower = middle;
+  }
+
+  // 54 bits: the 53 of the result and one to round with
+  uint64_t upperBit = upper >> 63;
+  uint64_t mantissa = upper >> (upperBit + 9);
+  zeros += (int)(1 ^ upperBit);
+
+  // Exactly halfway between two doubles: round to even, not up
+  if (lower <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+      (mantissa << (upperBit + 9)) == upper)
+    mantissa &= ~(uint64_t)1;
+
+  mantissa += mantissa & 1;
+  mantissa >>= 1;
+  if (mantissa >= (uint64_t)1 << (MANTISSA_BITS + 1)) {
+    mantissa = (uint64_t)1 << MANTISSA_BITS;
+    zeros--;
+  }
+  mantissa &= ~((uint64_t)1 << MANTISSA_BITS);
+
+  int64_t biased = exponent - zeros;
+  if (biased < 1 || biased > 2046)
+    return false;
+  uint64_t bits = mantissa | (uint64_t)biased << MANTISSA_BITS;
+  memcpy(out, &bits, sizeof(*out));
+  return true;
+}
+
+bool number_parse(substring text, real *out) {
+  uint64_t w;
+  int64_t q;
+  bool truncated;
+  splitLiteral(text, &w, &q, &truncated);
+
+  if (!truncated) {
+    if (w == 0) {
+      *out = 0;
+      return true;
+    }
+#if FLT_EVAL_METHOD == 0
+    // Both operands are exact, so one rounding gives the right result
+    if (w <= (uint64_t)1 << (MANTISSA_BITS + 1) && q >= -22 && q <= 22) {
+      *out = q < 0 ? (double)w / exactPowers[-q] : (double)w * exactPowers[q];
+      return true;
+    }
+#endif
+    if (q >= NUMBER_MIN_POWER && q <= NUMBER_MAX_POWER &&
+        eiselLemire(w, q, out))
+      return true;
+  }
+  return parseFallback(text, out);
+}
+
+#else
+bool number_parse(substring text, real *out) {
+  return parseFallback(text, out);
+}
+#endif
@@ -0,0 +1,289 @@
+#include "numeric.h"
+#include "util.h"
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+
+static real absoluteTolerance = NUMERIC_TOLERANCE;
+static real relativeTolerance = NUMERIC_TOLERANCE;
+static size_t maxEvaluations = NUMERIC_MAX_EVALUATIONS;
+
+void numeric_setTolerance(real absolute, real relative) {
+  absoluteTolerance = absolute;
+  relativeTolerance = relative;
+}
+
+void numeric_setMaxEvaluations(size_t count) { maxEvaluations = count; }
+
+static real tolerance(real magnitude) {
+  real relative = relativeTolerance * realAbs(magnitude);
+  return relative > absoluteTolerance ? relative : absoluteTolerance;
+}
+
+// Counts the evaluations of one call against maxEvaluations
+typedef struct countedFunction {
+  numericFunction f;
+  void *arg;
+  size_t evaluations;
+} countedFunction;
+
+static bool call(countedFunction *fn, real x, real *y) {
+  fn->evaluations++;
+  return fn->f(fn->arg, x, y);
+}
+
+/*--INTEGRATION--*/
+#define KRONROD_POINTS 15
+
+// Abscissae of the 15 point Kronrod rule on [-1, 1], from the outside in.
+// The odd ones are also the nodes of the embedded 7 point Gauss rule.
+static const real kronrodNodes[8] = {
+    0.991455371120812639206854697526329L, 0.949107912342758524526189684047851L,
+    0.864864423359769072789712788640926L, 0.741531185599394439863864773280788L,
+    0.586087235467691130294144845693013L, 0.405845151377397166906606412076961L,
+    0.207784955007898467600689403773245L, 0.0L};
+
+static const real kronrodWeights[8] = {
+    0.022935322010529224963732008058970L, 0.063092092629978553290700663189204L,
+    0.104790010322250183839876322541518L, 0.140653259715525918745189590510238L,
+    0.169004726639267902826583426598550L, 0.190350578064785409913256402421014L,
+    0.204432940075298892414161999234649L, 0.209482141084727828012999174891714L};
+
+static const real gaussWeights[4] = {
+    0.129484966168869693270611432679082L, 0.279705391489276667901467771423780L,
+    0.381830050505118944950369775488975L, 0.417959183673469387755102040816327L};
+
+typedef struct segment {
+  real a, b;
+  real result;
+  real error; // |Kronrod - Gauss|
+} segment;
+
+static bool evalSegment(countedFunction *fn, real a, real b, segment *out) {
+  real centre = a + (b - a) / 2;
+  real half = (b - a) / 2;
+
+  real fc;
+  if (!call(fn, centre, &fc))
+    return false;
+  real kronrod = fc * kronrodWeights[7];
+  real gauss = fc * gaussWeights[3];
+
+  for (size_t j = 0; j < 7; j++) {
+    real offset = half * kronrodNodes[j];
+    real f1, f2;
+    if (!call(fn, centre - offset, &f1) || !call(fn, centre + offset, &f2))
+      return false;
+    kronrod += kronrodWeights[j] * (f1 + f2);
+    if (j % 2)
+      gauss += gaussWeights[j / 2] * (f1 + f2);
+  }
+
+  *out = (segment){.a = a,
+                   .b = b,
+                   .result = kronrod * half,
+                   .error = realAbs((kronrod - gauss) * half)};
+  return true;
+}
+
+// Max-heap on the error, so the worst segment is always split next
+static void heapPush(segment *heap, size_t *count, segment s) {
+  size_t i = (*count)++;
+  while (i > 0 && heap[(i - 1) / 2].error < s.error) {
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  heap[i] = s;
+}
+
+static segment heapPop(segment *heap, size_t *count) {
+  segment top = heap[0];
+  segment last = heap[--*count];
+  size_t i = 0;
+  while (2 * i + 1 < *count) {
+    size_t child = 2 * i + 1;
+    if (child + 1 < *count && heap[child + 1].error > heap[child].error)
+      child++;
+    if (!(heap[child].error > last.error))
+      break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  if (*count)
+    heap[i] = last;
+  return top;
+}
+
+// Global adaptive scheme: the segment with the largest error estimate is
+// halved until the summed estimate meets the tolerance. A function value
+// that is not a number makes the estimate NaN, which ends the loop with a NaN
+// result like any other arithmetic on it.
+bool numeric_integrate(numericFunction f, void *arg, real a, real b,
+                       real *result) {
+  if (!isfinite(a) || !isfinite(b)) {
+    errno = INVALID_RANGE;
+    return false;
+  }
+  if (a == b) {
+    *result = 0;
+    return true;
+  }
+  if (maxEvaluations < KRONROD_POINTS) {
+    errno = NO_CONVERGENCE;
+    return false;
+  }
+
+  // Every split adds one segment for two more rule evaluations
+  size_t capacity = maxEvaluations / (2 * KRONROD_POINTS) + 2;
+  segment *heap = malloc(capacity * sizeof(segment));
+  if (!heap) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return false;
+  }
+
+  countedFunction fn = {.f = f, .arg = arg};
+  size_t count = 0;
+  segment whole;
+  if (!evalSegment(&fn, a, b, &whole)) {
+    free(heap);
+    return false;
+  }
+  heapPush(heap, &count, whole);
+
+  bool ok = true;
+  real total = whole.result;
+  real error = whole.error;
+  while (isfinite(total) && isfinite(error) && error > tolerance(total)) {
+    segment worst = heap[0];
+    real middle = worst.a + (worst.b - worst.a) / 2;
+    if (fn.evaluations + 2 * KRONROD_POINTS > maxEvaluations ||
+        middle == worst.a || middle == worst.b) {
+      errno = NO_CONVERGENCE;
+      ok = false;
+      break;
+    }
+
+    segment left, right;
+    heapPop(heap, &count);
+    ok = evalSegment(&fn, worst.a, middle, &left) &&
+         evalSegment(&fn, middle, worst.b, &right);
+    if (!ok)
+      break;
+    heapPush(heap, &count, left);
+    heapPush(heap, &count, right);
+    total += left.result + right.result - worst.result;
+    error += left.error + right.error - worst.error;
+  }
+
+  // Summed afresh, the running total collects rounding error from updates
+  if (ok) {
+    *result = 0;
+    for (size_t i = 0; i < count; i++)
+      *result += heap[i].result;
+  }
+  // Near a singularity the estimate overflows instead of converging
+  if (ok && (!isfinite(*result) || !isfinite(error))) {
+    errno = NO_CONVERGENCE;
+    ok = false;
+  }
+  free(heap);
+  return ok;
+}
+
+/*--ROOT FINDING--*/
+static bool sameSign(real x, real y) {
+  return (x > 0 && y > 0) || (x < 0 && y < 0);
+}
+
+// Brent's method: inverse quadratic interpolation or the secant step when it
+// stays well inside the bracket, bisection otherwise, so it never does worse
+// than bisection. b is the best estimate, [b, c] always brackets the root.
+bool numeric_solve(numericFunction f, void *arg, real lo, real hi,
+                   real *root) {
+  if (!isfinite(lo) || !isfinite(hi)) {
+    errno = INVALID_RANGE;
+    return false;
+  }
+
+  countedFunction fn = {.f = f, .arg = arg};
+  real a = lo, b = hi, fa, fb;
+  if (!call(&fn, a, &fa) || !call(&fn, b, &fb))
+    return false;
+  if (fa != fa || fb != fb) {
+    *root = NAN;
+    return true;
+  }
+  if (fa == 0) {
+    *root = a;
+    return true;
+  }
+  if (sameSign(fa, fb)) {
+    errno = NO_SIGN_CHANGE;
+    return false;
+  }
+
+  real c = a, fc = fa;
+  real d = b - a, e = d;
+  while (true) {
+    if (sameSign(fb, fc)) {
+      c = a;
+      fc = fa;
+      d = e = b - a;
+    }
+    if (realAbs(fc) < realAbs(fb)) {
+      a = b, b = c, c = a;
+      fa = fb, fb = fc, fc = fa;
+    }
+
+    real step = 2 * REAL_EPSILON * realAbs(b) + tolerance(b) / 2;
+    real middle = (c - b) / 2;
+    if (realAbs(middle) <= step || fb == 0) {
+      *root = b;
+      return true;
+    }
+    if (fn.evaluations >= maxEvaluations) {
+      errno = NO_CONVERGENCE;
+      return false;
+    }
+
+    if (realAbs(e) >= step && realAbs(fa) > realAbs(fb)) {
+      real s = fb / fa, p, q;
+      if (a == c) { // secant
+        p = 2 * middle * s;
+        q = 1 - s;
+      } else { // inverse quadratic
+        real r = fb / fc;
+        q = fa / fc;
+        p = s * (2 * middle * q * (q - r) - (b - a) * (r - 1));
+        q = (q - 1) * (r - 1) * (s - 1);
+      }
+      if (p > 0)
+        q = -q;
+      else
+        p = -p;
+
+      real bound = 3 * middle * q - realAbs(step * q);
+      real previous = realAbs(e * q);
+      if (2 * p < (bound < previous ? bound : previous)) {
+        e = d;
+        d = p / q;
+      } else {
+        d = middle;
+        e = d;
+      }
+    } else {
+      d = middle;
+      e = d;
+    }
+
+    a = b;
+    fa = fb;
+    b += realAbs(d) > step ? d : (middle > 0 ? step : -step);
+    if (!call(&fn, b, &fb))
+      return false;
+    if (fb != fb) {
+      *root = NAN;
+      return true;
+    }
+  }
+}
@@ -0,0 +1,221 @@
+#define _POSIX_C_SOURCE 200809L
+#include "output.h"
+#include "format.h"
+#include "util.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define NPY_ALIGNMENT 64
+#define NPY_PREFIX_SIZE 10 // magic, version and header length
+
+bool output_parseFormat(const char *name, outputFormat *format) {
+  static const char *names[] = {"text", "f64", "npy", "framed"};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      *format = (outputFormat)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*--ENCODING--*/
+bool outputBuffer_reserve(outputBuffer *buf, size_t bytes) {
+  if (buf->capacity - buf->len >= bytes)
+    return true;
+
+  size_t capacity = buf->capacity ? buf->capacity : 4096;
+  while (capacity - buf->len < bytes)
+    capacity *= 2;
+  char *data = realloc(buf->data, capacity);
+  if (!data) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return false;
+  }
+  buf->data = data;
+  buf->capacity = capacity;
+  return true;
+}
+
+void outputBuffer_free(outputBuffer *buf) {
+  free(buf->data);
+  *buf = (outputBuffer){0};
+}
+
+static void putLE32(char *out, uint32_t x) {
+  for (size_t i = 0; i < 4; i++)
+    out[i] = (char)(x >> (8 * i));
+}
+
+static void putLE64(char *out, uint64_t x) {
+  for (size_t i = 0; i < 8; i++)
+    out[i] = (char)(x >> (8 * i));
+}
+
+size_t output_formatReal(real value, char *out) {
+#if defined(EVAL_REAL_F32) || defined(EVAL_REAL_F80)
+  return (size_t)snprintf(out, OUTPUT_VALUE_BYTES, REAL_FORMAT, value);
+#else
+  return format_shortest(value, out);
+#endif
+}
+
+bool output_appendText(outputBuffer *buf, real value, char separator) {
+  if (!outputBuffer_reserve(buf, OUTPUT_VALUE_BYTES + 1))
+    return false;
+  buf->len += output_formatReal(value, buf->data + buf->len);
+  buf->data[buf->len++] = separator;
+  return true;
+}
+
+bool output_appendF64(outputBuffer *buf, real value) {
+  if (!outputBuffer_reserve(buf, 8))
+    return false;
+  double d = (double)value;
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  putLE64(buf->data + buf->len, bits);
+  buf->len += 8;
+  return true;
+}
+
+static bool appendFrame(outputBuffer *buf, uint32_t status, size_t count) {
+  if (!outputBuffer_reserve(buf, 8 + 8 * count))
+    return false;
+  putLE32(buf->data + buf->len, status);
+  putLE32(buf->data + buf->len + 4, (uint32_t)count);
+  buf->len += 8;
+  return true;
+}
+
+bool output_appendResult(outputBuffer *buf, outputFormat format,
+                         const real *values, size_t count) {
+  if (format == OUTPUT_TEXT) {
+    for (size_t i = 0; i < count; i++)
+      if (!output_appendText(buf, values[i], i + 1 < count ? ' ' : '\n'))
+        return false;
+    if (count)
+      return true;
+    if (!outputBuffer_reserve(buf, 1)) // an empty vector is an empty line
+      return false;
+    buf->data[buf->len++] = '\n';
+    return true;
+  }
+
+  if (format == OUTPUT_FRAMED && !appendFrame(buf, 0, count))
+    return false;
+  for (size_t i = 0; i < count; i++)
+    if (!output_appendF64(buf, values[i]))
+      return false;
+  return true;
+}
+
+bool output_appendError(outputBuffer *buf, outputFormat format,
+                        uint32_t status) {
+  return format != OUTPUT_FRAMED || appendFrame(buf, status, 0);
+}
+
+bool output_appendHeader(outputBuffer *buf, outputFormat format,
+                         const size_t *shape, size_t dims) {
+  if (format != OUTPUT_NPY)
+    return true;
+
+  // Version 1.0: the dictionary is padded with spaces and ends in a newline,
+  // so the data starts on an aligned offset
+  char header[128 + 24 * OUTPUT_NPY_MAX_DIMS];
+  size_t len = (size_t)snprintf(
+      header, sizeof(header),
+      "{'descr': '<f8', 'fortran_order': False, 'shape': (");
+  for (size_t i = 0; i < dims && i < OUTPUT_NPY_MAX_DIMS; i++)
+    len += (size_t)snprintf(header + len, sizeof(header) - len,
+                            i ? ", %zu" : "%zu", shape[i]);
+  len += (size_t)snprintf(header + len, sizeof(header) - len,
+                          dims == 1 ? ",), }" : "), }");
+  size_t total = NPY_PREFIX_SIZE + len + 1;
+  total += (NPY_ALIGNMENT - total % NPY_ALIGNMENT) % NPY_ALIGNMENT;
+
+  if (!outputBuffer_reserve(buf, total))
+    return false;
+  char *out = buf->data + buf->len;
+  memcpy(out, "\x93NUMPY\x01\x00", 8);
+  size_t headerLen = total - NPY_PREFIX_SIZE;
+  out[8] = (char)(headerLen & 0xff);
+  out[9] = (char)(headerLen >> 8);
+  memcpy(out + NPY_PREFIX_SIZE, header, len);
+  memset(out + NPY_PREFIX_SIZE + len, ' ', total - NPY_PREFIX_SIZE - len - 1);
+  out[total - 1] = '\n';
+  buf->len += total;
+  return true;
+}
+
+/*--WRITER--*/
+bool outputWriter_init(outputWriter *w, int fd) {
+  *w = (outputWriter){.fd = fd};
+  return outputBuffer_reserve(&w->buffer, OUTPUT_BUFFER_SIZE);
+}
+
+// Writes every byte of both blocks, retrying partial and interrupted writes
+static bool writeBlocks(outputWriter *w, const char *first, size_t firstLen,
+                        const char *second, size_t secondLen) {
+  while (firstLen + secondLen) {
+    struct iovec blocks[2] = {{.iov_base = (void *)first, .iov_len = firstLen},
+                              {.iov_base = (void *)second,
+                               .iov_len = secondLen}};
+    ssize_t n = firstLen ? writev(w->fd, blocks, 2)
+                         : write(w->fd, second, secondLen);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      logError("Failed to write output", __func__);
+      w->failed = true;
+      return false;
+    }
+
+    size_t written = (size_t)n;
+    size_t fromFirst = written < firstLen ? written : firstLen;
+    first += fromFirst;
+    firstLen -= fromFirst;
+    second += written - fromFirst;
+    secondLen -= written - fromFirst;
+  }
+  return true;
+}
+
+bool outputWriter_write(outputWriter *w, const void *data, size_t len) {
+  if (w->failed)
+    return false;
+  outputBuffer *buf = &w->buffer;
+  if (buf->capacity - buf->len >= len && len < OUTPUT_BUFFER_SIZE) {
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return true;
+  }
+
+  bool ok = writeBlocks(w, buf->data, buf->len, data, len);
+  buf->len = 0;
+  return ok;
+}
+
+bool outputWriter_writeBuffer(outputWriter *w, outputBuffer *buf) {
+  bool ok = outputWriter_write(w, buf->data, buf->len);
+  buf->len = 0;
+  return ok;
+}
+
+bool outputWriter_flush(outputWriter *w) {
+  if (w->failed)
+    return false;
+  bool ok = writeBlocks(w, w->buffer.data, w->buffer.len, NULL, 0);
+  w->buffer.len = 0;
+  return ok;
+}
+
+bool outputWriter_free(outputWriter *w) {
+  bool ok = outputWriter_flush(w);
+  outputBuffer_free(&w->buffer);
+  return ok;
+}
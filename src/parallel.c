@@ -0,0 +1,284 @@
+#define _GNU_SOURCE
+#include "parallel.h"
+#include "eval.h"
+#include "stats.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// One job at a time: every thread (the caller included) claims task indices
+// until none are left, and the caller returns once all of them are finished.
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t done;
+  pthread_mutex_t jobLock; // serialises callers
+  pthread_t *workers;
+  size_t workerCount;
+  bool stopping;
+  unsigned long generation;
+
+  parallelTask task;
+  void *arg;
+  size_t taskCount;
+  size_t next;
+  size_t finished;
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .jobLock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// Set while this thread runs a task, so nested calls stay on it
+static _Thread_local bool insideTask;
+
+/*--WORKERS--*/
+static void runTasks(void) {
+  pthread_mutex_lock(&pool.lock);
+  while (pool.next < pool.taskCount) {
+    size_t i = pool.next++;
+    pthread_mutex_unlock(&pool.lock);
+
+    insideTask = true;
+    pool.task(pool.arg, i);
+    insideTask = false;
+
+    pthread_mutex_lock(&pool.lock);
+    if (++pool.finished == pool.taskCount)
+      pthread_cond_signal(&pool.done);
+  }
+  pthread_mutex_unlock(&pool.lock);
+}
+
+static void *worker(void *arg) {
+  (void)arg;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pool.lock);
+  while (true) {
+    while (!pool.stopping && pool.generation == seen)
+      pthread_cond_wait(&pool.wake, &pool.lock);
+    if (pool.stopping)
+      break;
+    seen = pool.generation;
+
+    pthread_mutex_unlock(&pool.lock);
+    runTasks();
+    pthread_mutex_lock(&pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+  return NULL;
+}
+
+bool parallel_setThreads(size_t threads) {
+  if (pool.workers || threads <= 1)
+    return true;
+
+  pool.workers = malloc(sizeof(pthread_t) * (threads - 1));
+  if (!pool.workers)
+    return false;
+
+  for (; pool.workerCount < threads - 1; pool.workerCount++) {
+    if (pthread_create(&pool.workers[pool.workerCount], NULL, worker, NULL)) {
+      parallel_shutdown();
+      return false;
+    }
+  }
+
+  atexit(parallel_shutdown);
+  return true;
+}
+
+size_t parallel_threads(void) { return pool.workerCount + 1; }
+
+void parallel_shutdown(void) {
+  if (!pool.workers)
+    return;
+
+  pthread_mutex_lock(&pool.lock);
+  pool.stopping = true;
+  pthread_cond_broadcast(&pool.wake);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (size_t i = 0; i < pool.workerCount; i++)
+    pthread_join(pool.workers[i], NULL);
+
+  free(pool.workers);
+  pool.workers = NULL;
+  pool.workerCount = 0;
+  pool.stopping = false;
+}
+
+void parallel_run(size_t taskCount, parallelTask task, void *arg) {
+  if (!pool.workers || insideTask) {
+    for (size_t i = 0; i < taskCount; i++)
+      task(arg, i);
+    return;
+  }
+
+  pthread_mutex_lock(&pool.jobLock);
+  pthread_mutex_lock(&pool.lock);
+  pool.task = task;
+  pool.arg = arg;
+  pool.taskCount = taskCount;
+  pool.next = 0;
+  pool.finished = 0;
+  pool.generation++;
+  pthread_cond_broadcast(&pool.wake);
+  pthread_mutex_unlock(&pool.lock);
+
+  runTasks();
+
+  pthread_mutex_lock(&pool.lock);
+  while (pool.finished < pool.taskCount)
+    pthread_cond_wait(&pool.done, &pool.lock);
+  pool.taskCount = 0;
+  pthread_mutex_unlock(&pool.lock);
+  pthread_mutex_unlock(&pool.jobLock);
+}
+
+/*--EVALUATION--*/
+// Chains of binary operators (see isChainOperator()) are walked down their left
+// operands while those are larger than a task, and every operand along the way
+// with at least PARALLEL_GRAIN nodes becomes a task of its own. The chain is
+// still folded from the bottom up in eval() order, since reassociating it
+// would change the floating-point result. A long chain of small operands, such
+// as a generated 1 + 2 + ... + n, therefore has nothing to split and is
+// evaluated serially by eval().
+static bool isTask(const ASTNode *operand) {
+  return operand->pureSize >= PARALLEL_GRAIN;
+}
+
+// A node is split when it is larger than a task and at least two of its
+// operands are worth a task of their own
+static bool splits(const ASTNode *node, size_t taskSize) {
+  if (node->pureSize <= taskSize)
+    return false;
+
+  switch (node->type) {
+  case TOKEN_PLUS:
+  case TOKEN_MINUS:
+  case TOKEN_MUL:
+  case TOKEN_DIV:
+  case TOKEN_EXP: {
+    size_t tasks = 0;
+    for (; isChainOperator(node->type) && node->pureSize > taskSize;
+         node = node->binary.left)
+      if (isTask(node->binary.right) && ++tasks == 2)
+        return true;
+    return isTask(node) && tasks == 1;
+  }
+
+  case TOKEN_UNARY_MINUS:
+  case TOKEN_UNARY_PLUS:
+  case TOKEN_SIN:
+  case TOKEN_COS:
+  case TOKEN_LOG:
+    return splits(node->unary.operand, taskSize);
+
+  default:
+    return false;
+  }
+}
+
+// Tasks are collected and consumed in the same order, the operands of a chain
+// from the bottom up. False when out of memory.
+static bool collectTasks(ASTNode *node, size_t taskSize, ASTNode **tasks,
+                         size_t *count) {
+  if (!splits(node, taskSize)) {
+    tasks[(*count)++] = node;
+    return true;
+  }
+  if (!isChainOperator(node->type))
+    return collectTasks(node->unary.operand, taskSize, tasks, count);
+
+  astChain chain;
+  if (!astChain_push(&chain, node, taskSize + 1, SIZE_MAX))
+    return false;
+
+  ASTNode *first = astChain_node(&chain, 0)->binary.left;
+  bool ok = !isTask(first) || collectTasks(first, taskSize, tasks, count);
+  for (size_t i = 0; ok && i < chain.len; i++) {
+    ASTNode *right = astChain_node(&chain, i)->binary.right;
+    ok = !isTask(right) || collectTasks(right, taskSize, tasks, count);
+  }
+  astChain_pop(&chain);
+  return ok;
+}
+
+typedef struct evalJob {
+  ASTNode **tasks;
+  real *results;
+} evalJob;
+
+static void evalTask(void *arg, size_t task) {
+  evalJob *job = arg;
+  job->results[task] = eval(job->tasks[task]);
+}
+
+static real combineOperand(ASTNode *operand, size_t taskSize,
+                           const real *results, size_t *next);
+
+static real combine(ASTNode *node, size_t taskSize, const real *results,
+                    size_t *next) {
+  if (!splits(node, taskSize))
+    return results[(*next)++];
+  if (!isChainOperator(node->type))
+    return evalUnary(node->type,
+                     combine(node->unary.operand, taskSize, results, next));
+
+  // Cannot run out of memory: collectTasks() pushed the same chains
+  astChain chain;
+  if (!astChain_push(&chain, node, taskSize + 1, SIZE_MAX))
+    return nan("Allocation failed");
+
+  real value = combineOperand(astChain_node(&chain, 0)->binary.left, taskSize,
+                              results, next);
+  for (size_t i = 0; i < chain.len; i++) {
+    const ASTNode *op = astChain_node(&chain, i);
+    real right = combineOperand(op->binary.right, taskSize, results, next);
+    value = evalBinary(op->type, value, right);
+  }
+  astChain_pop(&chain);
+  return value;
+}
+
+// Operands too small for a task are evaluated here, in their turn
+static real combineOperand(ASTNode *operand, size_t taskSize,
+                           const real *results, size_t *next) {
+  return isTask(operand) ? combine(operand, taskSize, results, next)
+                         : eval(operand);
+}
+
+real parallel_eval(ASTNode *root) {
+  size_t threads = parallel_threads();
+  size_t taskSize = root->pureSize / (threads * PARALLEL_TASKS_PER_THREAD);
+  if (taskSize < PARALLEL_GRAIN)
+    taskSize = PARALLEL_GRAIN;
+
+  if (threads == 1 || !splits(root, taskSize))
+    return eval(root);
+
+  // Every task holds at least PARALLEL_GRAIN nodes
+  size_t maxTasks = root->pureSize / PARALLEL_GRAIN + 1;
+  ASTNode **tasks = malloc(sizeof(ASTNode *) * maxTasks);
+  real *results = malloc(sizeof(real) * maxTasks);
+  size_t taskCount = 0;
+  if (!tasks || !results ||
+      !collectTasks(root, taskSize, tasks, &taskCount)) {
+    free(tasks);
+    free(results);
+    return eval(root);
+  }
+
+  STATS_ADD(parallelTasks, taskCount);
+  parallel_run(taskCount, evalTask, &(evalJob){tasks, results});
+
+  size_t next = 0;
+  real value = combine(root, taskSize, results, &next);
+  free(tasks);
+  free(results);
+  return value;
+}
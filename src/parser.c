@@ -1,7 +1,14 @@
 #include "parser.h"
+#include "budget.h"
 #include "ds.h"
 #include "eval.h"
 #include "lexer.h"
+#include "number.h"
+#include "numeric.h"
+#include "parallel.h"
+#include "profile.h"
+#include "reduce.h"
+#include "stats.h"
 #include "util.h"
 
 #include <errno.h>
@@ -12,6 +19,8 @@
 
 #define GET_CURRENT_TOKEN psr->tknStream->stream[psr->currentToken]
 #define GET_TOKEN(t) psr->tknStream->stream[t]
+#define GET_LEXEME(t) tokenStream_lexeme(psr->tknStream, t)
+#define GET_CURRENT_LEXEME GET_LEXEME(psr->currentToken)
 #define ASSIGNMENT_CONTEXT                                                     \
   ((psr->currentToken + 3) <= psr->tknStream->count) &&                        \
       GET_CURRENT_TOKEN.type ==                                                \
@@ -27,7 +36,8 @@ static precedence precedenceMap[TOKEN_MAX] = {
     [TOKEN_EXP] = PRECEDENCE_POWER,     [TOKEN_UNARY_MINUS] = PRECEDENCE_UNARY,
     [TOKEN_SIN] = PRECEDENCE_UNARY,     [TOKEN_COS] = PRECEDENCE_UNARY,
     [TOKEN_LOG] = PRECEDENCE_UNARY,     [TOKEN_OPENPAREN] = PRECEDENCE_MIN,
-    [TOKEN_CLOSEPAREN] = PRECEDENCE_MIN};
+    [TOKEN_CLOSEPAREN] = PRECEDENCE_MIN, [TOKEN_OPENBRACKET] = PRECEDENCE_MIN,
+    [TOKEN_CLOSEBRACKET] = PRECEDENCE_MIN};
 
 static inline bool isUnary(tokenType type) {
   switch (type) {
@@ -40,115 +50,301 @@ static inline bool isUnary(tokenType type) {
   return false;
 }
 
+// Named functions taking their arguments in parentheses
+static inline bool isFunction(tokenType type) {
+  switch (type) {
+  case TOKEN_SUM:
+  case TOKEN_PROD:
+  case TOKEN_MINIMUM:
+  case TOKEN_MAXIMUM:
+  case TOKEN_DOT:
+  case TOKEN_RANGE:
+  case TOKEN_INTEGRATE:
+  case TOKEN_SOLVE:
+    return true;
+  }
+  return false;
+}
+
 static inline void nodeInit(ASTNode *node, token tkn) {
   memset(node, 0, sizeof(ASTNode));
   node->type = tkn.type;
   node->pos = tkn.pos;
 }
 
+// Chains are copied in a loop down their left operands and vector literals
+// down the rest of the list, so only other operands recurse
 static inline ASTNode *cloneAST(ASTNode *node, memPool *tempAlloc) {
-  if (!node)
-    return NULL;
-
-  ASTNode *cloneNode = memPool_alloc(tempAlloc);
-  if (!cloneNode)
-    return NULL;
-
-  cloneNode->type = node->type;
-  cloneNode->pos = node->pos;
+  ASTNode *root = NULL;
+  ASTNode **link = &root;
 
-  switch (node->type) {
-  case TOKEN_PLUS:
-  case TOKEN_MINUS:
-  case TOKEN_MUL:
-  case TOKEN_DIV:
-  case TOKEN_EXP:
-    cloneNode->binary.left = cloneAST(node->binary.left, tempAlloc);
-    cloneNode->binary.right = cloneAST(node->binary.right, tempAlloc);
-    if (!cloneNode->binary.left || !cloneNode->binary.right)
+  while (true) {
+    if (!node)
       return NULL;
-    break;
 
-  case TOKEN_UNARY_MINUS:
-  case TOKEN_UNARY_PLUS:
-  case TOKEN_SIN:
-  case TOKEN_COS:
-  case TOKEN_LOG:
-    cloneNode->unary.operand = cloneAST(node->unary.operand, tempAlloc);
-    if (!cloneNode->unary.operand)
+    ASTNode *cloneNode = memPool_alloc(tempAlloc);
+    if (!cloneNode)
       return NULL;
-    break;
+    STATS_ADD(clonedNodes, 1);
+    *link = cloneNode;
 
-  case TOKEN_IDEN:
+    cloneNode->type = node->type;
+    cloneNode->pos = node->pos;
+    cloneNode->pureSize = node->pureSize;
     cloneNode->identifer = node->identifer;
-    break;
 
-  case TOKEN_NUMBER:
-    cloneNode->number = node->number;
-    break;
+    switch (node->type) {
+    case TOKEN_PLUS:
+    case TOKEN_MINUS:
+    case TOKEN_MUL:
+    case TOKEN_DIV:
+    case TOKEN_EXP:
+      cloneNode->binary.right = cloneAST(node->binary.right, tempAlloc);
+      if (!cloneNode->binary.right)
+        return NULL;
+      link = &cloneNode->binary.left;
+      node = node->binary.left;
+      continue;
 
-  default:
-    return NULL;
+    case TOKEN_COMMA:
+      cloneNode->binary.left = cloneAST(node->binary.left, tempAlloc);
+      if (!cloneNode->binary.left)
+        return NULL;
+      link = &cloneNode->binary.right;
+      node = node->binary.right;
+      continue;
+
+    case TOKEN_DOT:
+    case TOKEN_RANGE:
+      cloneNode->binary.left = cloneAST(node->binary.left, tempAlloc);
+      cloneNode->binary.right = cloneAST(node->binary.right, tempAlloc);
+      if (!cloneNode->binary.left || !cloneNode->binary.right)
+        return NULL;
+      break;
+
+    case TOKEN_UNARY_MINUS:
+    case TOKEN_UNARY_PLUS:
+    case TOKEN_SIN:
+    case TOKEN_COS:
+    case TOKEN_LOG:
+    case TOKEN_OPENBRACKET:
+    case TOKEN_ELEMENT_SUM:
+    case TOKEN_ELEMENT_PROD:
+    case TOKEN_MINIMUM:
+    case TOKEN_MAXIMUM:
+      link = &cloneNode->unary.operand;
+      node = node->unary.operand;
+      continue;
+
+    case TOKEN_IDEN:
+    case TOKEN_DEREF:
+      break;
+
+    case TOKEN_NUMBER:
+      cloneNode->number = node->number;
+      break;
+
+    case TOKEN_VECTOR:
+      cloneNode->vector = node->vector;
+      break;
+
+    case TOKEN_SUM:
+    case TOKEN_PROD:
+    case TOKEN_INTEGRATE:
+    case TOKEN_SOLVE:
+      cloneNode->reduction.from = cloneAST(node->reduction.from, tempAlloc);
+      cloneNode->reduction.to = cloneAST(node->reduction.to, tempAlloc);
+      cloneNode->reduction.body = cloneAST(node->reduction.body, tempAlloc);
+      if (!cloneNode->reduction.from || !cloneNode->reduction.to ||
+          !cloneNode->reduction.body)
+        return NULL;
+      break;
+
+    default:
+      return NULL;
+    }
+    break;
   }
 
-  return cloneNode;
+  return root;
 }
 
-static ASTNode *parseNumber(parser *psr) {
-  char *numberLexeme = GET_CURRENT_TOKEN.lexeme.str;
-  char *end;
+static inline uint32_t pureSize(const ASTNode *left, const ASTNode *right) {
+  if (!left || !left->pureSize || (right && !right->pureSize))
+    return 0;
+  uint64_t size = 1 + (uint64_t)left->pureSize + (right ? right->pureSize : 0);
+  return size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+}
 
-  errno = 0;
-  double num = strtod(numberLexeme, &end);
-  if (errno == ERANGE) {
-    if (num == 0.0) {
-      errno = UNDERFLOW;
-      return NULL;
-    } else if (num == HUGE_VAL || num == -HUGE_VAL) {
-      errno = OVERFLOW;
-      return NULL;
+static size_t countNodes(const ASTNode *node) {
+  size_t count = 0;
+  while (true) {
+    count++;
+    switch (node->type) {
+    case TOKEN_PLUS:
+    case TOKEN_MINUS:
+    case TOKEN_MUL:
+    case TOKEN_DIV:
+    case TOKEN_EXP:
+      count += countNodes(node->binary.right);
+      node = node->binary.left;
+      break;
+
+    case TOKEN_COMMA:
+      count += countNodes(node->binary.left);
+      node = node->binary.right;
+      break;
+
+    case TOKEN_DOT:
+    case TOKEN_RANGE:
+      return count + countNodes(node->binary.left) +
+             countNodes(node->binary.right);
+
+    case TOKEN_UNARY_MINUS:
+    case TOKEN_UNARY_PLUS:
+    case TOKEN_SIN:
+    case TOKEN_COS:
+    case TOKEN_LOG:
+    case TOKEN_OPENBRACKET:
+    case TOKEN_ELEMENT_SUM:
+    case TOKEN_ELEMENT_PROD:
+    case TOKEN_MINIMUM:
+    case TOKEN_MAXIMUM:
+      node = node->unary.operand;
+      break;
+
+    case TOKEN_SUM:
+    case TOKEN_PROD:
+    case TOKEN_INTEGRATE:
+    case TOKEN_SOLVE:
+      return count + countNodes(node->reduction.from) +
+             countNodes(node->reduction.to) + countNodes(node->reduction.body);
+
+    default:
+      return count;
     }
   }
+}
+
+static ASTNode *parseNumber(parser *psr) {
+  real num;
+  if (!number_parse(GET_CURRENT_LEXEME, &num))
+    return NULL;
 
   ASTNode *node = memPool_alloc(&psr->nodePool);
   nodeInit(node, GET_CURRENT_TOKEN);
   node->number = num;
+  node->pureSize = 1;
   psr->currentToken++;
   return node;
 }
 
-static double parseIdentifier(substring key, parser *psr);
-
-static bool substituteIdentifiers(ASTNode *node, parser *psr) {
+static value parseIdentifier(substring key, parser *psr);
+static bool bindAssignment(parser *psr, ASTNode *assignment);
+static bool bindRunning(parser *psr, ASTNode *assignment);
+static bool runReduction(parser *psr, ASTNode *node, real *result);
+static bool runNumeric(parser *psr, ASTNode *node, real *result);
+static bool run(parser *psr, ASTNode *node, value *result);
+static void reportNodeError(parser *psr, const ASTNode *node,
+                            const char *funcName);
+
+// Sets *vectors when the tree needs run() instead of eval() afterwards
+static bool substituteIdentifiers(ASTNode *node, parser *psr, bool *vectors) {
   switch (node->type) {
   case TOKEN_PLUS:
   case TOKEN_MINUS:
   case TOKEN_MUL:
   case TOKEN_DIV:
-  case TOKEN_EXP:
-    return substituteIdentifiers(node->binary.left, psr) &&
-           substituteIdentifiers(node->binary.right, psr);
+  case TOKEN_EXP: {
+    // Left to right, as the references would be resolved when run
+    astChain chain;
+    if (!astChain_push(&chain, node, 0, SIZE_MAX)) {
+      logError("Fatal: Memory allocation failure", __func__);
+      psr->errorReported = true;
+      return false;
+    }
+    bool ok = substituteIdentifiers(astChain_node(&chain, 0)->binary.left, psr,
+                                    vectors);
+    for (size_t i = 0; ok && i < chain.len; i++)
+      ok = substituteIdentifiers(astChain_node(&chain, i)->binary.right, psr,
+                                 vectors);
+    astChain_pop(&chain);
+    return ok;
+  }
 
   case TOKEN_UNARY_MINUS:
   case TOKEN_UNARY_PLUS:
   case TOKEN_SIN:
   case TOKEN_COS:
   case TOKEN_LOG:
-    return substituteIdentifiers(node->unary.operand, psr);
+    return substituteIdentifiers(node->unary.operand, psr, vectors);
+
+  case TOKEN_COMMA:
+    *vectors = true;
+    for (; node->type == TOKEN_COMMA; node = node->binary.right)
+      if (!substituteIdentifiers(node->binary.left, psr, vectors))
+        return false;
+    return substituteIdentifiers(node, psr, vectors);
+
+  case TOKEN_DOT:
+  case TOKEN_RANGE:
+    *vectors = true;
+    return substituteIdentifiers(node->binary.left, psr, vectors) &&
+           substituteIdentifiers(node->binary.right, psr, vectors);
+
+  case TOKEN_OPENBRACKET:
+  case TOKEN_ELEMENT_SUM:
+  case TOKEN_ELEMENT_PROD:
+  case TOKEN_MINIMUM:
+  case TOKEN_MAXIMUM:
+    *vectors = true;
+    return substituteIdentifiers(node->unary.operand, psr, vectors);
+
+  case TOKEN_VECTOR:
+    *vectors = true;
+    return true;
 
   case TOKEN_IDEN: {
-    double value = parseIdentifier(node->identifer, psr);
-    if (value != value) { // check for nan
+    value result = parseIdentifier(node->identifer, psr);
+    if (!result.data && result.scalar != result.scalar) { // check for nan
+      if (psr->errorReported) // a vector operation failed and said why
+        return false;
+      if (errno == MEMORY_BUDGET_EXCEEDED) {
+        reportNodeError(psr, node, __func__); // where the copy did not fit
+        return false;
+      }
       errno = UNDEFINED_REFERENCE;
-      token tmp = {0};
-      tmp.lexeme = node->identifer;
       char buffer[256];
-      createErrorMessage(buffer, sizeof(buffer), &tmp);
+      createErrorMessage(buffer, sizeof(buffer), node->identifer, 0);
       logError(buffer, __func__);
       return false;
     }
+    if (result.data) {
+      node->type = TOKEN_VECTOR;
+      node->vector.data = result.data;
+      node->vector.len = result.len;
+      *vectors = true;
+    } else {
+      node->type = TOKEN_NUMBER;
+      node->number = result.scalar;
+    }
+    return true;
+  }
+
+  // The body depends on the index, so the whole loop runs here
+  case TOKEN_SUM:
+  case TOKEN_PROD:
+  case TOKEN_INTEGRATE:
+  case TOKEN_SOLVE: {
+    real result;
+    bool ok = node->type == TOKEN_SUM || node->type == TOKEN_PROD
+                  ? runReduction(psr, node, &result)
+                  : runNumeric(psr, node, &result);
+    if (!ok)
+      return false;
     node->type = TOKEN_NUMBER;
-    node->number = value;
+    node->number = result;
+    node->pureSize = 1;
     return true;
   }
 
@@ -158,104 +354,304 @@ static bool substituteIdentifiers(ASTNode *node, parser *psr) {
   }
 }
 
-static double parseIdentifier(substring key, parser *psr) {
+// A NaN scalar without data signals an error
+static value resolveIdentifier(substring key, parser *psr) {
+  STATS_ADD(identifierCalls, 1);
+  STATS_MAX(maxRecursionDepth, psr->recursionDepth + 1);
   if (++psr->recursionDepth >= 100) {
     errno = MAXIMUM_RECURSION_DEPTH;
-    return nan("Maximum Recursion Depth");
+    return (value){.scalar = nan("Maximum Recursion Depth")};
   }
 
-  size_t identiferTreeSize;
-  size_t declarationStartIndex;
-  ASTNode *ret = hashMap_getValue(&psr->map, key, &identiferTreeSize,
-                                  &declarationStartIndex);
-
-  if (declarationStartIndex) {
-    size_t returnIndex = psr->currentToken;
-    psr->currentToken = declarationStartIndex;
-    while (ASSIGNMENT_CONTEXT) {
-      parsePrefixExpression(psr);
-    }
-    psr->currentToken = returnIndex;
+  size_t identiferTreeSize = 0;
+  ASTNode *declarations = NULL;
+  ASTNode *ret =
+      hashMap_getValue(&psr->map, key, &identiferTreeSize, &declarations);
+
+  if (declarations)
+    STATS_ADD(declarationBinds, 1);
+  for (; declarations; declarations = declarations->assignment.body) {
+    errno = 0;
+    if (!bindRunning(psr, declarations))
+      return (value){.scalar = nan("Declaration failed")};
   }
 
   if (!ret) {
     errno = UNKNOWN_IDENTIFIER;
-    return nan("unknown identifier");
+    return (value){.scalar = nan("unknown identifier")};
   }
 
-  memPool tempAlloc = {0};
-  memPool_init(&tempAlloc, identiferTreeSize);
-
-  ASTNode *identifierInstance = cloneAST(ret, &tempAlloc);
-  if (!substituteIdentifiers(identifierInstance, psr)) {
-    memPool_free(&tempAlloc);
-    return nan("Substitution failed");
+  // The copy counts against the budget until its value is known. Then it is
+  // dead, and the pool is free again for the next reference at this depth.
+  size_t copyBytes = identiferTreeSize * sizeof(ASTNode);
+  if (!memBudget_charge(copyBytes))
+    return (value){.scalar = nan("Memory budget exceeded")};
+  memPool local = {0};
+  memPool *tempAlloc = &local;
+  clonePools *clones = psr->clones;
+  if (clones && clones->depth < PARSER_CLONE_POOLS)
+    tempAlloc = &clones->pools[clones->depth];
+  if (!memPool_reserve(tempAlloc, identiferTreeSize)) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return (value){.scalar = nan("Allocation failed")};
+  }
+  if (clones)
+    clones->depth++;
+
+  STATS_ADD(cloneCalls, 1);
+  ASTNode *identifierInstance = cloneAST(ret, tempAlloc);
+  bool vectors = false;
+  value result = {0};
+  if (!substituteIdentifiers(identifierInstance, psr, &vectors)) {
+    result = (value){.scalar = nan("Substitution failed")};
+  } else if (vectors) {
+    // Vector data lives in the arena or a loaded file, never in the clone
+    if (!run(psr, identifierInstance, &result))
+      result = (value){.scalar = nan("Vector operation failed")};
+  } else {
+    result.scalar = identifierInstance->pureSize >= 2 * PARALLEL_GRAIN
+                        ? parallel_eval(identifierInstance)
+                        : eval(identifierInstance);
   }
-  double value = eval(identifierInstance);
-  memPool_free(&tempAlloc);
+  STATS_ADD(identifierNodes, tempAlloc->allocated);
+
+  if (clones)
+    clones->depth--;
+  if (tempAlloc == &local)
+    memPool_free(&local);
+  memBudget_release(copyBytes);
+  return result;
+}
+
+static value parseIdentifier(substring key, parser *psr) {
+  profileNode *frame = profile_enter(key);
+  value result = resolveIdentifier(key, psr);
+  profile_leave(frame);
+  return result;
+}
 
-  return value;
+void clonePools_free(clonePools *clones) {
+  for (size_t i = 0; i < PARSER_CLONE_POOLS; i++)
+    memPool_free(&clones->pools[i]);
 }
-static bool assignIdentifier(parser *psr) {
+
+static ASTNode *assignIdentifier(parser *psr) {
   if (psr->parsingAssignment) {
     errno = NESTED_ASSIGNMENT;
-    return false;
+    return NULL;
   }
 
   psr->parsingAssignment = true;
-  substring key = GET_CURRENT_TOKEN.lexeme;
+  ASTNode *assignment = memPool_alloc(&psr->nodePool);
+  nodeInit(assignment, GET_CURRENT_TOKEN);
+  assignment->type = TOKEN_ASSIGNMENT;
+  assignment->identifer = GET_CURRENT_LEXEME;
   psr->currentToken += 2; // skip identifier and assignment operator
 
-  size_t declarationStartIndex = psr->currentToken;
+  // A leading declaration block is parsed once here and bound again on every
+  // reference, before the value is evaluated
+  ASTNode **declaration = &assignment->assignment.declarations;
+  psr->parsingAssignment = false;
   while (ASSIGNMENT_CONTEXT) {
-    int paranthesisCount = psr->unmatchedParanthesisCount;
+    *declaration = parsePrefixExpression(psr);
+    if (!*declaration)
+      return NULL;
+    declaration = &(*declaration)->assignment.body;
+  }
+  psr->parsingAssignment = true;
+
+  assignment->assignment.value = parseExpression(psr);
+  if (!assignment->assignment.value)
+    return NULL;
+
+  psr->parsingAssignment = false;
+  return assignment;
+}
+
+// sum(i, from, to, exp) and prod(...): the body is parsed once here and run
+// for every index when the node is evaluated
+static ASTNode *parseReduction(parser *psr) {
+  ASTNode *node = memPool_alloc(&psr->nodePool);
+  nodeInit(node, GET_CURRENT_TOKEN);
+  psr->currentToken++;
+
+  if (GET_CURRENT_TOKEN.type != TOKEN_OPENPAREN ||
+      GET_TOKEN(psr->currentToken + 1).type != TOKEN_IDEN ||
+      GET_TOKEN(psr->currentToken + 2).type != TOKEN_COMMA) {
+    errno = INVALID_REDUCTION;
+    return NULL;
+  }
+
+  size_t openingParenthesisPosition = psr->currentToken;
+  node->identifer = GET_LEXEME(psr->currentToken + 1);
+  psr->currentToken += 3;
+  psr->unmatchedParanthesisCount++;
+
+  ASTNode **arguments[] = {&node->reduction.from, &node->reduction.to,
+                           &node->reduction.body};
+  for (size_t i = 0; i < 3; i++) {
+    *arguments[i] = parseExpression(psr);
+    if (!*arguments[i])
+      return NULL;
+
+    tokenType separator = i < 2 ? TOKEN_COMMA : TOKEN_CLOSEPAREN;
+    if (GET_CURRENT_TOKEN.type == TOKEN_EOF) {
+      psr->currentToken = openingParenthesisPosition;
+      errno = MISSING_CLOSING_PARENTHESIS;
+      return NULL;
+    }
+    if (GET_CURRENT_TOKEN.type != separator) {
+      errno = INVALID_REDUCTION;
+      return NULL;
+    }
     psr->currentToken++;
-    psr->unmatchedParanthesisCount++;
-    while (psr->unmatchedParanthesisCount != paranthesisCount) {
-      switch (GET_CURRENT_TOKEN.type) {
-      case TOKEN_EOF:
-        errno = PREMATURE_END_OF_EXPRESSION;
-        return false;
+  }
 
-      case TOKEN_OPENPAREN:
-        psr->unmatchedParanthesisCount++;
-        psr->currentToken++;
-        break;
+  psr->unmatchedParanthesisCount--;
+  return node;
+}
 
-      case TOKEN_CLOSEPAREN:
-        psr->unmatchedParanthesisCount--;
-        psr->currentToken++;
-        break;
+// integrate(exp, x, a, b) and solve(exp, x, lo, hi) share the layout of a
+// reduction, with the variable as identifer and the interval as from and to
+static ASTNode *parseNumeric(parser *psr) {
+  ASTNode *node = memPool_alloc(&psr->nodePool);
+  nodeInit(node, GET_CURRENT_TOKEN);
+  psr->currentToken++;
 
-      default:
-        psr->currentToken++;
-        break;
-      }
+  if (GET_CURRENT_TOKEN.type != TOKEN_OPENPAREN) {
+    errno = INVALID_REDUCTION;
+    return NULL;
+  }
+
+  size_t openingParenthesisPosition = psr->currentToken;
+  psr->currentToken++;
+  psr->unmatchedParanthesisCount++;
+
+  ASTNode **arguments[] = {&node->reduction.body, NULL, &node->reduction.from,
+                           &node->reduction.to};
+  for (size_t i = 0; i < 4; i++) {
+    if (arguments[i]) {
+      *arguments[i] = parseExpression(psr);
+      if (!*arguments[i])
+        return NULL;
+    } else if (GET_CURRENT_TOKEN.type == TOKEN_IDEN) {
+      node->identifer = GET_CURRENT_LEXEME;
+      psr->currentToken++;
+    } else {
+      errno = INVALID_REDUCTION;
+      return NULL;
     }
+
+    tokenType separator = i < 3 ? TOKEN_COMMA : TOKEN_CLOSEPAREN;
+    if (GET_CURRENT_TOKEN.type == TOKEN_EOF) {
+      psr->currentToken = openingParenthesisPosition;
+      errno = MISSING_CLOSING_PARENTHESIS;
+      return NULL;
+    }
+    if (GET_CURRENT_TOKEN.type != separator) {
+      errno = INVALID_REDUCTION;
+      return NULL;
+    }
+    psr->currentToken++;
   }
 
-  if (psr->currentToken == declarationStartIndex)
-    declarationStartIndex = 0;
+  psr->unmatchedParanthesisCount--;
+  return node;
+}
 
-  size_t nodeCountBefore = psr->nodePool.used;
+// min(v), max(v), sum(v), prod(v), dot(u, v) and range(from, to); each
+// argument is parsed like a parenthesised expression
+static ASTNode *parseVectorFunction(parser *psr, tokenType type) {
+  ASTNode *node = memPool_alloc(&psr->nodePool);
+  nodeInit(node, GET_CURRENT_TOKEN);
+  node->type = type;
+  node->identifer = GET_CURRENT_LEXEME;
+  psr->currentToken++;
 
-  ASTNode *value = parseExpression(psr);
-  if (!value)
-    return false;
+  if (GET_CURRENT_TOKEN.type != TOKEN_OPENPAREN) {
+    errno = INVALID_VECTOR_SYNTAX;
+    return NULL;
+  }
 
-  size_t identiferTreeSize = psr->nodePool.used - nodeCountBefore;
+  size_t openingParenthesisPosition = psr->currentToken;
+  psr->currentToken++;
+  psr->unmatchedParanthesisCount++;
+
+  bool binary = type == TOKEN_DOT || type == TOKEN_RANGE;
+  ASTNode **arguments[] = {binary ? &node->binary.left : &node->unary.operand,
+                           &node->binary.right};
+  size_t count = binary ? 2 : 1;
+  for (size_t i = 0; i < count; i++) {
+    *arguments[i] = parseExpression(psr);
+    if (!*arguments[i])
+      return NULL;
 
-  hashmap_setKey(&psr->map, key, value, identiferTreeSize,
-                 declarationStartIndex);
-  psr->parsingAssignment = false;
-  return true;
+    tokenType separator = i + 1 < count ? TOKEN_COMMA : TOKEN_CLOSEPAREN;
+    if (GET_CURRENT_TOKEN.type == TOKEN_EOF) {
+      psr->currentToken = openingParenthesisPosition;
+      errno = MISSING_CLOSING_PARENTHESIS;
+      return NULL;
+    }
+    if (GET_CURRENT_TOKEN.type != separator) {
+      errno = INVALID_VECTOR_SYNTAX;
+      return NULL;
+    }
+    psr->currentToken++;
+  }
+
+  psr->unmatchedParanthesisCount--;
+  return node;
 }
 
-static ASTNode *parsePrefixExpression(parser *psr) {
+// [a, b, c]: the elements hang off a chain of TOKEN_COMMA nodes, each holding
+// one element on the left and the rest of the list on the right
+static ASTNode *parseVectorLiteral(parser *psr) {
+  ASTNode *node = memPool_alloc(&psr->nodePool);
+  nodeInit(node, GET_CURRENT_TOKEN);
+  node->identifer = GET_CURRENT_LEXEME;
+  size_t openingBracketPosition = psr->currentToken;
+  psr->currentToken++;
+  psr->unmatchedParanthesisCount++;
+
+  ASTNode **rest = &node->unary.operand;
+  while (true) {
+    ASTNode *element = parseExpression(psr);
+    if (!element)
+      return NULL;
+
+    if (GET_CURRENT_TOKEN.type == TOKEN_EOF) {
+      psr->currentToken = openingBracketPosition;
+      errno = MISSING_CLOSING_PARENTHESIS;
+      return NULL;
+    }
+    if (GET_CURRENT_TOKEN.type == TOKEN_CLOSEBRACKET) {
+      *rest = element;
+      break;
+    }
+    if (GET_CURRENT_TOKEN.type != TOKEN_COMMA) {
+      errno = INVALID_VECTOR_SYNTAX;
+      return NULL;
+    }
+
+    ASTNode *comma = memPool_alloc(&psr->nodePool);
+    nodeInit(comma, GET_CURRENT_TOKEN);
+    comma->binary.left = element;
+    *rest = comma;
+    rest = &comma->binary.right;
+    psr->currentToken++;
+  }
+
+  psr->currentToken++;
+  psr->unmatchedParanthesisCount--;
+  return node;
+}
+
+static ASTNode *parseOperand(parser *psr) {
   ASTNode *ret = NULL;
 
   if (GET_CURRENT_TOKEN.type == TOKEN_EOF ||
-      GET_CURRENT_TOKEN.type == TOKEN_CLOSEPAREN) {
+      GET_CURRENT_TOKEN.type == TOKEN_CLOSEPAREN ||
+      GET_CURRENT_TOKEN.type == TOKEN_CLOSEBRACKET) {
     if (psr->currentToken == 0 ||
         GET_TOKEN(psr->currentToken - 1).type == TOKEN_CLOSEPAREN) {
       errno = MISSING_EXPRESSION;
@@ -276,15 +672,10 @@ static ASTNode *parsePrefixExpression(parser *psr) {
 
   else if (GET_CURRENT_TOKEN.type == TOKEN_IDEN ||
            GET_CURRENT_TOKEN.type == TOKEN_MUL) {
-    if (psr->parsingAssignment && GET_CURRENT_TOKEN.type == TOKEN_IDEN) {
-      ret = memPool_alloc(&psr->nodePool);
-      nodeInit(ret, GET_CURRENT_TOKEN);
-      ret->identifer = GET_CURRENT_TOKEN.lexeme;
-      psr->currentToken++;
-      return ret;
-    }
-
-    if (GET_CURRENT_TOKEN.type == TOKEN_MUL) {
+    // '*' forces eager evaluation, which only differs from a plain reference
+    // inside a definition: it is resolved when the assignment is bound.
+    bool dereference = GET_CURRENT_TOKEN.type == TOKEN_MUL;
+    if (dereference) {
       if (GET_TOKEN(psr->currentToken + 1).type != TOKEN_IDEN) {
         errno = INVALID_OPERAND;
         return NULL;
@@ -292,20 +683,36 @@ static ASTNode *parsePrefixExpression(parser *psr) {
       psr->currentToken++;
     }
 
-    psr->recursionDepth = 0;
-    substring identifer_lexeme = GET_CURRENT_TOKEN.lexeme;
-    double value = parseIdentifier(identifer_lexeme, psr);
-
-    if (value != value)
-      return NULL;
-
     ret = memPool_alloc(&psr->nodePool);
     nodeInit(ret, GET_CURRENT_TOKEN);
-    ret->number = value;
-    ret->type = TOKEN_NUMBER;
+    if (dereference)
+      ret->type = TOKEN_DEREF;
+    ret->identifer = GET_CURRENT_LEXEME;
     psr->currentToken++;
   }
 
+  // sum(i, ...) loops over an index, sum(v) adds up the elements of v
+  else if ((GET_CURRENT_TOKEN.type == TOKEN_SUM ||
+            GET_CURRENT_TOKEN.type == TOKEN_PROD) &&
+           GET_TOKEN(psr->currentToken + 1).type == TOKEN_OPENPAREN &&
+           GET_TOKEN(psr->currentToken + 2).type == TOKEN_IDEN &&
+           GET_TOKEN(psr->currentToken + 3).type == TOKEN_COMMA)
+    ret = parseReduction(psr);
+
+  else if (GET_CURRENT_TOKEN.type == TOKEN_INTEGRATE ||
+           GET_CURRENT_TOKEN.type == TOKEN_SOLVE)
+    ret = parseNumeric(psr);
+
+  else if (GET_CURRENT_TOKEN.type == TOKEN_SUM)
+    ret = parseVectorFunction(psr, TOKEN_ELEMENT_SUM);
+  else if (GET_CURRENT_TOKEN.type == TOKEN_PROD)
+    ret = parseVectorFunction(psr, TOKEN_ELEMENT_PROD);
+  else if (isFunction(GET_CURRENT_TOKEN.type))
+    ret = parseVectorFunction(psr, GET_CURRENT_TOKEN.type);
+
+  else if (GET_CURRENT_TOKEN.type == TOKEN_OPENBRACKET)
+    ret = parseVectorLiteral(psr);
+
   else if (GET_CURRENT_TOKEN.type == TOKEN_OPENPAREN) {
     size_t openingParenthesisPosition = psr->currentToken;
     psr->unmatchedParanthesisCount++;
@@ -313,10 +720,9 @@ static ASTNode *parsePrefixExpression(parser *psr) {
 
     if (GET_CURRENT_TOKEN.type == TOKEN_IDEN &&
         GET_TOKEN(psr->currentToken + 1).type == TOKEN_ASSIGNMENT) {
-      if (!assignIdentifier(psr))
+      ret = assignIdentifier(psr);
+      if (!ret)
         return NULL;
-      ret = memPool_alloc(&psr->nodePool);
-      ret->type = TOKEN_ASSIGNMENT;
     }
 
     else {
@@ -332,12 +738,23 @@ static ASTNode *parsePrefixExpression(parser *psr) {
       return NULL;
     }
 
+    if (GET_CURRENT_TOKEN.type == TOKEN_COMMA) {
+      errno = INVALID_REDUCTION;
+      return NULL;
+    }
+
+    if (GET_CURRENT_TOKEN.type == TOKEN_CLOSEBRACKET) {
+      errno = INVALID_VECTOR_SYNTAX;
+      return NULL;
+    }
+
     if (GET_CURRENT_TOKEN.type == TOKEN_CLOSEPAREN) {
       psr->unmatchedParanthesisCount--;
       psr->currentToken++;
     }
 
   } else if (isUnary(GET_CURRENT_TOKEN.type) ||
+             GET_CURRENT_TOKEN.type == TOKEN_UNARY_PLUS || // parsed again
              GET_CURRENT_TOKEN.type == TOKEN_PLUS ||
              GET_CURRENT_TOKEN.type == TOKEN_MINUS) {
     ret = memPool_alloc(&psr->nodePool);
@@ -350,6 +767,9 @@ static ASTNode *parsePrefixExpression(parser *psr) {
     nodeInit(ret, GET_CURRENT_TOKEN);
     psr->currentToken++;
     ret->unary.operand = parsePrefixExpression(psr);
+    if (!ret->unary.operand)
+      return NULL;
+    ret->pureSize = pureSize(ret->unary.operand, NULL);
   } else {
     errno = INVALID_OPERAND;
   }
@@ -357,6 +777,18 @@ static ASTNode *parsePrefixExpression(parser *psr) {
   return ret;
 }
 
+// Each level of nesting passes through here once
+static ASTNode *parsePrefixExpression(parser *psr) {
+  if (psr->nesting == PARSER_MAX_NESTING) {
+    errno = NESTING_TOO_DEEP;
+    return NULL;
+  }
+  psr->nesting++;
+  ASTNode *ret = parseOperand(psr);
+  psr->nesting--;
+  return ret;
+}
+
 static ASTNode *parseInfixExpression(parser *psr, token currentOperator,
                                      ASTNode *left) {
   ASTNode *ret = memPool_alloc(&psr->nodePool);
@@ -366,13 +798,175 @@ static ASTNode *parseInfixExpression(parser *psr, token currentOperator,
   if (ret->binary.right == NULL) {
     return NULL; // error while parsing sub-expression
   }
+  ret->pureSize = pureSize(left, ret->binary.right);
   return ret;
 }
 
-ASTNode *parseExpression(parser *psr) {
-  // Due to the function being recursive, error can be reported multiple times.
-  static bool errorAlreadyReported = false;
+static void reportError(parser *psr, const char *funcName) {
+  char buffer[256];
+  createErrorMessage(buffer, sizeof(buffer), GET_CURRENT_LEXEME,
+                     GET_CURRENT_TOKEN.pos);
+  if (!psr->quiet)
+    logError(buffer, funcName);
+  psr->errorReported = true;
+}
+
+/*--PARALLEL DECLARATIONS--*/
+typedef struct declarationChunk {
+  parser psr;
+  size_t first; // statement range [first, last)
+  size_t last;
+} declarationChunk;
+
+typedef struct declarationJob {
+  tokenStream *tknStream;
+  const size_t *starts; // first token of each statement, plus one past the end
+  ASTNode **statements; // NULL where parsing failed or never got to
+  declarationChunk *chunks;
+} declarationJob;
+
+static void parseChunk(void *arg, size_t task) {
+  declarationJob *job = arg;
+  declarationChunk *chunk = &job->chunks[task];
+  parser *psr = &chunk->psr;
+
+  for (size_t i = chunk->first; i < chunk->last; i++) {
+    psr->currentToken = job->starts[i];
+    errno = 0;
+    ASTNode *assignment = parsePrefixExpression(psr);
+    if (!assignment || psr->errorReported ||
+        psr->currentToken != job->starts[i + 1])
+      return;
+    job->statements[i] = assignment;
+  }
+}
+
+// Finds the top-level "(iden = ...)" statements from currentToken on by
+// matching parentheses; stops at the first token that does not start one.
+static size_t scanDeclarations(parser *psr, size_t **starts) {
+  size_t count = 0, capacity = 64;
+  *starts = malloc(sizeof(size_t) * capacity);
+  if (!*starts)
+    return 0;
+
+  size_t t = psr->currentToken;
+  while (t + 2 < psr->tknStream->count && GET_TOKEN(t).type == TOKEN_OPENPAREN &&
+         GET_TOKEN(t + 1).type == TOKEN_IDEN &&
+         GET_TOKEN(t + 2).type == TOKEN_ASSIGNMENT) {
+    size_t end = t + 1, depth = 1;
+    for (; depth && GET_TOKEN(end).type != TOKEN_EOF; end++) {
+      if (GET_TOKEN(end).type == TOKEN_OPENPAREN)
+        depth++;
+      else if (GET_TOKEN(end).type == TOKEN_CLOSEPAREN)
+        depth--;
+    }
+    if (depth)
+      break; // unbalanced, left to the serial parser to report
+
+    if (count + 1 >= capacity) {
+      size_t *grown = realloc(*starts, sizeof(size_t) * capacity * 2);
+      if (!grown)
+        break;
+      *starts = grown;
+      capacity *= 2;
+    }
+    (*starts)[count++] = t;
+    t = end;
+  }
+
+  (*starts)[count] = t;
+  return count;
+}
 
+// Parses the statements on the pool, one chunk of roughly equal token count
+// per thread, each into its own node pool. The statements are then bound in
+// source order up to the first one that failed; the serial loop in
+// parseDeclarations() continues from there and reports the error.
+static bool parseDeclarationsParallel(parser *psr) {
+  size_t *starts;
+  size_t count = scanDeclarations(psr, &starts);
+  if (!starts)
+    return true;
+
+  size_t tokens = starts[count] - psr->currentToken;
+  size_t chunkCount = parallel_threads();
+  if (tokens / PARALLEL_GRAIN < chunkCount)
+    chunkCount = tokens / PARALLEL_GRAIN;
+  if (chunkCount < 2) {
+    free(starts);
+    return true;
+  }
+
+  declarationJob job = {
+      .tknStream = psr->tknStream,
+      .starts = starts,
+      .statements = calloc(count, sizeof(ASTNode *)),
+      .chunks = calloc(chunkCount, sizeof(declarationChunk)),
+  };
+  bool ok = job.statements && job.chunks;
+
+  size_t statement = 0;
+  for (size_t c = 0; ok && c < chunkCount; c++) {
+    size_t target = psr->currentToken + tokens * (c + 1) / chunkCount;
+    declarationChunk *chunk = &job.chunks[c];
+    chunk->first = statement;
+    while (statement < count && starts[statement] < target)
+      statement++;
+    chunk->last = statement;
+
+    chunk->psr.tknStream = psr->tknStream;
+    chunk->psr.quiet = true;
+    ok = memPool_init(&chunk->psr.nodePool,
+                      starts[chunk->last] - starts[chunk->first]);
+  }
+
+  if (ok)
+    parallel_run(chunkCount, parseChunk, &job);
+
+  for (size_t c = 0; job.chunks && c < chunkCount; c++) {
+    if (ok && job.chunks[c].psr.nodePool.nodes)
+      ok = memPool_adopt(&psr->nodePool, &job.chunks[c].psr.nodePool);
+    memPool_free(&job.chunks[c].psr.nodePool);
+  }
+
+  for (size_t i = 0; ok && i < count && job.statements[i]; i++) {
+    if (!bindAssignment(psr, job.statements[i])) {
+      free(job.statements);
+      free(job.chunks);
+      free(starts);
+      return false;
+    }
+    psr->currentToken = starts[i + 1];
+  }
+
+  free(job.statements);
+  free(job.chunks);
+  free(starts);
+  if (!ok)
+    logError("Fatal: Memory allocation failure", __func__);
+  return ok;
+}
+
+bool parseDeclarations(parser *psr) {
+  if (parallel_threads() > 1 && !parseDeclarationsParallel(psr))
+    return false;
+
+  while (ASSIGNMENT_CONTEXT) {
+    ASTNode *assignment = parsePrefixExpression(psr);
+    if (!assignment) {
+      if (!psr->errorReported)
+        reportError(psr, __func__);
+      return false;
+    }
+
+    if (!bindAssignment(psr, assignment))
+      return false;
+  }
+
+  return true;
+}
+
+ASTNode *parseExpression(parser *psr) {
   if (psr->currentToken >= psr->tknStream->count) {
     logError("Application Failure: Tried to parse beyond EOF", __func__);
     return NULL;
@@ -385,60 +979,75 @@ ASTNode *parseExpression(parser *psr) {
 
   ASTNode *left = NULL;
 
-  // Multiple assignments might be present.
-  // Assignments don't have anything to expression structure.
-  // So keep processing until node besides assignment is returned.
+  // Multiple assignments might be present. They are bound in order before
+  // the rest of this sub-expression runs, so chain them through their bodies.
+  // A parenthesised group can come back as an assignment chain too, but that
+  // is an operand: only a "(iden = ...)" at this level is a declaration.
+  ASTNode *assignments = NULL;
+  ASTNode **body = &assignments;
   while (true) {
+    bool declaration = ASSIGNMENT_CONTEXT;
     left = parsePrefixExpression(psr);
 
-    if (errorAlreadyReported || !left || left->type != TOKEN_ASSIGNMENT)
+    if (psr->errorReported || !left || !declaration)
       break;
 
-    // TOKEN_ASSIGNMENT isn't needed
-    psr->nodePool.used--;
+    *body = left;
+    body = &left->assignment.body;
   }
 
-  if (errorAlreadyReported)
+  if (psr->errorReported)
     return NULL;
 
   // Malformed unary errors
   if (!left) {
-
-    char buffer[256];
-    createErrorMessage(buffer, sizeof(buffer), &GET_CURRENT_TOKEN);
-    logError(buffer, __func__);
-    errorAlreadyReported = true;
+    reportError(psr, __func__);
     return NULL;
   }
 
-  // Handle possible identifier declaration
+  // Declarations after an operand are bound once that operand has run
   while (ASSIGNMENT_CONTEXT) {
-    parsePrefixExpression(psr);
+    ASTNode *assignment = parsePrefixExpression(psr);
+    if (!assignment)
+      break;
+
+    assignment->assignment.body = left;
+    assignment->assignment.bindAfter = true;
+    left = assignment;
   }
 
+  if (psr->errorReported)
+    return NULL;
+
   token currentOperator = GET_CURRENT_TOKEN;
   precedence currentPrecedence = precedenceMap[currentOperator.type];
 
   // Malformed binary errors
-  if (isUnary(currentOperator.type) || currentOperator.type == TOKEN_NUMBER ||
+  if (isUnary(currentOperator.type) || isFunction(currentOperator.type) ||
+      currentOperator.type == TOKEN_NUMBER ||
       currentOperator.type == TOKEN_IDEN ||
-      currentOperator.type == TOKEN_OPENPAREN) {
+      currentOperator.type == TOKEN_OPENPAREN ||
+      currentOperator.type == TOKEN_OPENBRACKET) {
     errno = MISSING_OPERATOR;
   } else if (currentOperator.type == TOKEN_CLOSEPAREN) {
     if (psr->unmatchedParanthesisCount != 0) {
       // return back to the unary expression handling function
-      return left;
+      *body = left;
+      return assignments;
     }
     errno = UNMATCHED_CLOSING_PARENTHEIS;
   } else if (currentOperator.type == TOKEN_ASSIGNMENT) {
     errno = INVALID_ASSIGNMENT_SYNTAX;
+  } else if (currentOperator.type == TOKEN_COMMA &&
+             psr->unmatchedParanthesisCount == 0) {
+    errno = INVALID_REDUCTION;
+  } else if (currentOperator.type == TOKEN_CLOSEBRACKET &&
+             psr->unmatchedParanthesisCount == 0) {
+    errno = INVALID_VECTOR_SYNTAX;
   }
 
   if (errno) {
-    char buffer[256];
-    createErrorMessage(buffer, sizeof(buffer), &GET_CURRENT_TOKEN);
-    logError(buffer, __func__);
-    errorAlreadyReported = true;
+    reportError(psr, __func__);
     return NULL;
   }
 
@@ -457,5 +1066,649 @@ ASTNode *parseExpression(parser *psr) {
     currentPrecedence = precedenceMap[currentOperator.type];
   }
 
-  return left;
+  *body = left;
+  return assignments;
+}
+
+/*--EVALUATION--*/
+static void reportNodeError(parser *psr, const ASTNode *node,
+                            const char *funcName) {
+  char buffer[256];
+  createErrorMessage(buffer, sizeof(buffer), node->identifer, node->pos);
+  logError(buffer, funcName);
+  psr->errorReported = true;
+}
+
+static bool containsDereference(const ASTNode *node) {
+  while (true) {
+    switch (node->type) {
+    case TOKEN_PLUS:
+    case TOKEN_MINUS:
+    case TOKEN_MUL:
+    case TOKEN_DIV:
+    case TOKEN_EXP:
+      if (containsDereference(node->binary.right))
+        return true;
+      node = node->binary.left;
+      break;
+
+    case TOKEN_COMMA:
+      if (containsDereference(node->binary.left))
+        return true;
+      node = node->binary.right;
+      break;
+
+    case TOKEN_DOT:
+    case TOKEN_RANGE:
+      return containsDereference(node->binary.left) ||
+             containsDereference(node->binary.right);
+
+    case TOKEN_UNARY_MINUS:
+    case TOKEN_UNARY_PLUS:
+    case TOKEN_SIN:
+    case TOKEN_COS:
+    case TOKEN_LOG:
+    case TOKEN_OPENBRACKET:
+    case TOKEN_ELEMENT_SUM:
+    case TOKEN_ELEMENT_PROD:
+    case TOKEN_MINIMUM:
+    case TOKEN_MAXIMUM:
+      node = node->unary.operand;
+      break;
+
+    case TOKEN_SUM:
+    case TOKEN_PROD:
+    case TOKEN_INTEGRATE:
+    case TOKEN_SOLVE:
+      return containsDereference(node->reduction.from) ||
+             containsDereference(node->reduction.to) ||
+             containsDereference(node->reduction.body);
+
+    case TOKEN_DEREF:
+      return true;
+
+    default:
+      return false;
+    }
+  }
+}
+
+// Replaces every dereference in a freshly cloned definition by its value
+static bool resolveDereferences(ASTNode *node, parser *psr) {
+  switch (node->type) {
+  case TOKEN_PLUS:
+  case TOKEN_MINUS:
+  case TOKEN_MUL:
+  case TOKEN_DIV:
+  case TOKEN_EXP: {
+    astChain chain;
+    if (!astChain_push(&chain, node, 0, SIZE_MAX)) {
+      logError("Fatal: Memory allocation failure", __func__);
+      psr->errorReported = true;
+      return false;
+    }
+    bool ok = resolveDereferences(astChain_node(&chain, 0)->binary.left, psr);
+    for (size_t i = 0; ok && i < chain.len; i++)
+      ok = resolveDereferences(astChain_node(&chain, i)->binary.right, psr);
+    astChain_pop(&chain);
+    return ok;
+  }
+
+  case TOKEN_COMMA:
+    for (; node->type == TOKEN_COMMA; node = node->binary.right)
+      if (!resolveDereferences(node->binary.left, psr))
+        return false;
+    return resolveDereferences(node, psr);
+
+  case TOKEN_DOT:
+  case TOKEN_RANGE:
+    return resolveDereferences(node->binary.left, psr) &&
+           resolveDereferences(node->binary.right, psr);
+
+  case TOKEN_UNARY_MINUS:
+  case TOKEN_UNARY_PLUS:
+  case TOKEN_SIN:
+  case TOKEN_COS:
+  case TOKEN_LOG:
+  case TOKEN_OPENBRACKET:
+  case TOKEN_ELEMENT_SUM:
+  case TOKEN_ELEMENT_PROD:
+  case TOKEN_MINIMUM:
+  case TOKEN_MAXIMUM:
+    return resolveDereferences(node->unary.operand, psr);
+
+  case TOKEN_SUM:
+  case TOKEN_PROD:
+  case TOKEN_INTEGRATE:
+  case TOKEN_SOLVE:
+    return resolveDereferences(node->reduction.from, psr) &&
+           resolveDereferences(node->reduction.to, psr) &&
+           resolveDereferences(node->reduction.body, psr);
+
+  case TOKEN_DEREF: {
+    psr->recursionDepth = psr->baseDepth;
+    value result = parseIdentifier(node->identifer, psr);
+    if (!result.data && result.scalar != result.scalar) {
+      if (!psr->errorReported)
+        reportNodeError(psr, node, __func__);
+      return false;
+    }
+    // A vector stays valid for as long as the layer it is bound in
+    if (result.data) {
+      node->type = TOKEN_VECTOR;
+      node->vector.data = result.data;
+      node->vector.len = result.len;
+    } else {
+      node->type = TOKEN_NUMBER;
+      node->number = result.scalar;
+    }
+    return true;
+  }
+
+  default:
+    return true;
+  }
+}
+
+static bool bindAssignment(parser *psr, ASTNode *assignment) {
+  ASTNode *value = assignment->assignment.value;
+
+  // The parsed definition may be shared (e.g. by a cached program), so
+  // dereferences are resolved on a copy
+  if (containsDereference(value)) {
+    STATS_ADD(cloneCalls, 1);
+    value = cloneAST(value, &psr->nodePool);
+    if (!value) {
+      logError("Fatal: Memory allocation failure", __func__);
+      return false;
+    }
+    if (!resolveDereferences(value, psr))
+      return false;
+  }
+
+  if (!hashmap_setKey(&psr->map, assignment->identifer, value,
+                      countNodes(value), assignment->assignment.declarations)) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return false;
+  }
+  return true;
+}
+
+// Assignments made while running hold a map entry for the rest of the
+// evaluation, which counts against the budget
+static bool bindRunning(parser *psr, ASTNode *assignment) {
+  size_t entries = psr->map.count;
+  if (!bindAssignment(psr, assignment))
+    return false;
+  if (psr->map.count > entries && !memBudget_charge(sizeof(entry))) {
+    reportNodeError(psr, assignment, __func__);
+    return false;
+  }
+  return true;
+}
+
+static void reportEvalError(parser *psr, const ASTNode *node,
+                              const char *funcName) {
+  // An allocation failure has been logged already and left a system errno
+  if (errno >= MISSING_ERROR_CODE)
+    reportNodeError(psr, node, funcName);
+  psr->errorReported = true;
+}
+
+// Runs a node whose value has to be a number
+static bool runScalar(parser *psr, ASTNode *node, real *result) {
+  value operand;
+  if (!run(psr, node, &operand))
+    return false;
+  if (operand.data) {
+    errno = INVALID_VECTOR_USE;
+    reportNodeError(psr, node, __func__);
+    return false;
+  }
+  *result = operand.scalar;
+  return true;
+}
+
+// Binds name to index in a map layer of its own, which also keeps
+// assignments made by a loop body out of the rest of the expression.
+// References in the body count their depth from here, so an identifier that
+// loops over itself still reaches the recursion limit.
+typedef struct indexLayer {
+  hashMap outer;
+  entry *bucket; // the layer's only one
+  size_t depth;
+  size_t base;
+} indexLayer;
+
+// The layer's entries go back to the outer map, which lent it its spares
+static void popIndex(parser *psr, indexLayer *layer) {
+  psr->baseDepth = layer->base;
+  psr->recursionDepth = layer->depth;
+  hashMap_clear(&psr->map);
+  layer->outer.spare = psr->map.spare;
+  psr->map = layer->outer;
+}
+
+static bool pushIndex(parser *psr, substring name, ASTNode *index,
+                      indexLayer *layer) {
+  layer->outer = psr->map;
+  layer->bucket = NULL;
+  psr->map = (hashMap){.size = 1,
+                       .buckets = &layer->bucket,
+                       .parent = &layer->outer,
+                       .spare = layer->outer.spare};
+  layer->outer.spare = NULL;
+
+  layer->depth = psr->recursionDepth;
+  layer->base = psr->baseDepth;
+  psr->baseDepth = layer->depth;
+
+  if (!hashmap_setKey(&psr->map, name, index, 1, NULL)) {
+    logError("Fatal: Memory allocation failure", __func__);
+    popIndex(psr, layer);
+    return false;
+  }
+  return true;
+}
+
+// Index i runs over from, from + 1, ... up to to. Bodies of numbers,
+// operators and the index go through the native loop in reduce.c; any other
+// body runs once per index with the index bound by pushIndex().
+static bool runReduction(parser *psr, ASTNode *node, real *result) {
+  real from, to;
+  if (!runScalar(psr, node->reduction.from, &from) ||
+      !runScalar(psr, node->reduction.to, &to))
+    return false;
+
+  size_t count;
+  if (!reduce_indexCount(from, to, REDUCE_MAX_COUNT, &count)) {
+    reportNodeError(psr, node, __func__);
+    return false;
+  }
+
+  accumulator acc = reduce_init(node->type);
+  if (reduce_isNative(node->reduction.body, node->identifer)) {
+    reduce_native(&acc, node->reduction.body, from, count);
+    *result = reduce_result(&acc);
+    return true;
+  }
+
+  ASTNode *index = memPool_alloc(&psr->nodePool);
+  indexLayer layer;
+  if (!index) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return false;
+  }
+  *index = (ASTNode){.type = TOKEN_NUMBER, .pos = node->pos, .pureSize = 1};
+  if (!pushIndex(psr, node->identifer, index, &layer))
+    return false;
+
+  bool ok = true;
+  for (size_t i = 0; ok && i < count; i++) {
+    real term;
+    index->number = from + (real)i;
+    ok = runScalar(psr, node->reduction.body, &term);
+    if (ok)
+      reduce_add(&acc, term);
+  }
+
+  popIndex(psr, &layer);
+  *result = reduce_result(&acc);
+  return ok;
+}
+
+// Bounds the tree built by inlineExpression(); identifiers used several times
+// by each other would otherwise multiply its size
+#define INLINE_MAX_NODES 4096
+// Assignments of a leading declaration block the inliner binds itself
+#define INLINE_MAX_LOCALS 16
+
+typedef struct inlineState {
+  parser *psr;
+  const substring *names;
+  ASTNode *variables;
+  size_t count;
+  const ASTNode *locals[INLINE_MAX_LOCALS];
+  size_t localCount;
+  memPool *pool;
+  size_t budget;
+} inlineState;
+
+// Definition an identifier has inside the inlined tree, NULL when unknown
+// or when it needs its own declarations bound first
+static const ASTNode *inlineDefinition(inlineState *s, substring name) {
+  for (size_t k = s->localCount; k-- > 0;)
+    if (substringCmp(name, s->locals[k]->identifer))
+      return s->locals[k]->assignment.value;
+
+  size_t treeSize = 0;
+  ASTNode *declarations = NULL;
+  ASTNode *definition =
+      hashMap_getValue(&s->psr->map, name, &treeSize, &declarations);
+  return declarations ? NULL : definition;
+}
+
+// Takes over the assignments in front of the expression, as run() would bind
+// them before the body. Returns the body, or NULL when one cannot be inlined.
+static const ASTNode *inlineDeclarations(inlineState *s, const ASTNode *root) {
+  for (; root->type == TOKEN_ASSIGNMENT; root = root->assignment.body) {
+    if (s->localCount == INLINE_MAX_LOCALS || !root->assignment.body ||
+        root->assignment.bindAfter || root->assignment.declarations ||
+        containsDereference(root->assignment.value))
+      return NULL;
+    for (size_t k = 0; k < s->count; k++)
+      if (substringCmp(root->identifer, s->names[k]))
+        return NULL;
+    s->locals[s->localCount++] = root;
+  }
+  return root;
+}
+
+static ASTNode *inlineNode(inlineState *s, const ASTNode *node, size_t depth) {
+  if (depth >= 100 || !s->budget)
+    return NULL;
+
+  if (node->type == TOKEN_IDEN) {
+    for (size_t k = 0; k < s->count; k++)
+      if (substringCmp(node->identifer, s->names[k]))
+        return &s->variables[k];
+    const ASTNode *definition = inlineDefinition(s, node->identifer);
+    return definition ? inlineNode(s, definition, depth + 1) : NULL;
+  }
+
+  ASTNode *copy = memPool_alloc(s->pool);
+  if (!copy)
+    return NULL;
+  s->budget--;
+  *copy = (ASTNode){.type = node->type, .pos = node->pos};
+
+  switch (node->type) {
+  case TOKEN_NUMBER:
+    copy->number = node->number;
+    return copy;
+
+  case TOKEN_UNARY_MINUS:
+  case TOKEN_UNARY_PLUS:
+  case TOKEN_SIN:
+  case TOKEN_COS:
+  case TOKEN_LOG:
+    copy->unary.operand = inlineNode(s, node->unary.operand, depth);
+    return copy->unary.operand ? copy : NULL;
+
+  case TOKEN_PLUS:
+  case TOKEN_MINUS:
+  case TOKEN_MUL:
+  case TOKEN_DIV:
+  case TOKEN_EXP:
+    copy->binary.left = inlineNode(s, node->binary.left, depth);
+    if (!copy->binary.left)
+      return NULL;
+    copy->binary.right = inlineNode(s, node->binary.right, depth);
+    return copy->binary.right ? copy : NULL;
+
+  default:
+    return NULL;
+  }
+}
+
+ASTNode *inlineExpression(parser *psr, const ASTNode *root,
+                          const substring *names, ASTNode *variables,
+                          size_t count, memPool *pool) {
+  inlineState s = {.psr = psr,
+                   .names = names,
+                   .variables = variables,
+                   .count = count,
+                   .pool = pool,
+                   .budget = INLINE_MAX_NODES};
+  root = inlineDeclarations(&s, root);
+  return root ? inlineNode(&s, root, 0) : NULL;
+}
+
+// Argument of evalBound(): the body runs through eval() when it could be
+// inlined, otherwise through run() with the variable bound by pushIndex()
+typedef struct boundFunction {
+  parser *psr;
+  ASTNode *body;
+  ASTNode *variable;
+  bool inlined;
+} boundFunction;
+
+static bool evalBound(void *arg, real x, real *y) {
+  boundFunction *fn = arg;
+  fn->variable->number = x;
+  if (fn->inlined) {
+    *y = eval(fn->body);
+    return true;
+  }
+  return runScalar(fn->psr, fn->body, y);
+}
+
+// integrate() and solve() call the body at points chosen by numeric.c. It is
+// parsed once; definitions it uses are inlined into one tree up front when
+// possible, so no point goes through parseIdentifier().
+static bool runNumeric(parser *psr, ASTNode *node, real *result) {
+  real from, to;
+  if (!runScalar(psr, node->reduction.from, &from) ||
+      !runScalar(psr, node->reduction.to, &to))
+    return false;
+
+  memPool pool = {0};
+  if (!memPool_init(&pool, 64)) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return false;
+  }
+  ASTNode *variable = memPool_alloc(&pool);
+  *variable = (ASTNode){.type = TOKEN_NUMBER, .pos = node->pos, .pureSize = 1};
+
+  boundFunction fn = {.psr = psr, .variable = variable};
+  fn.body = inlineExpression(psr, node->reduction.body, &node->identifer,
+                             variable, 1, &pool);
+  fn.inlined = fn.body != NULL;
+
+  indexLayer layer;
+  if (!fn.inlined) {
+    fn.body = node->reduction.body;
+    if (!pushIndex(psr, node->identifer, variable, &layer)) {
+      memPool_free(&pool);
+      return false;
+    }
+  }
+
+  errno = 0;
+  bool ok = node->type == TOKEN_INTEGRATE
+                ? numeric_integrate(evalBound, &fn, from, to, result)
+                : numeric_solve(evalBound, &fn, from, to, result);
+  if (!ok && !psr->errorReported)
+    reportEvalError(psr, node, __func__);
+
+  if (!fn.inlined)
+    popIndex(psr, &layer);
+  memPool_free(&pool);
+  return ok;
+}
+
+// Elements are numbers, evaluated left to right into one arena block
+static bool runVectorLiteral(parser *psr, ASTNode *node, value *result) {
+  size_t len = 1;
+  for (ASTNode *rest = node->unary.operand; rest->type == TOKEN_COMMA;
+       rest = rest->binary.right)
+    len++;
+
+  if (!psr->arena) {
+    errno = INVALID_VECTOR_USE;
+    reportNodeError(psr, node, __func__);
+    return false;
+  }
+  if (!memBudget_charge(len * sizeof(real))) {
+    reportNodeError(psr, node, __func__);
+    return false;
+  }
+  real *data = vectorArena_alloc(psr->arena, len);
+  if (!data) {
+    logError("Fatal: Memory allocation failure", __func__);
+    psr->errorReported = true;
+    return false;
+  }
+
+  ASTNode *rest = node->unary.operand;
+  for (size_t i = 0; i < len; i++) {
+    ASTNode *element = i + 1 < len ? rest->binary.left : rest;
+    if (!runScalar(psr, element, &data[i]))
+      return false;
+    rest = rest->binary.right;
+  }
+
+  *result = (value){.data = data, .len = len};
+  return true;
+}
+
+// Runs the first operand of the chain, then each operator up from the bottom
+// with its right operand. A pure part below that is large enough for
+// parallel_eval() is left to run() as the first operand.
+static bool runChain(parser *psr, const ASTNode *top, value *result) {
+  astChain chain;
+  if (!astChain_push(&chain, top, 0, 2 * PARALLEL_GRAIN)) {
+    logError("Fatal: Memory allocation failure", __func__);
+    psr->errorReported = true;
+    return false;
+  }
+
+  bool ok = run(psr, astChain_node(&chain, 0)->binary.left, result);
+  for (size_t i = 0; ok && i < chain.len; i++) {
+    const ASTNode *node = astChain_node(&chain, i);
+    value right;
+    ok = run(psr, node->binary.right, &right);
+    if (ok && !vector_binary(psr->arena, node->type, *result, right, result)) {
+      reportEvalError(psr, node, __func__);
+      ok = false;
+    }
+  }
+  astChain_pop(&chain);
+  return ok;
+}
+
+// Runs the tree strictly left to right, so references and assignments take
+// effect in the order they appear in the expression. Vector results are
+// allocated from psr->arena.
+static bool run(parser *psr, ASTNode *node, value *result) {
+  value left, right;
+  real from, to;
+
+  if (node->pureSize >= 2 * PARALLEL_GRAIN) {
+    *result = (value){.scalar = parallel_eval(node)};
+    return true;
+  }
+
+  switch (node->type) {
+  case TOKEN_NUMBER:
+    *result = (value){.scalar = node->number};
+    return true;
+
+  case TOKEN_VECTOR:
+    *result = (value){.data = node->vector.data, .len = node->vector.len};
+    return true;
+
+  case TOKEN_IDEN:
+  case TOKEN_DEREF:
+    psr->recursionDepth = psr->baseDepth;
+    *result = parseIdentifier(node->identifer, psr);
+    if (!result->data && result->scalar != result->scalar) {
+      if (!psr->errorReported) // already reported inside a loop body
+        reportNodeError(psr, node, __func__);
+      return false;
+    }
+    return true;
+
+  case TOKEN_ASSIGNMENT:
+    if (!node->assignment.bindAfter && !bindRunning(psr, node))
+      return false;
+    if (!node->assignment.body) {
+      *result = (value){.scalar = nan("Assignment without expression")};
+      return true;
+    }
+    if (!run(psr, node->assignment.body, result))
+      return false;
+    return !node->assignment.bindAfter || bindRunning(psr, node);
+
+  case TOKEN_UNARY_MINUS:
+  case TOKEN_UNARY_PLUS:
+  case TOKEN_SIN:
+  case TOKEN_COS:
+  case TOKEN_LOG:
+    if (!run(psr, node->unary.operand, &left))
+      return false;
+    if (!vector_unary(psr->arena, node->type, left, result)) {
+      reportEvalError(psr, node, __func__);
+      return false;
+    }
+    return true;
+
+  case TOKEN_PLUS:
+  case TOKEN_MINUS:
+  case TOKEN_MUL:
+  case TOKEN_DIV:
+  case TOKEN_EXP:
+    return runChain(psr, node, result);
+
+  case TOKEN_SUM:
+  case TOKEN_PROD:
+    *result = (value){0};
+    return runReduction(psr, node, &result->scalar);
+
+  case TOKEN_INTEGRATE:
+  case TOKEN_SOLVE:
+    *result = (value){0};
+    return runNumeric(psr, node, &result->scalar);
+
+  case TOKEN_OPENBRACKET:
+    return runVectorLiteral(psr, node, result);
+
+  case TOKEN_ELEMENT_SUM:
+  case TOKEN_ELEMENT_PROD:
+  case TOKEN_MINIMUM:
+  case TOKEN_MAXIMUM:
+    if (!run(psr, node->unary.operand, &left))
+      return false;
+    if (!vector_reduce(node->type, left, result)) {
+      reportEvalError(psr, node, __func__);
+      return false;
+    }
+    return true;
+
+  case TOKEN_DOT:
+    if (!run(psr, node->binary.left, &left) ||
+        !run(psr, node->binary.right, &right))
+      return false;
+    if (!vector_dot(left, right, result)) {
+      reportEvalError(psr, node, __func__);
+      return false;
+    }
+    return true;
+
+  case TOKEN_RANGE:
+    if (!runScalar(psr, node->binary.left, &from) ||
+        !runScalar(psr, node->binary.right, &to))
+      return false;
+    if (!vector_range(psr->arena, from, to, result)) {
+      reportEvalError(psr, node, __func__);
+      return false;
+    }
+    return true;
+
+  default:
+    *result = (value){.scalar = nan("Invalid Token")};
+    return true;
+  }
+}
+
+bool runExpression(parser *psr, ASTNode *root, real *result) {
+  errno = 0;
+  psr->errorReported = false;
+  return runScalar(psr, root, result);
+}
+
+bool runExpressionValue(parser *psr, ASTNode *root, value *result) {
+  errno = 0;
+  psr->errorReported = false;
+  return run(psr, root, result);
 }
@@ -0,0 +1,343 @@
+#define _POSIX_C_SOURCE 200809L
+#include "profile.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Deepest chain written out; parseIdentifier() stops at 100 anyway
+#define PROFILE_MAX_DEPTH 128
+
+struct profileNode {
+  char *name; // own copy, the expression text may be gone by the report
+  size_t len;
+  size_t hash;
+  profileNode *parent;
+  profileNode *child;
+  profileNode *sibling;
+  profileNode *bucketNext;
+
+  unsigned long long calls;
+  unsigned long long inclusiveNs;
+  unsigned long long childNs; // inclusive time of the nested references
+  unsigned long long start;   // of the call in progress
+};
+
+// The calls of one thread, or all of them merged. Children are found through
+// one table keyed on parent and name, as a reference may have thousands.
+typedef struct profileTree {
+  profileNode root;
+  profileNode **buckets;
+  size_t size;
+  size_t count;
+  struct profileTree *next;
+} profileTree;
+
+static bool enabled;
+
+// Every thread's tree, for the report. A reset bumps the generation, which
+// makes each thread start a new tree on its next reference.
+static pthread_mutex_t treesLock = PTHREAD_MUTEX_INITIALIZER;
+static profileTree *trees;
+static unsigned long generation = 1;
+
+static _Thread_local profileTree *tree;
+static _Thread_local profileNode *current;
+static _Thread_local unsigned long treeGeneration;
+
+void profile_setEnabled(bool enable) { enabled = enable; }
+
+bool profile_enabled(void) { return enabled; }
+
+static unsigned long long profileClock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull +
+         (unsigned long long)ts.tv_nsec;
+}
+
+/*--TREES--*/
+static profileTree *treeInit(void) {
+  profileTree *t = calloc(1, sizeof(profileTree));
+  if (t && !(t->buckets = calloc(64, sizeof(profileNode *)))) {
+    free(t);
+    return NULL;
+  }
+  if (t)
+    t->size = 64;
+  return t;
+}
+
+static void freeNodes(profileNode *node) {
+  while (node) {
+    profileNode *next = node->sibling;
+    freeNodes(node->child);
+    free(node->name);
+    free(node);
+    node = next;
+  }
+}
+
+static void treeFree(profileTree *t) {
+  freeNodes(t->root.child);
+  free(t->buckets);
+  free(t);
+}
+
+static size_t childHash(const profileNode *parent, size_t nameHash) {
+  return nameHash ^ ((uintptr_t)parent >> 4) * 0x9E3779B97F4A7C15ull;
+}
+
+static bool treeGrow(profileTree *t) {
+  size_t size = t->size * 2;
+  profileNode **buckets = calloc(size, sizeof(profileNode *));
+  if (!buckets)
+    return false;
+  for (size_t i = 0; i < t->size; i++) {
+    for (profileNode *n = t->buckets[i], *next; n; n = next) {
+      next = n->bucketNext;
+      size_t b = childHash(n->parent, n->hash) % size;
+      n->bucketNext = buckets[b];
+      buckets[b] = n;
+    }
+  }
+  free(t->buckets);
+  t->buckets = buckets;
+  t->size = size;
+  return true;
+}
+
+// parent's child called name, added when it has none; NULL when out of memory
+static profileNode *childOf(profileTree *t, profileNode *parent,
+                            substring name, size_t nameHash) {
+  profileNode **bucket = &t->buckets[childHash(parent, nameHash) % t->size];
+  for (profileNode *n = *bucket; n; n = n->bucketNext)
+    if (n->parent == parent && n->len == name.len &&
+        memcmp(n->name, name.str, name.len) == 0)
+      return n;
+
+  if (t->count >= t->size && treeGrow(t))
+    bucket = &t->buckets[childHash(parent, nameHash) % t->size];
+  profileNode *node = calloc(1, sizeof(profileNode));
+  char *copy = malloc(name.len + 1);
+  if (!node || !copy) {
+    free(node);
+    free(copy);
+    return NULL;
+  }
+  memcpy(copy, name.str, name.len);
+  copy[name.len] = '\0';
+  node->name = copy;
+  node->len = name.len;
+  node->hash = nameHash;
+  node->parent = parent;
+  node->sibling = parent->child;
+  parent->child = node;
+  node->bucketNext = *bucket;
+  *bucket = node;
+  t->count++;
+  return node;
+}
+
+/*--RECORDING--*/
+static profileTree *threadTree(void) {
+  profileTree *t = treeInit();
+  if (!t)
+    return NULL;
+  pthread_mutex_lock(&treesLock);
+  t->next = trees;
+  trees = t;
+  treeGeneration = generation;
+  pthread_mutex_unlock(&treesLock);
+  return t;
+}
+
+profileNode *profile_enter(substring name) {
+  if (!enabled)
+    return NULL;
+  if (!tree || treeGeneration != generation) {
+    tree = threadTree();
+    current = tree ? &tree->root : NULL;
+  }
+  if (!tree)
+    return NULL;
+
+  profileNode *node = childOf(tree, current, name, substringHash(name));
+  if (!node)
+    return NULL; // not recorded, the rest of the chain still is
+
+  node->calls++;
+  current = node;
+  node->start = profileClock();
+  return node;
+}
+
+void profile_leave(profileNode *node) {
+  if (!node)
+    return;
+  unsigned long long elapsed = profileClock() - node->start;
+  node->inclusiveNs += elapsed;
+  node->parent->childNs += elapsed;
+  current = node->parent;
+}
+
+/*--REPORTING--*/
+// Adds src's counts and children to dst, matching children by name
+static bool mergeTree(profileTree *t, profileNode *dst,
+                      const profileNode *src) {
+  dst->calls += src->calls;
+  dst->inclusiveNs += src->inclusiveNs;
+  dst->childNs += src->childNs;
+  for (const profileNode *c = src->child; c; c = c->sibling) {
+    substring name = {.str = c->name, .len = c->len};
+    profileNode *match = childOf(t, dst, name, c->hash);
+    if (!match || !mergeTree(t, match, c))
+      return false;
+  }
+  return true;
+}
+
+// One tree for every thread's calls, NULL after an allocation failure
+static profileTree *mergedTree(void) {
+  profileTree *merged = treeInit();
+  pthread_mutex_lock(&treesLock);
+  for (profileTree *t = trees; merged && t; t = t->next) {
+    if (!mergeTree(merged, &merged->root, &t->root)) {
+      treeFree(merged);
+      merged = NULL;
+    }
+  }
+  pthread_mutex_unlock(&treesLock);
+  if (!merged)
+    logError("Fatal: Memory allocation failure", __func__);
+  return merged;
+}
+
+static unsigned long long exclusiveNs(const profileNode *node) {
+  return node->inclusiveNs > node->childNs ? node->inclusiveNs - node->childNs
+                                           : 0;
+}
+
+static bool writeStacks(FILE *out, const profileNode *node,
+                        const profileNode **stack, size_t depth) {
+  for (; node; node = node->sibling) {
+    stack[depth] = node;
+    if (node->calls) {
+      for (size_t i = 0; i <= depth; i++) {
+        if (i && fputc(';', out) == EOF)
+          return false;
+        // ';' separates frames, so one inside a name is written as '_'
+        for (size_t c = 0; c < stack[i]->len; c++)
+          if (fputc(stack[i]->name[c] == ';' ? '_' : stack[i]->name[c],
+                    out) == EOF)
+            return false;
+      }
+      if (fprintf(out, " %llu\n", exclusiveNs(node)) < 0)
+        return false;
+    }
+    if (depth + 1 < PROFILE_MAX_DEPTH &&
+        !writeStacks(out, node->child, stack, depth + 1))
+      return false;
+  }
+  return true;
+}
+
+bool profile_writeFolded(FILE *out) {
+  profileTree *merged = mergedTree();
+  if (!merged)
+    return false;
+  const profileNode *stack[PROFILE_MAX_DEPTH];
+  bool ok = writeStacks(out, merged->root.child, stack, 0) && fflush(out) == 0;
+  treeFree(merged);
+  return ok;
+}
+
+typedef struct identifierTotals {
+  const char *name;
+  unsigned long long calls;
+  unsigned long long inclusiveNs;
+  unsigned long long exclusiveNs;
+} identifierTotals;
+
+static bool outermost(const profileNode *node) {
+  for (const profileNode *a = node->parent; a; a = a->parent)
+    if (a->len == node->len && memcmp(a->name, node->name, a->len) == 0)
+      return false;
+  return true;
+}
+
+static size_t collectNodes(const profileNode *node, const profileNode **out) {
+  size_t count = 0;
+  for (; node; node = node->sibling) {
+    out[count++] = node;
+    count += collectNodes(node->child, out + count);
+  }
+  return count;
+}
+
+static int byName(const void *a, const void *b) {
+  return strcmp((*(const profileNode *const *)a)->name,
+                (*(const profileNode *const *)b)->name);
+}
+
+static int byExclusive(const void *a, const void *b) {
+  const identifierTotals *x = a, *y = b;
+  return (x->exclusiveNs < y->exclusiveNs) - (x->exclusiveNs > y->exclusiveNs);
+}
+
+void profile_printSummary(FILE *out) {
+  profileTree *merged = mergedTree();
+  if (!merged)
+    return;
+  size_t count = merged->count;
+  const profileNode **nodes = malloc(sizeof(profileNode *) * (count + 1));
+  identifierTotals *totals = malloc(sizeof(identifierTotals) * (count + 1));
+  if (!nodes || !totals) {
+    logError("Fatal: Memory allocation failure", __func__);
+    free(nodes);
+    free(totals);
+    treeFree(merged);
+    return;
+  }
+
+  // Same names next to each other, then one row per name
+  collectNodes(merged->root.child, nodes);
+  qsort(nodes, count, sizeof(nodes[0]), byName);
+  size_t rows = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (!i || strcmp(nodes[i]->name, nodes[i - 1]->name) != 0)
+      totals[rows++] = (identifierTotals){.name = nodes[i]->name};
+    identifierTotals *t = &totals[rows - 1];
+    t->calls += nodes[i]->calls;
+    t->exclusiveNs += exclusiveNs(nodes[i]);
+    if (outermost(nodes[i]))
+      t->inclusiveNs += nodes[i]->inclusiveNs;
+  }
+  qsort(totals, rows, sizeof(totals[0]), byExclusive);
+
+  fprintf(out, "%-24s %12s %16s %16s\n", "identifier", "calls",
+          "inclusive (us)", "exclusive (us)");
+  for (size_t i = 0; i < rows; i++)
+    fprintf(out, "%-24s %12llu %16.1f %16.1f\n", totals[i].name,
+            totals[i].calls, totals[i].inclusiveNs / 1e3,
+            totals[i].exclusiveNs / 1e3);
+
+  free(nodes);
+  free(totals);
+  treeFree(merged);
+}
+
+void profile_reset(void) {
+  pthread_mutex_lock(&treesLock);
+  while (trees) {
+    profileTree *next = trees->next;
+    treeFree(trees);
+    trees = next;
+  }
+  generation++;
+  pthread_mutex_unlock(&treesLock);
+  tree = NULL;
+  current = NULL;
+}
@@ -0,0 +1,179 @@
+#include "reduce.h"
+#include "eval.h"
+#include "util.h"
+#include <errno.h>
+#include <string.h>
+
+static bool compensated;
+
+void reduce_setCompensated(bool enabled) { compensated = enabled; }
+
+bool reduce_indexCount(real from, real to, size_t maxCount, size_t *count) {
+  if (!isfinite(from) || !isfinite(to)) {
+    errno = INVALID_RANGE;
+    return false;
+  }
+  *count = 0;
+  if (to < from)
+    return true;
+
+  if (realAbs(from) > REDUCE_MAX_INDEX || realAbs(to) > REDUCE_MAX_INDEX) {
+    errno = INEXACT_RANGE;
+    return false;
+  }
+  if (to - from >= (real)maxCount) {
+    errno = RANGE_TOO_LONG;
+    return false;
+  }
+  *count = (size_t)(to - from) + 1;
+  return true;
+}
+
+accumulator reduce_init(tokenType type) {
+  return (accumulator){.type = type, .value = type == TOKEN_PROD ? 1 : 0};
+}
+
+void reduce_add(accumulator *acc, real term) {
+  if (acc->type == TOKEN_PROD) {
+    acc->value *= term;
+    return;
+  }
+  if (!compensated) {
+    acc->value += term;
+    return;
+  }
+
+  // Neumaier's variant of Kahan summation, also exact for large terms
+  real sum = acc->value + term;
+  if (realAbs(acc->value) >= realAbs(term))
+    acc->compensation += (acc->value - sum) + term;
+  else
+    acc->compensation += (term - sum) + acc->value;
+  acc->value = sum;
+}
+
+void reduce_addAll(accumulator *acc, const real *terms, size_t count) {
+  if (acc->type == TOKEN_SUM && !compensated) {
+    for (size_t k = 0; k < count; k++)
+      acc->value += terms[k];
+  } else {
+    for (size_t k = 0; k < count; k++)
+      reduce_add(acc, terms[k]);
+  }
+}
+
+real reduce_result(const accumulator *acc) {
+  return acc->value + acc->compensation;
+}
+
+/*--NATIVE LOOP--*/
+static bool isNative(const ASTNode *node, substring index, size_t depth) {
+  if (depth > REDUCE_MAX_DEPTH)
+    return false;
+
+  switch (node->type) {
+  case TOKEN_NUMBER:
+    return true;
+
+  case TOKEN_IDEN:
+    return substringCmp(node->identifer, index);
+
+  case TOKEN_UNARY_MINUS:
+  case TOKEN_UNARY_PLUS:
+  case TOKEN_SIN:
+  case TOKEN_COS:
+  case TOKEN_LOG:
+    return isNative(node->unary.operand, index, depth + 1);
+
+  case TOKEN_PLUS:
+  case TOKEN_MINUS:
+  case TOKEN_MUL:
+  case TOKEN_DIV:
+  case TOKEN_EXP:
+    return isNative(node->binary.left, index, depth + 1) &&
+           isNative(node->binary.right, index, depth + 1);
+
+  default:
+    return false;
+  }
+}
+
+bool reduce_isNative(const ASTNode *body, substring index) {
+  return isNative(body, index, 0);
+}
+
+// Evaluates the body for a whole block of indices at once. The loops have a
+// fixed trip count and no calls for the arithmetic operators, so the compiler
+// vectorises them.
+static void evalBlock(const ASTNode *node, const real *indices, real *out) {
+  switch (node->type) {
+  case TOKEN_NUMBER:
+    for (size_t k = 0; k < REDUCE_BLOCK; k++)
+      out[k] = node->number;
+    return;
+
+  case TOKEN_IDEN: // only the index passes reduce_isNative()
+    memcpy(out, indices, sizeof(real) * REDUCE_BLOCK);
+    return;
+
+  case TOKEN_UNARY_MINUS:
+  case TOKEN_UNARY_PLUS:
+  case TOKEN_SIN:
+  case TOKEN_COS:
+  case TOKEN_LOG:
+    evalBlock(node->unary.operand, indices, out);
+    if (node->type == TOKEN_UNARY_MINUS) {
+      for (size_t k = 0; k < REDUCE_BLOCK; k++)
+        out[k] = -out[k];
+    } else if (node->type != TOKEN_UNARY_PLUS) {
+      for (size_t k = 0; k < REDUCE_BLOCK; k++)
+        out[k] = evalUnary(node->type, out[k]);
+    }
+    return;
+
+  default:
+    break;
+  }
+
+  real left[REDUCE_BLOCK];
+  evalBlock(node->binary.left, indices, left);
+  evalBlock(node->binary.right, indices, out);
+
+  switch (node->type) {
+  case TOKEN_PLUS:
+    for (size_t k = 0; k < REDUCE_BLOCK; k++)
+      out[k] = left[k] + out[k];
+    break;
+  case TOKEN_MINUS:
+    for (size_t k = 0; k < REDUCE_BLOCK; k++)
+      out[k] = left[k] - out[k];
+    break;
+  case TOKEN_MUL:
+    for (size_t k = 0; k < REDUCE_BLOCK; k++)
+      out[k] = left[k] * out[k];
+    break;
+  case TOKEN_DIV:
+    for (size_t k = 0; k < REDUCE_BLOCK; k++)
+      out[k] = left[k] / out[k];
+    break;
+  default:
+    for (size_t k = 0; k < REDUCE_BLOCK; k++)
+      out[k] = evalBinary(node->type, left[k], out[k]);
+  }
+}
+
+void reduce_native(accumulator *acc, const ASTNode *body, real first,
+                   size_t count) {
+  real indices[REDUCE_BLOCK];
+  real terms[REDUCE_BLOCK];
+
+  for (size_t done = 0; done < count; done += REDUCE_BLOCK) {
+    size_t n = count - done < REDUCE_BLOCK ? count - done : REDUCE_BLOCK;
+
+    // The tail of the last block is computed but never added
+    for (size_t k = 0; k < REDUCE_BLOCK; k++)
+      indices[k] = first + (real)(done + k);
+    evalBlock(body, indices, terms);
+    reduce_addAll(acc, terms, n);
+  }
+}
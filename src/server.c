@@ -0,0 +1,442 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "context.h"
+#include "util.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 64
+#define READ_CHUNK 65536
+// Responses queued for a client that is not reading them. Past this the
+// server stops reading its requests until the queue has drained below it.
+#define MAX_QUEUED_OUTPUT (1 << 20)
+
+/*--PROTOCOL--*/
+size_t server_encodeRequest(unsigned char *buffer, const char *expression,
+                            uint32_t length) {
+  memcpy(buffer, &length, SERVER_REQUEST_HEADER_SIZE);
+  memcpy(buffer + SERVER_REQUEST_HEADER_SIZE, expression, length);
+  return SERVER_REQUEST_HEADER_SIZE + length;
+}
+
+static void encodeResponse(unsigned char *buffer, uint32_t status,
+                           double result) {
+  memcpy(buffer, &status, sizeof(status));
+  memcpy(buffer + sizeof(status), &result, sizeof(result));
+}
+
+void server_decodeResponse(const unsigned char *buffer,
+                           serverResponse *response) {
+  memcpy(&response->status, buffer, sizeof(response->status));
+  memcpy(&response->result, buffer + sizeof(response->status),
+         sizeof(response->result));
+}
+
+/*--LATENCY HISTOGRAM--*/
+// Log-linear buckets: 16 sub-buckets per power of two of nanoseconds, which
+// bounds the percentile error to ~6% with a fixed, allocation-free footprint.
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct latencyHistogram {
+  unsigned long long counts[HISTOGRAM_BUCKETS];
+  unsigned long long total;
+  unsigned long long max;
+} latencyHistogram;
+
+static size_t histogramIndex(unsigned long long ns) {
+  if (ns < HISTOGRAM_SUB_BUCKETS)
+    return (size_t)ns;
+
+  int msb = 63 - __builtin_clzll(ns);
+  int shift = msb - HISTOGRAM_SUB_BITS;
+  size_t sub = (size_t)(ns >> shift) & (HISTOGRAM_SUB_BUCKETS - 1);
+  return (size_t)(shift + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+static unsigned long long histogramValue(size_t index) {
+  if (index < HISTOGRAM_SUB_BUCKETS)
+    return index;
+
+  int shift = (int)(index / HISTOGRAM_SUB_BUCKETS) - 1;
+  unsigned long long sub = index % HISTOGRAM_SUB_BUCKETS;
+  return (HISTOGRAM_SUB_BUCKETS + sub) << shift;
+}
+
+static void histogramRecord(latencyHistogram *hist, unsigned long long ns) {
+  hist->counts[histogramIndex(ns)]++;
+  hist->total++;
+  if (ns > hist->max)
+    hist->max = ns;
+}
+
+static unsigned long long histogramPercentile(const latencyHistogram *hist,
+                                              double percentile) {
+  unsigned long long rank =
+      (unsigned long long)(percentile / 100.0 * (double)hist->total);
+  unsigned long long seen = 0;
+
+  for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += hist->counts[i];
+    if (seen > rank)
+      return histogramValue(i);
+  }
+  return hist->max;
+}
+
+static void reportLatency(const latencyHistogram *hist) {
+  if (hist->total == 0)
+    return;
+
+  fprintf(stderr,
+          "requests: %llu  p50: %.1f us  p99: %.1f us  max: %.1f us\n",
+          hist->total, histogramPercentile(hist, 50.0) / 1e3,
+          histogramPercentile(hist, 99.0) / 1e3, hist->max / 1e3);
+}
+
+static inline unsigned long long monotonicNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull +
+         (unsigned long long)ts.tv_nsec;
+}
+
+/*--CONNECTIONS--*/
+typedef struct buffer {
+  unsigned char *data;
+  size_t len;
+  size_t cap;
+} buffer;
+
+typedef struct connection {
+  int fd;
+  uint32_t events;
+  bool peerClosed;
+  buffer in;
+  buffer out;
+  size_t outSent;
+  struct connection *prev;
+  struct connection *next;
+} connection;
+
+static bool bufferReserve(buffer *buf, size_t extra) {
+  if (buf->len + extra <= buf->cap)
+    return true;
+
+  size_t cap = buf->cap ? buf->cap * 2 : READ_CHUNK;
+  while (cap < buf->len + extra)
+    cap *= 2;
+
+  unsigned char *data = realloc(buf->data, cap);
+  if (!data)
+    return false;
+
+  buf->data = data;
+  buf->cap = cap;
+  return true;
+}
+
+static inline bool outputFull(const connection *conn) {
+  return conn->out.len - conn->outSent >= MAX_QUEUED_OUTPUT;
+}
+
+static void connectionClose(int epollFd, connection **clients,
+                            connection *conn) {
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    *clients = conn->next;
+  if (conn->next)
+    conn->next->prev = conn->prev;
+
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+  close(conn->fd);
+  free(conn->in.data);
+  free(conn->out.data);
+  free(conn);
+}
+
+// Evaluates the complete frames in the input buffer, queueing responses in
+// request order, until the output is full. Returns false if the client sent
+// an oversized frame.
+static bool processRequests(evalContext *ctx, connection *conn,
+                            latencyHistogram *hist) {
+  // Room to terminate the last expression in place
+  if (!bufferReserve(&conn->in, 1))
+    return false;
+
+  size_t offset = 0;
+  while (!outputFull(conn) &&
+         conn->in.len - offset >= SERVER_REQUEST_HEADER_SIZE) {
+    uint32_t length;
+    memcpy(&length, conn->in.data + offset, sizeof(length));
+    if (length > SERVER_MAX_REQUEST_SIZE)
+      return false;
+    if (conn->in.len - offset - SERVER_REQUEST_HEADER_SIZE < length)
+      break;
+
+    // Terminating the expression overwrites the first byte of the next
+    // frame's header, so it is saved and restored around the evaluation.
+    char *expression =
+        (char *)conn->in.data + offset + SERVER_REQUEST_HEADER_SIZE;
+    char saved = expression[length];
+    expression[length] = '\0';
+
+    unsigned long long start = monotonicNs();
+    real result = 0.0;
+    uint32_t status = 0;
+    if (!evalContext_evaluate(ctx, expression, &result))
+      status = errno ? (uint32_t)errno : MISSING_ERROR_CODE;
+    histogramRecord(hist, monotonicNs() - start);
+
+    expression[length] = saved;
+
+    if (!bufferReserve(&conn->out, SERVER_RESPONSE_SIZE))
+      return false;
+    encodeResponse(conn->out.data + conn->out.len, status, result);
+    conn->out.len += SERVER_RESPONSE_SIZE;
+
+    offset += SERVER_REQUEST_HEADER_SIZE + length;
+  }
+
+  memmove(conn->in.data, conn->in.data + offset, conn->in.len - offset);
+  conn->in.len -= offset;
+  return true;
+}
+
+// Returns false once the socket failed.
+static bool flushResponses(connection *conn) {
+  while (conn->outSent < conn->out.len) {
+    ssize_t n = send(conn->fd, conn->out.data + conn->outSent,
+                     conn->out.len - conn->outSent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    conn->outSent += (size_t)n;
+  }
+
+  // Dropping what was sent keeps the buffer within the queue limit
+  memmove(conn->out.data, conn->out.data + conn->outSent,
+          conn->out.len - conn->outSent);
+  conn->out.len -= conn->outSent;
+  conn->outSent = 0;
+  return true;
+}
+
+// Stops at a full output queue, leaving the rest in the socket
+static bool handleReadable(evalContext *ctx, connection *conn,
+                           latencyHistogram *hist) {
+  while (!outputFull(conn)) {
+    if (!bufferReserve(&conn->in, READ_CHUNK))
+      return false;
+
+    ssize_t n = recv(conn->fd, conn->in.data + conn->in.len, READ_CHUNK, 0);
+    if (n == 0) {
+      conn->peerClosed = true;
+      break;
+    }
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    conn->in.len += (size_t)n;
+
+    if (!processRequests(ctx, conn, hist))
+      return false;
+  }
+  return true;
+}
+
+// Sends the queued responses and answers the requests held back while the
+// queue was full, for as long as the client takes them. Returns false once
+// the socket failed.
+static bool handleWritable(evalContext *ctx, int epollFd, connection *conn,
+                           latencyHistogram *hist) {
+  size_t queued;
+  do {
+    if (!flushResponses(conn))
+      return false;
+    queued = conn->out.len;
+    if (!processRequests(ctx, conn, hist))
+      return false;
+  } while (conn->out.len != queued);
+
+  // Reading resumes once the queue is below the limit again. A half-closed
+  // peer stays registered only until its answers are out.
+  uint32_t events = (conn->peerClosed || outputFull(conn) ? 0 : EPOLLIN) |
+                    (conn->out.len != 0 ? EPOLLOUT : 0);
+  if (events != conn->events) {
+    struct epoll_event ev = {.events = events, .data.ptr = conn};
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->fd, &ev);
+    conn->events = events;
+  }
+  return true;
+}
+
+/*--EVENT LOOP--*/
+static volatile sig_atomic_t stopRequested = 0;
+static volatile sig_atomic_t reloadRequested = 0;
+
+static void requestStop(int signal) {
+  (void)signal;
+  stopRequested = 1;
+}
+
+static void requestReload(int signal) {
+  (void)signal;
+  reloadRequested = 1;
+}
+
+static int listenOn(const char *socketPath) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+    logError("Socket path is too long\n", __func__);
+    return -1;
+  }
+  strcpy(addr.sun_path, socketPath);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    logError("Failed to create socket", __func__);
+    return -1;
+  }
+
+  unlink(socketPath);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    logError("Failed to listen on socket", __func__);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void acceptClients(int epollFd, int listenFd, connection **clients) {
+  while (true) {
+    int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      return;
+
+    connection *conn = calloc(1, sizeof(connection));
+    if (!conn) {
+      close(fd);
+      continue;
+    }
+    conn->fd = fd;
+    conn->events = EPOLLIN;
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = conn};
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      close(fd);
+      free(conn);
+      continue;
+    }
+
+    conn->next = *clients;
+    if (*clients)
+      (*clients)->prev = conn;
+    *clients = conn;
+  }
+}
+
+int runServer(evalContext *ctx, const char *socketPath) {
+  int listenFd = listenOn(socketPath);
+  if (listenFd < 0)
+    return -1;
+
+  int epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd < 0) {
+    logError("Failed to create epoll instance", __func__);
+    close(listenFd);
+    return -1;
+  }
+
+  // data.ptr == NULL marks the listening socket
+  struct epoll_event listenEv = {.events = EPOLLIN, .data.ptr = NULL};
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &listenEv);
+
+  struct sigaction sa = {.sa_handler = requestStop};
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sa.sa_handler = requestReload;
+  sigaction(SIGHUP, &sa, NULL);
+
+  latencyHistogram *hist = calloc(1, sizeof(latencyHistogram));
+  if (!hist) {
+    logError("Fatal: Memory allocation failure", __func__);
+    close(epollFd);
+    close(listenFd);
+    return -1;
+  }
+
+  fprintf(stderr, "Listening on %s\n", socketPath);
+
+  connection *clients = NULL;
+  struct epoll_event events[MAX_EVENTS];
+  while (!stopRequested) {
+    if (reloadRequested) {
+      reloadRequested = 0;
+      if (evalContext_reload(ctx))
+        fprintf(stderr, "Reloaded %s\n", ctx->configFile);
+    }
+
+    int ready = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      logError("epoll_wait failed", __func__);
+      break;
+    }
+
+    for (int i = 0; i < ready; i++) {
+      connection *conn = events[i].data.ptr;
+      if (!conn) {
+        acceptClients(epollFd, listenFd, &clients);
+        continue;
+      }
+
+      bool alive = true;
+      if (!conn->peerClosed &&
+          (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+        alive = handleReadable(ctx, conn, hist);
+
+      if (!alive || !handleWritable(ctx, epollFd, conn, hist) ||
+          (conn->peerClosed && conn->out.len == 0))
+        connectionClose(epollFd, &clients, conn);
+    }
+  }
+
+  while (clients)
+    connectionClose(epollFd, &clients, clients);
+
+  reportLatency(hist);
+  if (ctx->cache)
+    fprintf(stderr, "cache: %llu hits  %llu misses  %zu entries  %zu bytes\n",
+            ctx->cache->hits, ctx->cache->misses, ctx->cache->count,
+            ctx->cache->memoryUsed);
+  if (ctx->programs)
+    fprintf(stderr, "program cache: %llu hits  %llu misses  %zu entries\n",
+            ctx->programs->hits, ctx->programs->misses, ctx->programs->count);
+  free(hist);
+  close(epollFd);
+  close(listenFd);
+  unlink(socketPath);
+  return 0;
+}
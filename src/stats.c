@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+#include "stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef EVAL_STATS
+typedef struct statsBlock {
+  evalStats stats;
+  struct statsBlock *next;
+} statsBlock;
+
+// Every thread's block, for the totals. Blocks outlive their threads, so the
+// counts of finished workers are kept.
+static pthread_mutex_t blocksLock = PTHREAD_MUTEX_INITIALIZER;
+static statsBlock *blocks;
+static statsBlock fallback; // shared when a block can't be allocated
+static evalStats totals;
+
+_Thread_local evalStats *threadStats;
+
+evalStats *statsRegisterThread(void) {
+  statsBlock *block = calloc(1, sizeof(statsBlock));
+  pthread_mutex_lock(&blocksLock);
+  if (block) {
+    block->next = blocks;
+    blocks = block;
+  } else {
+    block = &fallback;
+  }
+  pthread_mutex_unlock(&blocksLock);
+  return threadStats = &block->stats;
+}
+
+unsigned long long statsClock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull +
+         (unsigned long long)ts.tv_nsec;
+}
+
+#define MERGE_SUM(field) (into->field += from->field)
+#define MERGE_MAX(field)                                                       \
+  (into->field = from->field > into->field ? from->field : into->field)
+
+static void merge(evalStats *into, const evalStats *from) {
+  MERGE_SUM(tokens);
+  MERGE_SUM(configNodes);
+  MERGE_SUM(programNodes);
+  MERGE_SUM(scratchNodes);
+  MERGE_SUM(identifierNodes);
+  MERGE_SUM(cloneCalls);
+  MERGE_SUM(clonedNodes);
+  MERGE_SUM(identifierCalls);
+  MERGE_MAX(maxRecursionDepth);
+  MERGE_SUM(declarationBinds);
+  MERGE_SUM(lazyDefinitions);
+  MERGE_SUM(parallelTasks);
+  MERGE_SUM(watchComputes);
+  MERGE_SUM(hashProbes);
+  MERGE_SUM(hashChainSteps);
+  MERGE_MAX(hashMaxChain);
+  MERGE_MAX(peakBytes);
+  for (int phase = 0; phase < PHASE_MAX; phase++)
+    MERGE_SUM(phaseNs[phase]);
+}
+#else
+static const evalStats totals;
+#endif
+
+bool evalStats_enabled(void) {
+#ifdef EVAL_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+const evalStats *evalStats_get(void) {
+#ifdef EVAL_STATS
+  pthread_mutex_lock(&blocksLock);
+  totals = fallback.stats;
+  for (const statsBlock *block = blocks; block; block = block->next)
+    merge(&totals, &block->stats);
+  pthread_mutex_unlock(&blocksLock);
+#endif
+  return &totals;
+}
+
+void evalStats_reset(void) {
+#ifdef EVAL_STATS
+  pthread_mutex_lock(&blocksLock);
+  memset(&fallback.stats, 0, sizeof(evalStats));
+  for (statsBlock *block = blocks; block; block = block->next)
+    memset(&block->stats, 0, sizeof(evalStats));
+  pthread_mutex_unlock(&blocksLock);
+#endif
+}
+
+void evalStats_print(FILE *out) {
+  const evalStats *s = evalStats_get();
+
+  fprintf(out, "tokens: %llu\n", s->tokens);
+  fprintf(out, "pool nodes: config %llu, program %llu, scratch %llu, "
+               "identifier %llu\n",
+          s->configNodes, s->programNodes, s->scratchNodes,
+          s->identifierNodes);
+  fprintf(out, "cloneAST: %llu calls, %llu nodes\n", s->cloneCalls,
+          s->clonedNodes);
+  fprintf(out, "parseIdentifier: %llu calls, max recursion depth %llu\n",
+          s->identifierCalls, s->maxRecursionDepth);
+  fprintf(out, "declaration blocks bound: %llu\n", s->declarationBinds);
+  fprintf(out, "config definitions loaded on first use: %llu\n",
+          s->lazyDefinitions);
+  fprintf(out, "parallel evaluation tasks: %llu\n", s->parallelTasks);
+  fprintf(out, "watch identifiers recomputed: %llu\n", s->watchComputes);
+  fprintf(out, "hash map: %llu probes, %llu chain steps (%.2f avg), "
+               "longest chain %llu\n",
+          s->hashProbes, s->hashChainSteps,
+          s->hashProbes ? (double)s->hashChainSteps / s->hashProbes : 0.0,
+          s->hashMaxChain);
+  fprintf(out, "memory: peak %llu bytes in one evaluation\n", s->peakBytes);
+  fprintf(out, "time (us): config %.1f, tokenise %.1f, parse %.1f, "
+               "run %.1f\n",
+          s->phaseNs[PHASE_CONFIG] / 1e3, s->phaseNs[PHASE_TOKENISE] / 1e3,
+          s->phaseNs[PHASE_PARSE] / 1e3, s->phaseNs[PHASE_RUN] / 1e3);
+}
@@ -0,0 +1,455 @@
+#define _GNU_SOURCE
+#include "stream.h"
+#include "parallel.h"
+#include "util.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define READ_CHUNK 65536
+
+/*--WAITING--*/
+// Where a stage sleeps until another one makes progress. Wakers only lock
+// when someone sleeps, so a stage that keeps up never makes a system call.
+typedef struct waitPoint {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  atomic_size_t sleepers;
+} waitPoint;
+
+typedef bool (*waitCondition)(void *arg, size_t seq);
+
+static void waitPoint_init(waitPoint *wp) {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_mutex_init(&wp->lock, NULL);
+  pthread_cond_init(&wp->wake, &attr);
+  pthread_condattr_destroy(&attr);
+  atomic_init(&wp->sleepers, 0);
+}
+
+static void waitPoint_free(waitPoint *wp) {
+  pthread_cond_destroy(&wp->wake);
+  pthread_mutex_destroy(&wp->lock);
+}
+
+static unsigned long long streamClock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull +
+         (unsigned long long)ts.tv_nsec;
+}
+
+static bool spinFor(waitCondition ready, void *arg, size_t seq) {
+  for (int i = 0; i < STREAM_SPINS; i++)
+    if (ready(arg, seq))
+      return true;
+  return false;
+}
+
+// Blocks until ready(arg, seq) holds, or until the CLOCK_MONOTONIC deadline
+// unless it is 0, and returns the nanoseconds it slept
+static unsigned long long waitPoint_wait(waitPoint *wp, waitCondition ready,
+                                         void *arg, size_t seq,
+                                         unsigned long long deadline) {
+  if (spinFor(ready, arg, seq))
+    return 0;
+
+  unsigned long long start = streamClock();
+  pthread_mutex_lock(&wp->lock);
+  // Announced before the condition is checked again, which pairs with the
+  // fence in waitPoint_notify(): either this sees the change or the waker
+  // sees a sleeper, and the lock keeps it from waking us too early.
+  atomic_fetch_add(&wp->sleepers, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  struct timespec until = {.tv_sec = (time_t)(deadline / 1000000000ull),
+                           .tv_nsec = (long)(deadline % 1000000000ull)};
+  while (!ready(arg, seq)) {
+    if (!deadline)
+      pthread_cond_wait(&wp->wake, &wp->lock);
+    else if (pthread_cond_timedwait(&wp->wake, &wp->lock, &until) ==
+             ETIMEDOUT)
+      break;
+  }
+  atomic_fetch_sub(&wp->sleepers, 1);
+  pthread_mutex_unlock(&wp->lock);
+  return streamClock() - start;
+}
+
+// Call after publishing a change some stage may be waiting for
+static void waitPoint_notify(waitPoint *wp) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&wp->sleepers, memory_order_relaxed)) {
+    pthread_mutex_lock(&wp->lock);
+    pthread_cond_broadcast(&wp->wake);
+    pthread_mutex_unlock(&wp->lock);
+  }
+}
+
+/*--RING--*/
+typedef struct streamSlot {
+  atomic_size_t filled; // seq + 1 once the line of seq is in text
+  atomic_size_t done;   // seq + 1 once its result is in out
+  char *text;           // NUL terminated
+  size_t len;
+  size_t capacity;
+  outputBuffer out;
+  bool failed; // out could not be encoded
+} streamSlot;
+
+typedef struct stageStats {
+  unsigned long long items;
+  unsigned long long bytes;
+  unsigned long long busyNs;
+  unsigned long long waitNs;
+} stageStats;
+
+typedef struct stream {
+  evalContext *ctx;
+  int inFd;
+  int outFd;
+  outputFormat format;
+  streamSlot *slots;
+
+  atomic_size_t published; // lines read so far
+  atomic_size_t end;      // lines read, SIZE_MAX until the input ends
+  atomic_size_t claimed;  // next line for an evaluator
+  atomic_size_t consumed; // lines written
+  atomic_bool stopping;   // a stage failed, stop reading
+  waitPoint space;        // the reader, for a free slot
+  waitPoint lines;        // evaluators, for a line
+  waitPoint results;      // the writer, for the next result
+
+  pthread_mutex_t statsLock; // evaluators add theirs when they finish
+  stageStats reader;
+  stageStats evaluators;
+  stageStats writer;
+  bool readFailed;
+  bool writeFailed;
+  atomic_bool evalFailed;
+} stream;
+
+static inline streamSlot *slotOf(stream *s, size_t seq) {
+  return &s->slots[seq % STREAM_SLOTS];
+}
+
+static bool hasSpace(void *arg, size_t seq) {
+  stream *s = arg;
+  return seq - atomic_load_explicit(&s->consumed, memory_order_acquire) <
+             STREAM_SLOTS ||
+         atomic_load_explicit(&s->stopping, memory_order_relaxed);
+}
+
+static bool hasLine(void *arg, size_t seq) {
+  stream *s = arg;
+  return atomic_load_explicit(&slotOf(s, seq)->filled,
+                              memory_order_acquire) == seq + 1 ||
+         atomic_load_explicit(&s->end, memory_order_acquire) <= seq;
+}
+
+static bool hasResult(void *arg, size_t seq) {
+  stream *s = arg;
+  return atomic_load_explicit(&slotOf(s, seq)->done, memory_order_acquire) ==
+             seq + 1 ||
+         atomic_load_explicit(&s->end, memory_order_acquire) <= seq;
+}
+
+static bool slotAppend(streamSlot *slot, const char *data, size_t len) {
+  if (slot->len + len + 1 > slot->capacity) {
+    size_t capacity = slot->capacity ? slot->capacity * 2 : 256;
+    while (capacity < slot->len + len + 1)
+      capacity *= 2;
+    char *text = realloc(slot->text, capacity);
+    if (!text) {
+      logError("Fatal: Memory allocation failure", __func__);
+      return false;
+    }
+    slot->text = text;
+    slot->capacity = capacity;
+  }
+  memcpy(slot->text + slot->len, data, len);
+  slot->len += len;
+  slot->text[slot->len] = '\0';
+  return true;
+}
+
+/*--READER--*/
+static void publishLine(stream *s, size_t seq) {
+  atomic_store_explicit(&slotOf(s, seq)->filled, seq + 1,
+                        memory_order_release);
+  atomic_store_explicit(&s->published, seq + 1, memory_order_relaxed);
+  waitPoint_notify(&s->lines);
+}
+
+static void *readerMain(void *arg) {
+  stream *s = arg;
+  char chunk[READ_CHUNK];
+  unsigned long long start = streamClock();
+  size_t seq = 0;
+  bool open = false; // slot seq holds the start of a line
+
+  while (!atomic_load_explicit(&s->stopping, memory_order_relaxed)) {
+    ssize_t n = read(s->inFd, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      logError("Failed to read the input stream", __func__);
+      s->readFailed = true;
+    }
+    if (n <= 0)
+      break;
+    s->reader.bytes += (unsigned long long)n;
+
+    for (const char *c = chunk, *end = chunk + n; c < end;) {
+      if (!open) {
+        s->reader.waitNs += waitPoint_wait(&s->space, hasSpace, s, seq, 0);
+        if (atomic_load_explicit(&s->stopping, memory_order_relaxed))
+          break;
+        slotOf(s, seq)->len = 0;
+        open = true;
+      }
+      const char *newline = memchr(c, '\n', (size_t)(end - c));
+      const char *stop = newline ? newline : end;
+      if (!slotAppend(slotOf(s, seq), c, (size_t)(stop - c))) {
+        s->readFailed = true;
+        atomic_store(&s->stopping, true);
+        break;
+      }
+      c = newline ? newline + 1 : end;
+      if (newline) {
+        publishLine(s, seq++);
+        open = false;
+      }
+    }
+  }
+  // A last line without a newline still counts
+  if (open && slotOf(s, seq)->len &&
+      !atomic_load_explicit(&s->stopping, memory_order_relaxed))
+    publishLine(s, seq++);
+
+  s->reader.items = seq;
+  s->reader.busyNs = streamClock() - start - s->reader.waitNs;
+  atomic_store_explicit(&s->end, seq, memory_order_release);
+  waitPoint_notify(&s->lines);
+  waitPoint_notify(&s->results);
+  return NULL;
+}
+
+/*--EVALUATORS--*/
+// The result of one line, in the same encoding as a single expression
+static bool encodeResult(streamSlot *slot, outputFormat format, bool ok,
+                         const value *result) {
+  outputBuffer *buf = &slot->out;
+  if (!ok) {
+    if (format != OUTPUT_TEXT)
+      return output_appendError(buf, format, (uint32_t)errno);
+    // Keeps the results on the lines of their expressions
+    if (!outputBuffer_reserve(buf, 1))
+      return false;
+    buf->data[buf->len++] = '\n';
+    return true;
+  }
+  if (!result->data)
+    return output_appendResult(buf, format, &result->scalar, 1);
+  return output_appendResult(buf, format, result->data, result->len);
+}
+
+// One task per thread, each evaluating lines until the input runs out
+static void evaluatorTask(void *arg, size_t task) {
+  (void)task;
+  stream *s = arg;
+  stageStats stats = {0};
+  unsigned long long start = streamClock();
+  evalWorker worker;
+  bool started = evalWorker_init(&worker, s->ctx);
+  if (!started) {
+    // Lines already read still get their (failed) results
+    atomic_store(&s->evalFailed, true);
+    atomic_store(&s->stopping, true);
+    waitPoint_notify(&s->space);
+  }
+
+  while (true) {
+    size_t seq = atomic_fetch_add(&s->claimed, 1);
+    stats.waitNs += waitPoint_wait(&s->lines, hasLine, s, seq, 0);
+    streamSlot *slot = slotOf(s, seq);
+    if (atomic_load_explicit(&slot->filled, memory_order_acquire) != seq + 1)
+      break; // past the end of the input
+
+    value result = {0};
+    bool ok = started &&
+              evalWorker_evaluate(&worker, slot->text, slot->len, &result);
+    if (!ok)
+      atomic_store(&s->evalFailed, true);
+    slot->out.len = 0;
+    slot->failed = !encodeResult(slot, s->format, ok, &result);
+    stats.items++;
+
+    atomic_store_explicit(&slot->done, seq + 1, memory_order_release);
+    waitPoint_notify(&s->results);
+  }
+  if (started)
+    evalWorker_free(&worker);
+
+  stats.busyNs = streamClock() - start - stats.waitNs;
+  pthread_mutex_lock(&s->statsLock);
+  s->evaluators.items += stats.items;
+  s->evaluators.busyNs += stats.busyNs;
+  s->evaluators.waitNs += stats.waitNs;
+  pthread_mutex_unlock(&s->statsLock);
+}
+
+/*--WRITER--*/
+static void *writerMain(void *arg) {
+  stream *s = arg;
+  unsigned long long start = streamClock();
+  outputWriter writer;
+  bool ok = outputWriter_init(&writer, s->outFd);
+  unsigned long long pendingSince = 0; // of the oldest unflushed result
+
+  for (size_t seq = 0;; seq++) {
+    while (!spinFor(hasResult, s, seq)) {
+      // Once every line read is written, the buffer goes out at once. While
+      // lines are still being evaluated it waits for them, up to
+      // STREAM_FLUSH_NS, instead of costing a write() per line.
+      bool caughtUp =
+          seq == atomic_load_explicit(&s->published, memory_order_relaxed);
+      unsigned long long deadline = 0;
+      if (pendingSince) {
+        deadline = pendingSince + STREAM_FLUSH_NS;
+        if (caughtUp || streamClock() >= deadline) {
+          ok = outputWriter_flush(&writer) && ok;
+          pendingSince = deadline = 0;
+        }
+      }
+      s->writer.waitNs +=
+          waitPoint_wait(&s->results, hasResult, s, seq, deadline);
+    }
+    streamSlot *slot = slotOf(s, seq);
+    if (atomic_load_explicit(&slot->done, memory_order_acquire) != seq + 1)
+      break; // every line has been written
+
+    // After a failure the rest is only drained, for the reader to finish
+    if (ok) {
+      s->writer.bytes += slot->out.len;
+      ok = outputWriter_writeBuffer(&writer, &slot->out) && !slot->failed;
+      if (!pendingSince && writer.buffer.len)
+        pendingSince = streamClock();
+      if (!ok) {
+        atomic_store(&s->stopping, true);
+        waitPoint_notify(&s->space);
+      }
+    }
+    s->writer.items++;
+    atomic_store_explicit(&s->consumed, seq + 1, memory_order_release);
+    waitPoint_notify(&s->space);
+  }
+
+  if (!outputWriter_free(&writer) || !ok) {
+    logError("Failed to write the output stream", __func__);
+    s->writeFailed = true;
+  }
+  s->writer.busyNs = streamClock() - start - s->writer.waitNs;
+  return NULL;
+}
+
+/*--STREAM--*/
+static void reportStage(const char *name, const stageStats *stats) {
+  double busy = stats->busyNs / 1e9;
+  fprintf(stderr, "%-12s %12llu %14.1f %14.3g %14.1f\n", name, stats->items,
+          stats->busyNs / 1e6, busy > 0 ? stats->items / busy : 0.0,
+          stats->waitNs / 1e6);
+}
+
+static void reportStream(const stream *s, unsigned long long elapsedNs) {
+  double seconds = elapsedNs / 1e9;
+  fprintf(stderr,
+          "stream: %llu lines  %.1f MB in  %.1f MB out  %.1f ms  "
+          "%.3g lines/s\n",
+          s->reader.items, s->reader.bytes / 1e6, s->writer.bytes / 1e6,
+          elapsedNs / 1e6, seconds > 0 ? s->reader.items / seconds : 0.0);
+  // Busy time of the evaluators is summed over their threads
+  fprintf(stderr, "%-12s %12s %14s %14s %14s\n", "stage", "items",
+          "busy (ms)", "items/busy s", "waiting (ms)");
+  reportStage("reader", &s->reader);
+  reportStage("evaluators", &s->evaluators);
+  reportStage("writer", &s->writer);
+}
+
+static void freeSlots(streamSlot *slots) {
+  for (size_t i = 0; i < STREAM_SLOTS; i++) {
+    free(slots[i].text);
+    outputBuffer_free(&slots[i].out);
+  }
+  free(slots);
+}
+
+int runStream(evalContext *ctx, int inFd, int outFd, outputFormat format) {
+  if (format == OUTPUT_NPY) {
+    errno = INVALID_ASSIGNMENT_SYNTAX;
+    logError("Invalid stream: npy needs the number of results up front\n",
+             __func__);
+    return -1;
+  }
+
+  stream *s = calloc(1, sizeof(stream));
+  streamSlot *slots = calloc(STREAM_SLOTS, sizeof(streamSlot));
+  if (!s || !slots) {
+    logError("Fatal: Memory allocation failure", __func__);
+    free(s);
+    free(slots);
+    return -1;
+  }
+  *s = (stream){.ctx = ctx,
+                .inFd = inFd,
+                .outFd = outFd,
+                .format = format,
+                .slots = slots};
+  for (size_t i = 0; i < STREAM_SLOTS; i++) {
+    atomic_init(&slots[i].filled, 0);
+    atomic_init(&slots[i].done, 0);
+  }
+  atomic_init(&s->published, 0);
+  atomic_init(&s->end, SIZE_MAX);
+  atomic_init(&s->claimed, 0);
+  atomic_init(&s->consumed, 0);
+  atomic_init(&s->stopping, false);
+  atomic_init(&s->evalFailed, false);
+  waitPoint_init(&s->space);
+  waitPoint_init(&s->lines);
+  waitPoint_init(&s->results);
+  pthread_mutex_init(&s->statsLock, NULL);
+
+  unsigned long long start = streamClock();
+  pthread_t reader, writer;
+  bool started = pthread_create(&reader, NULL, readerMain, s) == 0;
+  if (started && pthread_create(&writer, NULL, writerMain, s) != 0) {
+    atomic_store(&s->stopping, true);
+    pthread_join(reader, NULL);
+    started = false;
+  }
+  if (!started) {
+    logError("Fatal: Failed to start stream threads", __func__);
+  } else {
+    parallel_run(parallel_threads(), evaluatorTask, s);
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    reportStream(s, streamClock() - start);
+  }
+
+  bool ok = started && !s->readFailed && !s->writeFailed &&
+            !atomic_load(&s->evalFailed);
+  pthread_mutex_destroy(&s->statsLock);
+  waitPoint_free(&s->results);
+  waitPoint_free(&s->lines);
+  waitPoint_free(&s->space);
+  freeSlots(slots);
+  free(s);
+  return ok ? 0 : -1;
+}
@@ -0,0 +1,129 @@
+#include "stress.h"
+#include "parser.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Longest text one element of any workload takes, names included
+#define STRESS_ELEMENT_SIZE 48
+
+static const char *names[STRESS_DIMENSIONS] = {
+    [STRESS_LENGTH] = "length",
+    [STRESS_DEPTH] = "depth",
+    [STRESS_IDENTIFIERS] = "identifiers",
+    [STRESS_CHAIN] = "chain",
+    [STRESS_FANOUT] = "fanout",
+};
+
+const char *stress_name(stressDimension dimension) { return names[dimension]; }
+
+bool stress_parseDimension(const char *name, stressDimension *dimension) {
+  for (int d = 0; d < STRESS_DIMENSIONS; d++) {
+    if (strcmp(name, names[d]) == 0) {
+      *dimension = (stressDimension)d;
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t stress_maxSize(stressDimension dimension) {
+  switch (dimension) {
+  case STRESS_CHAIN:
+    return 99; // parseIdentifier() stops at 100 nested references
+  case STRESS_DEPTH:
+    return PARSER_MAX_NESTING - 1; // the innermost operand is one more
+  default:
+    return (size_t)-1;
+  }
+}
+
+// Identifiers are letters only, so number them in base 26 after a prefix
+static int identifierName(char *out, char prefix, size_t index) {
+  int len = 0;
+  out[len++] = prefix;
+  do {
+    out[len++] = (char)('a' + index % 26);
+    index /= 26;
+  } while (index);
+  out[len] = '\0';
+  return len;
+}
+
+/*--WORKLOADS--*/
+// "1 + 2 * 3 - 4 / 5 + ..."
+static size_t writeLength(char *out, size_t size) {
+  static const char *ops[] = {" + ", " * ", " - ", " / "};
+  size_t len = 0;
+  for (size_t i = 0; i < size; i++)
+    len += sprintf(out + len, "%s%zu", i ? ops[i % 4] : "", i % 9 + 1);
+  return len;
+}
+
+// "(((1 + 1) * 2) - 3)", one level per parenthesis
+static size_t writeDepth(char *out, size_t size) {
+  static const char *ops[] = {" + ", " * ", " - "};
+  memset(out, '(', size);
+  size_t len = size + sprintf(out + size, "1");
+  for (size_t i = 0; i < size; i++)
+    len += sprintf(out + len, "%s%zu)", ops[i % 3], i % 9 + 1);
+  return len;
+}
+
+// "(va = 1) (vb = 2) ... va + vb + ..."
+static size_t writeIdentifiers(char *out, size_t size) {
+  char name[16];
+  size_t len = 0;
+  for (size_t i = 0; i < size; i++) {
+    identifierName(name, 'v', i);
+    len += sprintf(out + len, "(%s = %zu) ", name, i % 9 + 1);
+  }
+  for (size_t i = 0; i < size; i++) {
+    identifierName(name, 'v', i);
+    len += sprintf(out + len, "%s%s", i ? " + " : "", name);
+  }
+  return len;
+}
+
+// "(ca = 1) (cb = ca + 1) ... cz", each reference resolving the one before
+static size_t writeChain(char *out, size_t size) {
+  char name[16], previous[16];
+  size_t len = sprintf(out, "(ca = 1) ");
+  for (size_t i = 1; i < size; i++) {
+    identifierName(previous, 'c', i - 1);
+    identifierName(name, 'c', i);
+    len += sprintf(out + len, "(%s = %s + 1) ", name, previous);
+  }
+  identifierName(name, 'c', size - 1);
+  return len + sprintf(out + len, "%s", name);
+}
+
+// "(x = 2) (f = (h = x) h * h + 1) f + f + ...", which binds the declaration
+// of f once per reference
+static size_t writeFanout(char *out, size_t size) {
+  size_t len = sprintf(out, "(x = 2) (f = (h = x) h * h + 1) ");
+  for (size_t i = 0; i < size; i++)
+    len += sprintf(out + len, i ? " + f" : "f");
+  return len;
+}
+
+char *stress_generate(stressDimension dimension, size_t size) {
+  static size_t (*const writers[STRESS_DIMENSIONS])(char *, size_t) = {
+      [STRESS_LENGTH] = writeLength,
+      [STRESS_DEPTH] = writeDepth,
+      [STRESS_IDENTIFIERS] = writeIdentifiers,
+      [STRESS_CHAIN] = writeChain,
+      [STRESS_FANOUT] = writeFanout,
+  };
+  if (!size)
+    size = 1;
+
+  char *out = malloc(size * STRESS_ELEMENT_SIZE + STRESS_ELEMENT_SIZE);
+  if (!out) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return NULL;
+  }
+  out[writers[dimension](out, size)] = '\0';
+  return out;
+}
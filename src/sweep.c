@@ -0,0 +1,363 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sweep.h"
+#include "budget.h"
+#include "eval.h"
+#include "parallel.h"
+#include "parser.h"
+#include "util.h"
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Buckets of the layer holding a point's own assignments, cleared after
+// every point
+#define SWEEP_LAYER_SIZE 8
+
+/*--AXES--*/
+static bool invalidAxis(const char *spec) {
+  errno = INVALID_ASSIGNMENT_SYNTAX;
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer),
+           "Invalid sweep '%s': expected <iden>=<from>:<to>:<count> or "
+           "<iden>=<value>,<value>,...\n",
+           spec);
+  logError(buffer, "sweepAxis_parse");
+  return false;
+}
+
+static bool parseRange(sweepAxis *axis, const char *values) {
+  char *end;
+  axis->from = realParse(values, &end);
+  if (end == values || *end != ':')
+    return false;
+
+  values = end + 1;
+  axis->to = realParse(values, &end);
+  if (end == values || *end != ':')
+    return false;
+
+  values = end + 1;
+  double count = strtod(values, &end);
+  if (end == values || *end || !(count >= 1 && count <= 1e15) ||
+      count != floor(count))
+    return false;
+  axis->count = (size_t)count;
+  return isfinite(axis->from) && isfinite(axis->to);
+}
+
+static bool parseList(sweepAxis *axis, const char *values) {
+  axis->count = 1;
+  for (const char *c = values; *c; c++)
+    axis->count += *c == ',';
+
+  axis->list = malloc(sizeof(real) * axis->count);
+  if (!axis->list) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return false;
+  }
+
+  for (size_t i = 0; i < axis->count; i++) {
+    char *end;
+    axis->list[i] = realParse(values, &end);
+    char separator = i + 1 < axis->count ? ',' : '\0';
+    if (end == values || *end != separator || !isfinite(axis->list[i]))
+      return false;
+    values = end + 1;
+  }
+  return true;
+}
+
+bool sweepAxis_parse(sweepAxis *axis, const char *spec) {
+  *axis = (sweepAxis){0};
+  const char *equals = strchr(spec, '=');
+  if (!equals)
+    return invalidAxis(spec);
+
+  char *name = strndup(spec, (size_t)(equals - spec));
+  bool valid = name && isIdentifierName(name);
+  free(name);
+  if (!valid)
+    return invalidAxis(spec);
+  axis->name = (substring){.str = (char *)spec, .len = equals - spec};
+
+  const char *values = equals + 1;
+  bool parsed = strchr(values, ':') ? parseRange(axis, values)
+                                    : parseList(axis, values);
+  if (!parsed) {
+    sweepAxis_free(axis);
+    return invalidAxis(spec);
+  }
+  return true;
+}
+
+void sweepAxis_free(sweepAxis *axis) {
+  free(axis->list);
+  axis->list = NULL;
+}
+
+static real axisValue(const sweepAxis *axis, size_t i) {
+  if (axis->list)
+    return axis->list[i];
+  if (i + 1 == axis->count) // exact end points, whatever the rounding
+    return axis->count == 1 ? axis->from : axis->to;
+  return axis->from + (axis->to - axis->from) * (real)i /
+                          (real)(axis->count - 1);
+}
+
+/*--WORKERS--*/
+// Everything a thread needs to run the shared tree on its own. Lookups go
+// from the point's assignments to the axis values to the config. When the
+// expression inlines, each point only sets values and calls eval().
+typedef struct sweepWorker {
+  parser psr;
+  hashMap axisLayer;
+  ASTNode values[SWEEP_MAX_AXES];
+  memPool inlinePool;
+  ASTNode *inlined;
+  vectorArena arena;
+  clonePools clones;
+  outputBuffer out; // encoded points of the current slice
+  bool failed;
+} sweepWorker;
+
+typedef struct sweepJob {
+  ASTNode *root;
+  const sweepAxis *axes;
+  size_t axisCount;
+  sweepLayout layout;
+  outputFormat format;
+  sweepWorker *workers;
+  size_t workerCount;
+  size_t first; // points of the current chunk
+  size_t count;
+} sweepJob;
+
+static bool sweepWorker_init(sweepWorker *w, evalContext *ctx, ASTNode *root,
+                             const sweepAxis *axes, size_t axisCount) {
+  w->psr.tknStream = &ctx->tokens;
+  w->psr.arena = &w->arena;
+  w->psr.clones = &w->clones;
+  if (!memPool_init(&w->psr.nodePool, 64) ||
+      !memPool_init(&w->inlinePool, 64) ||
+      !hashMap_init(&w->axisLayer, 2 * axisCount) ||
+      !hashMap_init(&w->psr.map, SWEEP_LAYER_SIZE))
+    return false;
+  w->axisLayer.parent = &ctx->map;
+  w->psr.map.parent = &w->axisLayer;
+
+  substring names[SWEEP_MAX_AXES];
+  for (size_t k = 0; k < axisCount; k++) {
+    names[k] = axes[k].name;
+    w->values[k] = (ASTNode){.type = TOKEN_NUMBER, .pureSize = 1};
+    if (!hashmap_setKey(&w->axisLayer, axes[k].name, &w->values[k], 1, NULL))
+      return false;
+  }
+
+  w->inlined =
+      inlineExpression(&w->psr, root, names, w->values, axisCount,
+                       &w->inlinePool);
+  return true;
+}
+
+// Safe on a worker whose init failed part way, since workers start zeroed
+static void sweepWorker_free(sweepWorker *w) {
+  if (w->psr.map.buckets)
+    hashMap_free(&w->psr.map);
+  if (w->axisLayer.buckets)
+    hashMap_free(&w->axisLayer);
+  memPool_free(&w->psr.nodePool);
+  memPool_free(&w->inlinePool);
+  vectorArena_free(&w->arena);
+  clonePools_free(&w->clones);
+  outputBuffer_free(&w->out);
+}
+
+// values holds the point's axis values, with room for the result after them
+static bool appendPoint(sweepWorker *w, const sweepJob *job, size_t point,
+                        real *values, real result) {
+  if (job->format != OUTPUT_TEXT) {
+    if (job->layout == SWEEP_GRID)
+      return output_appendResult(&w->out, job->format, &result, 1);
+    values[job->axisCount] = result;
+    return output_appendResult(&w->out, job->format, values,
+                               job->axisCount + 1);
+  }
+
+  if (job->layout == SWEEP_GRID) {
+    size_t lineLength = job->axes[job->axisCount - 1].count;
+    return output_appendText(&w->out, result,
+                             (point + 1) % lineLength ? ' ' : '\n');
+  }
+
+  char separator = job->layout == SWEEP_CSV ? ',' : ' ';
+  for (size_t k = 0; k < job->axisCount; k++)
+    if (!output_appendText(&w->out, values[k], separator))
+      return false;
+  return output_appendText(&w->out, result, '\n');
+}
+
+// Each task runs one contiguous slice of the chunk and formats it, so the
+// slices only have to be written out in task order
+static void sweepTask(void *arg, size_t task) {
+  sweepJob *job = arg;
+  sweepWorker *w = &job->workers[task];
+  size_t begin = job->first + job->count * task / job->workerCount;
+  size_t end = job->first + job->count * (task + 1) / job->workerCount;
+  w->out.len = 0;
+  w->failed = false;
+
+  for (size_t point = begin; point < end; point++) {
+    // The last axis varies fastest
+    real values[SWEEP_MAX_AXES + 1];
+    size_t rest = point;
+    for (size_t k = job->axisCount; k-- > 0;) {
+      values[k] = axisValue(&job->axes[k], rest % job->axes[k].count);
+      w->values[k].number = values[k];
+      rest /= job->axes[k].count;
+    }
+
+    real result;
+    bool ok = true;
+    if (w->inlined) {
+      result = eval(w->inlined);
+    } else {
+      memPool_reset(&w->psr.nodePool);
+      vectorArena_reset(&w->arena);
+      memBudget_begin();
+      w->psr.recursionDepth = w->psr.baseDepth = 0;
+      ok = runExpression(&w->psr, job->root, &result);
+      hashMap_clear(&w->psr.map); // assignments do not outlive their point
+    }
+    if (!ok) {
+      output_appendError(&w->out, job->format, (uint32_t)errno);
+      w->failed = true;
+      return;
+    }
+    if (!appendPoint(w, job, point, values, result)) {
+      w->failed = true;
+      return;
+    }
+  }
+}
+
+/*--SWEEP--*/
+// Number of points, or 0 when the product does not fit
+static size_t countPoints(const sweepAxis *axes, size_t axisCount) {
+  size_t total = 1;
+  for (size_t k = 0; k < axisCount; k++) {
+    if (axes[k].count > SIZE_MAX / total)
+      return 0;
+    total *= axes[k].count;
+  }
+  return total;
+}
+
+static bool validAxes(const sweepAxis *axes, size_t axisCount) {
+  const char *problem = NULL;
+  if (!axisCount || axisCount > SWEEP_MAX_AXES)
+    problem = "between 1 and 16 axes are supported";
+  else if (!countPoints(axes, axisCount))
+    problem = "too many points";
+
+  for (size_t k = 0; !problem && k < axisCount; k++)
+    for (size_t j = 0; j < k; j++)
+      if (substringCmp(axes[j].name, axes[k].name))
+        problem = "an identifier is swept twice";
+
+  if (problem) {
+    errno = INVALID_ASSIGNMENT_SYNTAX;
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "Invalid sweep: %s\n", problem);
+    logError(buffer, "runSweep");
+  }
+  return !problem;
+}
+
+// The CSV header line, or the .npy header with the shape of the whole output:
+// the grid itself, or one row of axis values and result per point
+static bool appendHeader(outputBuffer *buf, const sweepAxis *axes,
+                         size_t axisCount, sweepLayout layout,
+                         outputFormat format) {
+  if (format == OUTPUT_TEXT && layout == SWEEP_CSV) {
+    for (size_t k = 0; k < axisCount; k++) {
+      if (!outputBuffer_reserve(buf, axes[k].name.len + 1))
+        return false;
+      memcpy(buf->data + buf->len, axes[k].name.str, axes[k].name.len);
+      buf->len += axes[k].name.len;
+      buf->data[buf->len++] = ',';
+    }
+    if (!outputBuffer_reserve(buf, sizeof("result\n")))
+      return false;
+    memcpy(buf->data + buf->len, "result\n", sizeof("result\n") - 1);
+    buf->len += sizeof("result\n") - 1;
+    return true;
+  }
+
+  size_t shape[SWEEP_MAX_AXES];
+  size_t dims = 2;
+  if (layout == SWEEP_GRID) {
+    for (dims = 0; dims < axisCount; dims++)
+      shape[dims] = axes[dims].count;
+  } else {
+    shape[0] = countPoints(axes, axisCount);
+    shape[1] = axisCount + 1;
+  }
+  return output_appendHeader(buf, format, shape, dims);
+}
+
+int runSweep(evalContext *ctx, const char *expression, const sweepAxis *axes,
+             size_t axisCount, sweepLayout layout, outputFormat format,
+             FILE *out) {
+  if (!validAxes(axes, axisCount))
+    return -1;
+
+  compiledProgram *program = evalContext_compile(ctx, expression);
+  if (!program)
+    return -1;
+
+  // Slices go straight to the descriptor, after whatever out still holds
+  fflush(out);
+  outputWriter writer;
+  size_t workerCount = parallel_threads();
+  sweepWorker *workers = calloc(workerCount, sizeof(sweepWorker));
+  bool ok = outputWriter_init(&writer, fileno(out)) && workers != NULL;
+  for (size_t t = 0; ok && t < workerCount; t++)
+    ok = sweepWorker_init(&workers[t], ctx, program->root, axes, axisCount);
+  if (!ok) {
+    logError("Fatal: Memory allocation failure", __func__);
+    for (size_t t = 0; workers && t < workerCount; t++)
+      sweepWorker_free(&workers[t]);
+    free(workers);
+    outputWriter_free(&writer);
+    compiledProgram_free(program);
+    return -1;
+  }
+
+  ok = appendHeader(&writer.buffer, axes, axisCount, layout, format);
+  sweepJob job = {.root = program->root,
+                  .axes = axes,
+                  .axisCount = axisCount,
+                  .layout = layout,
+                  .format = format,
+                  .workers = workers,
+                  .workerCount = workerCount};
+  size_t total = countPoints(axes, axisCount);
+  size_t chunk = workerCount * SWEEP_TASK_POINTS;
+  for (job.first = 0; ok && job.first < total; job.first += job.count) {
+    job.count = total - job.first < chunk ? total - job.first : chunk;
+    parallel_run(workerCount, sweepTask, &job);
+
+    // A failed slice still holds the points before its failure
+    for (size_t t = 0; ok && t < workerCount; t++)
+      ok = outputWriter_writeBuffer(&writer, &workers[t].out) &&
+           !workers[t].failed;
+  }
+  ok = outputWriter_free(&writer) && ok;
+
+  for (size_t t = 0; t < workerCount; t++)
+    sweepWorker_free(&workers[t]);
+  free(workers);
+  compiledProgram_free(program);
+  return ok ? 0 : -1;
+}
@@ -1,11 +1,11 @@
 #include "util.h"
-#include "lexer.h"
+#include "budget.h"
+#include "logger.h"
+#include "parser.h"
+#include "reduce.h"
+#include "vector.h"
 #include <errno.h>
 #include <stdio.h>
-#include <string.h>
-#include <time.h>
-
-extern size_t configLen;
 
 void logError(const char *message, const char *funcName) {
   if (errno >= 1000) {
@@ -13,108 +13,84 @@ void logError(const char *message, const char *funcName) {
   } else
     perror(message);
 
-  FILE *logfile = fopen("log.txt", "a");
-  if (logfile == NULL) {
-    fprintf(stderr, "Failed to open log file\n");
-    return;
-  }
-
-  time_t now;
-  struct tm *timeinfo;
-  char time_str[20];
-
-  time(&now);
-  timeinfo = localtime(&now);
-  strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", timeinfo);
-
-  fprintf(logfile, "--------------------------------------------------\n");
-  fprintf(logfile, "Timestamp: %s\n", time_str);
-  fprintf(logfile, "Function: %s\n", funcName);
-  fprintf(logfile, "Error Message: %s\n", message);
-  if (errno < 1000)
-    fprintf(logfile, "System Error: %s\n", strerror(errno));
-  else {
-    fprintf(logfile, "Application error: %s\n", message);
-  }
-
-  fprintf(logfile, "--------------------------------------------------\n\n");
-
-  fclose(logfile);
+  // Written to the log file in the background
+  logger_record(funcName, errno, message);
 }
 
-void createErrorMessage(char *buffer, size_t bufferSize, const token *tkn) {
+void createErrorMessage(char *buffer, size_t bufferSize, substring lexeme,
+                        size_t pos) {
   switch (errno) {
   case INVALID_NUMBER_FORMAT:
     snprintf(buffer, bufferSize,
              "Invalid Number Format: Incorrect placement of decimal point at "
              "index %zu — '%.*s' is not a valid token\n",
-             tkn->pos - configLen, (int)tkn->lexeme.len, tkn->lexeme.str);
+             pos, (int)lexeme.len, lexeme.str);
     break;
 
   case INVALID_OPERATOR:
     snprintf(buffer, bufferSize,
              "Invalid Operator: '%.*s' at index %zu is not a valid operator\n",
-             (int)tkn->lexeme.len, tkn->lexeme.str, tkn->pos - configLen);
+             (int)lexeme.len, lexeme.str, pos);
     break;
 
   case OVERFLOW:
     snprintf(buffer, bufferSize,
              "Overflow: Failed to evaluate '%.*s' at position %zu\n",
-             (int)tkn->lexeme.len, tkn->lexeme.str, tkn->pos - configLen);
+             (int)lexeme.len, lexeme.str, pos);
     break;
 
   case UNDERFLOW:
     snprintf(buffer, bufferSize,
              "Overflow: Failed to evaluate '%.*s' at position %zu.\n",
-             (int)tkn->lexeme.len, tkn->lexeme.str, tkn->pos - configLen);
+             (int)lexeme.len, lexeme.str, pos);
     break;
 
   case INVALID_OPERAND:
     snprintf(buffer, bufferSize,
              "Invalid Operand: Failed to parse '%.*s' at position %zu. Can't "
              "pass a binary operator as an operand.\n",
-             (int)tkn->lexeme.len, tkn->lexeme.str, tkn->pos - configLen);
+             (int)lexeme.len, lexeme.str, pos);
     break;
 
   case MISSING_OPERATOR:
     snprintf(buffer, bufferSize,
              "Missing Operator: Expected a binary operator before '%.*s' at "
              "position %zu.\n",
-             (int)tkn->lexeme.len, tkn->lexeme.str, tkn->pos - configLen);
+             (int)lexeme.len, lexeme.str, pos);
     break;
 
   case MISSING_CLOSING_PARENTHESIS:
     snprintf(buffer, bufferSize,
              "Missing Paranthesis: Failed to find a matching closing "
              "parenthesis for the parenthesis at position %zu\n",
-             tkn->pos - configLen);
+             pos);
     break;
 
   case UNMATCHED_CLOSING_PARENTHEIS:
     snprintf(buffer, bufferSize,
              "Missing Paranthesis: Closing paranthesis without a matching "
              "opening paranthesis at position %zu\n",
-             tkn->pos - configLen);
+             pos);
     break;
 
   case PREMATURE_END_OF_EXPRESSION:
     snprintf(buffer, bufferSize,
              "Missing Operand: Sub-expression ended at index %zu without "
              "resolving required operand\n",
-             tkn->pos - configLen);
+             pos);
     break;
   case MISSING_EXPRESSION:
     snprintf(buffer, bufferSize,
              "Missing Sub-expression: Expression ended at %zu without "
              "providing any evaluable content.\n",
-             tkn->pos - configLen);
+             pos);
     break;
   case INVALID_ASSIGNMENT_SYNTAX:
     snprintf(buffer, bufferSize,
              "Invalid Syntax: Invalid use of assignment operator at position "
              "%zu. Ensure that all identifier declarations are of the form "
              "(<iden> = <exp>)\n",
-             tkn->pos - configLen);
+             pos);
     break;
 
   case NESTED_ASSIGNMENT:
@@ -122,19 +98,19 @@ void createErrorMessage(char *buffer, size_t bufferSize, const token *tkn) {
         buffer, bufferSize,
         "Nested Assignment: Invalid use of assignment operator at position "
         "%zu. Can't declare identifiers inside an identifier definition.\n",
-        tkn->pos - configLen);
+        pos);
     break;
   case UNKNOWN_IDENTIFIER:
     snprintf(buffer, bufferSize,
              "Unknown Identifier: Found no definition for identifier '%.*s' at "
              "position %zu.\n",
-             (int)tkn->lexeme.len, tkn->lexeme.str, tkn->pos - configLen);
+             (int)lexeme.len, lexeme.str, pos);
     break;
   case UNDEFINED_REFERENCE:
     snprintf(
         buffer, bufferSize,
         "Unknown Identifier: Found no valid definition for reference '%.*s'\n",
-        (int)tkn->lexeme.len, tkn->lexeme.str);
+        (int)lexeme.len, lexeme.str);
     break;
 
   case MAXIMUM_RECURSION_DEPTH:
@@ -142,14 +118,99 @@ void createErrorMessage(char *buffer, size_t bufferSize, const token *tkn) {
              "Maximum Recursion Depth: Reached maximum recursion depth while "
              "evaluating identifier '%.*s' at "
              "position %zu.\n",
-             (int)tkn->lexeme.len, tkn->lexeme.str, tkn->pos - configLen);
+             (int)lexeme.len, lexeme.str, pos);
+    break;
+
+  case INVALID_REDUCTION:
+    snprintf(buffer, bufferSize,
+             "Invalid Syntax: Unexpected '%.*s' at position %zu. Reductions "
+             "are of the form sum(<iden>, <exp>, <exp>, <exp>) or "
+             "prod(...), integrate(<exp>, <iden>, <exp>, <exp>) or "
+             "solve(...), and commas only separate their arguments.\n",
+             (int)lexeme.len, lexeme.str, pos);
+    break;
+
+  case INVALID_RANGE:
+    snprintf(buffer, bufferSize,
+             "Invalid Range: The bounds of '%.*s' at position %zu must be "
+             "finite numbers.\n",
+             (int)lexeme.len, lexeme.str, pos);
+    break;
+
+  case RANGE_TOO_LONG:
+    snprintf(buffer, bufferSize,
+             "Range Too Long: '%.*s' at position %zu would run over more "
+             "than %d indices, or make more than %d elements in range().\n",
+             (int)lexeme.len, lexeme.str, pos, REDUCE_MAX_COUNT,
+             VECTOR_MAX_RANGE);
+    break;
+
+  case INEXACT_RANGE:
+    snprintf(buffer, bufferSize,
+             "Inexact Range: The bounds of '%.*s' at position %zu are beyond "
+             "%.0f, where consecutive " REAL_NAME " indices are not exact.\n",
+             (int)lexeme.len, lexeme.str, pos, (double)REDUCE_MAX_INDEX);
+    break;
+
+  case INVALID_VECTOR_SYNTAX:
+    snprintf(buffer, bufferSize,
+             "Invalid Syntax: Unexpected '%.*s' at position %zu. Vectors are "
+             "written [<exp>, ...] and their functions are called as "
+             "min(<exp>), max(<exp>), sum(<exp>), prod(<exp>), "
+             "dot(<exp>, <exp>) and range(<exp>, <exp>).\n",
+             (int)lexeme.len, lexeme.str, pos);
+    break;
+
+  case LENGTH_MISMATCH:
+    snprintf(buffer, bufferSize,
+             "Length Mismatch: The vector operands at position %zu have "
+             "different lengths.\n",
+             pos);
+    break;
+
+  case INVALID_VECTOR_USE:
+    snprintf(buffer, bufferSize,
+             "Invalid Vector Use: '%.*s' at position %zu has to be a number "
+             "here, or a non-empty vector for min and max.\n",
+             (int)lexeme.len, lexeme.str, pos);
+    break;
+
+  case NO_CONVERGENCE:
+    snprintf(buffer, bufferSize,
+             "No Convergence: integrate() or solve() over '%.*s' at "
+             "position %zu did not reach a finite result within the "
+             "tolerance and evaluation limit.\n",
+             (int)lexeme.len, lexeme.str, pos);
+    break;
+
+  case NO_SIGN_CHANGE:
+    snprintf(buffer, bufferSize,
+             "No Sign Change: The function of '%.*s' given to solve() at "
+             "position %zu has the same sign at both ends of the "
+             "interval.\n",
+             (int)lexeme.len, lexeme.str, pos);
+    break;
+
+  case MEMORY_BUDGET_EXCEEDED:
+    snprintf(buffer, bufferSize,
+             "Memory Budget Exceeded: Evaluating '%.*s' at position %zu takes "
+             "more than the budget of %zu bytes.\n",
+             (int)lexeme.len, lexeme.str, pos,
+             memBudget_get());
+    break;
+
+  case NESTING_TOO_DEEP:
+    snprintf(buffer, bufferSize,
+             "Nesting Too Deep: '%.*s' at position %zu is inside more than %d "
+             "levels of parentheses, functions and unary operators.\n",
+             (int)lexeme.len, lexeme.str, pos, PARSER_MAX_NESTING);
     break;
   default:
     printf("Error code: %d", errno);
     snprintf(buffer, bufferSize,
              "Found No Error Code: Application stopped while processing '%.*s' "
              "at index %zu\n",
-             (int)tkn->lexeme.len, tkn->lexeme.str, tkn->pos - configLen);
+             (int)lexeme.len, lexeme.str, pos);
     break;
   }
 }
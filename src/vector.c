@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+#include "vector.h"
+#include "budget.h"
+#include "eval.h"
+#include "reduce.h"
+#include "util.h"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*--ARENA--*/
+static size_t alignUp(size_t size) {
+  return (size + VECTOR_ALIGN - 1) & ~(size_t)(VECTOR_ALIGN - 1);
+}
+
+real *vectorArena_alloc(vectorArena *arena, size_t len) {
+  if (len > SIZE_MAX / sizeof(real) - VECTOR_ALIGN)
+    return NULL;
+  size_t size = alignUp(len ? len * sizeof(real) : 1);
+
+  for (arenaChunk *chunk = arena->chunks; chunk; chunk = chunk->next) {
+    if (chunk->size - chunk->used >= size) {
+      real *data = (real *)(chunk->data + chunk->used);
+      chunk->used += size;
+      return data;
+    }
+  }
+
+  size_t chunkSize = size > VECTOR_CHUNK_SIZE ? size : VECTOR_CHUNK_SIZE;
+  arenaChunk *chunk = malloc(sizeof(arenaChunk));
+  unsigned char *data = aligned_alloc(VECTOR_ALIGN, chunkSize);
+  if (!chunk || !data) {
+    free(chunk);
+    free(data);
+    return NULL;
+  }
+
+  *chunk = (arenaChunk){
+      .next = arena->chunks, .size = chunkSize, .used = size, .data = data};
+  arena->chunks = chunk;
+  return (real *)data;
+}
+
+void vectorArena_reset(vectorArena *arena) {
+  for (arenaChunk *chunk = arena->chunks; chunk; chunk = chunk->next)
+    chunk->used = 0;
+}
+
+void vectorArena_free(vectorArena *arena) {
+  while (arena->chunks) {
+    arenaChunk *chunk = arena->chunks;
+    arena->chunks = chunk->next;
+    free(chunk->data);
+    free(chunk);
+  }
+}
+
+/*--KERNELS--*/
+static real *allocResult(vectorArena *arena, size_t len, value *result) {
+  if (!arena) {
+    errno = INVALID_VECTOR_USE;
+    return NULL;
+  }
+  // Reported at the node like any other error
+  if (!memBudget_charge(len * sizeof(real)))
+    return NULL;
+
+  real *out = vectorArena_alloc(arena, len);
+  if (!out) {
+    logError("Fatal: Memory allocation failure", __func__);
+    return NULL;
+  }
+  *result = (value){.data = out, .len = len};
+  return out;
+}
+
+// Kernels work on one cache line of each operand at a time. The fixed trip
+// count lets the compiler turn the arithmetic loops into SIMD code at -O2
+// already; the last, partial line runs element by element.
+#define VECTOR_LANES (VECTOR_ALIGN / sizeof(real))
+#define LINE_LOOP(expression)                                                  \
+  for (size_t k = 0; k < VECTOR_LANES; k++)                                    \
+    out[k] = (expression)
+
+static void unaryLine(tokenType type, const real *restrict x,
+                      real *restrict out) {
+  x = __builtin_assume_aligned(x, VECTOR_ALIGN);
+  out = __builtin_assume_aligned(out, VECTOR_ALIGN);
+
+  switch (type) {
+  case TOKEN_UNARY_MINUS:
+    LINE_LOOP(-x[k]);
+    break;
+  case TOKEN_UNARY_PLUS:
+    LINE_LOOP(x[k]);
+    break;
+  default:
+    LINE_LOOP(evalUnary(type, x[k]));
+  }
+}
+
+static void binaryLine(tokenType type, const real *restrict x,
+                       const real *restrict y, real *restrict out) {
+  x = __builtin_assume_aligned(x, VECTOR_ALIGN);
+  y = __builtin_assume_aligned(y, VECTOR_ALIGN);
+  out = __builtin_assume_aligned(out, VECTOR_ALIGN);
+
+  switch (type) {
+  case TOKEN_PLUS:
+    LINE_LOOP(x[k] + y[k]);
+    break;
+  case TOKEN_MINUS:
+    LINE_LOOP(x[k] - y[k]);
+    break;
+  case TOKEN_MUL:
+    LINE_LOOP(x[k] * y[k]);
+    break;
+  case TOKEN_DIV:
+    LINE_LOOP(x[k] / y[k]);
+    break;
+  default:
+    LINE_LOOP(evalBinary(type, x[k], y[k]));
+  }
+}
+
+bool vector_unary(vectorArena *arena, tokenType type, value operand,
+                  value *result) {
+  if (!operand.data) {
+    *result = (value){.scalar = evalUnary(type, operand.scalar)};
+    return true;
+  }
+
+  size_t n = operand.len;
+  real *out = allocResult(arena, n, result);
+  if (!out)
+    return false;
+
+  size_t lines = n - n % VECTOR_LANES;
+  for (size_t i = 0; i < lines; i += VECTOR_LANES)
+    unaryLine(type, operand.data + i, out + i);
+  for (size_t i = lines; i < n; i++)
+    out[i] = evalUnary(type, operand.data[i]);
+  return true;
+}
+
+bool vector_binary(vectorArena *arena, tokenType type, value left, value right,
+                   value *result) {
+  if (!left.data && !right.data) {
+    *result = (value){.scalar = evalBinary(type, left.scalar, right.scalar)};
+    return true;
+  }
+  if (left.data && right.data && left.len != right.len) {
+    errno = LENGTH_MISMATCH;
+    return false;
+  }
+
+  size_t n = left.data ? left.len : right.len;
+  real *out = allocResult(arena, n, result);
+  if (!out)
+    return false;
+
+  // A scalar operand is broadcast into a line of its own, which then stays
+  // in place while the vector operand advances
+  _Alignas(VECTOR_ALIGN) real broadcast[VECTOR_LANES];
+  real scalar = left.data ? right.scalar : left.scalar;
+  for (size_t k = 0; k < VECTOR_LANES; k++)
+    broadcast[k] = scalar;
+
+  size_t leftStep = left.data ? VECTOR_LANES : 0;
+  size_t rightStep = right.data ? VECTOR_LANES : 0;
+  const real *x = left.data ? left.data : broadcast;
+  const real *y = right.data ? right.data : broadcast;
+
+  size_t lines = n - n % VECTOR_LANES;
+  for (size_t i = 0; i < lines; i += VECTOR_LANES) {
+    binaryLine(type, x, y, out + i);
+    x += leftStep;
+    y += rightStep;
+  }
+  for (size_t i = lines, k = 0; i < n; i++, k++)
+    out[i] = evalBinary(type, x[leftStep ? k : 0], y[rightStep ? k : 0]);
+  return true;
+}
+
+/*--REDUCTIONS--*/
+static inline real element(value operand, size_t i) {
+  return operand.data ? operand.data[i] : operand.scalar;
+}
+
+bool vector_reduce(tokenType type, value operand, value *result) {
+  if (!operand.data) {
+    *result = operand;
+    return true;
+  }
+
+  const real *in = operand.data;
+  if (type == TOKEN_MINIMUM || type == TOKEN_MAXIMUM) {
+    if (!operand.len) {
+      errno = INVALID_VECTOR_USE; // an empty vector has no extreme
+      return false;
+    }
+    real extreme = in[0];
+    for (size_t i = 1; i < operand.len; i++)
+      if (type == TOKEN_MINIMUM ? in[i] < extreme : in[i] > extreme)
+        extreme = in[i];
+    *result = (value){.scalar = extreme};
+    return true;
+  }
+
+  // Sums honour --compensated like sum(i, ...) does
+  accumulator acc =
+      reduce_init(type == TOKEN_ELEMENT_PROD ? TOKEN_PROD : TOKEN_SUM);
+  reduce_addAll(&acc, in, operand.len);
+  *result = (value){.scalar = reduce_result(&acc)};
+  return true;
+}
+
+bool vector_dot(value left, value right, value *result) {
+  if (left.data && right.data && left.len != right.len) {
+    errno = LENGTH_MISMATCH;
+    return false;
+  }
+
+  size_t n = left.data ? left.len : right.data ? right.len : 1;
+  accumulator acc = reduce_init(TOKEN_SUM);
+  _Alignas(VECTOR_ALIGN) real products[VECTOR_LANES];
+  for (size_t i = 0; i < n; i += VECTOR_LANES) {
+    size_t count = n - i < VECTOR_LANES ? n - i : VECTOR_LANES;
+    for (size_t k = 0; k < count; k++)
+      products[k] = element(left, i + k) * element(right, i + k);
+    reduce_addAll(&acc, products, count);
+  }
+  *result = (value){.scalar = reduce_result(&acc)};
+  return true;
+}
+
+bool vector_range(vectorArena *arena, real from, real to, value *result) {
+  size_t n;
+  if (!reduce_indexCount(from, to, VECTOR_MAX_RANGE, &n))
+    return false;
+
+  real *out = allocResult(arena, n, result);
+  if (!out)
+    return false;
+
+  for (size_t i = 0; i < n; i++)
+    out[i] = from + (real)i;
+  return true;
+}
+
+/*--LOADING--*/
+real *vector_load(const char *path, size_t *len) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return NULL;
+
+  fseek(file, 0, SEEK_END);
+  long fileSize = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (fileSize < 0 || fileSize % sizeof(double)) {
+    errno = EINVAL; // not a whole number of values
+    fclose(file);
+    return NULL;
+  }
+
+  *len = (size_t)fileSize / sizeof(double);
+  double *raw = malloc(fileSize ? (size_t)fileSize : 1);
+  real *data = aligned_alloc(VECTOR_ALIGN, alignUp(*len * sizeof(real) + 1));
+  bool ok = raw && data;
+  if (ok && fread(raw, sizeof(double), *len, file) != *len) {
+    errno = EIO;
+    ok = false;
+  }
+  if (!ok) {
+    free(raw);
+    free(data);
+    fclose(file);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < *len; i++)
+    data[i] = (real)raw[i];
+  free(raw);
+  fclose(file);
+  return data;
+}
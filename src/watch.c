@@ -0,0 +1,670 @@
+#define _GNU_SOURCE
+#include "watch.h"
+#include "eval.h"
+#include "lexer.h"
+#include "output.h"
+#include "parser.h"
+#include "stats.h"
+#include "util.h"
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_NODE SIZE_MAX
+#define INITIAL_BUCKETS 64
+
+// An update line. The trees it bound point into its text and pool, so it is
+// kept until no identifier is defined by it any more.
+typedef struct watchSource {
+  char *text;
+  memPool nodePool;
+  size_t refs;
+} watchSource;
+
+typedef struct indexList {
+  size_t *items;
+  size_t count;
+  size_t capacity;
+} indexList;
+
+// A node is current only if everything it depends on is current, so marking
+// a node stale marks all of its dependents as well.
+typedef enum { NODE_STALE, NODE_VISITING, NODE_CURRENT } nodeState;
+
+typedef struct watchNode {
+  substring key;             // owned copy
+  const ASTNode *definition; // NULL while undefined
+  bool needsParser; // binds a declaration block, loops or uses vectors
+  bool rerun; // depends on such a node: recomputed on every update
+  indexList deps;
+  indexList dependents;
+  watchSource *source; // NULL for config definitions
+  nodeState state;
+  real value;
+  int error; // errCodes value, 0 when value is valid
+  size_t next; // bucket chain
+} watchNode;
+
+typedef struct watchResult {
+  int error;
+  real value;
+} watchResult;
+
+typedef struct watchGraph {
+  evalContext *ctx;
+  watchNode *nodes;
+  size_t count;
+  size_t capacity;
+  size_t *buckets;
+  size_t bucketCount;
+  indexList outputs;
+  watchResult *previous; // per output, while recomputing
+} watchGraph;
+
+/*--INDEX LIST--*/
+static bool indexList_push(indexList *list, size_t value) {
+  if (list->count == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 4;
+    size_t *items = realloc(list->items, sizeof(size_t) * capacity);
+    if (!items)
+      return false;
+    list->items = items;
+    list->capacity = capacity;
+  }
+
+  list->items[list->count++] = value;
+  return true;
+}
+
+static bool indexList_contains(const indexList *list, size_t value) {
+  for (size_t i = 0; i < list->count; i++)
+    if (list->items[i] == value)
+      return true;
+  return false;
+}
+
+static void indexList_remove(indexList *list, size_t value) {
+  for (size_t i = 0; i < list->count; i++) {
+    if (list->items[i] == value) {
+      list->items[i] = list->items[--list->count];
+      return;
+    }
+  }
+}
+
+/*--GRAPH--*/
+static size_t watchGraph_find(const watchGraph *g, const substring key) {
+  size_t idx = g->buckets[substringHash(key) & (g->bucketCount - 1)];
+  while (idx != NO_NODE && !substringCmp(g->nodes[idx].key, key))
+    idx = g->nodes[idx].next;
+  return idx;
+}
+
+static bool watchGraph_rehash(watchGraph *g, size_t bucketCount) {
+  size_t *buckets = malloc(sizeof(size_t) * bucketCount);
+  if (!buckets)
+    return false;
+
+  for (size_t i = 0; i < bucketCount; i++)
+    buckets[i] = NO_NODE;
+  for (size_t i = 0; i < g->count; i++) {
+    size_t b = substringHash(g->nodes[i].key) & (bucketCount - 1);
+    g->nodes[i].next = buckets[b];
+    buckets[b] = i;
+  }
+
+  free(g->buckets);
+  g->buckets = buckets;
+  g->bucketCount = bucketCount;
+  return true;
+}
+
+// Returns the node for key, creating an undefined one if needed. Node
+// pointers are invalidated by this call.
+static size_t watchGraph_intern(watchGraph *g, const substring key) {
+  size_t idx = watchGraph_find(g, key);
+  if (idx != NO_NODE)
+    return idx;
+
+  if (g->count == g->capacity) {
+    size_t capacity = g->capacity * 2;
+    watchNode *nodes = realloc(g->nodes, sizeof(watchNode) * capacity);
+    if (!nodes)
+      return NO_NODE;
+    g->nodes = nodes;
+    g->capacity = capacity;
+  }
+  if (g->count == g->bucketCount &&
+      !watchGraph_rehash(g, g->bucketCount * 2))
+    return NO_NODE;
+
+  char *copy = malloc(key.len);
+  if (!copy)
+    return NO_NODE;
+  memcpy(copy, key.str, key.len);
+
+  idx = g->count++;
+  size_t b = substringHash(key) & (g->bucketCount - 1);
+  g->nodes[idx] = (watchNode){
+      .key = {.str = copy, .len = key.len},
+      .state = NODE_STALE,
+      .value = nan("Undefined"),
+      .error = UNKNOWN_IDENTIFIER,
+      .next = g->buckets[b],
+  };
+  g->buckets[b] = idx;
+  return idx;
+}
+
+static bool collectReferences(watchGraph *g, const ASTNode *node,
+                              indexList *deps) {
+  switch (node->type) {
+  case TOKEN_PLUS:
+  case TOKEN_MINUS:
+  case TOKEN_MUL:
+  case TOKEN_DIV:
+  case TOKEN_EXP: {
+    astChain chain;
+    if (!astChain_push(&chain, node, 0, SIZE_MAX))
+      return false;
+    bool ok = collectReferences(g, astChain_node(&chain, 0)->binary.left, deps);
+    for (size_t i = 0; ok && i < chain.len; i++)
+      ok = collectReferences(g, astChain_node(&chain, i)->binary.right, deps);
+    astChain_pop(&chain);
+    return ok;
+  }
+
+  // Vector literals nest down their right operands
+  case TOKEN_COMMA:
+    for (; node->type == TOKEN_COMMA; node = node->binary.right)
+      if (!collectReferences(g, node->binary.left, deps))
+        return false;
+    return collectReferences(g, node, deps);
+
+  case TOKEN_DOT:
+  case TOKEN_RANGE:
+    return collectReferences(g, node->binary.left, deps) &&
+           collectReferences(g, node->binary.right, deps);
+
+  case TOKEN_UNARY_MINUS:
+  case TOKEN_UNARY_PLUS:
+  case TOKEN_SIN:
+  case TOKEN_COS:
+  case TOKEN_LOG:
+  case TOKEN_OPENBRACKET:
+  case TOKEN_ELEMENT_SUM:
+  case TOKEN_ELEMENT_PROD:
+  case TOKEN_MINIMUM:
+  case TOKEN_MAXIMUM:
+    return collectReferences(g, node->unary.operand, deps);
+
+  // The index or variable becomes a node of its own, which is harmless since
+  // loops are recomputed on every update anyway
+  case TOKEN_SUM:
+  case TOKEN_PROD:
+  case TOKEN_INTEGRATE:
+  case TOKEN_SOLVE:
+    return collectReferences(g, node->reduction.from, deps) &&
+           collectReferences(g, node->reduction.to, deps) &&
+           collectReferences(g, node->reduction.body, deps);
+
+  case TOKEN_IDEN: {
+    size_t idx = watchGraph_intern(g, node->identifer);
+    if (idx == NO_NODE)
+      return false;
+    return indexList_contains(deps, idx) || indexList_push(deps, idx);
+  }
+
+  default:
+    return true;
+  }
+}
+
+// Loops and vectors are beyond evalDefinition()
+static bool needsParserTree(const ASTNode *node) {
+  switch (node->type) {
+  case TOKEN_PLUS:
+  case TOKEN_MINUS:
+  case TOKEN_MUL:
+  case TOKEN_DIV:
+  case TOKEN_EXP: {
+    astChain chain;
+    if (!astChain_push(&chain, node, 0, SIZE_MAX))
+      return true; // the parser reports running out of memory
+    bool needed = needsParserTree(astChain_node(&chain, 0)->binary.left);
+    for (size_t i = 0; !needed && i < chain.len; i++)
+      needed = needsParserTree(astChain_node(&chain, i)->binary.right);
+    astChain_pop(&chain);
+    return needed;
+  }
+
+  case TOKEN_UNARY_MINUS:
+  case TOKEN_UNARY_PLUS:
+  case TOKEN_SIN:
+  case TOKEN_COS:
+  case TOKEN_LOG:
+    return needsParserTree(node->unary.operand);
+
+  case TOKEN_NUMBER:
+  case TOKEN_IDEN:
+  case TOKEN_DEREF:
+    return false;
+
+  default:
+    return true;
+  }
+}
+
+static void markStale(watchGraph *g, size_t idx) {
+  watchNode *n = &g->nodes[idx];
+  if (n->state == NODE_STALE)
+    return;
+
+  n->state = NODE_STALE;
+  for (size_t i = 0; i < n->dependents.count; i++)
+    markStale(g, n->dependents.items[i]);
+}
+
+// Replaces the node's edges with those of its current definition in the map
+static bool refreshDefinition(watchGraph *g, size_t idx) {
+  size_t treeSize;
+  ASTNode *declarations = NULL;
+  const ASTNode *definition = hashMap_getValue(&g->ctx->map, g->nodes[idx].key,
+                                               &treeSize, &declarations);
+
+  indexList deps = {0};
+  if (definition && !collectReferences(g, definition, &deps)) {
+    free(deps.items);
+    return false;
+  }
+
+  watchNode *n = &g->nodes[idx];
+  for (size_t i = 0; i < n->deps.count; i++)
+    indexList_remove(&g->nodes[n->deps.items[i]].dependents, idx);
+  free(n->deps.items);
+
+  n->definition = definition;
+  n->needsParser =
+      declarations != NULL || (definition && needsParserTree(definition));
+  n->deps = deps;
+  for (size_t i = 0; i < deps.count; i++)
+    if (!indexList_push(&g->nodes[deps.items[i]].dependents, idx))
+      return false;
+
+  markStale(g, idx);
+  return true;
+}
+
+/*--EVALUATION--*/
+static real evalDefinition(const watchGraph *g, const ASTNode *node) {
+  switch (node->type) {
+  case TOKEN_NUMBER:
+    return node->number;
+
+  case TOKEN_IDEN:
+    return g->nodes[watchGraph_find(g, node->identifer)].value;
+
+  case TOKEN_UNARY_MINUS:
+  case TOKEN_UNARY_PLUS:
+  case TOKEN_SIN:
+  case TOKEN_COS:
+  case TOKEN_LOG:
+    return evalUnary(node->type, evalDefinition(g, node->unary.operand));
+
+  case TOKEN_PLUS:
+  case TOKEN_MINUS:
+  case TOKEN_MUL:
+  case TOKEN_DIV:
+  case TOKEN_EXP: {
+    astChain chain;
+    if (!astChain_push(&chain, node, 0, SIZE_MAX))
+      return nan("Allocation failed");
+    const ASTNode *bottom = astChain_node(&chain, 0);
+    real value = evalDefinition(g, bottom->binary.left);
+    for (size_t i = 0; i < chain.len; i++) {
+      const ASTNode *op = astChain_node(&chain, i);
+      value = evalBinary(op->type, value, evalDefinition(g, op->binary.right));
+    }
+    astChain_pop(&chain);
+    return value;
+  }
+
+  default:
+    return nan("Invalid Token");
+  }
+}
+
+// Declaration blocks bind identifiers while they run, which can change what
+// later references see, and loops bind their index, so those go through the
+// parser like a reference in an expression would. So do vectors, which need
+// the arena; a vector-valued output is reported as an error.
+static void runReference(watchGraph *g, watchNode *n) {
+  evalContext *ctx = g->ctx;
+  parser psr = {0};
+  psr.tknStream = &ctx->tokens;
+
+  memPool_reset(&ctx->buffers.scratchPool);
+  psr.nodePool = ctx->buffers.scratchPool;
+  vectorArena_reset(&ctx->buffers.arena);
+  psr.arena = &ctx->buffers.arena;
+  psr.clones = &ctx->buffers.clones;
+
+  if (!hashMap_init(&psr.map, 1)) {
+    logError("Fatal: Memory allocation failure", __func__);
+    n->error = MISSING_ERROR_CODE;
+    return;
+  }
+  psr.map.parent = &ctx->map;
+
+  ASTNode reference = {.type = TOKEN_IDEN, .identifer = n->key};
+  if (runExpression(&psr, &reference, &n->value))
+    n->error = 0;
+  else
+    n->error = errno ? errno : MISSING_ERROR_CODE;
+
+  ctx->buffers.scratchPool = psr.nodePool; // may have grown
+  hashMap_free(&psr.map);
+}
+
+static void computeNode(watchGraph *g, watchNode *n) {
+  STATS_ADD(watchComputes, 1);
+  n->rerun = n->needsParser;
+  n->error = n->definition ? 0 : UNKNOWN_IDENTIFIER;
+
+  for (size_t i = 0; i < n->deps.count; i++) {
+    const watchNode *dep = &g->nodes[n->deps.items[i]];
+    if (dep->rerun)
+      n->rerun = true;
+    if (dep->state == NODE_VISITING && !n->error)
+      n->error = MAXIMUM_RECURSION_DEPTH; // cycle
+    else if (dep->error && !n->error)
+      n->error = UNDEFINED_REFERENCE;
+  }
+
+  if (n->definition && n->rerun) {
+    runReference(g, n);
+    return;
+  }
+  if (n->error) {
+    n->value = nan("Failed reference");
+    return;
+  }
+
+  n->value = evalDefinition(g, n->definition);
+  if (n->value != n->value)
+    n->error = MISSING_ERROR_CODE;
+}
+
+static void visit(watchGraph *g, size_t idx) {
+  watchNode *n = &g->nodes[idx];
+  if (n->state != NODE_STALE)
+    return;
+
+  n->state = NODE_VISITING;
+  for (size_t i = 0; i < n->deps.count; i++)
+    visit(g, n->deps.items[i]);
+
+  computeNode(g, n);
+  n->state = NODE_CURRENT;
+}
+
+/*--OUTPUT--*/
+static void printNode(FILE *out, const watchNode *n) {
+  if (n->error)
+    fprintf(out, "%.*s error %d\n", (int)n->key.len, n->key.str, n->error);
+  else {
+    char text[OUTPUT_VALUE_BYTES];
+    output_formatReal(n->value, text);
+    fprintf(out, "%.*s = %s\n", (int)n->key.len, n->key.str, text);
+  }
+}
+
+static bool sameResult(const watchNode *n, const watchResult *previous) {
+  if (n->error || previous->error)
+    return n->error == previous->error;
+  return n->value == previous->value;
+}
+
+// Brings every output up to date, visiting dependencies before dependents,
+// and prints the outputs whose result changed (all of them when printAll)
+static void recompute(watchGraph *g, FILE *out, bool printAll) {
+  for (size_t i = 0; i < g->count; i++)
+    if (g->nodes[i].rerun)
+      markStale(g, i);
+
+  // Outputs may depend on each other, so the old results are taken first
+  for (size_t i = 0; i < g->outputs.count; i++) {
+    const watchNode *n = &g->nodes[g->outputs.items[i]];
+    g->previous[i] = (watchResult){.error = n->error, .value = n->value};
+  }
+
+  for (size_t i = 0; i < g->outputs.count; i++)
+    visit(g, g->outputs.items[i]);
+
+  for (size_t i = 0; i < g->outputs.count; i++) {
+    const watchNode *n = &g->nodes[g->outputs.items[i]];
+    if (printAll || !sameResult(n, &g->previous[i]))
+      printNode(out, n);
+  }
+  fflush(out);
+}
+
+/*--UPDATES--*/
+static void releaseSource(watchSource *source) {
+  if (!source || --source->refs)
+    return;
+  memPool_free(&source->nodePool);
+  free(source->text);
+  free(source);
+}
+
+// Updates are a sequence of "(iden = exp)". Anything inside the parentheses,
+// such as a declaration block, is left for the parser to check.
+static size_t assignedKeys(const tokenStream *tknStream, substring *keys) {
+  const token *tokens = tknStream->stream;
+  size_t count = 0;
+  size_t i = 0;
+
+  while (tokens[i].type != TOKEN_EOF) {
+    if (tokens[i].type != TOKEN_OPENPAREN ||
+        tokens[i + 1].type != TOKEN_IDEN ||
+        tokens[i + 2].type != TOKEN_ASSIGNMENT)
+      return 0;
+    keys[count++] = tokenStream_lexeme(tknStream, i + 1);
+    i += 3;
+
+    for (int depth = 1; depth; i++) {
+      switch (tokens[i].type) {
+      case TOKEN_EOF:
+        return 0;
+      case TOKEN_OPENPAREN:
+        depth++;
+        break;
+      case TOKEN_CLOSEPAREN:
+        depth--;
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+  return count;
+}
+
+static bool applyUpdate(watchGraph *g, const char *line) {
+  evalContext *ctx = g->ctx;
+  watchSource *source = calloc(1, sizeof(watchSource));
+  if (!source || !(source->text = strdup(line))) {
+    logError("Fatal: Memory allocation failure", __func__);
+    free(source);
+    return false;
+  }
+  source->refs = 1; // held while binding
+
+  tokenStream *tknStream = tokenise(source->text);
+  if (!tknStream) {
+    releaseSource(source);
+    return true; // already reported, keep watching
+  }
+
+  substring *keys = malloc(sizeof(substring) * tknStream->count);
+  size_t keyCount = keys ? assignedKeys(tknStream, keys) : 0;
+  bool loaded = keys && evalContext_appendTokens(ctx, tknStream);
+  tokenStream_free(tknStream);
+  free(tknStream);
+
+  if (!loaded) {
+    free(keys);
+    releaseSource(source);
+    return false;
+  }
+  if (!keyCount) {
+    errno = INVALID_ASSIGNMENT_SYNTAX;
+    logError("Invalid Syntax: Updates must be assignments of the form "
+             "(<iden> = <exp>)\n",
+             __func__);
+    free(keys);
+    releaseSource(source);
+    return true;
+  }
+
+  // New identifiers are entered with the graph's copy of their name, so the
+  // map never points into a line that has been released
+  for (size_t i = 0; i < keyCount; i++) {
+    size_t idx = watchGraph_intern(g, keys[i]);
+    size_t treeSize;
+    ASTNode *declarations;
+    if (idx == NO_NODE ||
+        (!hashMap_getValue(&ctx->map, keys[i], &treeSize, &declarations) &&
+         !hashmap_setKey(&ctx->map, g->nodes[idx].key, NULL, 0, NULL))) {
+      logError("Fatal: Memory allocation failure", __func__);
+      free(keys);
+      releaseSource(source);
+      return false;
+    }
+  }
+
+  parser psr = {0};
+  psr.currentToken = ctx->appendIndex;
+  psr.tknStream = &ctx->tokens;
+  psr.map = ctx->map;
+  bool ok = memPool_init(&psr.nodePool, ctx->tokens.count - ctx->appendIndex);
+  if (!ok) {
+    logError("Fatal: Memory allocation failure", __func__);
+    free(keys);
+    releaseSource(source);
+    return false;
+  }
+
+  errno = 0;
+  parseDeclarations(&psr); // errors are reported, earlier bindings stay
+  source->nodePool = psr.nodePool;
+  ctx->map = psr.map;
+
+  for (size_t i = 0; ok && i < keyCount; i++) {
+    size_t idx = watchGraph_find(g, keys[i]);
+    ok = refreshDefinition(g, idx);
+
+    watchNode *n = &g->nodes[idx];
+    if (n->source != source) {
+      releaseSource(n->source);
+      n->source = source;
+      source->refs++;
+    }
+  }
+
+  if (!ok)
+    logError("Fatal: Memory allocation failure", __func__);
+  free(keys);
+  releaseSource(source);
+  return ok;
+}
+
+/*--WATCH LOOP--*/
+static bool watchGraph_init(watchGraph *g, evalContext *ctx,
+                            const char *outputs) {
+  *g = (watchGraph){.ctx = ctx, .capacity = INITIAL_BUCKETS};
+  g->nodes = malloc(sizeof(watchNode) * g->capacity);
+  if (!g->nodes || !watchGraph_rehash(g, INITIAL_BUCKETS))
+    return false;
+
+  for (size_t b = 0; b < ctx->map.size; b++) {
+    for (entry *e = ctx->map.buckets[b]; e; e = e->next) {
+      size_t idx = watchGraph_intern(g, e->key);
+      if (idx == NO_NODE || !refreshDefinition(g, idx))
+        return false;
+    }
+  }
+
+  const char *name = outputs;
+  while (*name) {
+    size_t len = strcspn(name, ",");
+    if (len) {
+      substring key = {.str = (char *)name, .len = len};
+      size_t idx = watchGraph_intern(g, key);
+      if (idx == NO_NODE || (!indexList_contains(&g->outputs, idx) &&
+                             !indexList_push(&g->outputs, idx)))
+        return false;
+    }
+    name += len + (name[len] == ',');
+  }
+
+  g->previous = malloc(sizeof(watchResult) * (g->outputs.count + 1));
+  return g->previous != NULL;
+}
+
+static void watchGraph_free(watchGraph *g) {
+  for (size_t i = 0; i < g->count; i++) {
+    watchNode *n = &g->nodes[i];
+    releaseSource(n->source);
+    free(n->deps.items);
+    free(n->dependents.items);
+    free(n->key.str);
+  }
+  free(g->outputs.items);
+  free(g->previous);
+  free(g->buckets);
+  free(g->nodes);
+}
+
+int runWatch(evalContext *ctx, const char *outputs, FILE *in, FILE *out) {
+  watchGraph g;
+  if (!watchGraph_init(&g, ctx, outputs)) {
+    logError("Fatal: Memory allocation failure", __func__);
+    watchGraph_free(&g);
+    return -1;
+  }
+
+  if (!g.outputs.count) {
+    errno = MISSING_EXPRESSION;
+    logError("No identifiers to watch\n", __func__);
+    watchGraph_free(&g);
+    return -1;
+  }
+
+  recompute(&g, out, true);
+
+  int status = 0;
+  char *line = NULL;
+  size_t lineCapacity = 0;
+  ssize_t len;
+  while ((len = getline(&line, &lineCapacity, in)) != -1) {
+    while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+      line[--len] = '\0';
+    if (!len)
+      continue;
+
+    if (!applyUpdate(&g, line)) {
+      status = -1;
+      break;
+    }
+    recompute(&g, out, false);
+  }
+
+  free(line);
+  watchGraph_free(&g);
+  return status;
+}
@@ -0,0 +1,1321 @@
+#include "budget.h"
+#include "context.h"
+#include "format.h"
+#include "logger.h"
+#include "number.h"
+#include "numeric.h"
+#include "output.h"
+#include "parallel.h"
+#include "parser.h"
+#include "profile.h"
+#include "real.h"
+#include "reduce.h"
+#include "stats.h"
+#include "stream.h"
+#include "stress.h"
+#include "sweep.h"
+#include "util.h"
+#include "watch.h"
+#include <criterion/criterion.h>
+#include <criterion/internal/assert.h>
+#include <criterion/internal/test.h>
+#include <criterion/logging.h>
+#include <criterion/redirect.h>
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Built once per numeric type (eval_f32, eval_f64, eval_f80), so expected
+// values are computed in `real` and compared within a few ulps.
+#define NO_CONFIG "test/no_such_config.txt"
+
+static evalContext ctx;
+
+static void setup(void) {
+  cr_redirect_stdout();
+  cr_redirect_stderr();
+  cr_assert(evalContext_init(&ctx, NO_CONFIG), "Context should initialise");
+}
+
+static void teardown(void) { evalContext_free(&ctx); }
+
+static real evaluate(const char *expression) {
+  real result = 0;
+  cr_assert(evalContext_evaluate(&ctx, expression, &result),
+            "'%s' should evaluate", expression);
+  return result;
+}
+
+static void assertClose(real actual, real expected) {
+  real scale = fabsl(expected) > 1 ? fabsl(expected) : 1;
+  real tolerance = 4 * REAL_EPSILON * scale;
+  cr_assert(fabsl(actual - expected) <= tolerance,
+            REAL_NAME ": got %.21Lg, expected %.21Lg", (long double)actual,
+            (long double)expected);
+}
+
+TestSuite(eval_real, .init = setup, .fini = teardown,
+          .description = "Evaluation in the compiled numeric type");
+
+Test(eval_real, test_arithmetic) {
+  assertClose(evaluate("1+2*3^2"), 19);
+  assertClose(evaluate("(8 - 2) / 4"), 1.5);
+  assertClose(evaluate("2^3^2"), 64);
+  assertClose(evaluate("-2^2"), 4);
+}
+
+Test(eval_real, test_rounding_follows_type) {
+  assertClose(evaluate("1/3"), (real)1 / 3);
+  assertClose(evaluate("0.1 + 0.2"), (real)0.1L + (real)0.2L);
+
+  // Only representable when the sum is kept wider than float
+  real expected = ((real)1 + (real)0x1p-30L) - 1;
+  cr_assert_eq(evaluate("(1 + 2^(0 - 30)) - 1"), expected);
+}
+
+Test(eval_real, test_math_functions) {
+  assertClose(evaluate("sin 0"), 0);
+  assertClose(evaluate("cos 0"), 1);
+  assertClose(evaluate("log 1000"), 3);
+  assertClose(evaluate("sin 1"), realSin((real)1));
+}
+
+Test(eval_real, test_identifiers) {
+  assertClose(evaluate("(x = 3) (y = x*2) y + x"), 9);
+  assertClose(evaluate("(a = (x = 3)(y = 2) x*y) a"), 6);
+}
+
+// A group that starts or ends with an assignment is an operand, not a
+// declaration of the expression around it
+Test(eval_real, test_grouped_assignments) {
+  assertClose(evaluate("2*((x = 3) x+1)"), 8);
+  assertClose(evaluate("((x = 3) x)"), 3);
+  assertClose(evaluate("((n = 3) (m = 2) n - m) + 1"), 2);
+  assertClose(evaluate("(7 (a = 2))"), 7);
+  assertClose(evaluate("(7 (a = 2)) + a"), 9);
+  assertClose(evaluate("(x = 1) ((y = 2) y) + x"), 3);
+}
+
+Test(eval_real, test_reductions) {
+  assertClose(evaluate("sum(i, 1, 100, i)"), 5050);
+  assertClose(evaluate("prod(i, 1, 10, i)"), 3628800);
+  assertClose(evaluate("sum(i, 1, 0, i) + prod(i, 1, 0, i)"), 1);
+
+  // Bodies referencing identifiers take the general path, same result
+  assertClose(evaluate("(f = i^2) sum(i, 1, 10, f)"),
+              evaluate("sum(i, 1, 10, i^2)"));
+  assertClose(evaluate("(i = 5) sum(i, 1, 3, i) + i"), 11);
+  assertClose(evaluate("sum(i, 1, 3, sum(j, 1, i, j))"), 10);
+
+  real result;
+  cr_assert_not(evalContext_evaluate(&ctx, "sum(i, 1, 1/0, i)", &result));
+  cr_assert_eq(errno, INVALID_RANGE);
+  cr_assert_not(evalContext_evaluate(&ctx, "sum(i, 0, 1e15, i)", &result));
+  cr_assert_eq(errno, REDUCE_MAX_INDEX < 1e15 ? INEXACT_RANGE : RANGE_TOO_LONG);
+  cr_assert_not(evalContext_evaluate(&ctx, "sum(i, 1, 3)", &result));
+  cr_assert_eq(errno, INVALID_REDUCTION);
+}
+
+static void assertVector(const char *expression, const real *expected,
+                         size_t len) {
+  value result;
+  cr_assert(evalContext_evaluateValue(&ctx, expression, &result),
+            "'%s' should evaluate", expression);
+  cr_assert_not_null(result.data, "'%s' should be a vector", expression);
+  cr_assert_eq(result.len, len, "'%s' has %zu elements, expected %zu",
+               expression, result.len, len);
+  for (size_t i = 0; i < len; i++)
+    assertClose(result.data[i], expected[i]);
+}
+
+Test(eval_real, test_vectors) {
+  assertVector("[1, 2, 3] * 2 + 1", (real[]){3, 5, 7}, 3);
+  assertVector("2 ^ [1, 2, 3]", (real[]){2, 4, 8}, 3);
+  assertVector("[4, 9] / [2, 3]", (real[]){2, 3}, 2);
+  assertVector("-log [10, 100]", (real[]){-1, -2}, 2);
+  assertVector("(v = range(1, 4)) v - 1", (real[]){0, 1, 2, 3}, 4);
+
+  // Lengths past one line, so the SIMD kernels and the tail both run
+  real squares[19];
+  for (size_t i = 0; i < 19; i++)
+    squares[i] = (real)((i + 1) * (i + 1));
+  assertVector("range(1, 19) ^ 2", squares, 19);
+  assertVector("range(1, 19) * range(1, 19)", squares, 19);
+
+  assertClose(evaluate("sum(range(1, 100))"), 5050);
+  assertClose(evaluate("prod([1, 2, 3, 4])"), 24);
+  assertClose(evaluate("min([3, -1, 2]) + max([3, -1, 2])"), 2);
+  assertClose(evaluate("dot([1, 2, 3], [4, 5, 6])"), 32);
+  assertClose(evaluate("(w = [1, 2]) sum(i, 1, 3, sum(w * i))"), 18);
+  assertClose(evaluate("sum(range(2, 1))"), 0);
+
+  real result;
+  cr_assert_not(evalContext_evaluate(&ctx, "[1, 2] + [1, 2, 3]", &result));
+  cr_assert_eq(errno, LENGTH_MISMATCH);
+  cr_assert_not(evalContext_evaluate(&ctx, "[1, 2]", &result),
+                "A vector is not a number");
+  cr_assert_eq(errno, INVALID_VECTOR_USE);
+  cr_assert_not(evalContext_evaluate(&ctx, "sum(range(0, 2e15))", &result));
+  cr_assert_eq(errno, REDUCE_MAX_INDEX < 2e15 ? INEXACT_RANGE : RANGE_TOO_LONG);
+  cr_assert_not(evalContext_evaluate(&ctx, "max(range(2, 1))", &result));
+  cr_assert_eq(errno, INVALID_VECTOR_USE);
+  cr_assert_not(evalContext_evaluate(&ctx, "[1, 2", &result));
+  cr_assert_eq(errno, MISSING_CLOSING_PARENTHESIS);
+  cr_assert_not(evalContext_evaluate(&ctx, "(1]", &result));
+  cr_assert_eq(errno, INVALID_VECTOR_SYNTAX);
+  cr_assert_not(evalContext_evaluate(&ctx, "dot([1])", &result));
+  cr_assert_eq(errno, INVALID_VECTOR_SYNTAX);
+}
+
+// integrate() and solve() only promise the default numeric tolerance
+static void assertConverged(const char *expression, real expected) {
+  real actual = evaluate(expression);
+  real scale = fabsl(expected) > 1 ? fabsl(expected) : 1;
+  cr_assert(fabsl(actual - expected) <= NUMERIC_TOLERANCE * scale,
+            REAL_NAME ": '%s' gave %.21Lg, expected %.21Lg", expression,
+            (long double)actual, (long double)expected);
+}
+
+Test(eval_real, test_integrate_solve) {
+  // Exact for polynomials of this degree, so only rounding is left
+  assertClose(evaluate("integrate(x^2, x, 0, 3)"), 9);
+  assertClose(evaluate("integrate(x, x, 1, 0)"), -0.5);
+  assertClose(evaluate("integrate(x, x, 2, 2)"), 0);
+
+  assertConverged("integrate(cos x, x, 0, 1)", realSin((real)1));
+  assertConverged("integrate(1/x^(1/2), x, 0, 1)", 2);
+  assertConverged("solve(x^2 - 2, x, 0, 2)", realPow(2, (real)0.5L));
+  assertConverged("solve(cos x - x, x, 0, 1)", (real)0.739085133215160642L);
+
+  // Definitions of the variable are inlined, anything else runs per point
+  assertConverged("(f = t^3 - t - 1) solve(f, t, 1, 2)",
+                  (real)1.32471795724474602596L);
+  assertClose(evaluate("(w = [1, 2]) integrate(sum(w) * x, x, 0, 2)"), 6);
+  assertConverged("integrate(integrate(x*y, x, 0, 1), y, 0, 2)", 1);
+
+  real result;
+  cr_assert_not(evalContext_evaluate(&ctx, "solve(x^2 + 1, x, 0, 1)", &result));
+  cr_assert_eq(errno, NO_SIGN_CHANGE);
+  cr_assert_not(evalContext_evaluate(&ctx, "integrate(x, x, 0, 1/0)", &result));
+  cr_assert_eq(errno, INVALID_RANGE);
+  cr_assert_not(evalContext_evaluate(&ctx, "integrate(x, 1, 0, 1)", &result));
+  cr_assert_eq(errno, INVALID_REDUCTION);
+  // Diverges at 0, where the estimate overflows instead of converging
+  cr_assert_not(evalContext_evaluate(&ctx, "integrate(1/x, x, 0, 1)", &result));
+  cr_assert_eq(errno, NO_CONVERGENCE);
+
+  numeric_setMaxEvaluations(20);
+  cr_assert_not(
+      evalContext_evaluate(&ctx, "integrate(1/x^(1/2), x, 0, 1)", &result));
+  cr_assert_eq(errno, NO_CONVERGENCE);
+  numeric_setMaxEvaluations(NUMERIC_MAX_EVALUATIONS);
+}
+
+static void assertSweep(const char *expression, const char **specs,
+                        size_t count, sweepLayout layout, int status,
+                        const char *expected) {
+  sweepAxis axes[SWEEP_MAX_AXES];
+  for (size_t k = 0; k < count; k++)
+    cr_assert(sweepAxis_parse(&axes[k], specs[k]), "'%s' should parse",
+              specs[k]);
+
+  FILE *out = tmpfile();
+  cr_assert_not_null(out);
+  cr_assert_eq(
+      runSweep(&ctx, expression, axes, count, layout, OUTPUT_TEXT, out),
+      status);
+
+  char text[256] = {0};
+  rewind(out);
+  fread(text, 1, sizeof(text) - 1, out);
+  fclose(out);
+  cr_assert_str_eq(text, expected);
+  for (size_t k = 0; k < count; k++)
+    sweepAxis_free(&axes[k]);
+}
+
+Test(eval_real, test_sweep) {
+  assertSweep("x*y", (const char *[]){"x=0:1:3", "y=1,2"}, 2, SWEEP_ROWS, 0,
+              "0 1 0\n0 2 0\n0.5 1 0.5\n0.5 2 1\n1 1 1\n1 2 2\n");
+  assertSweep("x*y", (const char *[]){"x=1,2", "y=1,2,3"}, 2, SWEEP_GRID, 0,
+              "1 2 3\n2 4 6\n");
+  assertSweep("x + 1", (const char *[]){"x=1,2"}, 1, SWEEP_CSV, 0,
+              "x,result\n1,2\n2,3\n");
+
+  // A leading declaration block is inlined, dereferences take the general
+  // path, and assignments only last for their point
+  assertSweep("(f = g * 2) (g = x + 1) f", (const char *[]){"x=1,2"}, 1,
+              SWEEP_ROWS, 0, "1 4\n2 6\n");
+  assertSweep("(x = *x * 2) x", (const char *[]){"x=1,2,3"}, 1, SWEEP_ROWS, 0,
+              "1 2\n2 4\n3 6\n");
+  assertSweep("sum(i, 1, x, i)", (const char *[]){"x=1:3:3"}, 1, SWEEP_ROWS, 0,
+              "1 1\n2 3\n3 6\n");
+
+  // Points before the first failure are still written
+  assertSweep("integrate(1, t, 0, 1 / (2 - x))", (const char *[]){"x=1,2"}, 1,
+              SWEEP_ROWS, -1, "1 1\n");
+
+  sweepAxis axis;
+  cr_assert_not(sweepAxis_parse(&axis, "x=1:2"));
+  cr_assert_not(sweepAxis_parse(&axis, "x=1:2:0"));
+  cr_assert_not(sweepAxis_parse(&axis, "x=1,,2"));
+  cr_assert_not(sweepAxis_parse(&axis, "sin=1"));
+}
+
+Test(eval_real, test_stream) {
+  FILE *in = tmpfile(), *out = tmpfile();
+  cr_assert(in && out);
+  fputs("1 + 2\n2 +\n(x = 4) x * x\n[1, 2] * 2\nx\n", in);
+  // More lines than slots, so every slot is reused
+  for (int i = 0; i < 3 * STREAM_SLOTS; i++)
+    fprintf(in, "%d + 1\n", i);
+  fputs("7", in); // no newline after the last line
+  fflush(in);
+  rewind(in);
+
+  // Failures keep their line, and assignments stay on theirs
+  cr_assert_eq(runStream(&ctx, fileno(in), fileno(out), OUTPUT_TEXT), -1);
+  rewind(out);
+  char line[64];
+  const char *expected[] = {"3\n", "\n", "16\n", "2 4\n", "\n"};
+  for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+    cr_assert(fgets(line, sizeof(line), out));
+    cr_assert_str_eq(line, expected[i]);
+  }
+  for (int i = 0; i < 3 * STREAM_SLOTS; i++) {
+    cr_assert(fgets(line, sizeof(line), out));
+    cr_assert_eq(atoi(line), i + 1, "Line %d is out of order", i);
+  }
+  cr_assert(fgets(line, sizeof(line), out));
+  cr_assert_str_eq(line, "7\n");
+  cr_assert_null(fgets(line, sizeof(line), out));
+  fclose(in);
+  fclose(out);
+
+  cr_assert_eq(runStream(&ctx, 0, 1, OUTPUT_NPY), -1);
+}
+
+static uint64_t readLE(const unsigned char *bytes, size_t size) {
+  uint64_t x = 0;
+  for (size_t i = size; i-- > 0;)
+    x = x << 8 | bytes[i];
+  return x;
+}
+
+static double readF64(const unsigned char *bytes) {
+  uint64_t bits = readLE(bytes, 8);
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+Test(eval_real, test_output_formats) {
+  outputBuffer buf = {0};
+  size_t shape[] = {2, 3};
+  cr_assert(output_appendHeader(&buf, OUTPUT_NPY, shape, 2));
+  cr_assert_eq(buf.len % 64, 0, "The data should start aligned");
+  cr_assert(memcmp(buf.data, "\x93NUMPY\x01\x00", 8) == 0);
+  cr_assert_eq(readLE((unsigned char *)buf.data + 8, 2) + 10, buf.len);
+  cr_assert_eq(buf.data[buf.len - 1], '\n');
+  char header[128] = {0};
+  memcpy(header, buf.data + 10, buf.len - 10);
+  cr_assert(strstr(header, "'descr': '<f8'") &&
+            strstr(header, "'shape': (2, 3), }"));
+  outputBuffer_free(&buf);
+
+  // Grid points as frames: a result, then the error the sweep stopped at
+  sweepAxis axis;
+  cr_assert(sweepAxis_parse(&axis, "x=1,2"));
+  FILE *out = tmpfile();
+  cr_assert_not_null(out);
+  cr_assert_eq(runSweep(&ctx, "integrate(1, t, 0, 1 / (2 - x))", &axis, 1,
+                        SWEEP_GRID, OUTPUT_FRAMED, out),
+               -1);
+  unsigned char bytes[64];
+  rewind(out);
+  cr_assert_eq(fread(bytes, 1, sizeof(bytes), out), 24);
+  fclose(out);
+  sweepAxis_free(&axis);
+  cr_assert_eq(readLE(bytes, 4), 0);
+  cr_assert_eq(readLE(bytes + 4, 4), 1);
+  cr_assert_eq(readF64(bytes + 8), 1.0);
+  cr_assert_eq(readLE(bytes + 16, 4), INVALID_RANGE);
+  cr_assert_eq(readLE(bytes + 20, 4), 0);
+
+  outputFormat format;
+  cr_assert(output_parseFormat("npy", &format) && format == OUTPUT_NPY);
+  cr_assert_not(output_parseFormat("f32", &format));
+}
+
+static void assertShortest(double value, const char *expected) {
+  char text[FORMAT_SHORTEST_MAX];
+  cr_assert_eq(format_shortest(value, text), strlen(expected));
+  cr_assert_str_eq(text, expected);
+}
+
+// True when a decimal with fewer significant digits than text also reads back
+// as value. Those that could are next to the correctly rounded one.
+static bool hasShorter(double value, const char *text) {
+  int digits = 0;
+  bool leading = true;
+  for (const char *c = text; *c && *c != 'e'; c++) {
+    leading &= *c < '1' || *c > '9';
+    digits += !leading && *c >= '0' && *c <= '9';
+  }
+  if (!strchr(text, '.') && !strchr(text, 'e'))
+    for (size_t end = strlen(text); text[end - 1] == '0'; end--)
+      digits--;
+  if (digits <= 1)
+    return false;
+
+  char rounded[32];
+  snprintf(rounded, sizeof(rounded), "%.*e", digits - 2, fabs(value));
+  char *exponent = strchr(rounded, 'e');
+  long long mantissa = 0;
+  for (const char *c = rounded; c < exponent; c++)
+    if (*c != '.')
+      mantissa = mantissa * 10 + (*c - '0');
+
+  for (long long m = mantissa - 1; m <= mantissa + 1; m++) {
+    char candidate[48];
+    snprintf(candidate, sizeof(candidate), "%s%llde%d", value < 0 ? "-" : "",
+             m, atoi(exponent + 1) - (digits - 2));
+    if (strtod(candidate, NULL) == value)
+      return true;
+  }
+  return false;
+}
+
+Test(eval_real, test_shortest_format) {
+  assertShortest(0.1, "0.1");
+  assertShortest(0.1 + 0.2, "0.30000000000000004");
+  assertShortest(-0.0, "-0");
+  assertShortest(123456, "123456");
+  assertShortest(9007199254740991.0, "9007199254740991");
+  assertShortest(1e16, "10000000000000000");
+  assertShortest(1e17, "1e+17");
+  assertShortest(1e22, "1e+22");
+  assertShortest(1e-4, "0.0001");
+  assertShortest(1.5e-5, "1.5e-05");
+  assertShortest(5e-324, "5e-324");
+  assertShortest(DBL_MAX, "1.7976931348623157e+308");
+  assertShortest(-HUGE_VAL, "-inf");
+  assertShortest(NAN, "nan");
+
+  // Random bit patterns, also with mostly zero mantissas and subnormals
+  uint64_t state = 0x9E3779B97F4A7C15ull;
+  for (size_t i = 0; i < 200000; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    uint64_t bits = state;
+    if (i % 3 == 1)
+      bits &= 0xfff00000000000ffull;
+    else if (i % 3 == 2)
+      bits &= 0x800fffffffffffffull;
+
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    if (value != value)
+      continue;
+    char text[FORMAT_SHORTEST_MAX];
+    format_shortest(value, text);
+    double back = strtod(text, NULL);
+    cr_assert(memcmp(&back, &value, sizeof(value)) == 0,
+              "'%s' should read back as %a", text, value);
+    cr_assert_not(hasShorter(value, text), "'%s' is not the shortest", text);
+  }
+}
+
+// Text output of every type reads back as the value it was printed from
+Test(eval_real, test_text_round_trip) {
+  real values[] = {(real)1 / 3,     (real)2 / 3,      (real)0.1L + (real)0.2L,
+                   1 + REAL_EPSILON, 1 - REAL_EPSILON, realSin((real)1),
+                   -REAL_EPSILON,    (real)1e30L,      (real)1e-30L};
+  char text[OUTPUT_VALUE_BYTES];
+  for (size_t i = 0; i < sizeof(values) / sizeof(*values); i++) {
+    output_formatReal(values[i], text);
+    cr_assert(realParse(text, NULL) == values[i],
+              "'%s' should read back as the " REAL_NAME " it came from", text);
+  }
+
+  uint64_t state = 0x2545F4914F6CDD1Dull;
+  for (size_t i = 0; i < 100000; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    real value = (real)state * realPow(10, (real)(int)(i % 61) - 50);
+    output_formatReal(value, text);
+    cr_assert(realParse(text, NULL) == value, "'%s' should read back", text);
+  }
+}
+
+Test(eval_real, test_lazy_config) {
+  static const char *path = "test/lazy_config.tmp";
+  FILE *file = fopen(path, "w");
+  cr_assert(file);
+  fputs("(x = 1) (y = *x) (x = 2)\n(bad = 1 +)\n(f = g * 2) (g = 3)\n", file);
+  fclose(file);
+
+  // The broken definition only fails startup when it is parsed up front
+  evalContext lazy;
+  cr_assert_not(evalContext_init(&lazy, path));
+  evalContext_setLazyConfig(true);
+  bool loaded = evalContext_init(&lazy, path);
+  evalContext_setLazyConfig(false);
+  remove(path);
+  cr_assert(loaded, "Lazy context should initialise");
+
+  real result;
+  cr_assert(evalContext_evaluate(&lazy, "y * 10 + x", &result));
+  assertClose(result, 12);
+  cr_assert(evalContext_evaluate(&lazy, "f", &result));
+  assertClose(result, 6);
+  cr_assert_not(evalContext_evaluate(&lazy, "bad", &result));
+  cr_assert(evalContext_evaluate(&lazy, "(x = 5) y + x", &result));
+  assertClose(result, 6);
+  evalContext_free(&lazy);
+}
+
+Test(eval_real, test_profile) {
+  profile_setEnabled(true);
+  assertClose(evaluate("(f = g * 2) (g = 3) f + f"), 12);
+  profile_setEnabled(false);
+
+  FILE *folded = tmpfile();
+  cr_assert(folded);
+  cr_assert(profile_writeFolded(folded));
+  rewind(folded);
+  char line[64];
+  bool outer = false, nested = false;
+  unsigned long long ns;
+  while (fgets(line, sizeof(line), folded)) {
+    outer |= sscanf(line, "f %llu", &ns) == 1;
+    nested |= sscanf(line, "f;g %llu", &ns) == 1;
+  }
+  fclose(folded);
+  profile_reset();
+  cr_assert(outer && nested, "Both frames of f should be written");
+
+  // Nothing is kept once reset, nor recorded while disabled
+  evaluate("(h = 1) h");
+  folded = tmpfile();
+  cr_assert(folded);
+  cr_assert(profile_writeFolded(folded));
+  cr_assert_eq(ftell(folded), 0);
+  fclose(folded);
+}
+
+// Allocations made by this thread while counting. Everything else goes
+// straight to the C library, whose entry points glibc exports under these
+// names.
+static _Thread_local bool countAllocations;
+static _Thread_local size_t allocations;
+static _Thread_local size_t allocatedBytes;
+
+static void countAllocation(size_t bytes) {
+  if (countAllocations) {
+    allocations++;
+    allocatedBytes += bytes;
+  }
+}
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+  countAllocation(size);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  countAllocation(count * size);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  countAllocation(size);
+  return __libc_realloc(ptr, size);
+}
+
+Test(eval_real, test_steady_state_allocations) {
+  static const char *expressions[] = {
+      "1 + 2 * 3",
+      "(x = 3) (y = x*2) y + x",
+      "(a = (x = 3)(y = 2) x*y) a",
+      "(f = i^2) sum(i, 1, 10, f)",
+      "sum(i, 1, 3, sum(j, 1, i, j))",
+      "(v = range(1, 19)) v * v + max([3, -1, 2])",
+      "1 +",
+      "unknown * 2",
+  };
+  size_t count = sizeof(expressions) / sizeof(expressions[0]);
+  value result;
+
+  // The first rounds grow the buffers to fit, after that nothing allocates
+  for (int round = 0; round < 100; round++) {
+    countAllocations = round >= 3;
+    for (size_t i = 0; i < count; i++)
+      evalContext_evaluateValue(&ctx, expressions[i], &result);
+  }
+  countAllocations = false;
+  cr_assert_eq(allocations, 0, "%zu allocations after warm-up", allocations);
+  assertClose(evaluate("(x = 3) (y = x*2) y + x"), 9);
+}
+
+static double wallSeconds(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Seconds per evaluation, the best of a few batches of at least 2 ms, and
+// bytes a fresh context allocates for the first one
+static void measureWorkload(const char *workload, double *seconds,
+                            double *bytes) {
+  evalContext fresh;
+  cr_assert(evalContext_init(&fresh, NO_CONFIG));
+  value result;
+  allocatedBytes = 0;
+  countAllocations = true;
+  cr_assert(evalContext_evaluateValue(&fresh, workload, &result));
+  countAllocations = false;
+  *bytes = (double)allocatedBytes;
+
+  *seconds = HUGE_VAL;
+  for (int batch = 0; batch < 3; batch++) {
+    size_t runs = 0;
+    double start = wallSeconds(), elapsed;
+    do {
+      evalContext_evaluateValue(&fresh, workload, &result);
+      runs++;
+    } while ((elapsed = wallSeconds() - start) < 2e-3);
+    if (elapsed / runs < *seconds)
+      *seconds = elapsed / runs;
+  }
+  evalContext_free(&fresh);
+}
+
+// Least squares slope of log cost over log size: 1 for linear growth, 2 for
+// quadratic
+static double growthExponent(const double *sizes, const double *costs,
+                             size_t count) {
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (size_t i = 0; i < count; i++) {
+    double x = log(sizes[i]), y = log(costs[i]);
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+  }
+  return (count * sxy - sx * sy) / (count * sxx - sx * sx);
+}
+
+Test(eval_real, test_complexity) {
+  // Every dimension is linear in time and memory over sizes doubling from
+  // the first, which a superlinear path would push towards 2
+  static const struct {
+    stressDimension dimension;
+    size_t first;
+  } cases[] = {
+      {STRESS_LENGTH, 500},      {STRESS_DEPTH, 500}, {STRESS_IDENTIFIERS, 250},
+      {STRESS_CHAIN, 6},         {STRESS_FANOUT, 250},
+  };
+  enum { STEPS = 5 };
+
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    double sizes[STEPS], seconds[STEPS], bytes[STEPS];
+    for (size_t k = 0; k < STEPS; k++) {
+      sizes[k] = (double)(cases[c].first << k);
+      char *workload = stress_generate(cases[c].dimension, cases[c].first << k);
+      cr_assert_not_null(workload);
+      measureWorkload(workload, &seconds[k], &bytes[k]);
+      free(workload);
+    }
+
+    const char *name = stress_name(cases[c].dimension);
+    double time = growthExponent(sizes, seconds, STEPS);
+    double memory = growthExponent(sizes, bytes, STEPS);
+    cr_assert(time < 1.5, "%s: time grows as n^%.2f", name, time);
+    cr_assert(memory < 1.25, "%s: memory grows as n^%.2f", name, memory);
+  }
+}
+
+Test(eval_real, test_memory_budget) {
+  // Every reference holds a copy of its definition until its value is known,
+  // so a chain holds one per level at its deepest
+  char *chain = stress_generate(STRESS_CHAIN, 50);
+  cr_assert_not_null(chain);
+  assertClose(evaluate(chain), 50);
+  size_t peak = memBudget_peak();
+  cr_assert(peak > 50 * sizeof(ASTNode), "Peak of %zu bytes", peak);
+
+  real result;
+  memBudget_set(peak);
+  cr_assert(evalContext_evaluate(&ctx, chain, &result), "The peak fits");
+  memBudget_set(peak - 1);
+  cr_assert_not(evalContext_evaluate(&ctx, chain, &result));
+  cr_assert_eq(errno, MEMORY_BUDGET_EXCEEDED);
+  free(chain);
+
+  // Vectors count too, and the budget is per evaluation, not cumulative
+  memBudget_set(1 << 16);
+  cr_assert_not(evalContext_evaluate(&ctx, "sum(range(1, 100000))", &result));
+  cr_assert_eq(errno, MEMORY_BUDGET_EXCEEDED);
+  for (int i = 0; i < 100; i++)
+    assertClose(evaluate("sum(range(1, 1000))"), 500500);
+  memBudget_set(0);
+}
+
+static real parseLiteral(const char *text) {
+  real value;
+  cr_assert(number_parse((substring){.str = (char *)text, .len = strlen(text)},
+                         &value),
+            "'%s' should parse", text);
+  return value;
+}
+
+Test(eval_real, test_number_parse) {
+  // Compared with the platform's correctly rounded conversion
+  static const char *literals[] = {
+      "0",      "0.000",         "1",    "0.1",
+      "123.456", "6.02214076e23", "1e22", "1e23",
+      "9007199254740993", "1.5E-7", "123456789012345678901234567890",
+      "0.00000000000000000000000000000000000000000000001e+30"};
+  for (size_t i = 0; i < sizeof(literals) / sizeof(literals[0]); i++)
+    cr_assert_eq(parseLiteral(literals[i]), realParse(literals[i], NULL),
+                 "'%s' should be correctly rounded", literals[i]);
+
+  // Only the token is read, not what follows it
+  real value;
+  cr_assert(number_parse((substring){.str = "2.5e3x", .len = 5}, &value));
+  cr_assert_eq(value, (real)2.5e3);
+  cr_assert(number_parse((substring){.str = "0x10", .len = 1}, &value));
+  cr_assert_eq(value, 0);
+
+  cr_assert_not(number_parse((substring){.str = "1e-99999", .len = 8}, &value));
+  cr_assert_eq(errno, UNDERFLOW);
+  cr_assert_not(number_parse((substring){.str = "1e99999", .len = 7}, &value));
+  cr_assert_eq(errno, OVERFLOW);
+
+#if !defined(EVAL_REAL_F32) && !defined(EVAL_REAL_F80)
+  cr_assert_eq(parseLiteral("2.2250738585072014e-308"), DBL_MIN);
+  cr_assert_eq(parseLiteral("1.7976931348623157e308"), DBL_MAX);
+  cr_assert_eq(parseLiteral("4.9406564584124654e-324"), 0x1p-1074);
+  cr_assert_eq(parseLiteral("1e-310"), 1e-310); // subnormal, not an underflow
+
+  // Every shortest decimal reads back as the double it was written from
+  uint64_t state = 0x2545F4914F6CDD1Dull;
+  for (size_t i = 0; i < 100000; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    double expected;
+    memcpy(&expected, &state, sizeof(expected));
+    if (!isfinite(expected) || expected <= 0)
+      continue;
+    char text[FORMAT_SHORTEST_MAX];
+    format_shortest(expected, text);
+    cr_assert_eq(parseLiteral(text), expected, "'%s' should read back", text);
+  }
+#endif
+}
+
+Test(eval_real, test_range_errors) {
+  real result;
+
+  cr_assert_not(evalContext_evaluate(&ctx, "1e5000", &result));
+  cr_assert_eq(errno, OVERFLOW, "1e5000 overflows every type");
+
+#if defined(EVAL_REAL_F32)
+  cr_assert_not(evalContext_evaluate(&ctx, "1e300", &result));
+  cr_assert_eq(errno, OVERFLOW, "1e300 overflows a float");
+#else
+  assertClose(evaluate("1e300 / 1e299"), 10);
+#endif
+
+  // Indices stay exact and distinct up to REDUCE_MAX_INDEX, which depends on
+  // the type: past 2^24, a float cannot tell 16777216 and 16777217 apart
+  assertClose(evaluate("sum(range(8388600, 8388608)) - 9 * 8388604"), 0);
+  assertClose(evaluate("sum(i, 8388600, 8388608, i - 8388604)"), 0);
+#if defined(EVAL_REAL_F32)
+  cr_assert_not(
+      evalContext_evaluate(&ctx, "range(16777216, 16777220)", &result));
+  cr_assert_eq(errno, INEXACT_RANGE);
+  cr_assert_not(evalContext_evaluate(&ctx, "sum(i, 0, 16777220, i)", &result));
+  cr_assert_eq(errno, INEXACT_RANGE);
+#else
+  assertVector("range(16777216, 16777220) - 16777216",
+               (real[]){0, 1, 2, 3, 4}, 5);
+
+  // Exact bounds are still limited in how much work they make
+  cr_assert_not(evalContext_evaluate(&ctx, "sum(i, 0, 1e9, i)", &result));
+  cr_assert_eq(errno, RANGE_TOO_LONG);
+  cr_assert_not(evalContext_evaluate(&ctx, "sum(range(0, 2^27))", &result));
+  cr_assert_eq(errno, RANGE_TOO_LONG);
+#endif
+  assertClose(evaluate("sum(i, 1e30, 0, i) + sum(range(1e30, 0))"), 0);
+}
+
+// Writes `open` depth times, the operand, then `close` depth times
+static char *nested(const char *open, size_t depth, const char *operand,
+                    const char *close) {
+  size_t openLength = strlen(open), closeLength = strlen(close);
+  size_t operandLength = strlen(operand);
+  char *text = malloc(depth * (openLength + closeLength) + operandLength + 1);
+  cr_assert_not_null(text);
+  char *end = text;
+  for (size_t i = 0; i < depth; i++, end += openLength)
+    memcpy(end, open, openLength);
+  memcpy(end, operand, operandLength);
+  end += operandLength;
+  for (size_t i = 0; i < depth; i++, end += closeLength)
+    memcpy(end, close, closeLength);
+  *end = '\0';
+  return text;
+}
+
+Test(eval_real, test_deep_expressions) {
+  // Chains are walked in a loop, so their length is not a nesting level
+  char *text = nested("1+", 199999, "1", "");
+  assertClose(evaluate(text), 200000);
+  free(text);
+  char *definition = nested("1 - ", 199999, "1", "");
+  text = malloc(strlen(definition) + sizeof("(x = ) x * 2"));
+  cr_assert_not_null(text);
+  sprintf(text, "(x = %s) x * 2", definition);
+  assertClose(evaluate(text), -399996);
+  free(text);
+  free(definition);
+
+  text = nested("(", PARSER_MAX_NESTING - 1, "1", ")");
+  assertClose(evaluate(text), 1);
+  free(text);
+
+  real result;
+  text = nested("(", PARSER_MAX_NESTING, "1", ")");
+  cr_assert_not(evalContext_evaluate(&ctx, text, &result));
+  cr_assert_eq(errno, NESTING_TOO_DEEP);
+  free(text);
+  text = nested("-", 200000, "1", "");
+  cr_assert_not(evalContext_evaluate(&ctx, text, &result));
+  cr_assert_eq(errno, NESTING_TOO_DEEP);
+  free(text);
+}
+
+// Appends count terms with uneven values and operators, so any
+// reassociation of the chain would show up in the last bits
+static char *appendTerms(char *end, size_t count, unsigned seed) {
+  static const char ops[] = "+-*/+-";
+  for (size_t i = 0; i < count; i++) {
+    unsigned n = seed + 7919 * (unsigned)i;
+    if (i)
+      *end++ = ops[n % (sizeof(ops) - 1)];
+    end += sprintf(end, "%u.%u", 1 + n % 3, n % 997);
+  }
+  return end;
+}
+
+static real evaluateWithThreads(const char *expression, size_t threads) {
+  cr_assert(parallel_setThreads(threads));
+  real result = evaluate(expression);
+  parallel_shutdown();
+  return result;
+}
+
+// Finite and equal compares every bit of the value, but not the padding of a
+// long double, which memcmp() would
+static void assertParallelSame(const char *expression) {
+  real serial = evaluateWithThreads(expression, 1);
+  real parallel = evaluateWithThreads(expression, 4);
+  cr_assert(isfinite(serial));
+  cr_assert(serial == parallel && signbit(serial) == signbit(parallel));
+}
+
+Test(eval_real, test_parallel_bitwise) {
+  const size_t groups = 12, groupTerms = 20000, chainTerms = 1000000;
+  char *text = malloc(chainTerms * 16);
+  cr_assert_not_null(text);
+
+  // A chain of large operands, which become tasks and are folded in order
+  char *end = text;
+  for (size_t g = 0; g < groups; g++) {
+    end += sprintf(end, "%s(", g ? (g % 2 ? " - " : " + ") : "");
+    end = appendTerms(end, groupTerms, (unsigned)g);
+    *end++ = ')';
+  }
+  *end = '\0';
+  assertParallelSame(text);
+
+  // A long chain of small operands has nothing to split
+  *appendTerms(text, chainTerms, 1) = '\0';
+  assertParallelSame(text);
+  free(text);
+}
+
+static void writeFile(const char *path, const void *data, size_t size) {
+  FILE *file = fopen(path, "wb");
+  cr_assert(file);
+  cr_assert_eq(fwrite(data, 1, size, file), size);
+  fclose(file);
+}
+
+Test(eval_real, test_result_cache) {
+  static const char *config = "test/cache_config.tmp";
+  static const char *vector = "test/cache_vector.tmp";
+  writeFile(config, "(a = 1)\n", 8);
+  evalContext cached;
+  cr_assert(evalContext_init(&cached, config));
+  resultCache cache;
+  cr_assert(resultCache_init(&cache, 1 << 16));
+  cached.cache = &cache;
+
+  // Keys are the tokens, so spacing does not matter but every token does
+  real result;
+  cr_assert(evalContext_evaluate(&cached, "a + 1", &result));
+  cr_assert(evalContext_evaluate(&cached, "a+1", &result));
+  assertClose(result, 2);
+  cr_assert(evalContext_evaluate(&cached, "a + 2", &result));
+  assertClose(result, 3);
+  cr_assert_eq(cache.hits, 1);
+  cr_assert_eq(cache.misses, 2);
+
+  // A reload bumps the version, so results of the old config never hit
+  writeFile(config, "(a = 5)\n", 8);
+  cr_assert(evalContext_reload(&cached));
+  cr_assert(evalContext_evaluate(&cached, "a + 1", &result));
+  assertClose(result, 6);
+  cr_assert_eq(cache.hits, 1);
+  cr_assert(evalContext_evaluate(&cached, "a + 1", &result));
+  cr_assert_eq(cache.hits, 2);
+
+  // So does loading a vector
+  writeFile(vector, (double[]){1, 2}, 2 * sizeof(double));
+  cr_assert(evalContext_loadVector(&cached, "v", vector));
+  cr_assert(evalContext_evaluate(&cached, "sum(v) + a", &result));
+  assertClose(result, 8);
+  writeFile(vector, (double[]){4, 5}, 2 * sizeof(double));
+  cr_assert(evalContext_loadVector(&cached, "v", vector));
+  cr_assert(evalContext_evaluate(&cached, "sum(v) + a", &result));
+  assertClose(result, 14);
+  cr_assert(evalContext_evaluate(&cached, "a + 1", &result));
+  cr_assert_eq(cache.hits, 2);
+  remove(config);
+  remove(vector);
+  evalContext_free(&cached);
+  resultCache_free(&cache);
+}
+
+Test(eval_real, test_result_cache_eviction) {
+  // Room for the smallest bucket array and three entries with 1-byte keys
+  resultCache cache;
+  cr_assert(resultCache_init(&cache, 16 * sizeof(cacheEntry *) +
+                                         3 * (sizeof(cacheEntry) + 1)));
+  substring keys[] = {{.str = "a", .len = 1},
+                      {.str = "b", .len = 1},
+                      {.str = "c", .len = 1},
+                      {.str = "d", .len = 1}};
+  for (size_t i = 0; i < 3; i++)
+    resultCache_put(&cache, keys[i], 0, (real)i);
+
+  // Reading a refreshes it, so b is the oldest when d arrives
+  real result;
+  cr_assert(resultCache_get(&cache, keys[0], 0, &result));
+  resultCache_put(&cache, keys[3], 0, 3);
+  cr_assert_eq(cache.count, 3);
+  cr_assert_not(resultCache_get(&cache, keys[1], 0, &result));
+  for (size_t i = 0; i < 4; i++) {
+    if (i == 1)
+      continue;
+    cr_assert(resultCache_get(&cache, keys[i], 0, &result));
+    cr_assert_eq(result, (real)i);
+  }
+
+  // Those reads left a as the oldest
+  resultCache_put(&cache, keys[1], 0, 1);
+  cr_assert_not(resultCache_get(&cache, keys[0], 0, &result));
+  cr_assert(resultCache_get(&cache, keys[2], 0, &result));
+
+  // A stale version misses and drops the entry
+  cr_assert_not(resultCache_get(&cache, keys[3], 1, &result));
+  cr_assert_eq(cache.count, 2);
+  resultCache_free(&cache);
+}
+
+// Runs of a program from the cache give what parsing it afresh gives
+Test(eval_real, test_program_cache) {
+  static const char *expressions[] = {
+      "1 + 2 * 3",
+      "(f = g * 2) (g = 3) f + f",
+      "(x = 2) sum(i, 1, 4, i * x)",
+      "sum([1, 2, 3] * 2)",
+      // The grouped assignments of test_grouped_assignments
+      "2*((x = 3) x+1)",
+      "((x = 3) x)",
+      "((n = 3) (m = 2) n - m) + 1",
+      "(7 (a = 2))",
+      "(7 (a = 2)) + a",
+      "(x = 1) ((y = 2) y) + x",
+  };
+  size_t count = sizeof(expressions) / sizeof(*expressions);
+
+  programCache programs;
+  cr_assert(programCache_init(&programs, 64));
+  evalContext cached;
+  cr_assert(evalContext_init(&cached, NO_CONFIG));
+  cached.programs = &programs;
+
+  // Twice around, so every program is run again from the cache after the
+  // others have run in between
+  for (size_t round = 0; round < 2; round++) {
+    for (size_t i = 0; i < count; i++) {
+      real fresh = evaluate(expressions[i]), result;
+      cr_assert(evalContext_evaluate(&cached, expressions[i], &result),
+                "'%s' should evaluate from the cache", expressions[i]);
+      cr_assert(result == fresh, "'%s' differs when cached", expressions[i]);
+    }
+  }
+  cr_assert_eq(programs.misses, count);
+  cr_assert_eq(programs.hits, count);
+
+  evalContext_free(&cached);
+  programCache_free(&programs);
+}
+
+// Feeds the update lines to runWatch() and returns everything it printed
+static char *watchOutput(evalContext *context, const char *outputs,
+                         const char *updates) {
+  FILE *in = tmpfile(), *out = tmpfile();
+  cr_assert(in && out);
+  fputs(updates, in);
+  rewind(in);
+  cr_assert_eq(runWatch(context, outputs, in, out), 0);
+
+  long size = ftell(out);
+  char *text = calloc((size_t)size + 1, 1);
+  cr_assert_not_null(text);
+  rewind(out);
+  cr_assert_eq(fread(text, 1, (size_t)size, out), (size_t)size);
+  fclose(in);
+  fclose(out);
+  return text;
+}
+
+Test(eval_real, test_watch) {
+  static const char *path = "test/watch_config.tmp";
+  static const char *config = "(a = 1) (b = a * 2) (c = b + a)\n"
+                              "(d = 7) (e = d + 1)\n";
+  writeFile(path, config, strlen(config));
+  evalContext watched;
+  cr_assert(evalContext_init(&watched, path));
+  remove(path);
+
+  // c reads b, so it is only right if b is recomputed first. Outputs that
+  // keep their value are not printed again, and x, which no output reads,
+  // is never computed.
+  evalStats_reset();
+  char *text = watchOutput(&watched, "c,e,b",
+                           "(a = 2)\n"  // a, b and c
+                           "(d = 7)\n"  // d and e, which stays 8
+                           "(x = 1)\n"  // nothing
+                           "(y = 4) (a = y)\n"); // y, a, b and c
+  cr_assert_str_eq(text, "c = 3\ne = 8\nb = 2\n"
+                         "c = 6\nb = 4\n"
+                         "c = 12\nb = 8\n");
+  free(text);
+  if (evalStats_enabled())
+    cr_assert_eq(evalStats_get()->watchComputes, 5 + 3 + 2 + 4);
+
+  evalContext_free(&watched);
+}
+
+// Counters of one stream run over the same lines as every other run
+static evalStats streamStats(FILE *in, size_t threads) {
+  FILE *out = tmpfile();
+  cr_assert(out);
+  rewind(in);
+  cr_assert(parallel_setThreads(threads));
+  evalStats_reset();
+  cr_assert_eq(runStream(&ctx, fileno(in), fileno(out), OUTPUT_TEXT), 0);
+  evalStats stats = *evalStats_get();
+  parallel_shutdown();
+  fclose(out);
+  return stats;
+}
+
+// Each thread counts on its own and the totals merge them, so a parallel run
+// adds up to the same work as a serial one. Without EVAL_STATS every counter
+// is 0 and this holds trivially.
+Test(eval_real, test_stats_merge) {
+  FILE *in = tmpfile();
+  cr_assert(in);
+  for (int i = 0; i < 4 * STREAM_SLOTS; i++)
+    fprintf(in, "(f = g * %d) (g = (h = 2) h + %d) f + sum(k, 1, 3, k * g)\n",
+            i, i % 7);
+  fflush(in);
+
+  evalStats serial = streamStats(in, 1);
+  evalStats parallel = streamStats(in, 4);
+  fclose(in);
+
+  // Which thread evaluates which line is left to chance, and so are the
+  // parallel tasks and the times, but not how much each line does
+  cr_assert_eq(parallel.tokens, serial.tokens);
+  cr_assert_eq(parallel.programNodes, serial.programNodes);
+  cr_assert_eq(parallel.scratchNodes, serial.scratchNodes);
+  cr_assert_eq(parallel.identifierNodes, serial.identifierNodes);
+  cr_assert_eq(parallel.cloneCalls, serial.cloneCalls);
+  cr_assert_eq(parallel.clonedNodes, serial.clonedNodes);
+  cr_assert_eq(parallel.identifierCalls, serial.identifierCalls);
+  cr_assert_eq(parallel.maxRecursionDepth, serial.maxRecursionDepth);
+  cr_assert_eq(parallel.declarationBinds, serial.declarationBinds);
+  cr_assert_eq(parallel.hashProbes, serial.hashProbes);
+  cr_assert_eq(parallel.hashChainSteps, serial.hashChainSteps);
+  if (evalStats_enabled())
+    cr_assert(serial.identifierCalls > 0);
+}
+
+static evalContext configWithThreads(const char *path, size_t threads) {
+  cr_assert(parallel_setThreads(threads));
+  evalContext context;
+  cr_assert(evalContext_init(&context, path));
+  parallel_shutdown();
+  return context;
+}
+
+// Identifiers cannot hold digits, so they are spelt with a to j instead
+static const char *indexed(char *identifier, char name, int i) {
+  char *c = identifier + sprintf(identifier, "%c%d", name, i);
+  while (--c > identifier)
+    *c += 'a' - '0';
+  return identifier;
+}
+
+static void assertBinding(evalContext *serial, evalContext *parallel,
+                          char name, int i, real expected) {
+  char identifier[16];
+  indexed(identifier, name, i);
+  real first, second;
+  cr_assert(evalContext_evaluate(serial, identifier, &first));
+  cr_assert(evalContext_evaluate(parallel, identifier, &second));
+  cr_assert(first == expected && second == expected, "%s", identifier);
+}
+
+// Every line redefines r and snapshots it, so the first line of each chunk
+// reads the r the previous chunk bound. The a reference half the config
+// away, both backwards and forwards, and the first a is redefined at the end.
+Test(eval_real, test_parallel_config) {
+  static const char *path = "test/parallel_config.tmp";
+  enum { LINES = 8000 };
+  FILE *file = fopen(path, "w");
+  cr_assert(file);
+  char a[16], other[16], b[16];
+  for (int i = 0; i < LINES; i++)
+    fprintf(file, "(%s = %s + %d) (r = %d) (%s = *r * 3)\n",
+            indexed(a, 'a', i), indexed(other, 'b', (i + LINES / 2) % LINES),
+            i, i, indexed(b, 'b', i));
+  fputs("(aa = r * 2) (r = -1)\n", file);
+  fclose(file);
+
+  evalContext serial = configWithThreads(path, 1);
+  evalContext parallel = configWithThreads(path, 4);
+  remove(path);
+  cr_assert(parallel.tokens.count > 4 * PARALLEL_GRAIN,
+            "The config should be split into one chunk per thread");
+
+  for (int i = 0; i < LINES; i++) {
+    real a = i ? 3 * ((i + LINES / 2) % LINES) + i : -2;
+    assertBinding(&serial, &parallel, 'a', i, a);
+    assertBinding(&serial, &parallel, 'b', i, 3 * i);
+  }
+
+  evalContext_free(&serial);
+  evalContext_free(&parallel);
+}
+
+static char *readLog(FILE *file) {
+  size_t len = 0, capacity = 4096;
+  char *text = malloc(capacity);
+  cr_assert(text);
+  for (size_t n; (n = fread(text + len, 1, capacity - len - 1, file));) {
+    len += n;
+    if (capacity - len == 1) {
+      text = realloc(text, capacity *= 2);
+      cr_assert(text);
+    }
+  }
+  text[len] = '\0';
+  return text;
+}
+
+// Checks that the log holds "record <from>", "record <from + 1>", ... and
+// returns how many, adding the records it says were dropped to *dropped
+static int checkRecords(char *text, int from, unsigned long long *dropped) {
+  int count = 0;
+  for (char *line = strtok(text, "\n"); line; line = strtok(NULL, "\n")) {
+    int index;
+    unsigned long long n;
+    const char *msg = strstr(line, " msg=\"");
+    cr_assert(msg, "%s", line);
+    if (sscanf(msg, " msg=\"record %d\"", &index) == 1)
+      cr_assert_eq(index, from + count++, "%s", line);
+    else if (sscanf(msg, " msg=\"Log buffer full, dropped %llu", &n) == 1)
+      *dropped += n;
+    else
+      cr_assert(false, "%s", line);
+  }
+  return count;
+}
+
+static void recordRange(int from, int to) {
+  char message[32];
+  for (int i = from; i < to; i++) {
+    sprintf(message, "record %d", i);
+    logger_record(__func__, 0, message);
+  }
+}
+
+static const char *loggerPath = "test/logger.tmp";
+
+Test(eval_real, test_logger) {
+  remove(loggerPath);
+  logger_setPath(loggerPath);
+
+  // Fewer records than the ring holds, so none of them is dropped
+  unsigned long long dropped = 0;
+  recordRange(0, 1000);
+  logger_flush();
+  FILE *file = fopen(loggerPath, "r");
+  cr_assert(file);
+  char *text = readLog(file);
+  fclose(file);
+  cr_assert_eq(checkRecords(text, 0, &dropped), 1000);
+  free(text);
+
+  // Shutting down writes what is still in the ring
+  recordRange(1000, 2000);
+  logger_shutdown();
+  file = fopen(loggerPath, "r");
+  cr_assert(file);
+  text = readLog(file);
+  fclose(file);
+  remove(loggerPath);
+  cr_assert_eq(checkRecords(text, 0, &dropped), 2000);
+  cr_assert_eq(dropped, 0);
+  free(text);
+}
+
+static void *readFifo(void *arg) {
+  FILE *fifo = fopen(loggerPath, "r");
+  cr_assert(fifo);
+  *(char **)arg = readLog(fifo);
+  fclose(fifo);
+  return NULL;
+}
+
+// The writer blocks opening a FIFO until something reads it, so the ring
+// fills up: the records that fit are written in order, and the rest are
+// counted in a note instead
+Test(eval_real, test_logger_overflow) {
+  enum { RECORDS = 20000 };
+  remove(loggerPath);
+  cr_assert_eq(mkfifo(loggerPath, 0600), 0);
+  logger_setPath(loggerPath);
+  recordRange(0, RECORDS);
+
+  char *text;
+  pthread_t reader;
+  cr_assert_eq(pthread_create(&reader, NULL, readFifo, &text), 0);
+  logger_shutdown();
+  pthread_join(reader, NULL);
+  remove(loggerPath);
+
+  unsigned long long dropped = 0;
+  int written = checkRecords(text, 0, &dropped);
+  cr_assert(written > 0 && dropped > 0);
+  cr_assert_eq(written + dropped, RECORDS);
+  free(text);
+}
+
+static real evaluateIn(evalContext *context, const char *expression) {
+  real result = 0;
+  cr_assert(evalContext_evaluate(context, expression, &result),
+            "'%s' should evaluate", expression);
+  return result;
+}
+
+static ASTNode *declarationsOf(evalContext *context, char *name) {
+  size_t treeSize;
+  ASTNode *declarations = NULL;
+  hashMap_getValue(&context->map, (substring){.str = name, .len = strlen(name)},
+                   &treeSize, &declarations);
+  return declarations;
+}
+
+// A declaration block is parsed with its definition and only bound again on
+// every reference; whatever redefines the identifier brings its own block
+Test(eval_real, test_declaration_blocks) {
+  static const char *path = "test/declarations.tmp";
+  static const char *config = "(y = 10)\n"
+                              "(f = (x = 9) x - y) (g = (x = 8) x)\n"
+                              "(f = (x = 2) x * y) (g = y + 1)\n";
+  writeFile(path, config, strlen(config));
+  evalContext blocks;
+  cr_assert(evalContext_init(&blocks, path));
+
+  ASTNode *declarations = declarationsOf(&blocks, "f");
+  cr_assert_not_null(declarations);
+  cr_assert_null(declarationsOf(&blocks, "g"));
+
+  // Referencing f takes no more nodes than referencing g, whose value is
+  // as large, so its block is not parsed again
+  evalStats_reset();
+  assertClose(evaluateIn(&blocks, "g"), 11);
+  evalStats plain = *evalStats_get();
+  evalStats_reset();
+  assertClose(evaluateIn(&blocks, "f"), 20);
+  evalStats declared = *evalStats_get();
+  cr_assert_eq(declared.programNodes, plain.programNodes);
+  cr_assert_eq(declared.scratchNodes, plain.scratchNodes);
+  cr_assert_eq(declared.configNodes, 0);
+  cr_assert_eq(declared.declarationBinds, evalStats_enabled() ? 1 : 0);
+
+  evalStats_reset();
+  assertClose(evaluateIn(&blocks, "f * f + f"), 420);
+  if (evalStats_enabled())
+    cr_assert_eq(evalStats_get()->declarationBinds, 3);
+  cr_assert_eq(declarationsOf(&blocks, "f"), declarations);
+
+  // A redefinition within an expression lasts as long as the expression
+  assertClose(evaluateIn(&blocks, "(f = (x = 3) x + y) f"), 13);
+  assertClose(evaluateIn(&blocks, "(f = x + y) (x = 1) f"), 11);
+  assertClose(evaluateIn(&blocks, "f"), 20);
+  cr_assert_eq(declarationsOf(&blocks, "f"), declarations);
+
+  // So does one by --watch, for the lines after it
+  char *text = watchOutput(&blocks, "f",
+                           "(f = (x = 4) x + y)\n"
+                           "(x = 7)\n"   // shadowed by the block, unchanged
+                           "(y = 20)\n"
+                           "(f = x)\n"); // no block any more, so x is 7
+  cr_assert_str_eq(text, "f = 20\nf = 14\nf = 24\nf = 7\n");
+  free(text);
+  evalContext_free(&blocks);
+
+  // And a reload, by the definitions of the new config
+  config = "(y = 10) (f = (x = 5) x - y)\n";
+  writeFile(path, config, strlen(config));
+  cr_assert(evalContext_init(&blocks, path));
+  assertClose(evaluateIn(&blocks, "f"), -5);
+  writeFile(path, "(y = 10) (f = (z = 6) z - y)\n", 29);
+  cr_assert(evalContext_reload(&blocks));
+  remove(path);
+  assertClose(evaluateIn(&blocks, "f"), -4);
+  evalContext_free(&blocks);
+}
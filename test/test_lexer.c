@@ -15,12 +15,13 @@ void redirect_all_output(void) {
 TestSuite(lexer_basic, .description = "Basic lexer tokenization tests");
 
 Test(lexer_basic, test_number_tokens, .init = redirect_all_output) {
-  token *tokens = tokenise("123")->stream;
+  tokenStream *tknStream = tokenise("123");
+  token *tokens = tknStream->stream;
 
   cr_assert_not_null(tokens, "Tokenization should not return NULL");
   cr_assert_eq(tokens[0].type, TOKEN_NUMBER, "First token should be NUMBER");
-  cr_assert_eq(tokens[0].lexeme.len, 3, "Token length should be 3");
-  cr_assert_eq(strncmp(tokens[0].lexeme.str, "123", 3), 0,
+  cr_assert_eq(tokens[0].len, 3, "Token length should be 3");
+  cr_assert_eq(strncmp(tokenStream_lexeme(tknStream, 0).str, "123", 3), 0,
                "Token lexeme should be '123'");
   cr_assert_eq(tokens[0].pos, 0, "Token position should be 0");
   cr_assert_eq(tokens[1].type, TOKEN_EOF, "Second token should be EOF");
@@ -29,12 +30,13 @@ Test(lexer_basic, test_number_tokens, .init = redirect_all_output) {
 }
 
 Test(lexer_basic, test_decimal_numbers, .init = redirect_all_output) {
-  token *tokens = tokenise("3.14")->stream;
+  tokenStream *tknStream = tokenise("3.14");
+  token *tokens = tknStream->stream;
 
   cr_assert_not_null(tokens);
   cr_assert_eq(tokens[0].type, TOKEN_NUMBER);
-  cr_assert_eq(tokens[0].lexeme.len, 4);
-  cr_assert_eq(strncmp(tokens[0].lexeme.str, "3.14", 4), 0);
+  cr_assert_eq(tokens[0].len, 4);
+  cr_assert_eq(strncmp(tokenStream_lexeme(tknStream, 0).str, "3.14", 4), 0);
   cr_assert_eq(tokens[1].type, TOKEN_EOF);
 
   free(tokens);
@@ -177,7 +179,7 @@ Test(lexer_edge_cases, test_single_digit, .init = redirect_all_output) {
 
   cr_assert_not_null(tokens);
   cr_assert_eq(tokens[0].type, TOKEN_NUMBER);
-  cr_assert_eq(tokens[0].lexeme.len, 1);
+  cr_assert_eq(tokens[0].len, 1);
   cr_assert_eq(tokens[1].type, TOKEN_EOF);
 
   free(tokens);
@@ -188,7 +190,7 @@ Test(lexer_edge_cases, test_zero_decimal, .init = redirect_all_output) {
 
   cr_assert_not_null(tokens);
   cr_assert_eq(tokens[0].type, TOKEN_NUMBER);
-  cr_assert_eq(tokens[0].lexeme.len, 3);
+  cr_assert_eq(tokens[0].len, 3);
   cr_assert_eq(tokens[1].type, TOKEN_EOF);
 
   free(tokens);
@@ -199,12 +201,68 @@ Test(lexer_edge_cases, test_long_number, .init = redirect_all_output) {
 
   cr_assert_not_null(tokens);
   cr_assert_eq(tokens[0].type, TOKEN_NUMBER);
-  cr_assert_eq(tokens[0].lexeme.len, 9);
+  cr_assert_eq(tokens[0].len, 9);
   cr_assert_eq(tokens[1].type, TOKEN_EOF);
 
   free(tokens);
 }
 
+Test(lexer_edge_cases, test_range, .init = redirect_all_output) {
+  const char *input = "(a = 1) (bc = a * 2) (";
+  tokenStream *tknStream = tokeniseRange(input, 8, 20);
+  token *tokens = tknStream->stream;
+
+  cr_assert_not_null(tokens);
+  cr_assert_eq(tokens[0].type, TOKEN_OPENPAREN);
+  cr_assert_eq(tokens[0].pos, 8, "Positions should be relative to the input");
+  cr_assert_eq(tokens[1].type, TOKEN_IDEN);
+  cr_assert_eq(tokenStream_lexeme(tknStream, 1).str, input + 9);
+  cr_assert_eq(tokens[6].type, TOKEN_CLOSEPAREN);
+  cr_assert_eq(tokens[7].type, TOKEN_EOF, "Tokens should stop at the range");
+  cr_assert_eq(tokens[7].pos, 20);
+
+  free(tokens);
+}
+
+Test(lexer_edge_cases, test_append_sources, .init = redirect_all_output) {
+  const char *config = "(a = 1)";
+  const char *first = "a * 20";
+  const char *second = "bc + 3";
+  tokenStream tknStream = {0};
+  size_t capacity = 0;
+
+  cr_assert_eq(sizeof(token), 12);
+  cr_assert(tokeniseAppend(&tknStream, &capacity, config, 0, strlen(config)));
+  size_t appendIndex = --tknStream.count; // behind the config, like a context
+  cr_assert(tokeniseAppend(&tknStream, &capacity, first, 0, strlen(first)));
+  tknStream.count = appendIndex;
+  cr_assert(tokeniseAppend(&tknStream, &capacity, second, 0, strlen(second)));
+
+  cr_assert_eq(tknStream.sourceCount, 2, "Dropped sources are forgotten");
+  cr_assert_eq(tokenStream_lexeme(&tknStream, 1).str, config + 1);
+  substring lexeme = tokenStream_lexeme(&tknStream, appendIndex);
+  cr_assert_eq(lexeme.str, second);
+  cr_assert_eq(lexeme.len, 2);
+  cr_assert_eq(tknStream.stream[appendIndex + 2].pos, 5);
+
+  tokenStream copy = {0};
+  size_t copyCapacity = 0;
+  cr_assert(tokenStream_append(&copy, &copyCapacity, &tknStream,
+                               tknStream.count));
+  cr_assert_eq(tokenStream_lexeme(&copy, appendIndex + 2).str, second + 5);
+
+  tokenStream_free(&copy);
+  tokenStream_free(&tknStream);
+}
+
+Test(lexer_edge_cases, test_identifier_length, .init = redirect_all_output) {
+  cr_assert_eq(identifierLength("abc = 1", 7), 3);
+  cr_assert_eq(identifierLength("abc = 1", 2), 2);
+  cr_assert_eq(identifierLength("x1", 2), 1);
+  cr_assert_eq(identifierLength("sin = 1", 7), 0, "Keywords are not names");
+  cr_assert_eq(identifierLength("1x", 2), 0);
+}
+
 // Test with fixtures for setup/teardown
 static token *test_tokens;
 
@@ -0,0 +1,175 @@
+// Minimal client for `eval --serve`. Sends every expression given on the
+// command line (or one per line on stdin) pipelined over one connection and
+// prints the answers in order as they arrive.
+#define _GNU_SOURCE
+#include "format.h"
+#include "server.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int connectTo(const char *socketPath) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(socketPath) >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, socketPath);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Expressions come from the command line, or one per line from stdin
+typedef struct requestSource {
+  char **args;
+  int argCount;
+  char *line;
+  size_t lineCap;
+} requestSource;
+
+static const char *nextExpression(requestSource *src) {
+  if (src->args) {
+    if (src->argCount == 0)
+      return NULL;
+    src->argCount--;
+    return *src->args++;
+  }
+
+  ssize_t len = getline(&src->line, &src->lineCap, stdin);
+  if (len <= 0)
+    return NULL;
+  if (src->line[len - 1] == '\n')
+    src->line[len - 1] = '\0';
+  return src->line;
+}
+
+// The frame being sent, replaced by the next one once it is out
+typedef struct pendingFrame {
+  unsigned char *data;
+  size_t len;
+  size_t sent;
+} pendingFrame;
+
+static bool loadFrame(pendingFrame *frame, const char *expression) {
+  size_t len = strlen(expression);
+  unsigned char *data = realloc(frame->data, SERVER_REQUEST_HEADER_SIZE + len);
+  if (!data)
+    return false;
+
+  frame->data = data;
+  frame->len = server_encodeRequest(data, expression, (uint32_t)len);
+  frame->sent = 0;
+  return true;
+}
+
+static void printResponse(const unsigned char *frame) {
+  serverResponse response;
+  server_decodeResponse(frame, &response);
+  if (response.status == 0) {
+    char text[FORMAT_SHORTEST_MAX];
+    format_shortest(response.result, text);
+    printf("%s\n", text);
+  } else
+    printf("error %u\n", response.status);
+}
+
+// Sends the requests and reads the responses in one loop. The server stops
+// reading from a connection whose responses pile up unread, so sending
+// everything before reading would hang once they outgrow its output queue.
+static int exchange(int fd, requestSource *src) {
+  pendingFrame frame = {0};
+  bool inputDone = false;
+  size_t sent = 0, received = 0;
+  unsigned char response[SERVER_RESPONSE_SIZE];
+  size_t responseLen = 0;
+  int status = 0;
+
+  while (!inputDone || received < sent) {
+    if (!inputDone && frame.sent == frame.len) {
+      const char *expression = nextExpression(src);
+      if (!expression) {
+        inputDone = true;
+        shutdown(fd, SHUT_WR);
+      } else if (!loadFrame(&frame, expression)) {
+        perror("malloc");
+        status = 1;
+        break;
+      }
+    }
+
+    bool sending = frame.sent < frame.len;
+    struct pollfd pfd = {.fd = fd, .events = POLLIN | (sending ? POLLOUT : 0)};
+    if (poll(&pfd, 1, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      status = 1;
+      break;
+    }
+
+    if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t n = recv(fd, response + responseLen,
+                       sizeof(response) - responseLen, MSG_DONTWAIT);
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        fprintf(stderr, "Connection closed after %zu of %zu responses\n",
+                received, sent);
+        status = 1;
+        break;
+      }
+      if (n > 0 && (responseLen += (size_t)n) == sizeof(response)) {
+        printResponse(response);
+        responseLen = 0;
+        received++;
+      }
+    }
+
+    if (sending && (pfd.revents & POLLOUT)) {
+      ssize_t n = send(fd, frame.data + frame.sent, frame.len - frame.sent,
+                       MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n < 0 && errno != EAGAIN && errno != EINTR) {
+        perror("send");
+        status = 1;
+        break;
+      }
+      if (n > 0 && (frame.sent += (size_t)n) == frame.len)
+        sent++;
+    }
+  }
+
+  free(frame.data);
+  return status;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <socket> [expression...]\n", argv[0]);
+    return 1;
+  }
+
+  int fd = connectTo(argv[1]);
+  if (fd < 0) {
+    perror("connect");
+    return 1;
+  }
+
+  requestSource src = {0};
+  if (argc > 2) {
+    src.args = argv + 2;
+    src.argCount = argc - 2;
+  }
+  int status = exchange(fd, &src);
+
+  free(src.line);
+  close(fd);
+  return status;
+}
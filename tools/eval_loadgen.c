@@ -0,0 +1,223 @@
+// Load generator for `eval --serve`. Opens several connections, keeps a fixed
+// number of pipelined requests in flight on each and reports throughput and
+// end-to-end latency percentiles.
+#define _GNU_SOURCE
+#include "server.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct client {
+  int fd;
+  size_t inFlight;
+  size_t sent;
+  unsigned long long *sendTimes; // ring of `depth` timestamps, FIFO order
+  size_t head;
+  unsigned char response[SERVER_RESPONSE_SIZE];
+  size_t responseLen;
+} client;
+
+static unsigned char *frame;
+static size_t frameLen;
+static size_t depth = 16;
+static size_t perClient;
+
+static unsigned long long *latencies;
+static size_t latencyCount;
+static size_t errors;
+
+static inline unsigned long long monotonicNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull +
+         (unsigned long long)ts.tv_nsec;
+}
+
+static int connectTo(const char *socketPath) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(socketPath) >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, socketPath);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Requests are small, so a blocking send of a whole frame is fine here
+static bool fillPipeline(client *c) {
+  while (c->inFlight < depth && c->sent < perClient) {
+    const unsigned char *data = frame;
+    size_t len = frameLen;
+    while (len) {
+      ssize_t n = send(c->fd, data, len, MSG_NOSIGNAL);
+      if (n <= 0)
+        return false;
+      data += n;
+      len -= (size_t)n;
+    }
+    c->sendTimes[(c->head + c->inFlight) % depth] = monotonicNs();
+    c->inFlight++;
+    c->sent++;
+  }
+  return true;
+}
+
+static bool drainResponses(client *c) {
+  while (c->inFlight) {
+    ssize_t n = recv(c->fd, c->response + c->responseLen,
+                     SERVER_RESPONSE_SIZE - c->responseLen, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return true;
+    if (n <= 0)
+      return false;
+
+    c->responseLen += (size_t)n;
+    if (c->responseLen < SERVER_RESPONSE_SIZE)
+      continue;
+
+    serverResponse response;
+    server_decodeResponse(c->response, &response);
+    if (response.status != 0)
+      errors++;
+
+    latencies[latencyCount++] = monotonicNs() - c->sendTimes[c->head];
+    c->head = (c->head + 1) % depth;
+    c->inFlight--;
+    c->responseLen = 0;
+  }
+  return true;
+}
+
+static int compareLatency(const void *a, const void *b) {
+  unsigned long long x = *(const unsigned long long *)a;
+  unsigned long long y = *(const unsigned long long *)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(double p) {
+  size_t rank = (size_t)(p / 100.0 * (double)(latencyCount - 1));
+  return latencies[rank] / 1e3;
+}
+
+int main(int argc, char **argv) {
+  const char *socketPath = NULL;
+  const char *expression = "(x = 3) 2*x^2 + sin(x) - log(x)";
+  size_t connections = 4;
+  size_t total = 100000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:n:d:e:")) != -1) {
+    switch (opt) {
+    case 'c':
+      connections = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      total = strtoul(optarg, NULL, 10);
+      break;
+    case 'd':
+      depth = strtoul(optarg, NULL, 10);
+      break;
+    case 'e':
+      expression = optarg;
+      break;
+    default:
+      goto usage;
+    }
+  }
+  if (optind != argc - 1 || connections == 0 || depth == 0)
+    goto usage;
+  socketPath = argv[optind];
+
+  perClient = (total + connections - 1) / connections;
+  total = perClient * connections;
+
+  size_t exprLen = strlen(expression);
+  frame = malloc(SERVER_REQUEST_HEADER_SIZE + exprLen);
+  latencies = malloc(sizeof(unsigned long long) * total);
+  client *clients = calloc(connections, sizeof(client));
+  int epollFd = epoll_create1(0);
+  if (!frame || !latencies || !clients || epollFd < 0) {
+    perror("setup");
+    return 1;
+  }
+  frameLen = server_encodeRequest(frame, expression, (uint32_t)exprLen);
+
+  for (size_t i = 0; i < connections; i++) {
+    clients[i].fd = connectTo(socketPath);
+    clients[i].sendTimes = malloc(sizeof(unsigned long long) * depth);
+    if (clients[i].fd < 0 || !clients[i].sendTimes) {
+      perror("connect");
+      return 1;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &clients[i]};
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, clients[i].fd, &ev);
+  }
+
+  unsigned long long start = monotonicNs();
+  for (size_t i = 0; i < connections; i++) {
+    if (!fillPipeline(&clients[i])) {
+      perror("send");
+      return 1;
+    }
+  }
+
+  size_t open = connections;
+  struct epoll_event events[64];
+  while (open) {
+    int ready = epoll_wait(epollFd, events, 64, -1);
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      return 1;
+    }
+
+    for (int i = 0; i < ready; i++) {
+      client *c = events[i].data.ptr;
+      if (!drainResponses(c) || !fillPipeline(c)) {
+        fprintf(stderr, "Server closed the connection early\n");
+        return 1;
+      }
+      if (c->sent == perClient && c->inFlight == 0) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+        open--;
+      }
+    }
+  }
+  double elapsed = (monotonicNs() - start) / 1e9;
+
+  qsort(latencies, latencyCount, sizeof(unsigned long long), compareLatency);
+  printf("requests: %zu  errors: %zu  connections: %zu  depth: %zu\n",
+         latencyCount, errors, connections, depth);
+  printf("throughput: %.0f req/s\n", latencyCount / elapsed);
+  printf("latency p50: %.1f us  p99: %.1f us  max: %.1f us\n",
+         percentile(50.0), percentile(99.0), percentile(100.0));
+
+  for (size_t i = 0; i < connections; i++)
+    free(clients[i].sendTimes);
+  free(clients);
+  free(latencies);
+  free(frame);
+  close(epollFd);
+  return 0;
+
+usage:
+  fprintf(stderr,
+          "Usage: %s [-c connections] [-n requests] [-d depth] "
+          "[-e expression] <socket>\n",
+          argv[0]);
+  return 1;
+}
@@ -0,0 +1,34 @@
+// Stress corpus generator: prints the workload of one dimension (see
+// stress.h) at each size given, one expression per line, ready for
+// `eval --stream` or a loop over `eval`.
+#include "stress.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char **argv) {
+  stressDimension dimension;
+  if (argc < 3 || !stress_parseDimension(argv[1], &dimension))
+    goto usage;
+
+  for (int i = 2; i < argc; i++) {
+    char *end;
+    unsigned long long size = strtoull(argv[i], &end, 10);
+    if (*end || !size || size > stress_maxSize(dimension)) {
+      fprintf(stderr, "Invalid size for %s: %s\n", argv[1], argv[i]);
+      return 1;
+    }
+    char *workload = stress_generate(dimension, (size_t)size);
+    if (!workload)
+      return 1;
+    puts(workload);
+    free(workload);
+  }
+  return 0;
+
+usage:
+  fprintf(stderr, "Usage: %s <dimension> <size>...\nDimensions:", argv[0]);
+  for (int d = 0; d < STRESS_DIMENSIONS; d++)
+    fprintf(stderr, " %s", stress_name((stressDimension)d));
+  fputc('\n', stderr);
+  return 1;
+}